@@ -0,0 +1,496 @@
+#include "batch.h"
+
+#include "params.h"
+#include "yjit.h"
+#include "ysim.h"
+#include "yutil.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**************************** Batch Inputs *****************************/
+
+typedef struct {
+  int numParams;
+  Word *params;
+} BatchRun;
+
+/** The n values lo, lo + step, lo + 2*step, ... */
+typedef struct {
+  Word lo;
+  Word step;
+  int n;
+} ValueRange;
+
+/** The values taken by one input of a sweep. */
+typedef struct {
+  int nRanges;
+  ValueRange *ranges;
+  int nValues;             /** total over ranges */
+} ValueSet;
+
+/** Holds either explicit runs or the sets whose cartesian product
+ *  gives the runs of a sweep.
+ */
+struct BatchStruct {
+  int nRuns;
+  BatchRun *runs;          /** NULL for a sweep */
+  int nSets;
+  ValueSet *sets;
+};
+
+/** Add the input vector on line to batch; ignore it if it is blank
+ *  or a comment.
+ */
+static void
+add_batch_run(Batch *batch, const char *line, const char *fileName,
+              int lineNum)
+{
+  const char *p = line;
+  while (isspace(*p)) p++;
+  if (*p == '\0' || *p == '#') return;
+  BatchRun run = { .numParams = 0, .params = NULL };
+  while (*p != '\0') {
+    char *end;
+    Word value = strtol(p, &end, 0);
+    if (end == p || (*end != '\0' && !isspace(*end))) {
+      fatal("%s:%d: bad input '%s'", fileName, lineNum, p);
+    }
+    run.params = reallocChk(run.params, (run.numParams + 1) * sizeof(Word));
+    run.params[run.numParams++] = value;
+    p = end;
+    while (isspace(*p)) p++;
+  }
+  batch->runs = reallocChk(batch->runs, (batch->nRuns + 1) * sizeof(BatchRun));
+  batch->runs[batch->nRuns++] = run;
+}
+
+Batch *
+read_batch(FILE *in, const char *fileName)
+{
+  Batch *batch = callocChk(1, sizeof(Batch));
+  char *line = NULL;
+  size_t lineSize = 0;
+  for (int lineNum = 1; getline(&line, &lineSize, in) >= 0; lineNum++) {
+    add_batch_run(batch, line, fileName, lineNum);
+  }
+  if (ferror(in)) fatal("cannot read %s:", fileName);
+  free(line);
+  return batch;
+}
+
+/** Parse range LO..HI[:STEP] or integer N at *p into *range,
+ *  advancing *p past it.  Return false if it is invalid.
+ */
+static bool
+parse_value_range(const char **p, ValueRange *range)
+{
+  char *end;
+  if (!isdigit(**p) && !(**p == '-' && isdigit((*p)[1]))) return false;
+  Word lo = strtoll(*p, &end, 0);
+  Word hi = lo, step = 1;
+  if (strncmp(end, "..", 2) == 0) {
+    const char *q = end + 2;
+    if (!isdigit(*q) && !(*q == '-' && isdigit(q[1]))) return false;
+    hi = strtoll(q, &end, 0);
+    if (*end == ':') {
+      q = end + 1;
+      if (!isdigit(*q)) return false;
+      step = strtoull(q, &end, 0);
+      if (step == 0) return false;
+    }
+  }
+  //values are counted in unsigned arithmetic to avoid overflow
+  Word span = ((int64_t)hi >= (int64_t)lo) ? hi - lo : lo - hi;
+  if (span / step >= INT_MAX) return false;
+  range->lo = lo;
+  range->step = ((int64_t)hi >= (int64_t)lo) ? step : -step;
+  range->n = span / step + 1;
+  *p = end;
+  return true;
+}
+
+/** Parse spec, a comma-separated list of integers and ranges, into
+ *  set.  Return false if it is invalid.
+ */
+static bool
+parse_value_set(const char *spec, ValueSet *set)
+{
+  const char *p = spec;
+  set->nRanges = set->nValues = 0;
+  set->ranges = NULL;
+  for (;;) {
+    ValueRange range;
+    if (!parse_value_range(&p, &range) || range.n > INT_MAX - set->nValues) {
+      return false;
+    }
+    set->ranges =
+      reallocChk(set->ranges, (set->nRanges + 1) * sizeof(ValueRange));
+    set->ranges[set->nRanges++] = range;
+    set->nValues += range.n;
+    if (*p == '\0') return true;
+    if (*p++ != ',') return false;
+  }
+}
+
+bool
+is_sweep_spec(const char *spec)
+{
+  return strchr(spec, ',') != NULL || strstr(spec, "..") != NULL;
+}
+
+Batch *
+new_sweep_batch(int numSpecs, const char *const specs[])
+{
+  Batch *batch = callocChk(1, sizeof(Batch));
+  batch->nSets = numSpecs;
+  batch->sets = callocChk(numSpecs, sizeof(ValueSet));
+  batch->nRuns = 1;
+  for (int k = 0; k < numSpecs; k++) {
+    ValueSet *set = &batch->sets[k];
+    if (!parse_value_set(specs[k], set)) {
+      fatal("bad input range '%s'", specs[k]);
+    }
+    if (batch->nRuns > INT_MAX / set->nValues) {
+      fatal("input ranges give more than %d runs", INT_MAX);
+    }
+    batch->nRuns *= set->nValues;
+  }
+  return batch;
+}
+
+void
+free_batch(Batch *batch)
+{
+  if (batch->runs != NULL) {
+    for (int i = 0; i < batch->nRuns; i++) free(batch->runs[i].params);
+    free(batch->runs);
+  }
+  for (int k = 0; k < batch->nSets; k++) free(batch->sets[k].ranges);
+  free(batch->sets);
+  free(batch);
+}
+
+/** Return the # of inputs of run i of batch, setting *params to them.
+ *  The inputs of a sweep are computed into buf[], which must have room
+ *  for one per set.
+ */
+static int
+get_run_params(const Batch *batch, int i, Word buf[], const Word **params)
+{
+  if (batch->runs != NULL) {
+    *params = batch->runs[i].params;
+    return batch->runs[i].numParams;
+  }
+  //i is a mixed-radix number whose k'th digit selects a value of set k
+  for (int k = batch->nSets - 1; k >= 0; k--) {
+    const ValueSet *set = &batch->sets[k];
+    int j = i % set->nValues;
+    i /= set->nValues;
+    const ValueRange *range = set->ranges;
+    while (j >= range->n) j -= range++->n;
+    buf[k] = range->lo + j * range->step;
+  }
+  *params = buf;
+  return batch->nSets;
+}
+
+/***************************** Running a Batch *************************/
+
+enum {
+  WINDOW_RUNS = 1 << 16,   /** max # of runs whose output is held at once */
+};
+
+/** Runs [lo, hi) of a batch which have not yet been started.  Each
+ *  worker removes runs from the bottom of its own queue and, when that
+ *  is empty, steals half the runs from the top of another queue.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  int lo, hi;
+} RunQueue;
+
+/** Outcome of a run for CSV output. */
+typedef struct {
+  Word rax;
+  uint64_t nSteps;
+  Status status;
+} RunResult;
+
+/** Runs are made in windows of at most WINDOW_RUNS runs starting at
+ *  run first; the output of run i is held at index i - first until
+ *  its window is written.
+ */
+typedef struct {
+  const Batch *batch;
+  Snapshot *image;         /** state of y86 before each run */
+  bool isJit;
+  bool isCsv;
+  int nThreads;
+  int first;               /** first run of current window */
+  RunQueue *queues;        /** one per worker */
+  char **outputs;          /** text output of each run */
+  size_t *outputSizes;
+  RunResult *results;      /** CSV output of each run */
+} Pool;
+
+typedef struct {
+  Pool *pool;
+  int index;               /** index of worker's queue in pool */
+  Y86 *y86;                /** reused for CSV runs; NULL before the first */
+  YJit *yjit;              /** runs y86 with -j; NULL before the first */
+} Worker;
+
+/** Run y86 until it stops, using yjit unless it is NULL.  Return the
+ *  # of instructions executed.
+ */
+static uint64_t
+run_to_end(Y86 *y86, YJit *yjit)
+{
+  uint64_t nSteps = 0;
+  if (yjit != NULL) {
+    while (read_status_y86(y86) == STATUS_AOK) {
+      nSteps += run_yjit(yjit, UINT64_MAX);
+    }
+  }
+  else {
+    while (read_status_y86(y86) == STATUS_AOK) {
+      nSteps += run_ysim(y86, UINT64_MAX);
+    }
+  }
+  return nSteps;
+}
+
+/** Simulate run i of pool, leaving its text output in pool->outputs[]. */
+static void
+do_run(Pool *pool, int i)
+{
+  Word buf[pool->batch->nSets + 1];
+  const Word *params;
+  int numParams = get_run_params(pool->batch, i, buf, &params);
+  int k = i - pool->first;
+  FILE *out = open_memstream(&pool->outputs[k], &pool->outputSizes[k]);
+  if (out == NULL) fatal("cannot create output stream:");
+  fprintf(out, "run %d:", i);
+  for (int j = 0; j < numParams; j++) {
+    fprintf(out, " %ld", (long)params[j]);
+  }
+  fprintf(out, "\n");
+  Y86 *y86 = fork_y86(pool->image);
+  setup_params(y86, numParams, params, out);
+  YJit *yjit = pool->isJit ? new_yjit(y86) : NULL;
+  run_to_end(y86, yjit);
+  if (yjit != NULL) free_yjit(yjit);
+  dump_changes_y86(y86, true, out);
+  free_ysim(y86);
+  free_y86(y86);
+  if (fclose(out) != 0) fatal("cannot write output stream:");
+}
+
+/** Simulate run i of the pool of worker, leaving its outcome in
+ *  pool->results[].  Nothing is dumped, so the same Y86 is restored
+ *  to the image for each run made by worker.
+ */
+static void
+do_csv_run(Worker *worker, int i)
+{
+  Pool *pool = worker->pool;
+  Word buf[pool->batch->nSets + 1];
+  const Word *params;
+  int numParams = get_run_params(pool->batch, i, buf, &params);
+  if (worker->y86 == NULL) {
+    worker->y86 = fork_y86(pool->image);
+    if (pool->isJit) worker->yjit = new_yjit(worker->y86);
+  }
+  else {
+    restore_y86(worker->y86, pool->image);
+    if (worker->yjit != NULL) reset_yjit(worker->yjit);
+  }
+  Y86 *y86 = worker->y86;
+  setup_params(y86, numParams, params, NULL);
+  RunResult *result = &pool->results[i - pool->first];
+  result->nSteps = run_to_end(y86, worker->yjit);
+  result->rax = read_register_y86(y86, REG_RAX);
+  result->status = read_status_y86(y86);
+}
+
+/** Remove a run from queue, returning its index or -1 if none. */
+static int
+take_run(RunQueue *queue)
+{
+  pthread_mutex_lock(&queue->lock);
+  int i = (queue->lo < queue->hi) ? queue->lo++ : -1;
+  pthread_mutex_unlock(&queue->lock);
+  return i;
+}
+
+/** Move half the runs of some other worker's queue into the queue of
+ *  worker.  Return false if there were none to steal.
+ */
+static bool
+steal_runs(Worker *worker)
+{
+  Pool *pool = worker->pool;
+  for (int k = 1; k < pool->nThreads; k++) {
+    RunQueue *victim = &pool->queues[(worker->index + k) % pool->nThreads];
+    pthread_mutex_lock(&victim->lock);
+    int n = (victim->hi - victim->lo + 1) / 2;
+    int hi = victim->hi;
+    victim->hi -= n;
+    pthread_mutex_unlock(&victim->lock);
+    if (n > 0) {
+      RunQueue *queue = &pool->queues[worker->index];
+      pthread_mutex_lock(&queue->lock);
+      queue->lo = hi - n;
+      queue->hi = hi;
+      pthread_mutex_unlock(&queue->lock);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *
+do_worker(void *arg)
+{
+  Worker *worker = arg;
+  RunQueue *queue = &worker->pool->queues[worker->index];
+  for (;;) {
+    int i = take_run(queue);
+    if (i >= 0) {
+      if (worker->pool->isCsv) {
+        do_csv_run(worker, i);
+      }
+      else {
+        do_run(worker->pool, i);
+      }
+    }
+    else if (!steal_runs(worker)) {
+      break;
+    }
+  }
+  //the simulator state of a Y86 belongs to the thread which made it
+  if (worker->yjit != NULL) free_yjit(worker->yjit);
+  if (worker->y86 != NULL) {
+    free_ysim(worker->y86);
+    free_y86(worker->y86);
+  }
+  return NULL;
+}
+
+/** Make runs [pool->first, hi) of pool using its threads. */
+static void
+run_window(Pool *pool, int hi)
+{
+  int nThreads = pool->nThreads;
+  int nRuns = hi - pool->first;
+  for (int t = 0; t < nThreads; t++) {
+    pool->queues[t].lo = pool->first + (int)((long)nRuns * t / nThreads);
+    pool->queues[t].hi = pool->first + (int)((long)nRuns * (t + 1) / nThreads);
+  }
+  Worker workers[nThreads];
+  pthread_t threads[nThreads];
+  for (int t = 0; t < nThreads; t++) {
+    workers[t] = (Worker) { .pool = pool, .index = t, .y86 = NULL,
+                             .yjit = NULL };
+    if (t > 0 && pthread_create(&threads[t], NULL, do_worker, &workers[t])) {
+      fatal("cannot create thread:");
+    }
+  }
+  do_worker(&workers[0]);     //main thread is worker 0
+  for (int t = 1; t < nThreads; t++) pthread_join(threads[t], NULL);
+}
+
+/** Return the largest # of inputs of any run of batch. */
+static int
+max_run_params(const Batch *batch)
+{
+  if (batch->runs == NULL) return batch->nSets;
+  int n = 0;
+  for (int i = 0; i < batch->nRuns; i++) {
+    if (batch->runs[i].numParams > n) n = batch->runs[i].numParams;
+  }
+  return n;
+}
+
+/** Write the CSV line for run i of pool, with nInputs input columns,
+ *  to out.
+ */
+static void
+write_csv_line(const Pool *pool, int i, int nInputs, FILE *out)
+{
+  Word buf[pool->batch->nSets + 1];
+  const Word *params;
+  int numParams = get_run_params(pool->batch, i, buf, &params);
+  for (int j = 0; j < nInputs; j++) {
+    if (j < numParams) fprintf(out, "%ld", (long)params[j]);
+    fputc(',', out);
+  }
+  const RunResult *result = &pool->results[i - pool->first];
+  fprintf(out, "%ld,%s,%lu\n", (long)result->rax,
+          STATUS_NAMES[result->status], (unsigned long)result->nSteps);
+}
+
+void
+run_batch(Y86 *image, const Batch *batch, int nThreads, bool isJit,
+          bool isCsv, FILE *out)
+{
+  int nRuns = batch->nRuns;
+  int windowRuns = (nRuns < WINDOW_RUNS) ? nRuns : WINDOW_RUNS;
+  if (nThreads <= 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads > windowRuns) nThreads = windowRuns;
+  if (nThreads <= 0) nThreads = 1;
+  Pool pool = {
+    .batch = batch,
+    .image = snapshot_y86(image),
+    .isJit = isJit,
+    .isCsv = isCsv,
+    .nThreads = nThreads,
+    .queues = mallocChk(nThreads * sizeof(RunQueue)),
+  };
+  if (isCsv) {
+    pool.results = mallocChk((windowRuns + 1) * sizeof(RunResult));
+  }
+  else {
+    pool.outputs = callocChk(windowRuns + 1, sizeof(char *));
+    pool.outputSizes = callocChk(windowRuns + 1, sizeof(size_t));
+  }
+  for (int t = 0; t < nThreads; t++) {
+    pthread_mutex_init(&pool.queues[t].lock, NULL);
+  }
+
+  int nInputs = max_run_params(batch);
+  if (isCsv) {
+    for (int j = 0; j < nInputs; j++) fprintf(out, "input%d,", j + 1);
+    fprintf(out, "rax,status,instructions\n");
+  }
+  for (pool.first = 0; pool.first < nRuns; pool.first += windowRuns) {
+    int hi = (nRuns - pool.first < windowRuns)
+      ? nRuns : pool.first + windowRuns;
+    run_window(&pool, hi);
+    for (int i = pool.first; i < hi; i++) {
+      if (isCsv) {
+        write_csv_line(&pool, i, nInputs, out);
+      }
+      else {
+        int k = i - pool.first;
+        fwrite(pool.outputs[k], 1, pool.outputSizes[k], out);
+        free(pool.outputs[k]);
+      }
+    }
+  }
+  for (int t = 0; t < nThreads; t++) pthread_mutex_destroy(&pool.queues[t].lock);
+  free(pool.queues);
+  free(pool.outputs);
+  free(pool.outputSizes);
+  free(pool.results);
+  free_snapshot(pool.image);
+}
@@ -0,0 +1,56 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include "y86.h"
+
+#include <stdio.h>
+
+/** An opaque structure holding the input vectors for a batch of runs. */
+typedef struct BatchStruct Batch;
+
+/** Read a batch of input vectors from in, one per line.  Each vector
+ *  consists of whitespace-separated integers in any C notation.
+ *  Blank lines and lines starting with '#' are ignored.  fileName is
+ *  used only in error messages.
+ */
+Batch *read_batch(FILE *in, const char *fileName);
+
+/** Return a batch holding every input vector in the cartesian
+ *  product of the sets of integers given by specs[0, numSpecs), with
+ *  the last input varying fastest.  Each spec is a comma-separated
+ *  list of integers N and ranges LO..HI[:STEP] (STEP defaults to 1
+ *  and counts down from LO if HI < LO), in any C notation.  Exits with
+ *  an error message if a spec is invalid or there are too many
+ *  vectors.
+ */
+Batch *new_sweep_batch(int numSpecs, const char *const specs[]);
+
+/** Return true iff spec, an integer input from the command line, is
+ *  a list or range for new_sweep_batch() rather than a single integer.
+ */
+bool is_sweep_spec(const char *spec);
+
+/** Free all resources allocated by read_batch() or new_sweep_batch()
+ *  in batch.
+ */
+void free_batch(Batch *batch);
+
+/** Run the program loaded in image once for each input vector in
+ *  batch, using nThreads threads (all online processors if nThreads
+ *  is 0).  Each run starts on its own copy of image; image itself is
+ *  not changed.  Memory loaded into image is not reported as changed
+ *  in the output of a run.  If isJit, runs are translated to native
+ *  code.
+ *
+ *  For each run, in input order, write to out a line
+ *  "run N: INPUTS..." followed by the output that a silent simulation
+ *  of that run would produce: the argv addresses, then the final
+ *  state as dumped by dump_changes_y86().  If isCsv, instead write a
+ *  CSV header line followed by a line "INPUTS...,RAX,STATUS,STEPS"
+ *  per run, giving the final %rax and status and the number of
+ *  instructions executed.
+ */
+void run_batch(Y86 *image, const Batch *batch, int nThreads,
+               bool isJit, bool isCsv, FILE *out);
+
+#endif //ifndef _BATCH_H
@@ -0,0 +1,101 @@
+#include "decode.h"
+
+const char *const REG_NAMES[N_REG] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14",
+};
+
+/** How instructions with a base opcode are encoded. */
+typedef struct {
+  Byte size;        /** # of bytes in encoding */
+  Byte immOffset;   /** offset of immediate word in encoding; 0 if none */
+  Byte maxFn;       /** largest valid function code */
+  bool hasRegs;     /** true if encoding has a register byte */
+} Encoding;
+
+static const Encoding ENCODINGS[] = {
+  [HALT_CODE] =   { 1,  0, 0xF,      false },
+  [NOP_CODE] =    { 1,  0, 0xF,      false },
+  [CMOVxx_CODE] = { 2,  0, GT_COND,  true },
+  [IRMOVQ_CODE] = { 10, 2, 0xF,      true },
+  [RMMOVQ_CODE] = { 10, 2, 0xF,      true },
+  [MRMOVQ_CODE] = { 10, 2, 0xF,      true },
+  [OP1_CODE] =    { 2,  0, 0xF,      true },
+  [Jxx_CODE] =    { 9,  1, GT_COND,  false },
+  [CALL_CODE] =   { 9,  1, 0xF,      false },
+  [RET_CODE] =    { 1,  0, 0xF,      false },
+  [PUSHQ_CODE] =  { 2,  0, 0xF,      true },
+  [POPQ_CODE] =   { 2,  0, 0xF,      true },
+  [IOPQ_CODE] =   { 10, 2, XORQ_FN,  true },
+  [CASQ_CODE] =   { 10, 2, 0,        true },
+  [BLOCK_CODE] =  { 2,  0, FILLQ_FN, true },
+  [TRAP_CODE] =   { 1,  0, 0,        false },
+};
+
+/** Fill in *d by decoding the instruction at pc in the memSize bytes
+ *  of memory starting at mem as the checked simulator path does.
+ *  Return STATUS_AOK, or the status with which the checked path stops
+ *  on the instruction before executing it.  Does not set d->isValid.
+ */
+Status
+decode_checked_instr(const Byte mem[], Size memSize, Address pc, Decoded *d)
+{
+  if (pc >= memSize) return STATUS_ADR;
+  const Byte *bytes = &mem[pc];
+  d->op = get_nybble(bytes[0], 1);
+  d->fn = get_nybble(bytes[0], 0);
+  const Encoding *encoding = &ENCODINGS[d->op];
+  d->size = encoding->size;
+  //function codes are checked before anything else is fetched
+  if (d->fn > encoding->maxFn) return STATUS_INS;
+  Size nBytes = memSize - pc;
+  d->nextPC = pc + d->size;
+  d->regA = d->regB = REG_NONE;
+  d->imm = 0;
+  if (encoding->hasRegs) {
+    if (nBytes < 2*sizeof(Byte)) return STATUS_ADR;
+    d->regA = get_nybble(bytes[1], 1);
+    d->regB = get_nybble(bytes[1], 0);
+    //and registers before the rest of the instruction
+    if (d->op == CASQ_CODE &&
+        (d->regA == REG_NONE || d->regB == REG_NONE)) {
+      return STATUS_INS;
+    }
+    //the pointers must be distinct registers other than the count
+    if (d->op == BLOCK_CODE &&
+        (d->regA == REG_NONE || d->regB == REG_NONE ||
+         d->regA == d->regB || d->regA == REG_RCX || d->regB == REG_RCX)) {
+      return STATUS_INS;
+    }
+  }
+  if (nBytes < d->size) return STATUS_ADR;
+  if (encoding->immOffset != 0) {
+    d->imm = get_le_word(&bytes[encoding->immOffset]);
+  }
+  return STATUS_AOK;
+}
+
+/** Fill in *d by decoding the instruction at pc in the memSize bytes
+ *  of memory starting at mem.  Return false if the instruction cannot
+ *  be decoded.  Does not set d->isValid.
+ */
+bool
+decode_instr(const Byte mem[], Size memSize, Address pc, Decoded *d)
+{
+  if (decode_checked_instr(mem, memSize, pc, d) != STATUS_AOK) return false;
+  //leave a fall-through to an invalid pc to the checked path
+  if (d->op != HALT_CODE && d->nextPC >= memSize) return false;
+  //other OPq functions do nothing, as in the base ISA
+  if (d->op == OP1_CODE && d->fn > MODQ_FN) return false;
+  bool usesA = d->op == CMOVxx_CODE || d->op == RMMOVQ_CODE ||
+    d->op == MRMOVQ_CODE || d->op == OP1_CODE ||
+    d->op == PUSHQ_CODE || d->op == POPQ_CODE || d->op == CASQ_CODE ||
+    d->op == BLOCK_CODE;
+  bool usesB = d->op == CMOVxx_CODE || d->op == IRMOVQ_CODE ||
+    d->op == RMMOVQ_CODE || d->op == MRMOVQ_CODE || d->op == OP1_CODE ||
+    d->op == CASQ_CODE || d->op == IOPQ_CODE || d->op == BLOCK_CODE;
+  if ((usesA && d->regA == REG_NONE) || (usesB && d->regB == REG_NONE)) {
+    return false;
+  }
+  return true;
+}
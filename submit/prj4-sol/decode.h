@@ -0,0 +1,110 @@
+#ifndef _DECODE_H
+#define _DECODE_H
+
+#include "y86.h"
+
+#include <string.h>
+
+/** Return nybble from op (pos 0: least-significant; pos 1:
+ *  most-significant)
+ */
+static inline Byte
+get_nybble(Byte op, int pos) {
+  return (op >> (pos * 4)) & 0xF;
+}
+
+/** Return the little-endian word stored at bytes[0, sizeof(Word)). */
+static inline Word
+get_le_word(const Byte bytes[])
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  Word word;
+  memcpy(&word, bytes, sizeof(Word));
+  return word;
+#else
+  Word word = 0;
+  for (int i = sizeof(Word) - 1; i >= 0; i--) {
+    word = (word << BYTE_BITS) | bytes[i];
+  }
+  return word;
+#endif
+}
+
+/** Names of the registers, without their % prefix. */
+extern const char *const REG_NAMES[N_REG];
+
+/** Conditions used in instructions */
+typedef enum {
+  ALWAYS_COND, LE_COND, LT_COND, EQ_COND, NE_COND, GE_COND, GT_COND
+} Condition;
+
+typedef enum {
+  HALT_CODE, NOP_CODE, CMOVxx_CODE, IRMOVQ_CODE, RMMOVQ_CODE, MRMOVQ_CODE,
+  OP1_CODE, Jxx_CODE, CALL_CODE, RET_CODE,
+  PUSHQ_CODE, POPQ_CODE, IOPQ_CODE, CASQ_CODE, BLOCK_CODE, TRAP_CODE
+} BaseOpCode;
+
+/** Function codes for OP1_CODE and, up to XORQ_FN, for IOPQ_CODE;
+ *  those after XORQ_FN are extensions.
+ */
+enum { ADDQ_FN, SUBQ_FN, ANDQ_FN, XORQ_FN, MULQ_FN, DIVQ_FN, MODQ_FN };
+
+/** Function codes for BLOCK_CODE */
+enum { COPYQ_FN, FILLQ_FN };
+
+/** Function codes for NOP_CODE: a fence orders the memory accesses of
+ *  a core in ycores and is a nop anywhere else.
+ */
+enum { NOP_FN, FENCE_FN };
+
+enum {
+  MAX_INSTR_SIZE = 2*sizeof(Byte) + sizeof(Word), /** longest encoding */
+};
+
+/** An instruction decoded once from memory.  Only instructions which
+ *  lie entirely within memory, are followed by a valid address, use
+ *  valid function codes and do not name REG_NONE as an operand are
+ *  ever decoded by decode_instr(); anything else is left to the
+ *  checked simulator path.
+ */
+typedef struct {
+  Byte op;          /** BaseOpCode from high nybble of instruction byte */
+  Byte fn;          /** function code from low nybble */
+  Byte regA;        /** high nybble of register byte */
+  Byte regB;        /** low nybble of register byte */
+  Byte size;        /** # of bytes in encoding */
+  bool isValid;     /** false if entry must be decoded again */
+  uint16_t handler; /** index of run_ysim() handler; set by ysim */
+  Word imm;         /** immediate value, displacement or destination */
+  Address nextPC;   /** address of following instruction */
+} Decoded;
+
+/** Return true iff d is one of the extension instructions, which are
+ *  invalid unless enabled by set_extensions_ysim().
+ */
+static inline bool
+is_extension(const Decoded *d)
+{
+  return d->op == IOPQ_CODE || d->op == BLOCK_CODE || d->op == CASQ_CODE ||
+    (d->op == OP1_CODE && d->fn > XORQ_FN);
+}
+
+/** Fill in *d by decoding the instruction at pc in the memSize bytes
+ *  of memory starting at mem.  Return false if the instruction cannot
+ *  be decoded.  Does not set d->isValid.
+ */
+bool decode_instr(const Byte mem[], Size memSize, Address pc, Decoded *d);
+
+/** Fill in *d by decoding the instruction at pc in the memSize bytes
+ *  of memory starting at mem as the checked simulator path does,
+ *  including instructions which decode_instr() declines.  Return
+ *  STATUS_AOK, or the status with which the checked path stops on the
+ *  instruction before executing it: STATUS_ADR if the instruction does
+ *  not lie within memory and STATUS_INS if it is invalid.  Extensions
+ *  are decoded as if enabled; OPq function codes are not checked.
+ *  Does not set d->isValid.
+ */
+Status decode_checked_instr(const Byte mem[], Size memSize, Address pc,
+                            Decoded *d);
+
+#endif //ifndef _DECODE_H
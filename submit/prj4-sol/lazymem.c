@@ -0,0 +1,58 @@
+#include "lazymem.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__)
+#include <sys/mman.h>
+#endif
+
+#if defined(MAP_ANONYMOUS) && defined(MAP_NORESERVE)
+
+void *
+new_lazy_mem(size_t size)
+{
+  if (size == 0) return NULL;
+  void *p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) fatal("cannot map %zu bytes:", size);
+  return p;
+}
+
+void
+clear_lazy_mem(void *p, size_t size)
+{
+  //private anonymous pages read back as zero after MADV_DONTNEED
+  if (size > 0 && madvise(p, size, MADV_DONTNEED) != 0) memset(p, 0, size);
+}
+
+void
+free_lazy_mem(void *p, size_t size)
+{
+  if (size > 0) munmap(p, size);
+}
+
+#else //no lazily committed mappings: fall back to calloc()
+
+void *
+new_lazy_mem(size_t size)
+{
+  return callocChk(size, 1);
+}
+
+void
+clear_lazy_mem(void *p, size_t size)
+{
+  memset(p, 0, size);
+}
+
+void
+free_lazy_mem(void *p, size_t size)
+{
+  free(p);
+}
+
+#endif
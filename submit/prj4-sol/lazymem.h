@@ -0,0 +1,21 @@
+#ifndef _LAZYMEM_H
+#define _LAZYMEM_H
+
+#include <stddef.h>
+
+/** Return size bytes of zeroed memory whose pages are committed only
+ *  when first touched, so that tables indexed by y86 address cost
+ *  nothing for parts of memory the program never uses.  Terminates
+ *  the program on failure.
+ */
+void *new_lazy_mem(size_t size);
+
+/** Zero the size bytes at p returned by new_lazy_mem(), releasing any
+ *  committed pages.
+ */
+void clear_lazy_mem(void *p, size_t size);
+
+/** Free the size bytes at p returned by new_lazy_mem(). */
+void free_lazy_mem(void *p, size_t size);
+
+#endif //ifndef _LAZYMEM_H
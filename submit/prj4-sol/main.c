@@ -1,11 +1,26 @@
+#include "batch.h"
+#include "decode.h"
+#include "params.h"
 #include "y86.h"
+#include "yaot.h"
 #include "yas.h"
+#include "ycores.h"
+#include "ycrash.h"
+#include "yio.h"
+#include "yjit.h"
+#include "yobj.h"
+#include "yprof.h"
+#include "yrecord.h"
+#include "yrev.h"
 #include "ysim.h"
+#include "ytrace.h"
 
 #include "errors.h"
+#include "memalloc.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,79 +31,611 @@ typedef struct {
   const char **fileNames;
   int numParams;
   Word *params;
+  const char **paramSpecs; /** INT_INPUTS as given */
+  bool isSweep;            /** some INT_INPUT is a list or range */
   int verbosity;
   bool isStep;
   bool isList;
+  bool isJit;
+  bool isExtended;         /** -x */
+  bool isProfile;
+  const char *traceFileName;
+  const char *batchFileName;
+  const char *cacheDir;
+  const char *objFileName;
+  const char *aotFileName;  /** -a */
+  const char *inFileName;   /** -i */
+  const char *outFileName;  /** -w */
+  const char *recordFileName;
+  uint64_t nFuzzRuns;      /** -F; 0 unless fuzzing */
+  bool hasFuzzInput;       /** -z given fuzzAddr and fuzzSize */
+  Address fuzzAddr;
+  Size fuzzSize;
+  bool isReplay;           /** replay recordFileName to replayStep */
+  uint64_t replayStep;
+  int numBreaks;
+  const char **breakSpecs; /** -B values */
+  int numWatches;
+  const char **watchSpecs; /** -W values */
+  int nThreads;
+  int nCores;              /** 0 unless -C */
+  MemoryOrder order;       /** -O */
+  bool hasOrder;
+  Size memSize;            /** 0 for default memory size */
+  Size reverseBudget;      /** -r; 0 unless run reversibly */
 } Args;
 
 enum { SILENT_VERBOSE, VERBOSE, VERY_VERBOSE };
 
-/**************************** Y86 Parameter Setup ***********************/
+enum {
+  FUZZ_MAX_STEPS = 1 << 16,  /** # of instructions before a -F run hangs */
+};
 
+/************************** Reverse Execution ***************************/
 
+/** Write to out why yrev stopped and the state of y86 it reached. */
 static void
-setup_params(const Args *args, Y86 *y86)
+dump_position(YRev *yrev, Y86 *y86, StopKind stop, Address addr, FILE *out)
 {
-  Word argc = args->numParams;
-  if (argc > 0) {
-    Address top = get_memory_size_y86(y86);
-    Address argv = top - argc * sizeof(Word);
-    for (int i = 0; i < argc; i++) {
-      const Address argvi = argv + i * sizeof(Word);
-      printf("argvi = %08lx\n", argvi);
-      write_memory_word_y86(y86, argvi, args->params[i]);
-      assert(read_status_y86(y86) == STATUS_AOK);
+  unsigned long nSteps = get_step_yrev(yrev);
+  if (stop == STOP_BREAK) {
+    fprintf(out, "breakpoint at pc %0*lx after %lu instructions\n",
+            (int)sizeof(Address)*2, addr, nSteps);
+  }
+  else if (stop == STOP_WATCH) {
+    fprintf(out, "watchpoint: W[%lx] written after %lu instructions\n",
+            addr, nSteps);
+  }
+  else {
+    fprintf(out, "pc %0*lx after %lu instructions\n",
+            (int)sizeof(Address)*2, read_pc_y86(y86), nSteps);
+  }
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    fprintf(out, "%s: %lx\n", REG_NAMES[r], read_register_y86(y86, r));
+  }
+  fprintf(out, "cc: %x\nstatus: %x\n\n",
+          read_cc_y86(y86), read_status_y86(y86));
+}
+
+/** Run the program in y86 under the commands read from in, one per
+ *  line, moving forwards and backwards through its execution using at
+ *  most budget bytes to do so:
+ *
+ *    s [N]    step forward N (default 1) instructions; also an empty line
+ *    c        continue to a breakpoint, watchpoint, halt or fault
+ *    rs [N]   step back N (default 1) instructions
+ *    rc       continue back to the last breakpoint or watchpoint stop
+ *    i        show the checkpoints and undo log held
+ *    q        quit, as does the end of input
+ *
+ *  The state reached is written to out after each command.
+ */
+static void
+simulate_reverse(Y86 *y86, Size budget, FILE *in, FILE *out)
+{
+  YRev *yrev = new_yrev(y86, budget);
+  char line[80];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    char cmd[8] = "s";
+    unsigned long n = 1;
+    sscanf(line, "%7s %lu", cmd, &n);
+    StopKind stop = STOP_NONE;
+    Address addr = 0;
+    if (strcmp(cmd, "s") == 0) {
+      step_yrev(yrev, n);
+    }
+    else if (strcmp(cmd, "c") == 0) {
+      stop = continue_yrev(yrev, &addr);
+    }
+    else if (strcmp(cmd, "rs") == 0) {
+      reverse_step_yrev(yrev, n);
+    }
+    else if (strcmp(cmd, "rc") == 0) {
+      stop = reverse_continue_yrev(yrev, &addr);
     }
-    write_register_y86(y86, REG_RDI, argc);
-    write_register_y86(y86, REG_RSI, argv);
+    else if (strcmp(cmd, "i") == 0) {
+      dump_yrev(yrev, out);
+      continue;
+    }
+    else if (strcmp(cmd, "q") == 0) {
+      break;
+    }
+    else {
+      fprintf(stderr, "unknown command '%s'\n", cmd);
+      continue;
+    }
+    dump_position(yrev, y86, stop, addr, out);
   }
+  free_yrev(yrev);
 }
 
 /*************************** Main Simulation ****************************/
 
+/** State of a Y86 before a step, and the words stored by the step. */
+typedef struct {
+  Word regs[N_REG];
+  Byte cc;
+  Address *stores;         /** addresses of the words stored, in order */
+  Size nStores;
+  Size maxStores;
+} Step;
+
+/** StoreFn which records the store of the word at addr in ctx. */
+static void
+note_step_store(void *ctx, Address addr)
+{
+  Step *step = ctx;
+  if (step->nStores == step->maxStores) {
+    step->maxStores = (step->maxStores == 0) ? 16 : 2 * step->maxStores;
+    step->stores =
+      reallocChk(step->stores, step->maxStores * sizeof(Address));
+  }
+  step->stores[step->nStores++] = addr;
+}
+
+/** Prepare to dump the changes made to y86 by its next step. */
+static void
+begin_step(Y86 *y86, Step *step)
+{
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    step->regs[r] = read_register_y86(y86, r);
+  }
+  step->cc = read_cc_y86(y86);
+  step->nStores = 0;
+  clear_changes_ysim(y86);
+}
+
+/** Write the changes made to y86 by step to out in the format of
+ *  dump_changes_y86(), examining only the state which the step wrote.
+ *  If isVerbose, all registers, cc and status are written.
+ */
 static void
-simulate(const Args *args, Y86 *y86, FILE *out)
+dump_step(Y86 *y86, const Step *step, bool isVerbose, FILE *out)
+{
+  YChanges changes;
+  get_changes_ysim(y86, &changes);
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    Word value = read_register_y86(y86, r);
+    if (isVerbose ||
+        ((changes.regs & (1u << r)) != 0 && value != step->regs[r])) {
+      fprintf(out, "%s: %lx\n", REG_NAMES[r], value);
+    }
+  }
+  Byte cc = read_cc_y86(y86);
+  if (isVerbose || ((changes.regs & CHANGED_CC) != 0 && cc != step->cc)) {
+    fprintf(out, "cc: %x\n", cc);
+  }
+  if (isVerbose || (changes.regs & CHANGED_STATUS) != 0) {
+    fprintf(out, "status: %x\n", read_status_y86(y86));
+  }
+  //stores may be unaligned; the memory written by a trap is only
+  //known as the aligned words which contain it, and a trap writes the
+  //bytes of a word which extends past the end of memory one by one
+  for (Size i = 0; i < step->nStores; i++) {
+    Address a = step->stores[i];
+    fprintf(out, "W[%lx]: %lx\n", a, read_memory_word_y86(y86, a));
+  }
+  Size memSize = get_memory_size_y86(y86);
+  for (Size i = 0; step->nStores == 0 && i < changes.nWords; i++) {
+    Address a = changes.words[i];
+    if (memSize - a >= sizeof(Word)) {
+      fprintf(out, "W[%lx]: %lx\n", a, read_memory_word_y86(y86, a));
+      continue;
+    }
+    for (Address b = a; b < memSize; b++) {
+      fprintf(out, "B[%lx]: %x\n", b, read_memory_byte_y86(y86, b));
+    }
+  }
+}
+
+/** Run the program in y86 as specified by args.  If yio is not NULL,
+ *  it carries out the traps of y86 and is freed once the program
+ *  stops.
+ */
+static void
+simulate(const Args *args, Y86 *y86, YIO *yio, FILE *out)
 {
-  setup_params(args, y86);
   bool isRunning = true;
+  if (args->recordFileName == NULL) {
+    setup_params(y86, args->numParams, args->params, out);
+  }
+
   bool isVeryVerbose = (args->verbosity == VERY_VERBOSE);
+  YProf *yprof = NULL;
+  if (args->recordFileName != NULL) {
+    //record sets up the params itself so that they can be replayed
+    record_y86(args->recordFileName, y86, yio,
+               args->numParams, args->params, out);
+    isRunning = false;
+  }
+  else if (args->isProfile) {
+    //count instructions; the profile is reported after the final state
+    yprof = new_yprof(y86);
+    run_yprof(yprof);
+    isRunning = false;
+  }
+  else if (args->traceFileName != NULL) {
+    //record a binary trace instead of dumping changes as text
+    YTrace *ytrace = new_ytrace(args->traceFileName, y86,
+                                args->numFileNames, args->fileNames,
+                                args->numParams, args->params);
+    while (read_status_y86(y86) == STATUS_AOK) step_ytrace(ytrace);
+    free_ytrace(ytrace);
+    isRunning = false;
+  }
+  else if (args->nCores > 0) {
+    //core 0 is dumped as the y86 itself below
+    YCores *ycores = new_ycores(y86, args->nCores, args->order);
+    run_ycores(ycores);
+    dump_ycores(ycores, out);
+    free_ycores(ycores);
+    isRunning = false;
+  }
+  else if (args->reverseBudget > 0) {
+    simulate_reverse(y86, args->reverseBudget, stdin, out);
+    isRunning = false;
+  }
+  else if (args->verbosity == SILENT_VERBOSE && !args->isStep) {
+    //nothing to show between instructions: run without stopping
+    if (args->isJit) {
+      YJit *yjit = new_yjit(y86);
+      while (read_status_y86(y86) == STATUS_AOK) run_yjit(yjit, UINT64_MAX);
+      free_yjit(yjit);
+    }
+    else {
+      uint64_t nSteps = 0;
+      StopKind stop = STOP_NONE;
+      Address addr;
+      while (read_status_y86(y86) == STATUS_AOK && stop == STOP_NONE) {
+        nSteps += run_ysim(y86, UINT64_MAX);
+        stop = get_stop_ysim(y86, &addr);
+      }
+      if (stop == STOP_BREAK) {
+        fprintf(out, "breakpoint at pc %0*lx after %lu instructions\n",
+                (int)sizeof(Address)*2, addr, (unsigned long)nSteps);
+      }
+      else if (stop == STOP_WATCH) {
+        fprintf(out, "watchpoint: W[%lx] written after %lu instructions\n",
+                addr, (unsigned long)nSteps);
+      }
+    }
+    isRunning = false;
+  }
+  //changes made during setup are only known to dump_changes_y86(),
+  //which is too slow to call after every step
+  bool isFirstStep = true;
+  Step step = { .stores = NULL, .maxStores = 0 };
+  if (args->verbosity != SILENT_VERBOSE) {
+    set_store_fn_ysim(y86, note_step_store, &step);
+  }
   while (isRunning) {
     Address pc = read_pc_y86(y86);
+    begin_step(y86, &step);
     step_ysim(y86);
     isRunning = read_status_y86(y86) == STATUS_AOK;
     if (isRunning) {
       if (args->verbosity != SILENT_VERBOSE) {
         fprintf(out, "pc: %0*lx\n", (int)sizeof(Address)*2, pc);
-        dump_changes_y86(y86, isVeryVerbose, out);
+        if (isFirstStep) {
+          dump_changes_y86(y86, isVeryVerbose, out);
+        }
+        else {
+          dump_step(y86, &step, isVeryVerbose, out);
+        }
         fprintf(out, "\n");
       }
+      isFirstStep = false;
       if (args->isStep) {
         char line[80];
         fgets(line, sizeof(line), stdin);
       }
     }
   }
-  dump_changes_y86(y86, true, out);
+  set_store_fn_ysim(y86, NULL, NULL);
+  //the program's own output precedes the final state
+  if (yio != NULL) free_yio(yio);
+  if (args->verbosity != SILENT_VERBOSE && !isFirstStep) {
+    //dump_changes_y86() would also give the writes of earlier steps
+    dump_step(y86, &step, true, out);
+  }
+  else {
+    dump_changes_y86(y86, true, out);
+  }
+  free(step.stores);
+  if (yprof != NULL) {
+    fprintf(out, "\n");
+    dump_yprof(yprof, args->numFileNames, args->fileNames, out);
+    free_yprof(yprof);
+  }
+}
+
+
+/** Run the program in y86 once for each input vector in the batch
+ *  file specified by args.
+ */
+static void
+simulate_batch(const Args *args, Y86 *y86, FILE *out)
+{
+  FILE *in = fopen(args->batchFileName, "r");
+  if (in == NULL) fatal("cannot read %s:", args->batchFileName);
+  Batch *batch = read_batch(in, args->batchFileName);
+  fclose(in);
+  run_batch(y86, batch, args->nThreads, args->isJit, false, out);
+  free_batch(batch);
+}
+
+
+/** Run the program in y86 once for each combination of the INT_INPUTS
+ *  lists and ranges specified by args, writing a CSV line per run.
+ */
+static void
+simulate_sweep(const Args *args, Y86 *y86, FILE *out)
+{
+  Batch *batch = new_sweep_batch(args->numParams, args->paramSpecs);
+  run_batch(y86, batch, args->nThreads, args->isJit, true, out);
+  free_batch(batch);
+}
+
+/** Fuzz the program in y86 for crashes as specified by args: the input
+ *  is the region given by -z, else the argv[] words of the INT_INPUTS.
+ */
+static void
+simulate_fuzz(const Args *args, Y86 *y86, FILE *out)
+{
+  setup_params(y86, args->numParams, args->params, NULL);
+  Address addr = args->fuzzAddr;
+  Size size = args->fuzzSize;
+  if (!args->hasFuzzInput) {
+    size = args->numParams * sizeof(Word);
+    addr = get_memory_size_y86(y86) - size;
+  }
+  run_ycrash(y86, addr, size, args->nFuzzRuns, FUZZ_MAX_STEPS,
+             args->nThreads, out);
+}
+
+
+/** Replay the run recorded in the record file specified by args to
+ *  its replay step and continue simulating from there.
+ */
+static void
+simulate_replay(const Args *args, FILE *out)
+{
+  uint64_t reached;
+  YIO *yio;
+  Y86 *y86 = replay_y86(args->recordFileName, args->replayStep, &yio,
+                        &reached, out);
+  fprintf(out, "replayed to step %lu\n", (unsigned long)reached);
+  if (args->verbosity != SILENT_VERBOSE) {
+    //the first step's dump would otherwise include the replayed writes
+    FILE *discard = fopen("/dev/null", "w");
+    if (discard == NULL) fatal("cannot open /dev/null:");
+    dump_changes_y86(y86, false, discard);
+    fclose(discard);
+  }
+  if (args->outFileName != NULL) {
+    if (yio == NULL || (get_open_fds_yio(yio) & (1u << TRAP_OUT_FD)) == 0) {
+      fatal("-w requires a run recorded with -w");
+    }
+    set_output_yio(yio, args->outFileName);
+  }
+  Args replayArgs = *args;
+  replayArgs.numParams = 0;
+  replayArgs.recordFileName = NULL;
+  simulate(&replayArgs, y86, yio, out);
+  free_ysim(y86);
+  free_y86(y86);
 }
 
 
 /************************* Parse Command Line **************************/
 
+/** Parse a number at *p into *value, advancing *p past it.  Return
+ *  false if there is no number at *p.
+ */
+static bool
+parse_number(const char **p, Word *value)
+{
+  char *end;
+  if (!isdigit(**p) && **p != '-') return false;
+  *value = strtoull(*p, &end, 0);
+  if (end == *p) return false;
+  *p = end;
+  return true;
+}
+
+/** Parse breakpoint spec ADDR[:REG=VALUE] into *pc, *reg and *value,
+ *  with *reg REG_NONE if there is no condition.  Return false if spec
+ *  is invalid.
+ */
+static bool
+parse_breakpoint(const char *spec, Address *pc, Register *reg, Word *value)
+{
+  const char *p = spec;
+  if (!parse_number(&p, pc)) return false;
+  *reg = REG_NONE;
+  *value = 0;
+  if (*p == '\0') return true;
+  if (*p++ != ':') return false;
+  const char *eq = strchr(p, '=');
+  if (eq == NULL) return false;
+  if (*p == '%') p++;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (strlen(REG_NAMES[r]) == (size_t)(eq - p) &&
+        strncmp(p, REG_NAMES[r], eq - p) == 0) {
+      *reg = r;
+    }
+  }
+  p = eq + 1;
+  return *reg != REG_NONE && parse_number(&p, value) && *p == '\0';
+}
+
+/** Parse watchpoint spec ADDR[:SIZE] into *addr and *size, with *size
+ *  the size of a word if not specified.  Return false if spec is
+ *  invalid.
+ */
+static bool
+parse_watchpoint(const char *spec, Address *addr, Size *size)
+{
+  const char *p = spec;
+  if (!parse_number(&p, addr)) return false;
+  *size = sizeof(Word);
+  if (*p == '\0') return true;
+  return *p++ == ':' && parse_number(&p, size) && *p == '\0' && *size > 0;
+}
+
+/** Add the breakpoints and watchpoints specified by args to y86. */
+static void
+add_debug_points(const Args *args, Y86 *y86)
+{
+  for (int i = 0; i < args->numBreaks; i++) {
+    Address pc;
+    Register reg;
+    Word value;
+    parse_breakpoint(args->breakSpecs[i], &pc, &reg, &value);
+    add_breakpoint_ysim(y86, pc, reg, value);
+  }
+  for (int i = 0; i < args->numWatches; i++) {
+    Address addr;
+    Size size;
+    parse_watchpoint(args->watchSpecs[i], &addr, &size);
+    add_watchpoint_ysim(y86, addr, size);
+  }
+}
+
 static void
 usage(const char *prog)
 {
   fprintf(stderr,
-          "usage: %s [-s] [-v] [-V] YAS_FILE_NAMES... INT_INPUTS...\n", prog);
+          "usage: %s [-b INPUTS_FILE [-n N_THREADS]] [-j] [-p] [-x] "
+          "[-m MEM_SIZE] [-s] [-t TRACE_FILE] [-v] [-V] [-i IN_FILE] "
+          "[-w OUT_FILE]\n"
+          "          [-c CACHE_DIR] [-o OBJ_FILE] YAS_FILE_NAMES... "
+          "INT_INPUTS...\n"
+          "       %s -l YAS_FILE_NAMES...\n"
+          "       %s -R RECORD_FILE -g STEP [-r BUDGET | [-s] [-v] [-V] "
+          "[-w OUT_FILE]]\n"
+          "       %s [-B ADDR[:REG=VALUE]]... [-W ADDR[:SIZE]]... "
+          "YAS_FILE_NAMES... INT_INPUTS...\n"
+          "       %s -C N_CORES [-O sc|relaxed] [-m MEM_SIZE] "
+          "YAS_FILE_NAMES... INT_INPUTS...\n"
+          "       %s -a C_FILE [-m MEM_SIZE] YAS_FILE_NAMES... "
+          "INT_INPUTS...\n"
+          "       %s -r BUDGET [-B ADDR[:REG=VALUE]]... [-W ADDR[:SIZE]]... "
+          "[-x] [-m MEM_SIZE]\n"
+          "          YAS_FILE_NAMES... INT_INPUTS...\n"
+          "       %s -F N_RUNS [-z ADDR[:SIZE]] [-n N_THREADS] [-x] "
+          "[-m MEM_SIZE]\n"
+          "          YAS_FILE_NAMES... INT_INPUTS...\n",
+          prog, prog, prog, prog, prog, prog, prog, prog);
   fprintf(stderr,
+          "          -a:  write C_FILE, the program translated to C, "
+          "for compiling into a\n"
+          "               standalone runner taking INT_INPUTS\n"
+          "          -B:  stop before the instruction at ADDR (when REG "
+          "holds VALUE)\n"
+          "          -b:  run once for each line of INT_INPUTS in "
+          "INPUTS_FILE\n"
+          "          -C:  run N_CORES cores, each a thread, sharing memory; "
+          "core K starts\n"
+          "               with %%rdx = K and %%rcx = N_CORES and must set up "
+          "its own stack\n"
+          "          -c:  reuse object images of unchanged programs cached "
+          "in CACHE_DIR\n"
+          "          -F:  fuzz for crashes over N_RUNS runs, mutating "
+          "the INT_INPUTS words\n"
+          "               and keeping inputs which reach new branch "
+          "coverage\n"
+          "          -g:  replay RECORD_FILE to instruction STEP and "
+          "continue from there,\n"
+          "               reading the recorded IN_FILE input\n"
+          "          -i:  make the program's trap reads of fd 0 read IN_FILE "
+          "(- for standard\n"
+          "               input)\n"
+          "          -j:  translate to native code when running silently\n"
           "          -l:  produce assembler listing only\n"
+          "          -m:  use MEM_SIZE bytes of y86 memory; MEM_SIZE may "
+          "have a K, M or G suffix\n"
+          "          -n:  use N_THREADS threads for -b, -F or INT_INPUTS "
+          "ranges (default:\n"
+          "               all processors)\n"
+          "          -O:  order the loads and stores of -C cores "
+          "sequentially consistently\n"
+          "               (sc, the default) or relaxed; casq and fence are "
+          "always sc\n"
+          "          -o:  write object image of assembled program to "
+          "OBJ_FILE\n"
+          "          -p:  profile: report instruction, branch and call counts "
+          "and\n"
+          "               an annotated listing\n"
+          "          -R:  record run with checkpoints to RECORD_FILE for -g\n"
+          "          -r:  run under commands from standard input which step "
+          "(s [N]) and\n"
+          "               continue (c) forwards and back (rs [N], rc), "
+          "keeping at most\n"
+          "               BUDGET bytes (with an optional K, M or G suffix) "
+          "of checkpoints\n"
+          "               and undo log\n"
           "          -s:  single-step program\n"
-          "          -v:  verbose: dump changes after each instruction\n"
+          "          -t:  write binary trace to TRACE_FILE for ytrace-dump\n"
           "          -V:  very verbose: dump all registers after each "
-          "instruction\n");
+          "instruction\n"
+          "          -v:  verbose: dump changes after each instruction\n"
+          "          -W:  stop after a store to any of the SIZE (default 8) "
+          "bytes at ADDR\n"
+          "          -w:  make the program's trap writes to fd 1 write "
+          "OUT_FILE (- for\n"
+          "               standard output, before the final state)\n"
+          "          -x:  enable the extension instructions iaddq, isubq, "
+          "iandq, ixorq,\n"
+          "               mulq, divq, modq, copyq, fillq and casq\n"
+          "          -z:  with -F, mutate the SIZE (default 8) bytes at "
+          "ADDR instead\n"
+          "     Each of INT_INPUTS may be a comma-separated list of integers "
+          "and ranges\n"
+          "     LO..HI[:STEP]; the program is then run for every combination "
+          "of inputs\n"
+          "     and a CSV line of the inputs, final %%rax, status and "
+          "instruction count\n"
+          "     is written for each run.\n");
   exit(1);
 }
 
 
+/** Return true iff arg is an option followed by a value. */
+static bool
+is_option_with_value(const char *arg)
+{
+  return strcmp(arg, "-a") == 0 ||
+         strcmp(arg, "-B") == 0 || strcmp(arg, "-W") == 0 ||
+         strcmp(arg, "-C") == 0 || strcmp(arg, "-O") == 0 ||
+         strcmp(arg, "-F") == 0 || strcmp(arg, "-z") == 0 ||
+         strcmp(arg, "-b") == 0 || strcmp(arg, "-c") == 0 ||
+         strcmp(arg, "-g") == 0 || strcmp(arg, "-m") == 0 ||
+         strcmp(arg, "-i") == 0 || strcmp(arg, "-w") == 0 ||
+         strcmp(arg, "-n") == 0 || strcmp(arg, "-o") == 0 ||
+         strcmp(arg, "-R") == 0 || strcmp(arg, "-r") == 0 ||
+         strcmp(arg, "-t") == 0;
+}
+
+/** Return the memory size specified by value, a number optionally
+ *  followed by a K, M or G suffix; 0 if value is invalid.
+ */
+static Size
+parse_mem_size(const char *value)
+{
+  char *p;
+  unsigned long long size = strtoull(value, &p, 0);
+  if (p == value || value[0] == '-') return 0;
+  int shift = 0;
+  switch (toupper(*p)) {
+    case 'K': shift = 10; p++; break;
+    case 'M': shift = 20; p++; break;
+    case 'G': shift = 30; p++; break;
+  }
+  if (*p != '\0' || size > (UINT64_MAX >> shift)) return 0;
+  return (Size)size << shift;
+}
+
 static void
 first_pass_args(int argc, const char *argv[], Args *args)
 {
@@ -105,6 +652,130 @@ first_pass_args(int argc, const char *argv[], Args *args)
     else if (strcmp(argv[i], "-l") == 0) {
       args->isList = true;
     }
+    else if (strcmp(argv[i], "-j") == 0) {
+      args->isJit = true;
+    }
+    else if (strcmp(argv[i], "-x") == 0) {
+      args->isExtended = true;
+    }
+    else if (strcmp(argv[i], "-p") == 0) {
+      args->isProfile = true;
+    }
+    else if (is_option_with_value(argv[i])) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "missing value for option '%s'\n", argv[i]);
+        usage(argv[0]);
+      }
+      const char *value = argv[++i];
+      if (strcmp(argv[i - 1], "-t") == 0) {
+        args->traceFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-b") == 0) {
+        args->batchFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-c") == 0) {
+        args->cacheDir = value;
+      }
+      else if (strcmp(argv[i - 1], "-o") == 0) {
+        args->objFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-a") == 0) {
+        args->aotFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-i") == 0) {
+        args->inFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-w") == 0) {
+        args->outFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-R") == 0) {
+        args->recordFileName = value;
+      }
+      else if (strcmp(argv[i - 1], "-F") == 0) {
+        char *p;
+        args->nFuzzRuns = strtoull(value, &p, 0);
+        if (*p != '\0' || value[0] == '-' || args->nFuzzRuns == 0) {
+          fprintf(stderr, "bad number of runs '%s'\n", value);
+          usage(argv[0]);
+        }
+      }
+      else if (strcmp(argv[i - 1], "-z") == 0) {
+        if (!parse_watchpoint(value, &args->fuzzAddr, &args->fuzzSize)) {
+          fprintf(stderr, "bad input region '%s'\n", value);
+          usage(argv[0]);
+        }
+        args->hasFuzzInput = true;
+      }
+      else if (strcmp(argv[i - 1], "-B") == 0) {
+        Address pc;
+        Register reg;
+        Word v;
+        if (!parse_breakpoint(value, &pc, &reg, &v)) {
+          fprintf(stderr, "bad breakpoint '%s'\n", value);
+          usage(argv[0]);
+        }
+        args->numBreaks++;
+      }
+      else if (strcmp(argv[i - 1], "-W") == 0) {
+        Address addr;
+        Size size;
+        if (!parse_watchpoint(value, &addr, &size)) {
+          fprintf(stderr, "bad watchpoint '%s'\n", value);
+          usage(argv[0]);
+        }
+        args->numWatches++;
+      }
+      else if (strcmp(argv[i - 1], "-g") == 0) {
+        char *p;
+        args->replayStep = strtoull(value, &p, 0);
+        if (p == value || *p != '\0' || value[0] == '-') {
+          fprintf(stderr, "bad replay step '%s'\n", value);
+          usage(argv[0]);
+        }
+        args->isReplay = true;
+      }
+      else if (strcmp(argv[i - 1], "-C") == 0) {
+        char *p;
+        args->nCores = strtol(value, &p, 0);
+        if (*p != '\0' || args->nCores <= 0 || args->nCores > MAX_CORES) {
+          fprintf(stderr, "bad number of cores '%s'\n", value);
+          usage(argv[0]);
+        }
+      }
+      else if (strcmp(argv[i - 1], "-O") == 0) {
+        if (strcmp(value, "sc") == 0) {
+          args->order = ORDER_SC;
+        }
+        else if (strcmp(value, "relaxed") == 0) {
+          args->order = ORDER_RELAXED;
+        }
+        else {
+          fprintf(stderr, "bad memory order '%s'\n", value);
+          usage(argv[0]);
+        }
+        args->hasOrder = true;
+      }
+      else if (strcmp(argv[i - 1], "-r") == 0) {
+        if ((args->reverseBudget = parse_mem_size(value)) == 0) {
+          fprintf(stderr, "bad reverse execution budget '%s'\n", value);
+          usage(argv[0]);
+        }
+      }
+      else if (strcmp(argv[i - 1], "-m") == 0) {
+        if ((args->memSize = parse_mem_size(value)) == 0) {
+          fprintf(stderr, "bad memory size '%s'\n", value);
+          usage(argv[0]);
+        }
+      }
+      else {
+        char *p;
+        args->nThreads = strtol(value, &p, 0);
+        if (*p != '\0' || args->nThreads <= 0) {
+          fprintf(stderr, "bad number of threads '%s'\n", value);
+          usage(argv[0]);
+        }
+      }
+    }
     else if (argv[i][0] == '-' && !isdigit(argv[i][1])) {
       fprintf(stderr, "unknown option '%s'\n", argv[i]);
       usage(argv[0]);
@@ -117,25 +788,145 @@ first_pass_args(int argc, const char *argv[], Args *args)
       args->numFileNames++;
     }
   }
+  if (args->isExtended &&
+      (args->aotFileName != NULL || args->nCores > 0 ||
+       args->recordFileName != NULL || args->traceFileName != NULL)) {
+    fprintf(stderr, "-x cannot be specified with -a, -C, -g, -R or -t\n");
+    usage(argv[0]);
+  }
+  if ((args->inFileName != NULL || args->outFileName != NULL) &&
+      (args->aotFileName != NULL || args->batchFileName != NULL ||
+       args->nCores > 0)) {
+    fprintf(stderr, "-i and -w cannot be specified with -a, -b or -C\n");
+    usage(argv[0]);
+  }
+  if (args->reverseBudget > 0 &&
+      (args->aotFileName != NULL || args->batchFileName != NULL ||
+       args->nCores > 0 || args->nFuzzRuns > 0 ||
+       (args->recordFileName != NULL && !args->isReplay) ||
+       args->traceFileName != NULL || args->isProfile || args->isJit ||
+       args->isStep || args->verbosity != SILENT_VERBOSE ||
+       args->inFileName != NULL || args->outFileName != NULL)) {
+    fprintf(stderr, "-r cannot be specified with -a, -b, -C, -F, -i, -j, "
+            "-p, -R (without -g), -s, -t, -v, -V or -w\n");
+    usage(argv[0]);
+  }
+  if (args->isJit &&
+      (args->recordFileName != NULL || args->traceFileName != NULL ||
+       args->isStep || args->verbosity != SILENT_VERBOSE)) {
+    fprintf(stderr, "-j cannot be specified with -R, -s, -t, -v or -V\n");
+    usage(argv[0]);
+  }
+  if (args->isReplay) {
+    if (args->recordFileName == NULL) {
+      fprintf(stderr, "-g requires -R\n");
+      usage(argv[0]);
+    }
+    if (args->numFileNames > 0 || args->numParams > 0 ||
+        args->inFileName != NULL) {
+      fprintf(stderr, "files, INT_INPUTS and -i input come from the -R file "
+              "with -g\n");
+      usage(argv[0]);
+    }
+    return;
+  }
   if (args->numFileNames == 0) {
     fprintf(stderr, "no files specified\n");
     usage(argv[0]);
   }
+  if (args->batchFileName != NULL && args->numParams > 0) {
+    fprintf(stderr, "INT_INPUTS cannot be specified with -b\n");
+    usage(argv[0]);
+  }
+  if (args->batchFileName != NULL &&
+      (args->traceFileName != NULL || args->isStep ||
+       args->verbosity != SILENT_VERBOSE)) {
+    fprintf(stderr, "-b cannot be specified with -s, -t, -v or -V\n");
+    usage(argv[0]);
+  }
+  if (args->isProfile &&
+      (args->batchFileName != NULL || args->traceFileName != NULL ||
+       args->isJit || args->isStep || args->verbosity != SILENT_VERBOSE)) {
+    fprintf(stderr, "-p cannot be specified with -b, -j, -s, -t, -v or -V\n");
+    usage(argv[0]);
+  }
+  if (args->recordFileName != NULL &&
+      (args->batchFileName != NULL || args->traceFileName != NULL ||
+       args->isProfile || args->isStep ||
+       args->verbosity != SILENT_VERBOSE)) {
+    fprintf(stderr, "-R (without -g) cannot be specified with -b, -p, -s, "
+            "-t, -v or -V\n");
+    usage(argv[0]);
+  }
+  if ((args->numBreaks > 0 || args->numWatches > 0) &&
+      (args->batchFileName != NULL || args->traceFileName != NULL ||
+       args->recordFileName != NULL || args->isProfile || args->isJit ||
+       args->isStep || args->verbosity != SILENT_VERBOSE)) {
+    fprintf(stderr, "-B and -W only apply to runs without -b, -j, -p, -R, "
+            "-s, -t, -v or -V\n");
+    usage(argv[0]);
+  }
+  if (args->hasFuzzInput && args->nFuzzRuns == 0) {
+    fprintf(stderr, "-z requires -F\n");
+    usage(argv[0]);
+  }
+  if (args->nFuzzRuns > 0 &&
+      (args->aotFileName != NULL || args->batchFileName != NULL ||
+       args->nCores > 0 || args->recordFileName != NULL ||
+       args->traceFileName != NULL || args->isProfile || args->isJit ||
+       args->isStep || args->verbosity != SILENT_VERBOSE ||
+       args->numBreaks > 0 || args->numWatches > 0 ||
+       args->inFileName != NULL || args->outFileName != NULL)) {
+    fprintf(stderr, "-F cannot be specified with -a, -B, -b, -C, -i, -j, "
+            "-p, -R, -s, -t, -v, -V, -w or -W\n");
+    usage(argv[0]);
+  }
+  if (args->nFuzzRuns > 0 && !args->hasFuzzInput && args->numParams == 0) {
+    fprintf(stderr, "-F requires INT_INPUTS or -z\n");
+    usage(argv[0]);
+  }
+  if (args->hasOrder && args->nCores == 0) {
+    fprintf(stderr, "-O requires -C\n");
+    usage(argv[0]);
+  }
+  if (args->nCores > 0 &&
+      (args->batchFileName != NULL || args->traceFileName != NULL ||
+       args->recordFileName != NULL || args->isProfile || args->isJit ||
+       args->isStep || args->verbosity != SILENT_VERBOSE ||
+       args->numBreaks > 0 || args->numWatches > 0)) {
+    fprintf(stderr, "-C cannot be specified with -B, -b, -j, -p, -R, -s, "
+            "-t, -v, -V or -W\n");
+    usage(argv[0]);
+  }
 }
 
 static void
 second_pass_args(int argc, const char *argv[], Args *args)
 {
   args->numFileNames = args->numParams = 0;
+  args->numBreaks = args->numWatches = 0;
   for (int i = 1; i < argc; i++) {
     const char *arg = argv[i];
-    if (arg[0] == '-' && !isdigit(arg[1])) {
+    if (strcmp(arg, "-B") == 0) {
+      args->breakSpecs[args->numBreaks++] = argv[++i];
+    }
+    else if (strcmp(arg, "-W") == 0) {
+      args->watchSpecs[args->numWatches++] = argv[++i];
+    }
+    else if (is_option_with_value(arg)) {
+      i++;  //skip option value
+    }
+    else if (arg[0] == '-' && !isdigit(arg[1])) {
       continue;
     }
     else if (isdigit(arg[0]) || (arg[0] == '-' && isdigit(arg[1]))) {
       char *p;
+      args->paramSpecs[args->numParams] = arg;
       args->params[args->numParams++] = strtol(arg, &p, 0);
-      if (*p != '\0') {
+      if (is_sweep_spec(arg)) {
+        args->isSweep = true;   //checked by new_sweep_batch()
+      }
+      else if (*p != '\0') {
         fprintf(stderr, "bad parameter '%s'\n", arg);
         usage(argv[0]);
       }
@@ -144,6 +935,16 @@ second_pass_args(int argc, const char *argv[], Args *args)
       args->fileNames[args->numFileNames++] = arg;
     }
   }
+  if (args->isSweep &&
+      (args->traceFileName != NULL || args->recordFileName != NULL ||
+       args->isProfile || args->isStep || args->verbosity != SILENT_VERBOSE ||
+       args->numBreaks > 0 || args->numWatches > 0 || args->nCores > 0 ||
+       args->inFileName != NULL || args->outFileName != NULL ||
+       args->nFuzzRuns > 0 || args->reverseBudget > 0)) {
+    fprintf(stderr, "INT_INPUTS lists and ranges cannot be specified with "
+            "-B, -C, -F, -i, -p, -R, -r, -s, -t, -v, -V, -w or -W\n");
+    usage(argv[0]);
+  }
 }
 
 int
@@ -157,16 +958,49 @@ main(int argc, const char *argv[])
   first_pass_args(argc, argv, &args);
   const char *fileNames[args.numFileNames];
   Word params[args.numParams];
+  const char *paramSpecs[args.numParams + 1];
+  const char *breakSpecs[args.numBreaks + 1];
+  const char *watchSpecs[args.numWatches + 1];
   args.fileNames = fileNames; args.params = params;
+  args.paramSpecs = paramSpecs;
+  args.breakSpecs = breakSpecs; args.watchSpecs = watchSpecs;
   second_pass_args(argc, argv, &args);
-  if (args.isList) {
+  if (args.isReplay) {
+    simulate_replay(&args, stdout);
+  }
+  else if (args.isList) {
     yas_to_listing(stdout, args.numFileNames, args.fileNames);
   }
   else {
-    Y86 *y86 = new_y86_default();
-    if (yas_to_y86(y86, args.numFileNames, args.fileNames)) {
-      simulate(&args, y86, stdout);
+    Y86 *y86 = (args.memSize > 0) ? new_y86(args.memSize) : new_y86_default();
+    if (load_yobj(y86, args.numFileNames, args.fileNames, args.cacheDir)) {
+      if (args.objFileName != NULL) {
+        if (is_yobj(args.fileNames[0])) fatal("-o requires .ys files");
+        write_yobj(args.objFileName, y86, args.numFileNames, args.fileNames);
+      }
+      if (args.aotFileName != NULL) {
+        write_yaot(args.aotFileName, y86, args.numFileNames, args.fileNames);
+      }
+      if (args.isExtended) set_extensions_ysim(y86, true);
+      add_debug_points(&args, y86);
+      if (args.nFuzzRuns > 0) {
+        simulate_fuzz(&args, y86, stdout);
+      }
+      else if (args.batchFileName != NULL) {
+        simulate_batch(&args, y86, stdout);
+      }
+      else if (args.isSweep) {
+        simulate_sweep(&args, y86, stdout);
+      }
+      else {
+        YIO *yio = NULL;
+        if (args.inFileName != NULL || args.outFileName != NULL) {
+          yio = new_yio(y86, args.inFileName, args.outFileName);
+        }
+        simulate(&args, y86, yio, stdout);
+      }
     }
+    free_ysim(y86);
     free_y86(y86);
   }
 }
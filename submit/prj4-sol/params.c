@@ -0,0 +1,25 @@
+#include "params.h"
+
+#include "ysim.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+void
+setup_params(Y86 *y86, int numParams, const Word params[], FILE *out)
+{
+  Word argc = numParams;
+  if (argc > 0) {
+    Address top = get_memory_size_y86(y86);
+    Address argv = top - argc * sizeof(Word);
+    for (int i = 0; i < argc; i++) {
+      const Address argvi = argv + i * sizeof(Word);
+      if (out != NULL) fprintf(out, "argvi = %08lx\n", argvi);
+      write_memory_word_y86(y86, argvi, params[i]);
+      assert(read_status_y86(y86) == STATUS_AOK);
+      invalidate_ysim(y86, argvi, sizeof(Word));
+    }
+    write_register_y86(y86, REG_RDI, argc);
+    write_register_y86(y86, REG_RSI, argv);
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef _PARAMS_H
+#define _PARAMS_H
+
+#include "y86.h"
+
+#include <stdio.h>
+
+/** Set up numParams integer parameters params[] for the program in
+ *  y86: they are stored in an argv[] array at the top of memory, with
+ *  %rdi set to numParams and %rsi to the address of argv[].  The
+ *  address of each argv[] element is logged to out unless it is NULL.
+ */
+void setup_params(Y86 *y86, int numParams, const Word params[], FILE *out);
+
+#endif //ifndef _PARAMS_H
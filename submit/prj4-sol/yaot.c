@@ -0,0 +1,982 @@
+#include "yaot.h"
+
+#include "decode.h"
+#include "lazymem.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The C program consists of the memory image and initial state of
+ * the y86, RUNTIME_HEAD (the runner state, memory access and
+ * condition-code helpers and an interpreter), a function per basic
+ * block, run_blocks() to dispatch on the pc, and RUNTIME_MAIN, which
+ * loads the image, sets up the parameters, runs and dumps.
+ *
+ * The instructions translated are found by following every path from
+ * the starting pc, with call return sites as the only assumed targets
+ * of ret.  They are decoded exactly as the checked path of step_ysim()
+ * fetches them, so that a fault while fetching becomes an exit with
+ * the same status.  A store which overlaps translated code makes the
+ * runner interpret everything from then on.
+ */
+
+enum {
+  IMAGE_PAGE_SIZE = 4096,      /** granularity of the memory image */
+  MAX_BLOCK_INSTRS = 256,      /** longest block translated */
+};
+
+/** Flags for each address of memory. */
+enum {
+  IS_INSTR = 1,                /** an instruction was decoded here */
+  IS_LEADER = 2,               /** a block starts here */
+  IS_CODE = 4,                 /** byte is part of a decoded instruction */
+};
+
+static const char *const STATUS_NAMES[] = {
+  "", "STATUS_AOK", "STATUS_HLT", "STATUS_ADR", "STATUS_INS"
+};
+
+/** An instruction as fetched by the checked path of step_ysim(). */
+typedef struct {
+  Byte op;
+  Byte fn;
+  Byte regA;
+  Byte regB;
+  Word imm;
+  Size size;          /** # of bytes of encoding within memory */
+  Status fault;       /** STATUS_AOK unless fetching it faults */
+} Instr;
+
+typedef struct {
+  const Byte *mem;
+  Size memSize;
+  Byte *flags;        /** IS_ flags per address */
+  Address *leaders;   /** addresses of blocks */
+  Size nLeaders;
+  Size maxLeaders;
+  Address *queue;     /** leaders not yet walked */
+  Size nQueued;
+} Aot;
+
+/** Fill in *in with the instruction at pc in the memSize bytes at mem,
+ *  fetching its register byte and immediate as step_ysim() does.
+ */
+static void
+fetch_instr(const Byte mem[], Size memSize, Address pc, Instr *in)
+{
+  *in = (Instr){ .regA = REG_NONE, .regB = REG_NONE, .fault = STATUS_AOK };
+  in->op = get_nybble(mem[pc], 1);
+  in->fn = get_nybble(mem[pc], 0);
+  in->size = MAX_INSTR_SIZE;
+  Byte op = in->op;
+  bool hasRegs = op == CMOVxx_CODE || op == IRMOVQ_CODE ||
+    op == RMMOVQ_CODE || op == MRMOVQ_CODE || op == OP1_CODE ||
+    op == PUSHQ_CODE || op == POPQ_CODE;
+  bool hasImm = op == IRMOVQ_CODE || op == RMMOVQ_CODE ||
+    op == MRMOVQ_CODE || op == Jxx_CODE || op == CALL_CODE;
+  if ((op == CMOVxx_CODE || op == Jxx_CODE) && in->fn > GT_COND) {
+    in->fault = STATUS_INS;
+  }
+  else if (op > POPQ_CODE) {
+    in->fault = STATUS_INS;   //including casq and the extensions
+  }
+  else if (hasRegs && pc + 1 >= memSize) {
+    in->fault = STATUS_ADR;
+  }
+  else {
+    if (hasRegs) {
+      in->regA = get_nybble(mem[pc + 1], 1);
+      in->regB = get_nybble(mem[pc + 1], 0);
+    }
+    Address immAddr = pc + (hasRegs ? 2 : 1);
+    if (hasImm && (memSize < sizeof(Word) ||
+                   immAddr > memSize - sizeof(Word))) {
+      in->fault = STATUS_ADR;
+    }
+    else {
+      if (hasImm) in->imm = get_le_word(&mem[immAddr]);
+      in->size = (hasImm ? immAddr + sizeof(Word) : immAddr) - pc;
+    }
+  }
+  if (in->size > memSize - pc) in->size = memSize - pc;
+}
+
+/** Return true iff control can pass from in at pc to the following
+ *  instruction.
+ */
+static bool
+is_fall_through(const Instr *in)
+{
+  switch (in->op) {
+  case HALT_CODE: case CALL_CODE: case RET_CODE:
+    return false;
+  case Jxx_CODE:
+    return in->fn != ALWAYS_COND;
+  default:
+    return in->fault == STATUS_AOK;
+  }
+}
+
+/*************************** Finding Blocks ****************************/
+
+/** Make pc, if valid, the start of a block in aot. */
+static void
+add_leader(Aot *aot, Address pc)
+{
+  if (pc >= aot->memSize || (aot->flags[pc] & IS_LEADER)) return;
+  aot->flags[pc] |= IS_LEADER;
+  if (aot->nLeaders == aot->maxLeaders) {
+    aot->maxLeaders = (aot->maxLeaders == 0) ? 64 : 2 * aot->maxLeaders;
+    aot->leaders = reallocChk(aot->leaders, aot->maxLeaders * sizeof(Address));
+    aot->queue = reallocChk(aot->queue, aot->maxLeaders * sizeof(Address));
+  }
+  aot->leaders[aot->nLeaders++] = pc;
+  aot->queue[aot->nQueued++] = pc;
+}
+
+/** Decode the instructions from leader pc up to the end of its block,
+ *  adding the blocks it can reach to aot.
+ */
+static void
+walk_block(Aot *aot, Address pc)
+{
+  for (int n = 0; ; n++) {
+    if (n == MAX_BLOCK_INSTRS) {
+      add_leader(aot, pc);
+      return;
+    }
+    if (n > 0 && (aot->flags[pc] & (IS_INSTR | IS_LEADER))) {
+      add_leader(aot, pc);      //already walked: end block here
+      return;
+    }
+    Instr in;
+    fetch_instr(aot->mem, aot->memSize, pc, &in);
+    aot->flags[pc] |= IS_INSTR;
+    for (Size i = 0; i < in.size; i++) aot->flags[pc + i] |= IS_CODE;
+    if (in.fault != STATUS_AOK) return;
+    Address nextPC = pc + in.size;
+    if (in.op == Jxx_CODE) {
+      add_leader(aot, in.imm);
+      if (in.fn != ALWAYS_COND) add_leader(aot, nextPC);
+      return;
+    }
+    if (in.op == CALL_CODE) {
+      add_leader(aot, in.imm);
+      add_leader(aot, nextPC);  //return site
+      return;
+    }
+    if (!is_fall_through(&in) || nextPC >= aot->memSize) return;
+    pc = nextPC;
+  }
+}
+
+static int
+compare_addresses(const void *p1, const void *p2)
+{
+  Address a1 = *(const Address *)p1, a2 = *(const Address *)p2;
+  return (a1 > a2) - (a1 < a2);
+}
+
+/***************************** Runtime *********************************/
+
+/** The runner state, its memory access and condition-code helpers and
+ *  step(), which interprets the instruction at the pc as the checked
+ *  path of step_ysim() does.
+ */
+static const char RUNTIME_HEAD[] =
+  "typedef struct {\n"
+  "  Address addr;             /** address of stored word */\n"
+  "  Byte old[sizeof(Word)];   /** contents before store */\n"
+  "  Word value;               /** word stored */\n"
+  "} Store;\n"
+  "\n"
+  "typedef struct {\n"
+  "  Word regs[N_REG + 1];     /** regs[REG_NONE] reads as 0 */\n"
+  "  Address pc;\n"
+  "  Byte cc;\n"
+  "  Status status;\n"
+  "  Byte *mem;\n"
+  "  uint64_t *isCode;         /** bit per byte of translated code */\n"
+  "  bool isCodeChanged;       /** translated code may be stale */\n"
+  "  Store *stores;            /** every store, in order */\n"
+  "  Size nStores;\n"
+  "  Size maxStores;\n"
+  "} State;\n"
+  "\n"
+  "static inline bool\n"
+  "is_bit(const uint64_t bits[], Address addr)\n"
+  "{\n"
+  "  return (bits[addr / 64] >> (addr % 64)) & 1;\n"
+  "}\n"
+  "\n"
+  "static inline void\n"
+  "set_bit(uint64_t bits[], Address addr)\n"
+  "{\n"
+  "  bits[addr / 64] |= 1ULL << (addr % 64);\n"
+  "}\n"
+  "\n"
+  "static inline bool\n"
+  "in_bounds(Address addr)\n"
+  "{\n"
+  "  return MEM_SIZE >= sizeof(Word) && addr <= MEM_SIZE - sizeof(Word);\n"
+  "}\n"
+  "\n"
+  "static inline Word\n"
+  "load(const State *s, Address addr)\n"
+  "{\n"
+  "  Word w;\n"
+  "  memcpy(&w, &s->mem[addr], sizeof(Word));\n"
+  "#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__\n"
+  "  w = __builtin_bswap64(w);\n"
+  "#endif\n"
+  "  return w;\n"
+  "}\n"
+  "\n"
+  "/** Record the store of value to addr in s, noting whether it\n"
+  " *  overwrites translated code.\n"
+  " */\n"
+  "static void\n"
+  "note_store(State *s, Address addr, Word value)\n"
+  "{\n"
+  "  if (s->nStores == s->maxStores) {\n"
+  "    s->maxStores = (s->maxStores == 0) ? 1024 : 2 * s->maxStores;\n"
+  "    s->stores = realloc(s->stores, s->maxStores * sizeof(Store));\n"
+  "    if (s->stores == NULL) {\n"
+  "      fprintf(stderr, \"out of memory\\n\");\n"
+  "      exit(1);\n"
+  "    }\n"
+  "  }\n"
+  "  Store *store = &s->stores[s->nStores++];\n"
+  "  store->addr = addr;\n"
+  "  store->value = value;\n"
+  "  memcpy(store->old, &s->mem[addr], sizeof(Word));\n"
+  "  for (Size i = 0; i < sizeof(Word); i++) {\n"
+  "    if (is_bit(s->isCode, addr + i)) s->isCodeChanged = true;\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "static inline void\n"
+  "store(State *s, Address addr, Word value)\n"
+  "{\n"
+  "  note_store(s, addr, value);\n"
+  "#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__\n"
+  "  value = __builtin_bswap64(value);\n"
+  "#endif\n"
+  "  memcpy(&s->mem[addr], &value, sizeof(Word));\n"
+  "}\n"
+  "\n"
+  "static inline Byte\n"
+  "make_cc(bool of, bool sf, bool zf)\n"
+  "{\n"
+  "  return of << OF_CC | sf << SF_CC | zf << ZF_CC;\n"
+  "}\n"
+  "\n"
+  "/** Return the condition codes for result == a + b. */\n"
+  "static inline Byte\n"
+  "add_cc(Word a, Word b, Word result)\n"
+  "{\n"
+  "  return make_cc(((a ^ result) & (b ^ result)) >> 63, result >> 63,\n"
+  "                 result == 0);\n"
+  "}\n"
+  "\n"
+  "/** Return the condition codes for result == b - a. */\n"
+  "static inline Byte\n"
+  "sub_cc(Word a, Word b, Word result)\n"
+  "{\n"
+  "  return make_cc(((a ^ b) & (b ^ result)) >> 63, result >> 63,\n"
+  "                 result == 0);\n"
+  "}\n"
+  "\n"
+  "static inline Byte\n"
+  "logic_cc(Word result)\n"
+  "{\n"
+  "  return make_cc(false, result >> 63, result == 0);\n"
+  "}\n"
+  "\n"
+  "static inline bool\n"
+  "is_cond(Byte cc, int cond)\n"
+  "{\n"
+  "  bool of = (cc >> OF_CC) & 1, sf = (cc >> SF_CC) & 1;\n"
+  "  bool zf = (cc >> ZF_CC) & 1;\n"
+  "  switch (cond) {\n"
+  "  case 0: return true;\n"
+  "  case 1: return (sf ^ of) || zf;\n"
+  "  case 2: return sf ^ of;\n"
+  "  case 3: return zf;\n"
+  "  case 4: return !zf;\n"
+  "  case 5: return !(sf ^ of);\n"
+  "  case 6: return !(sf ^ of) && !zf;\n"
+  "  default: return false;\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "/** Set the pc of s to addr, or its status to STATUS_ADR if addr is\n"
+  " *  invalid.\n"
+  " */\n"
+  "static inline void\n"
+  "set_pc(State *s, Address addr)\n"
+  "{\n"
+  "  if (addr < MEM_SIZE) {\n"
+  "    s->pc = addr;\n"
+  "  }\n"
+  "  else {\n"
+  "    s->status = STATUS_ADR;\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "/** Execute the instruction at the pc of s directly from memory. */\n"
+  "static void\n"
+  "step(State *s)\n"
+  "{\n"
+  "  Word *regs = s->regs;\n"
+  "  Address pc = s->pc;\n"
+  "  if (pc >= MEM_SIZE) {\n"
+  "    s->status = STATUS_ADR;\n"
+  "    return;\n"
+  "  }\n"
+  "  Byte instr = s->mem[pc];\n"
+  "  int op = instr >> 4, fn = instr & 0xF;\n"
+  "  Byte rA = REG_NONE, rB = REG_NONE;\n"
+  "  Word imm = 0;\n"
+  "  if ((op == 0x2 || op == 0x7) && fn > 6) {\n"
+  "    s->status = STATUS_INS;\n"
+  "    return;\n"
+  "  }\n"
+  "  //fetch the register byte and immediate as each instruction would\n"
+  "  if (op == 0x2 || op == 0x3 || op == 0x4 || op == 0x5 || op == 0x6 ||\n"
+  "      op == 0xA || op == 0xB) {\n"
+  "    //a cmovxx here would fail to set its pc instead\n"
+  "    if (pc + 1 >= MEM_SIZE) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    rA = s->mem[pc + 1] >> 4;\n"
+  "    rB = s->mem[pc + 1] & 0xF;\n"
+  "  }\n"
+  "  if (op == 0x3 || op == 0x4 || op == 0x5 || op == 0x7 || op == 0x8) {\n"
+  "    Address immAddr = pc + ((op == 0x7 || op == 0x8) ? 1 : 2);\n"
+  "    if (!in_bounds(immAddr)) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    imm = load(s, immAddr);\n"
+  "  }\n"
+  "  switch (op) {\n"
+  "  case 0x0:\n"
+  "    s->status = STATUS_HLT;\n"
+  "    break;\n"
+  "  case 0x1:\n"
+  "    set_pc(s, pc + 1);\n"
+  "    break;\n"
+  "  case 0x2:\n"
+  "    set_pc(s, pc + 2);\n"
+  "    if (s->status == STATUS_AOK && is_cond(s->cc, fn)) {\n"
+  "      regs[rB] = regs[rA];\n"
+  "    }\n"
+  "    break;\n"
+  "  case 0x3:\n"
+  "    regs[rB] = imm;\n"
+  "    set_pc(s, pc + 10);\n"
+  "    break;\n"
+  "  case 0x4:\n"
+  "    if (!in_bounds(regs[rB] + imm)) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    store(s, regs[rB] + imm, regs[rA]);\n"
+  "    set_pc(s, pc + 10);\n"
+  "    break;\n"
+  "  case 0x5:\n"
+  "    if (!in_bounds(regs[rB] + imm)) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    regs[rA] = load(s, regs[rB] + imm);\n"
+  "    set_pc(s, pc + 10);\n"
+  "    break;\n"
+  "  case 0x6: {\n"
+  "    Word a = regs[rA], b = regs[rB];\n"
+  "    switch (fn) {\n"
+  "    case 0: regs[rB] = a + b; s->cc = add_cc(a, b, a + b); break;\n"
+  "    case 1: regs[rB] = b - a; s->cc = sub_cc(a, b, b - a); break;\n"
+  "    case 2: regs[rB] = a & b; s->cc = logic_cc(a & b); break;\n"
+  "    case 3: regs[rB] = a ^ b; s->cc = logic_cc(a ^ b); break;\n"
+  "    }\n"
+  "    set_pc(s, pc + 2);\n"
+  "    break;\n"
+  "  }\n"
+  "  case 0x7:\n"
+  "    set_pc(s, is_cond(s->cc, fn) ? imm : pc + 9);\n"
+  "    break;\n"
+  "  case 0x8:\n"
+  "    regs[REG_RSP] -= sizeof(Word);\n"
+  "    if (!in_bounds(regs[REG_RSP])) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    store(s, regs[REG_RSP], pc + 9);\n"
+  "    set_pc(s, imm);\n"
+  "    break;\n"
+  "  case 0x9: {\n"
+  "    if (!in_bounds(regs[REG_RSP])) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    Word retAddr = load(s, regs[REG_RSP]);\n"
+  "    regs[REG_RSP] += sizeof(Word);\n"
+  "    set_pc(s, retAddr);\n"
+  "    break;\n"
+  "  }\n"
+  "  case 0xA: {\n"
+  "    Word value = regs[rA];\n"
+  "    regs[REG_RSP] -= sizeof(Word);\n"
+  "    if (!in_bounds(regs[REG_RSP])) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    store(s, regs[REG_RSP], value);\n"
+  "    set_pc(s, pc + 2);\n"
+  "    break;\n"
+  "  }\n"
+  "  case 0xB: {\n"
+  "    if (!in_bounds(regs[REG_RSP])) {\n"
+  "      s->status = STATUS_ADR;\n"
+  "      return;\n"
+  "    }\n"
+  "    Word value = load(s, regs[REG_RSP]);\n"
+  "    regs[REG_RSP] += sizeof(Word);\n"
+  "    regs[rA] = value;\n"
+  "    set_pc(s, pc + 2);\n"
+  "    break;\n"
+  "  }\n"
+  "  default:\n"
+  "    s->status = STATUS_INS;\n"
+  "    break;\n"
+  "  }\n"
+  "  regs[REG_NONE] = 0;\n"
+  "}\n";
+
+/** write_state(), which hands the final state to liby86 for dumping,
+ *  and main(), which loads the image, sets up the parameters as
+ *  setup_params() does and runs it.
+ */
+static const char RUNTIME_MAIN[] =
+  "/** Make the final state in s the state of y86, repeating each store\n"
+  " *  through y86 so that dump_changes_y86() reports the same stores as\n"
+  " *  for the simulator.\n"
+  " */\n"
+  "static void\n"
+  "write_state(Y86 *y86, State *s)\n"
+  "{\n"
+  "  for (Size i = s->nStores; i > 0; i--) {\n"
+  "    memcpy(&s->mem[s->stores[i - 1].addr], s->stores[i - 1].old,\n"
+  "           sizeof(Word));\n"
+  "  }\n"
+  "  for (Size i = 0; i < s->nStores; i++) {\n"
+  "    write_memory_word_y86(y86, s->stores[i].addr, s->stores[i].value);\n"
+  "  }\n"
+  "  for (Register r = REG_RAX; r < N_REG; r++) {\n"
+  "    if (read_register_y86(y86, r) != s->regs[r]) {\n"
+  "      write_register_y86(y86, r, s->regs[r]);\n"
+  "    }\n"
+  "  }\n"
+  "  if (read_cc_y86(y86) != s->cc) write_cc_y86(y86, s->cc);\n"
+  "  if (read_pc_y86(y86) != s->pc) write_pc_y86(y86, s->pc);\n"
+  "  if (read_status_y86(y86) != s->status) {\n"
+  "    write_status_y86(y86, s->status);\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "int\n"
+  "main(int argc, const char *argv[])\n"
+  "{\n"
+  "  int numParams = argc - 1;\n"
+  "  Word params[numParams + 1];\n"
+  "  for (int i = 0; i < numParams; i++) {\n"
+  "    char *p;\n"
+  "    params[i] = strtol(argv[i + 1], &p, 0);\n"
+  "    if (p == argv[i + 1] || *p != '\\0') {\n"
+  "      fprintf(stderr, \"usage: %s INT_INPUTS...\\n\", argv[0]);\n"
+  "      return 1;\n"
+  "    }\n"
+  "  }\n"
+  "  Y86 *y86 = new_y86(MEM_SIZE);\n"
+  "  Byte *mem = get_memory_pointer_y86(y86, 0);\n"
+  "  for (Size i = 0; i < sizeof(PAGES) / sizeof(PAGES[0]); i++) {\n"
+  "    memcpy(&mem[PAGES[i].addr], PAGES[i].bytes, PAGES[i].size);\n"
+  "  }\n"
+  "  for (Register r = REG_RAX; r < N_REG; r++) {\n"
+  "    if (read_register_y86(y86, r) != START_REGS[r]) {\n"
+  "      write_register_y86(y86, r, START_REGS[r]);\n"
+  "    }\n"
+  "  }\n"
+  "  if (read_cc_y86(y86) != START_CC) write_cc_y86(y86, START_CC);\n"
+  "  if (read_pc_y86(y86) != START_PC) write_pc_y86(y86, START_PC);\n"
+  "  if (read_status_y86(y86) != START_STATUS) {\n"
+  "    write_status_y86(y86, START_STATUS);\n"
+  "  }\n"
+  "\n"
+  "  State s = { .mem = mem };\n"
+  "  Size nBitWords = MEM_SIZE / 64 + 1;\n"
+  "  s.isCode = calloc(nBitWords, sizeof(uint64_t));\n"
+  "  if (s.isCode == NULL) {\n"
+  "    fprintf(stderr, \"out of memory\\n\");\n"
+  "    return 1;\n"
+  "  }\n"
+  "  for (Size i = 0; i < sizeof(CODE) / sizeof(CODE[0]); i++) {\n"
+  "    Address end = CODE[i].addr + CODE[i].size;\n"
+  "    for (Address a = CODE[i].addr; a < end; a++) set_bit(s.isCode, a);\n"
+  "  }\n"
+  "\n"
+  "  //set up parameters as setup_params() does\n"
+  "  if (numParams > 0) {\n"
+  "    Address args = MEM_SIZE - numParams * sizeof(Word);\n"
+  "    for (int i = 0; i < numParams; i++) {\n"
+  "      Address argvi = args + i * sizeof(Word);\n"
+  "      printf(\"argvi = %08lx\\n\", (unsigned long)argvi);\n"
+  "      write_memory_word_y86(y86, argvi, params[i]);\n"
+  "      for (Size j = 0; j < sizeof(Word); j++) {\n"
+  "        if (is_bit(s.isCode, argvi + j)) s.isCodeChanged = true;\n"
+  "      }\n"
+  "    }\n"
+  "    write_register_y86(y86, REG_RDI, numParams);\n"
+  "    write_register_y86(y86, REG_RSI, args);\n"
+  "  }\n"
+  "\n"
+  "  for (Register r = REG_RAX; r < N_REG; r++) {\n"
+  "    s.regs[r] = read_register_y86(y86, r);\n"
+  "  }\n"
+  "  s.regs[REG_NONE] = 0;\n"
+  "  s.pc = read_pc_y86(y86);\n"
+  "  s.cc = read_cc_y86(y86);\n"
+  "  s.status = read_status_y86(y86);\n"
+  "  run_blocks(&s);\n"
+  "  write_state(y86, &s);\n"
+  "  dump_changes_y86(y86, true, stdout);\n"
+  "  free(s.stores);\n"
+  "  free(s.isCode);\n"
+  "  free_y86(y86);\n"
+  "  return 0;\n"
+  "}\n";
+
+/***************************** Emitting ********************************/
+
+/** The translation of a block, emitted to body while noting which
+ *  registers, condition codes and temporaries it uses.
+ */
+typedef struct {
+  FILE *body;
+  Address start;
+  unsigned usedRegs;     /** bit per register read or written */
+  unsigned setRegs;      /** bit per register written */
+  bool usesCC;
+  bool setsCC;
+  bool usesAddr;         /** uses temporary a */
+  bool usesX;            /** uses temporary x */
+  bool usesY;            /** uses temporary y */
+  bool hasStore;
+  bool isLoop;           /** jumps back to start */
+} Block;
+
+/** Return the C expression for reading register r in block b. */
+static const char *
+src(Block *b, Register r)
+{
+  if (r == REG_NONE) return "0";
+  b->usedRegs |= 1u << r;
+  return REG_NAMES[r];
+}
+
+/** Emit the assignment of expression expr to register r in block b,
+ *  indented by indent; nothing if r is REG_NONE.
+ */
+static void
+emit_set(Block *b, const char *indent, Register r, const char *expr)
+{
+  if (r == REG_NONE) return;
+  b->usedRegs |= 1u << r;
+  b->setRegs |= 1u << r;
+  fprintf(b->body, "%s%s = %s;\n", indent, REG_NAMES[r], expr);
+}
+
+/** Emit an exit from block b to pc, setting status unless it is
+ *  STATUS_AOK.  If isCond, the exit is the body of an if.
+ */
+static void
+emit_exit(Block *b, Status status, Address pc, bool isCond)
+{
+  const char *indent = isCond ? "    " : "  ";
+  if (isCond) fprintf(b->body, "{\n");
+  if (status != STATUS_AOK) {
+    fprintf(b->body, "%ss->status = %s;\n", indent, STATUS_NAMES[status]);
+  }
+  fprintf(b->body, "%snext = 0x%lx;\n%sgoto out;\n", indent, pc, indent);
+  if (isCond) fprintf(b->body, "  }\n");
+}
+
+/** Emit the check that the word at addr, which must be aligned if
+ *  isAligned, can be accessed by the instruction at pc in block b.
+ */
+static void
+emit_bounds(Block *b, Address pc, const char *addr, bool isAligned)
+{
+  fprintf(b->body, "  if (%s!in_bounds(%s)) ",
+          isAligned ? "a % sizeof(Word) != 0 || " : "", addr);
+  emit_exit(b, STATUS_ADR, pc, true);
+}
+
+/** Emit the transfer to nextPC after the instruction at pc in block b,
+ *  which fails if nextPC is not a valid address.  If isStore, the
+ *  instruction may have changed translated code.  Return true iff the
+ *  block continues with the instruction at nextPC.
+ */
+static bool
+emit_next(Aot *aot, Block *b, Address pc, Address nextPC, bool isStore)
+{
+  if (nextPC >= aot->memSize) {
+    emit_exit(b, STATUS_ADR, pc, false);
+    return false;
+  }
+  if (isStore) {
+    fprintf(b->body, "  if (s->isCodeChanged) ");
+    emit_exit(b, STATUS_AOK, nextPC, true);
+  }
+  if (aot->flags[nextPC] & IS_LEADER) {
+    emit_exit(b, STATUS_AOK, nextPC, false);
+    return false;
+  }
+  return true;
+}
+
+/** Emit the conditional jump in at pc, ending block b. */
+static void
+emit_jump(Aot *aot, Block *b, Address pc, const Instr *in)
+{
+  FILE *out = b->body;
+  bool isAlways = in->fn == ALWAYS_COND;
+  if (!isAlways) {
+    b->usesCC = true;
+    fprintf(out, "  if (is_cond(cc, %d)) ", in->fn);
+  }
+  if (in->imm >= aot->memSize) {
+    emit_exit(b, STATUS_ADR, pc, !isAlways);
+  }
+  else if (in->imm == b->start) {
+    //stay in the block function while the loop runs
+    b->isLoop = true;
+    if (!isAlways) fprintf(out, "{\n");
+    if (b->hasStore) {
+      fprintf(out, "  if (s->isCodeChanged) ");
+      emit_exit(b, STATUS_AOK, in->imm, true);
+    }
+    fprintf(out, "  goto top;\n");
+    if (!isAlways) fprintf(out, "  }\n");
+  }
+  else {
+    emit_exit(b, STATUS_AOK, in->imm, !isAlways);
+  }
+  if (!isAlways) {
+    Address nextPC = pc + in->size;
+    if (nextPC < aot->memSize) {
+      emit_exit(b, STATUS_AOK, nextPC, false);
+    }
+    else {
+      emit_exit(b, STATUS_ADR, pc, false);
+    }
+  }
+}
+
+/** Emit the C for the instruction in at pc in block b of aot, with the
+ *  semantics of the checked path of step_ysim().  Return true iff the
+ *  block continues with the following instruction.
+ */
+static bool
+emit_instr(Aot *aot, Block *b, Address pc, const Instr *in)
+{
+  static const char *const RESULTS[] = { "x + y", "y - x", "x & y", "x ^ y" };
+  static const char *const CCS[] = {
+    "add_cc(x, y, x + y)", "sub_cc(x, y, y - x)",
+    "logic_cc(x & y)", "logic_cc(x ^ y)"
+  };
+  FILE *out = b->body;
+  fprintf(out, "  /* %lx:", pc);
+  for (Size i = 0; i < in->size; i++) fprintf(out, " %02x", aot->mem[pc + i]);
+  fprintf(out, " */\n");
+  if (in->fault != STATUS_AOK) {
+    emit_exit(b, in->fault, pc, false);
+    return false;
+  }
+  Address nextPC = pc + in->size;
+  Register rA = in->regA, rB = in->regB;
+  char imm[32];
+  snprintf(imm, sizeof(imm), "0x%lxUL", in->imm);
+  switch (in->op) {
+  case HALT_CODE:
+    emit_exit(b, STATUS_HLT, pc, false);
+    return false;
+  case NOP_CODE:
+    return emit_next(aot, b, pc, nextPC, false);
+  case CMOVxx_CODE:
+    //the pc is set before the move
+    if (nextPC < aot->memSize && rB != REG_NONE) {
+      b->usesCC = true;
+      fprintf(out, "  if (is_cond(cc, %d))\n", in->fn);
+      emit_set(b, "    ", rB, src(b, rA));
+    }
+    return emit_next(aot, b, pc, nextPC, false);
+  case IRMOVQ_CODE:
+    emit_set(b, "  ", rB, imm);
+    return emit_next(aot, b, pc, nextPC, false);
+  case RMMOVQ_CODE:
+    b->usesAddr = b->hasStore = true;
+    fprintf(out, "  a = %s + %s;\n", src(b, rB), imm);
+    emit_bounds(b, pc, "a", false);
+    fprintf(out, "  store(s, a, %s);\n", src(b, rA));
+    return emit_next(aot, b, pc, nextPC, true);
+  case MRMOVQ_CODE:
+    b->usesAddr = true;
+    fprintf(out, "  a = %s + %s;\n", src(b, rB), imm);
+    emit_bounds(b, pc, "a", false);
+    emit_set(b, "  ", rA, "load(s, a)");
+    return emit_next(aot, b, pc, nextPC, false);
+  case OP1_CODE:
+    //other function codes do nothing
+    if (in->fn <= XORQ_FN) {
+      b->usesX = b->usesY = b->setsCC = true;
+      fprintf(out, "  x = %s;\n", src(b, rA));
+      fprintf(out, "  y = %s;\n", src(b, rB));
+      fprintf(out, "  cc = %s;\n", CCS[in->fn]);
+      emit_set(b, "  ", rB, RESULTS[in->fn]);
+    }
+    return emit_next(aot, b, pc, nextPC, false);
+  case Jxx_CODE:
+    emit_jump(aot, b, pc, in);
+    return false;
+  case CALL_CODE:
+    b->hasStore = true;
+    emit_set(b, "  ", REG_RSP, "rsp - 8");
+    emit_bounds(b, pc, "rsp", false);
+    fprintf(out, "  store(s, rsp, 0x%lxUL);\n", nextPC);
+    if (in->imm < aot->memSize) {
+      emit_exit(b, STATUS_AOK, in->imm, false);
+    }
+    else {
+      emit_exit(b, STATUS_ADR, pc, false);
+    }
+    return false;
+  case RET_CODE:
+    b->usesAddr = true;
+    emit_bounds(b, pc, src(b, REG_RSP), false);
+    fprintf(out, "  a = load(s, rsp);\n");
+    emit_set(b, "  ", REG_RSP, "rsp + 8");
+    fprintf(out, "  if (a >= MEM_SIZE) ");
+    emit_exit(b, STATUS_ADR, pc, true);
+    fprintf(out, "  next = a;\n  goto out;\n");
+    return false;
+  case PUSHQ_CODE:
+    b->usesX = b->hasStore = true;
+    fprintf(out, "  x = %s;\n", src(b, rA));
+    emit_set(b, "  ", REG_RSP, "rsp - 8");
+    emit_bounds(b, pc, "rsp", false);
+    fprintf(out, "  store(s, rsp, x);\n");
+    return emit_next(aot, b, pc, nextPC, true);
+  case POPQ_CODE:
+    b->usesX = true;
+    emit_bounds(b, pc, src(b, REG_RSP), false);
+    fprintf(out, "  x = load(s, rsp);\n");
+    emit_set(b, "  ", REG_RSP, "rsp + 8");
+    emit_set(b, "  ", rA, "x");
+    return emit_next(aot, b, pc, nextPC, false);
+  default:
+    emit_exit(b, STATUS_INS, pc, false);
+    return false;
+  }
+}
+
+/** Emit to out the function for the block of aot starting at start. */
+static void
+emit_block(Aot *aot, Address start, FILE *out)
+{
+  char *bodyText;
+  size_t bodySize;
+  Block b = { .start = start };
+  b.body = open_memstream(&bodyText, &bodySize);
+  if (b.body == NULL) fatal("cannot create block buffer:");
+  Address pc = start;
+  for (bool isMore = true; isMore; ) {
+    Instr in;
+    fetch_instr(aot->mem, aot->memSize, pc, &in);
+    isMore = emit_instr(aot, &b, pc, &in);
+    pc += in.size;
+  }
+  if (fclose(b.body) != 0) fatal("cannot write block buffer:");
+
+  fprintf(out, "\nstatic void\nb_%lx(State *s)\n{\n", start);
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (b.usedRegs & (1u << r)) {
+      fprintf(out, "  Word %s = s->regs[%d];\n", REG_NAMES[r], r);
+    }
+  }
+  if (b.usesCC || b.setsCC) fprintf(out, "  Byte cc = s->cc;\n");
+  if (b.usesAddr) fprintf(out, "  Address a;\n");
+  if (b.usesX) fprintf(out, "  Word x;\n");
+  if (b.usesY) fprintf(out, "  Word y;\n");
+  fprintf(out, "  Address next;\n");
+  if (b.isLoop) fprintf(out, " top:\n");
+  fputs(bodyText, out);
+  fprintf(out, " out:\n");
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (b.setRegs & (1u << r)) {
+      fprintf(out, "  s->regs[%d] = %s;\n", r, REG_NAMES[r]);
+    }
+  }
+  if (b.setsCC) fprintf(out, "  s->cc = cc;\n");
+  fprintf(out, "  s->pc = next;\n}\n");
+  free(bodyText);
+}
+
+/** Return # of bytes of the image page at page of aot up to its last
+ *  non-zero byte.
+ */
+static Size
+page_size(const Aot *aot, Address page)
+{
+  Size size = aot->memSize - page;
+  if (size > IMAGE_PAGE_SIZE) size = IMAGE_PAGE_SIZE;
+  while (size > 0 && aot->mem[page + size - 1] == 0) size--;
+  return size;
+}
+
+/** Emit to out the memory image of aot as PAGES[], the pages which are
+ *  not all zero, and the bytes of translated code as CODE[] ranges.
+ */
+static void
+emit_image(const Aot *aot, FILE *out)
+{
+  fprintf(out, "\ntypedef struct { Address addr; Size size; "
+          "const Byte *bytes; } Page;\n");
+  Size nPages = 0;
+  for (Address page = 0; page < aot->memSize; page += IMAGE_PAGE_SIZE) {
+    Size size = page_size(aot, page);
+    if (size == 0) continue;
+    fprintf(out, "\nstatic const Byte PAGE_%lx[] = {", page);
+    for (Size i = 0; i < size; i++) {
+      fprintf(out, "%s0x%02x,", (i % 12 == 0) ? "\n  " : " ",
+              aot->mem[page + i]);
+    }
+    fprintf(out, "\n};\n");
+    nPages++;
+  }
+  fprintf(out, "\nstatic const Page PAGES[] = {\n");
+  for (Address page = 0; page < aot->memSize; page += IMAGE_PAGE_SIZE) {
+    Size size = page_size(aot, page);
+    if (size == 0) continue;
+    fprintf(out, "  { 0x%lx, %lu, PAGE_%lx },\n", page, size, page);
+  }
+  if (nPages == 0) fprintf(out, "  { 0, 0, NULL },\n");
+  fprintf(out, "};\n");
+
+  fprintf(out, "\nstatic const struct { Address addr; Size size; } "
+          "CODE[] = {\n");
+  Size nRanges = 0;
+  for (Address a = 0; a < aot->memSize; ) {
+    if (!(aot->flags[a] & IS_CODE)) {
+      a++;
+      continue;
+    }
+    Address start = a;
+    while (a < aot->memSize && (aot->flags[a] & IS_CODE)) a++;
+    fprintf(out, "  { 0x%lx, %lu },\n", start, a - start);
+    nRanges++;
+  }
+  if (nRanges == 0) fprintf(out, "  { 0, 0 },\n");
+  fprintf(out, "};\n");
+}
+
+/** Emit to out the initial state of y86. */
+static void
+emit_state(Y86 *y86, Size memSize, FILE *out)
+{
+  fprintf(out, "\n#define MEM_SIZE ((Size)0x%lx)\n", memSize);
+  fprintf(out, "\nstatic const Word START_REGS[N_REG] = {\n");
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    fprintf(out, "  0x%lx,\n", read_register_y86(y86, r));
+  }
+  fprintf(out, "};\n");
+  fprintf(out, "static const Address START_PC = 0x%lx;\n",
+          read_pc_y86(y86));
+  fprintf(out, "static const Byte START_CC = 0x%x;\n", read_cc_y86(y86));
+  fprintf(out, "static const Status START_STATUS = %s;\n",
+          STATUS_NAMES[read_status_y86(y86)]);
+}
+
+/** Emit to out run_blocks(), which runs the block at each pc it has a
+ *  function for and interprets everything else.
+ */
+static void
+emit_dispatch(const Aot *aot, FILE *out)
+{
+  fprintf(out, "\nstatic void\nrun_blocks(State *s)\n{\n"
+          "  while (s->status == STATUS_AOK) {\n"
+          "    if (s->isCodeChanged) {\n"
+          "      step(s);\n"
+          "      continue;\n"
+          "    }\n"
+          "    switch (s->pc) {\n");
+  for (Size i = 0; i < aot->nLeaders; i++) {
+    Address pc = aot->leaders[i];
+    fprintf(out, "    case 0x%lx: b_%lx(s); break;\n", pc, pc);
+  }
+  fprintf(out, "    default: step(s); break;\n"
+          "    }\n"
+          "  }\n"
+          "}\n");
+}
+
+void
+write_yaot(const char *cFileName, Y86 *y86,
+           int numFiles, const char *yasFiles[])
+{
+  Aot aot = {
+    .mem = get_memory_pointer_y86(y86, 0),
+    .memSize = get_memory_size_y86(y86),
+  };
+  aot.flags = new_lazy_mem(aot.memSize);
+  Address startPC = read_pc_y86(y86);
+  if (read_status_y86(y86) == STATUS_AOK) add_leader(&aot, startPC);
+  while (aot.nQueued > 0) walk_block(&aot, aot.queue[--aot.nQueued]);
+  qsort(aot.leaders, aot.nLeaders, sizeof(Address), compare_addresses);
+
+  FILE *out = fopen(cFileName, "w");
+  if (out == NULL) fatal("cannot create %s:", cFileName);
+  fprintf(out, "/* Ahead-of-time translation of");
+  for (int i = 0; i < numFiles; i++) fprintf(out, " %s", yasFiles[i]);
+  fprintf(out, ".  Build with\n *\n"
+          " *   gcc -O2 -I $HOME/cs220/include %s \\\n"
+          " *     -L $HOME/cs220/lib -ly86 -lcs220 "
+          "-Wl,-rpath,$HOME/cs220/lib\n *\n"
+          " * and run with INT_INPUTS as arguments.\n */\n\n", cFileName);
+  fprintf(out, "#include \"y86.h\"\n\n"
+          "#include <stdbool.h>\n#include <stdint.h>\n"
+          "#include <stdio.h>\n#include <stdlib.h>\n"
+          "#include <string.h>\n");
+  emit_state(y86, aot.memSize, out);
+  emit_image(&aot, out);
+  fprintf(out, "\n%s", RUNTIME_HEAD);
+  for (Size i = 0; i < aot.nLeaders; i++) {
+    emit_block(&aot, aot.leaders[i], out);
+  }
+  emit_dispatch(&aot, out);
+  fprintf(out, "\n%s", RUNTIME_MAIN);
+  if (fclose(out) != 0) fatal("cannot write %s:", cFileName);
+
+  free(aot.queue);
+  free(aot.leaders);
+  free_lazy_mem(aot.flags, aot.memSize);
+}
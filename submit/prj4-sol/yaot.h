@@ -0,0 +1,28 @@
+#ifndef _YAOT_H
+#define _YAOT_H
+
+#include "y86.h"
+
+/** Write to cFileName a C program which runs the program loaded in
+ *  y86 ahead-of-time translated to C, for compiling into a standalone
+ *  runner with
+ *
+ *    gcc -O2 -I $HOME/cs220/include FILE.c -L $HOME/cs220/lib -ly86 -lcs220
+ *
+ *  The runner takes the program's INT_INPUTS as arguments and writes
+ *  what a silent run of y86-sim writes: the argv addresses, then the
+ *  final state as dumped by dump_changes_y86(), with the status of
+ *  step_ysim().  Memory changes are dumped once per word stored to,
+ *  in the order of the first store.
+ *
+ *  The code reachable from the pc of y86 is translated into one C
+ *  function per basic block, keeping y86 registers in locals and
+ *  memory in a bounds-checked byte array.  Anything else, including
+ *  all code once a store has changed translated code, is run by an
+ *  interpreter built into the runner.  numFiles yasFiles[] are named
+ *  in the header of the C file.
+ */
+void write_yaot(const char *cFileName, Y86 *y86,
+                int numFiles, const char *yasFiles[]);
+
+#endif //ifndef _YAOT_H
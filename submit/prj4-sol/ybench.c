@@ -0,0 +1,307 @@
+#include "y86.h"
+#include "yas.h"
+#include "yjit.h"
+#include "ysim.h"
+#include "yutil.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Time silent runs of y86 programs with each simulator engine and
+ *  report millions of instructions per second, optionally checking
+ *  them against a baseline recorded earlier.
+ */
+
+typedef enum { ENGINE_STEP, ENGINE_RUN, ENGINE_JIT, N_ENGINES } Engine;
+
+static const char *const ENGINE_NAMES[N_ENGINES] = { "step", "run", "jit" };
+
+enum {
+  DEFAULT_REPS = 5,
+  DEFAULT_TOLERANCE = 10,    /** % below baseline which is a regression */
+  MAX_BASELINE = 256,        /** max # of entries in a baseline file */
+};
+
+/** MIPS recorded for a program and engine. */
+typedef struct {
+  char program[64];
+  char engine[16];
+  double mips;
+} BaselineEntry;
+
+typedef struct {
+  int nEntries;
+  BaselineEntry entries[MAX_BASELINE];
+} Baseline;
+
+/** Run y86 to completion using engine, returning the number of
+ *  instructions executed.
+ */
+static uint64_t
+run_engine(Y86 *y86, Engine engine)
+{
+  uint64_t nSteps = 0;
+  switch (engine) {
+  case ENGINE_STEP:
+    while (read_status_y86(y86) == STATUS_AOK) {
+      step_ysim(y86);
+      nSteps++;
+    }
+    break;
+  case ENGINE_RUN:
+    while (read_status_y86(y86) == STATUS_AOK) {
+      nSteps += run_ysim(y86, UINT64_MAX);
+    }
+    break;
+  case ENGINE_JIT: {
+    //translation is part of the cost of running with the JIT
+    YJit *yjit = new_yjit(y86);
+    while (read_status_y86(y86) == STATUS_AOK) {
+      nSteps += run_yjit(yjit, UINT64_MAX);
+    }
+    free_yjit(yjit);
+    break;
+  }
+  default:
+    break;
+  }
+  return nSteps;
+}
+
+static int
+compare_doubles(const void *p1, const void *p2)
+{
+  double d1 = *(const double *)p1, d2 = *(const double *)p2;
+  return (d1 > d2) - (d1 < d2);
+}
+
+/** Return the base name of path. */
+static const char *
+base_name(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  return (slash == NULL) ? path : slash + 1;
+}
+
+/************************** Baseline Files *****************************/
+
+/** Read baseline entries "PROGRAM ENGINE MIPS" from fileName into
+ *  baseline, ignoring blank lines and lines starting with #.
+ */
+static void
+read_baseline(const char *fileName, Baseline *baseline)
+{
+  FILE *in = fopen(fileName, "r");
+  if (in == NULL) fatal("cannot read baseline %s:", fileName);
+  char line[256];
+  int lineN = 0;
+  baseline->nEntries = 0;
+  while (fgets(line, sizeof(line), in) != NULL) {
+    lineN++;
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    if (baseline->nEntries >= MAX_BASELINE) {
+      fatal("%s:%d: too many baseline entries", fileName, lineN);
+    }
+    BaselineEntry *e = &baseline->entries[baseline->nEntries];
+    if (sscanf(p, "%63s %15s %lf", e->program, e->engine, &e->mips) != 3) {
+      fatal("%s:%d: expected PROGRAM ENGINE MIPS", fileName, lineN);
+    }
+    baseline->nEntries++;
+  }
+  fclose(in);
+}
+
+/** Return the baseline MIPS for program run by engine; 0 if none. */
+static double
+baseline_mips(const Baseline *baseline, const char *program,
+              const char *engine)
+{
+  for (int i = 0; i < baseline->nEntries; i++) {
+    const BaselineEntry *e = &baseline->entries[i];
+    if (strcmp(e->program, program) == 0 && strcmp(e->engine, engine) == 0) {
+      return e->mips;
+    }
+  }
+  return 0;
+}
+
+/*************************** Benchmarking ******************************/
+
+typedef struct {
+  int nReps;
+  int tolerance;             /** % */
+  bool isEngine[N_ENGINES];  /** engines to benchmark */
+  const Baseline *baseline;  /** NULL if no baseline */
+  FILE *newBaseline;         /** NULL if not writing a baseline */
+} Options;
+
+/** Benchmark the program in yasFile with each engine selected by
+ *  options, writing a line of results per engine to out.  Return the
+ *  number of regressions from the baseline.
+ */
+static int
+bench_program(const char *yasFile, const Options *options, FILE *out)
+{
+  Y86 *y86 = new_y86_default();
+  if (!yas_to_y86(y86, 1, &yasFile)) fatal("cannot assemble %s", yasFile);
+  Snapshot *start = snapshot_y86(y86);
+  const char *program = base_name(yasFile);
+  int nRegressions = 0;
+  Word expected = 0;
+  uint64_t expectedSteps = 0;
+  bool isFirst = true;
+  for (Engine engine = 0; engine < N_ENGINES; engine++) {
+    if (!options->isEngine[engine]) continue;
+    double secs[options->nReps];
+    uint64_t nSteps = 0;
+    for (int i = 0; i < options->nReps; i++) {
+      restore_y86(y86, start);
+      double t0 = now();
+      nSteps = run_engine(y86, engine);
+      secs[i] = now() - t0;
+    }
+    //every engine must compute the same result in the same # of steps
+    Word rax = read_register_y86(y86, REG_RAX);
+    if (isFirst) {
+      expected = rax; expectedSteps = nSteps; isFirst = false;
+    }
+    else if (rax != expected || nSteps != expectedSteps) {
+      fatal("%s: %s gives %%rax %lx after %lu instructions; expected "
+            "%lx after %lu", program, ENGINE_NAMES[engine],
+            rax, (unsigned long)nSteps, expected, (unsigned long)expectedSteps);
+    }
+    qsort(secs, options->nReps, sizeof(double), compare_doubles);
+    double median = (options->nReps % 2 == 1)
+      ? secs[options->nReps / 2]
+      : (secs[options->nReps/2 - 1] + secs[options->nReps/2]) / 2;
+    double mips = nSteps / median / 1e6;
+    fprintf(out, "%-12s %-5s %12lu %9.4f %9.1f", program,
+            ENGINE_NAMES[engine], (unsigned long)nSteps, median, mips);
+    double base = (options->baseline == NULL) ? 0
+      : baseline_mips(options->baseline, program, ENGINE_NAMES[engine]);
+    if (base > 0) {
+      double change = (mips - base) / base * 100;
+      fprintf(out, " %9.1f %+7.1f%%", base, change);
+      if (change < -options->tolerance) {
+        fprintf(out, "  REGRESSION");
+        nRegressions++;
+      }
+    }
+    fprintf(out, "\n");
+    if (options->newBaseline != NULL) {
+      fprintf(options->newBaseline, "%s %s %.1f\n", program,
+              ENGINE_NAMES[engine], mips);
+    }
+  }
+  free_snapshot(start);
+  free_ysim(y86);
+  free_y86(y86);
+  return nRegressions;
+}
+
+/************************* Parse Command Line **************************/
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-b BASELINE] [-e ENGINES] [-n N_REPS] [-t PERCENT] "
+          "[-w BASELINE] YAS_FILE...\n", prog);
+  fprintf(stderr,
+          "          -b:  compare with MIPS in BASELINE and fail if any is "
+          "more than\n"
+          "               PERCENT (default %d) lower\n"
+          "          -e:  comma-separated engines from step, run, jit "
+          "(default: all)\n"
+          "          -n:  time N_REPS runs of each program and report the "
+          "median\n"
+          "               (default %d)\n"
+          "          -w:  write the measured MIPS to BASELINE\n",
+          DEFAULT_TOLERANCE, DEFAULT_REPS);
+  exit(1);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  Options options = {
+    .nReps = DEFAULT_REPS,
+    .tolerance = DEFAULT_TOLERANCE,
+    .isEngine = { true, true, true },
+  };
+  const char *baselineFileName = NULL;
+  const char *newBaselineFileName = NULL;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    if (i + 1 >= argc) usage(argv[0]);
+    const char *value = argv[++i];
+    char *p;
+    if (strcmp(argv[i - 1], "-b") == 0) {
+      baselineFileName = value;
+    }
+    else if (strcmp(argv[i - 1], "-w") == 0) {
+      newBaselineFileName = value;
+    }
+    else if (strcmp(argv[i - 1], "-e") == 0) {
+      if (!parse_engines(value, N_ENGINES, ENGINE_NAMES,
+                         options.isEngine)) {
+        fprintf(stderr, "bad engines '%s'\n", value);
+        usage(argv[0]);
+      }
+    }
+    else if (strcmp(argv[i - 1], "-n") == 0) {
+      options.nReps = strtol(value, &p, 0);
+      if (*p != '\0' || options.nReps <= 0) usage(argv[0]);
+    }
+    else if (strcmp(argv[i - 1], "-t") == 0) {
+      options.tolerance = strtol(value, &p, 0);
+      if (*p != '\0' || options.tolerance < 0) usage(argv[0]);
+    }
+    else {
+      fprintf(stderr, "unknown option '%s'\n", argv[i - 1]);
+      usage(argv[0]);
+    }
+  }
+  if (i == argc) usage(argv[0]);
+
+  Baseline *baseline = NULL;
+  if (baselineFileName != NULL) {
+    baseline = mallocChk(sizeof(Baseline));
+    read_baseline(baselineFileName, baseline);
+    options.baseline = baseline;
+  }
+  if (newBaselineFileName != NULL) {
+    options.newBaseline = fopen(newBaselineFileName, "w");
+    if (options.newBaseline == NULL) {
+      fatal("cannot write baseline %s:", newBaselineFileName);
+    }
+    fprintf(options.newBaseline,
+            "# PROGRAM ENGINE MIPS: median MIPS of %d runs; MIPS depend on\n"
+            "# the host and compiler flags, so compare only runs made by\n"
+            "# the same build on the same machine\n", options.nReps);
+  }
+  printf("%-12s %-5s %12s %9s %9s", "program", "mode", "instructions",
+         "median-s", "MIPS");
+  if (baseline != NULL) printf(" %9s %8s", "baseline", "change");
+  printf("\n");
+  int nRegressions = 0;
+  for (; i < argc; i++) {
+    nRegressions += bench_program(argv[i], &options, stdout);
+  }
+  if (options.newBaseline != NULL && fclose(options.newBaseline) != 0) {
+    fatal("cannot write baseline %s:", newBaselineFileName);
+  }
+  free(baseline);
+  if (nRegressions > 0) {
+    printf("%d regression%s of more than %d%%\n", nRegressions,
+           (nRegressions == 1) ? "" : "s", options.tolerance);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,526 @@
+#include "ycfg.h"
+
+#include "decode.h"
+#include "lazymem.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The analysis is an abstract interpretation over the instructions
+ * reachable from the starting pc.  The value of each register before
+ * an instruction is approximated by a range of unsigned words, joined
+ * over all the ways of reaching the instruction.  Conditions are not
+ * tracked, so both ways out of a jXX are followed and a cmovXX may or
+ * may not move.  Memory is not tracked either: anything loaded may be
+ * any value, except that a ret is assumed to return just after one of
+ * the analyzed calls.  An access which does not fault narrows the
+ * range of the register holding its address.  Ranges which keep
+ * growing around a loop are widened to their extremes so that the
+ * analysis terminates.
+ */
+
+enum {
+  MAX_NODES = 1 << 16,   /** max # of instructions analyzed */
+  WIDEN_VISITS = 4,      /** # of changes to the ranges of a jump target
+                          *  after which they are widened */
+};
+
+/** Register values lo ... hi, where lo <= hi. */
+typedef struct {
+  Word lo, hi;
+} Range;
+
+static const Range ANY = { 0, UINT64_MAX };
+
+/** An instruction reached by the analysis. */
+typedef struct {
+  Decoded d;
+  bool isDecoded;        /** false if left to the checked simulator path */
+  bool hasRegs;          /** false until control is known to reach it */
+  bool isQueued;         /** true while waiting to be visited */
+  bool isReturnSite;     /** true if it follows an analyzed call */
+  bool isTarget;         /** true if reached other than by falling
+                          *  through, as every loop must be */
+  Byte facts;            /** CFG_ facts */
+  unsigned nChanges;     /** # of times regs[] has grown */
+  Range regs[N_REG];     /** values of registers before the instruction */
+} Node;
+
+struct YCfgStruct {
+  const Byte *mem;
+  Size memSize;
+  Node *nodes;           /** the nNodes instructions analyzed */
+  Size nNodes;
+  Size maxNodes;         /** # of entries allocated in nodes[] and queue[] */
+  uint32_t *nodeIndex;   /** 1 + index in nodes[] for each address, or 0 */
+  uint64_t *isCode;      /** bit set for each byte of analyzed code */
+  Address codeLo;        /** first byte of analyzed code */
+  Address codeEnd;       /** just after last byte of analyzed code */
+  uint32_t *queue;       /** the nQueued nodes waiting to be visited */
+  Size nQueued;
+  Address *returnSites;  /** the nReturnSites pcs following calls */
+  Size nReturnSites;
+  bool hasRet;           /** true once some ret has been reached */
+  Range retRegs[N_REG];  /** values of registers after any ret */
+  bool isTooLarge;       /** true if MAX_NODES was exceeded */
+};
+
+static inline Size
+code_bitmap_size(Size memSize)
+{
+  return (memSize / 64 + 1) * sizeof(uint64_t);
+}
+
+/****************************** Ranges *********************************/
+
+static inline Range
+const_range(Word value)
+{
+  return (Range){ value, value };
+}
+
+/** Return the smallest range containing both r1 and r2. */
+static inline Range
+union_ranges(Range r1, Range r2)
+{
+  return (Range){ (r1.lo < r2.lo) ? r1.lo : r2.lo,
+                  (r1.hi > r2.hi) ? r1.hi : r2.hi };
+}
+
+/** Return the range of a + b for all a in ra and b in rb, with
+ *  wrap-around.  The sums form a single range only if they all wrap
+ *  or none do.
+ */
+static Range
+add_ranges(Range ra, Range rb)
+{
+  Range sum = { ra.lo + rb.lo, ra.hi + rb.hi };
+  bool isLoWrapped = sum.lo < ra.lo, isHiWrapped = sum.hi < ra.hi;
+  return (isLoWrapped == isHiWrapped) ? sum : ANY;
+}
+
+/** Return the range of b - a for all a in ra and b in rb, with
+ *  wrap-around.
+ */
+static Range
+sub_ranges(Range rb, Range ra)
+{
+  Range diff = { rb.lo - ra.hi, rb.hi - ra.lo };
+  bool isLoWrapped = rb.lo < ra.hi, isHiWrapped = rb.hi < ra.lo;
+  return (isLoWrapped == isHiWrapped) ? diff : ANY;
+}
+
+/** Return value with all bits below its most-significant 1 set. */
+static Word
+fill_low_bits(Word value)
+{
+  for (unsigned shift = 1; shift < sizeof(Word) * BYTE_BITS; shift *= 2) {
+    value |= value >> shift;
+  }
+  return value;
+}
+
+/** Return the range of the result of OPq function fn on values in ra
+ *  and rb; isSameReg is true if both operands are the same register.
+ */
+static Range
+op_ranges(Byte fn, Range ra, Range rb, bool isSameReg)
+{
+  bool isConst = ra.lo == ra.hi && rb.lo == rb.hi;
+  switch (fn) {
+  case ADDQ_FN:
+    return add_ranges(ra, rb);
+  case SUBQ_FN:
+    return isSameReg ? const_range(0) : sub_ranges(rb, ra);
+  case ANDQ_FN:
+    if (isConst) return const_range(ra.lo & rb.lo);
+    return (Range){ 0, (ra.hi < rb.hi) ? ra.hi : rb.hi };
+  case XORQ_FN:
+    if (isSameReg) return const_range(0);
+    if (isConst) return const_range(ra.lo ^ rb.lo);
+    return (Range){ 0, fill_low_bits(ra.hi | rb.hi) };
+  default:
+    return ANY;
+  }
+}
+
+/** Return true iff the word at every address in addr lies within
+ *  memory of memSize.
+ */
+static inline bool
+is_in_bounds(Range addr, Size memSize)
+{
+  return memSize >= sizeof(Word) && addr.hi <= memSize - sizeof(Word);
+}
+
+/** Restrict *base to the values for which the word at *base + disp
+ *  lies within memory of memSize, as it must after a successful
+ *  access.  Return false if there are no such values.
+ */
+static bool
+restrict_base(Range *base, Word disp, Size memSize)
+{
+  if (memSize < sizeof(Word)) return false;
+  Range addr = add_ranges(*base, const_range(disp));
+  if (addr.lo > memSize - sizeof(Word)) return false;
+  if (addr.hi > memSize - sizeof(Word)) addr.hi = memSize - sizeof(Word);
+  Range bases = sub_ranges(addr, const_range(disp));
+  if (bases.lo == ANY.lo && bases.hi == ANY.hi) return true;  //wraps around
+  if (bases.lo > base->lo) base->lo = bases.lo;
+  if (bases.hi < base->hi) base->hi = bases.hi;
+  return base->lo <= base->hi;
+}
+
+/** Join ranges from[] into to[].  If isWiden, a lower bound which
+ *  shrinks is widened to 0 and an upper bound which grows is widened
+ *  to the last word address of memory of memSize, or failing that to
+ *  the largest word, so that pointers which step through memory can
+ *  still be proved in bounds.  Return true iff to[] changed.
+ */
+static bool
+join_regs(Range to[], const Range from[], bool isWiden, Size memSize)
+{
+  Word limit = (memSize < sizeof(Word)) ? 0 : memSize - sizeof(Word);
+  bool isChanged = false;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (from[r].lo < to[r].lo) {
+      to[r].lo = isWiden ? ANY.lo : from[r].lo;
+      isChanged = true;
+    }
+    if (from[r].hi > to[r].hi) {
+      to[r].hi = !isWiden ? from[r].hi
+        : (from[r].hi <= limit) ? limit : ANY.hi;
+      isChanged = true;
+    }
+  }
+  return isChanged;
+}
+
+/*************************** Building the CFG **************************/
+
+/** Record memory bytes [addr, addr + size) as analyzed code. */
+static void
+mark_code(YCfg *cfg, Address addr, Size size)
+{
+  if (size == 0) return;
+  for (Address a = addr; a < addr + size; a++) {
+    cfg->isCode[a / 64] |= 1ULL << (a % 64);
+  }
+  if (addr < cfg->codeLo) cfg->codeLo = addr;
+  if (addr + size > cfg->codeEnd) cfg->codeEnd = addr + size;
+}
+
+/** Return the index of the node for the instruction at pc in cfg,
+ *  decoding it if it has not been reached before.  Return -1 if there
+ *  are too many nodes.
+ */
+static long
+get_node(YCfg *cfg, Address pc)
+{
+  if (cfg->nodeIndex[pc] != 0) return cfg->nodeIndex[pc] - 1;
+  if (cfg->nNodes == MAX_NODES) {
+    cfg->isTooLarge = true;
+    return -1;
+  }
+  if (cfg->nNodes == cfg->maxNodes) {
+    cfg->maxNodes = (cfg->maxNodes == 0) ? 64 : 2 * cfg->maxNodes;
+    cfg->nodes = reallocChk(cfg->nodes, cfg->maxNodes * sizeof(Node));
+    cfg->queue = reallocChk(cfg->queue, cfg->maxNodes * sizeof(uint32_t));
+  }
+  Node *node = &cfg->nodes[cfg->nNodes];
+  *node = (Node){ .isDecoded = false };
+  node->isDecoded = decode_instr(cfg->mem, cfg->memSize, pc, &node->d);
+  //bytes which do not decode now could be changed into an instruction
+  Size size = node->isDecoded ? node->d.size : MAX_INSTR_SIZE;
+  if (cfg->memSize - pc < size) size = cfg->memSize - pc;
+  mark_code(cfg, pc, size);
+  cfg->nodeIndex[pc] = ++cfg->nNodes;
+  return cfg->nNodes - 1;
+}
+
+/** Note that control can reach pc in cfg with registers in regs[],
+ *  by a jump, call or ret if isJump.  Only ranges at jump targets are
+ *  widened, which is enough to make every loop terminate.
+ */
+static void
+flow(YCfg *cfg, Address pc, const Range regs[], bool isJump)
+{
+  if (pc >= cfg->memSize) return;    //faults
+  long i = get_node(cfg, pc);
+  if (i < 0) return;
+  Node *node = &cfg->nodes[i];
+  node->isTarget |= isJump;
+  if (node->hasRegs) {
+    bool isWiden = node->isTarget && node->nChanges >= WIDEN_VISITS;
+    if (!join_regs(node->regs, regs, isWiden, cfg->memSize)) return;
+    node->nChanges++;
+  }
+  else {
+    for (Register r = REG_RAX; r < N_REG; r++) node->regs[r] = regs[r];
+    node->hasRegs = true;
+  }
+  if (!node->isQueued) {
+    node->isQueued = true;
+    cfg->queue[cfg->nQueued++] = i;
+  }
+}
+
+/** Note that pc follows a call in cfg, so any ret can reach it. */
+static void
+add_return_site(YCfg *cfg, Address pc)
+{
+  long i = get_node(cfg, pc);
+  if (i < 0) return;
+  if (!cfg->nodes[i].isReturnSite) {
+    cfg->nodes[i].isReturnSite = true;
+    cfg->returnSites =
+      reallocChk(cfg->returnSites, (cfg->nReturnSites + 1) * sizeof(Address));
+    cfg->returnSites[cfg->nReturnSites++] = pc;
+  }
+  if (cfg->hasRet) flow(cfg, pc, cfg->retRegs, true);
+}
+
+/** Note that some ret leaves registers in regs[], which can therefore
+ *  reach every return site in cfg.
+ */
+static void
+flow_ret(YCfg *cfg, const Range regs[])
+{
+  if (cfg->hasRet) {
+    if (!join_regs(cfg->retRegs, regs, false, cfg->memSize)) return;
+  }
+  else {
+    for (Register r = REG_RAX; r < N_REG; r++) cfg->retRegs[r] = regs[r];
+    cfg->hasRet = true;
+  }
+  for (Size j = 0; j < cfg->nReturnSites; j++) {
+    flow(cfg, cfg->returnSites[j], cfg->retRegs, true);
+  }
+}
+
+/** Propagate the registers before node i of cfg to its successors. */
+static void
+visit(YCfg *cfg, long i)
+{
+  const Node *node = &cfg->nodes[i];
+  if (!node->isDecoded) return;
+  //flow() may move nodes[]
+  const Decoded d = node->d;
+  Range regs[N_REG];
+  for (Register r = REG_RAX; r < N_REG; r++) regs[r] = node->regs[r];
+  Range *rsp = &regs[REG_RSP];
+  switch (d.op) {
+  case HALT_CODE:
+    break;
+  case NOP_CODE:
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case CMOVxx_CODE:
+    regs[d.regB] = (d.fn == ALWAYS_COND)
+      ? regs[d.regA] : union_ranges(regs[d.regA], regs[d.regB]);
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case IRMOVQ_CODE:
+    regs[d.regB] = const_range(d.imm);
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case RMMOVQ_CODE:
+    if (!restrict_base(&regs[d.regB], d.imm, cfg->memSize)) break;
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case MRMOVQ_CODE:
+    if (!restrict_base(&regs[d.regB], d.imm, cfg->memSize)) break;
+    regs[d.regA] = ANY;
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case CASQ_CODE:
+    if (!restrict_base(&regs[d.regB], d.imm, cfg->memSize)) break;
+    regs[REG_RAX] = ANY;
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case OP1_CODE:
+    regs[d.regB] = op_ranges(d.fn, regs[d.regA], regs[d.regB],
+                             d.regA == d.regB);
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  //extensions fault if not enabled, so flowing past them is merely
+  //imprecise
+  case IOPQ_CODE:
+    regs[d.regB] = op_ranges(d.fn, const_range(d.imm), regs[d.regB], false);
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case BLOCK_CODE:
+    regs[d.regA] = regs[d.regB] = ANY;
+    regs[REG_RCX] = const_range(0);
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  //ysim drops the analysis if a trap reads input over analyzed code
+  case TRAP_CODE:
+    regs[REG_RAX] = ANY;
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case Jxx_CODE:
+    if (d.fn != ALWAYS_COND) flow(cfg, d.nextPC, regs, false);
+    flow(cfg, d.imm, regs, true);
+    break;
+  case CALL_CODE:
+    if (!restrict_base(rsp, -sizeof(Word), cfg->memSize)) break;
+    *rsp = sub_ranges(*rsp, const_range(sizeof(Word)));
+    flow(cfg, d.imm, regs, true);
+    add_return_site(cfg, d.nextPC);
+    break;
+  case RET_CODE:
+    if (!restrict_base(rsp, 0, cfg->memSize)) break;
+    *rsp = add_ranges(*rsp, const_range(sizeof(Word)));
+    flow_ret(cfg, regs);
+    break;
+  case PUSHQ_CODE:
+    if (!restrict_base(rsp, -sizeof(Word), cfg->memSize)) break;
+    *rsp = sub_ranges(*rsp, const_range(sizeof(Word)));
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  case POPQ_CODE:
+    if (!restrict_base(rsp, 0, cfg->memSize)) break;
+    *rsp = add_ranges(*rsp, const_range(sizeof(Word)));
+    regs[d.regA] = ANY;
+    flow(cfg, d.nextPC, regs, false);
+    break;
+  default:
+    break;
+  }
+}
+
+/** Set the facts of each node of cfg from its registers. */
+static void
+prove_facts(YCfg *cfg)
+{
+  for (Size i = 0; i < cfg->nNodes; i++) {
+    Node *node = &cfg->nodes[i];
+    if (!node->isDecoded || !node->hasRegs) continue;
+    const Decoded *d = &node->d;
+    Range rsp = node->regs[REG_RSP];
+    Range addr;
+    bool isStore = false;
+    switch (d->op) {
+    case RMMOVQ_CODE:
+      isStore = true;
+      /* fall through */
+    case MRMOVQ_CODE:
+      addr = add_ranges(node->regs[d->regB], const_range(d->imm));
+      break;
+    case PUSHQ_CODE: case CALL_CODE:
+      isStore = true;
+      addr = sub_ranges(rsp, const_range(sizeof(Word)));
+      break;
+    case POPQ_CODE: case RET_CODE:
+      addr = rsp;
+      break;
+    default:
+      continue;
+    }
+    if (!is_in_bounds(addr, cfg->memSize)) continue;
+    node->facts |= CFG_IN_BOUNDS;
+    if (isStore &&
+        !is_code_ycfg(cfg, addr.lo, addr.hi - addr.lo + sizeof(Word))) {
+      node->facts |= CFG_NOT_CODE;
+    }
+  }
+}
+
+YCfg *
+new_ycfg(const Byte mem[], Size memSize, Address pc, const Word regs[])
+{
+  YCfg *cfg = callocChk(1, sizeof(YCfg));
+  cfg->mem = mem;
+  cfg->memSize = memSize;
+  cfg->nodeIndex = new_lazy_mem(memSize * sizeof(uint32_t));
+  cfg->isCode = new_lazy_mem(code_bitmap_size(memSize));
+  cfg->codeLo = memSize;
+  cfg->codeEnd = 0;
+  Range entry[N_REG];
+  for (Register r = REG_RAX; r < N_REG; r++) entry[r] = const_range(regs[r]);
+  flow(cfg, pc, entry, false);
+  while (cfg->nQueued > 0 && !cfg->isTooLarge) {
+    long i = cfg->queue[--cfg->nQueued];
+    cfg->nodes[i].isQueued = false;
+    visit(cfg, i);
+  }
+  if (cfg->isTooLarge) {
+    free_ycfg(cfg);
+    return NULL;
+  }
+  prove_facts(cfg);
+  return cfg;
+}
+
+void
+free_ycfg(YCfg *cfg)
+{
+  free_lazy_mem(cfg->nodeIndex, cfg->memSize * sizeof(uint32_t));
+  free_lazy_mem(cfg->isCode, code_bitmap_size(cfg->memSize));
+  free(cfg->nodes);
+  free(cfg->queue);
+  free(cfg->returnSites);
+  free(cfg);
+}
+
+/*************************** Using the Analysis ************************/
+
+/** Return the node for the instruction at pc in cfg; NULL if none. */
+static const Node *
+find_node(const YCfg *cfg, Address pc)
+{
+  if (pc >= cfg->memSize || cfg->nodeIndex[pc] == 0) return NULL;
+  return &cfg->nodes[cfg->nodeIndex[pc] - 1];
+}
+
+bool
+is_covered_ycfg(const YCfg *cfg, Address pc, const Word regs[])
+{
+  const Node *node = find_node(cfg, pc);
+  if (node == NULL || !node->hasRegs) return false;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (regs[r] < node->regs[r].lo || regs[r] > node->regs[r].hi) return false;
+  }
+  return true;
+}
+
+bool
+is_return_site_ycfg(const YCfg *cfg, Address pc)
+{
+  const Node *node = find_node(cfg, pc);
+  return node != NULL && node->isReturnSite;
+}
+
+bool
+is_code_ycfg(const YCfg *cfg, Address addr, Size size)
+{
+  if (addr >= cfg->codeEnd || size == 0) return false;
+  Address lo = (addr < cfg->codeLo) ? cfg->codeLo : addr;
+  Address end = (cfg->codeEnd - addr < size) ? cfg->codeEnd : addr + size;
+  for (Address a = lo; a < end; a++) {
+    if (a % 64 == 0 && cfg->isCode[a / 64] == 0) {
+      a += 63;            //skip a word of the bitmap without code
+      continue;
+    }
+    if (cfg->isCode[a / 64] & (1ULL << (a % 64))) return true;
+  }
+  return false;
+}
+
+Size
+get_code_ycfg(const YCfg *cfg, Address *addr)
+{
+  *addr = cfg->codeLo;
+  return (cfg->codeEnd > cfg->codeLo) ? cfg->codeEnd - cfg->codeLo : 0;
+}
+
+unsigned
+get_facts_ycfg(const YCfg *cfg, Address pc)
+{
+  const Node *node = find_node(cfg, pc);
+  return (node == NULL) ? 0 : node->facts;
+}
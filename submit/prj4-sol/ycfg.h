@@ -0,0 +1,59 @@
+#ifndef _YCFG_H
+#define _YCFG_H
+
+#include "y86.h"
+
+#include <stdbool.h>
+
+/** An opaque static analysis of the y86 code reachable from some
+ *  starting state: its control-flow graph, following jXX and call
+ *  targets, together with a range of possible values for each
+ *  register before each instruction.
+ */
+typedef struct YCfgStruct YCfg;
+
+/** Facts proved about the memory access of an analyzed instruction. */
+enum {
+  CFG_IN_BOUNDS = 1,  /** the word accessed always lies within memory */
+  CFG_NOT_CODE = 2,   /** a store never overlaps an analyzed instruction */
+};
+
+/** Analyze the code in the memSize bytes of memory at mem which can
+ *  be reached by starting at pc with registers regs[].  Return NULL if
+ *  the program is too large to analyze.
+ *
+ *  Return addresses are assumed to be those pushed by analyzed calls,
+ *  and memory holding analyzed instructions is assumed not to change;
+ *  the analysis is valid only for as long as is_covered_ycfg() holds
+ *  after anything which breaks those assumptions.
+ */
+YCfg *new_ycfg(const Byte mem[], Size memSize, Address pc, const Word regs[]);
+
+/** Free all resources allocated by new_ycfg(). */
+void free_ycfg(YCfg *cfg);
+
+/** Return true iff cfg covers a state with the given pc and registers:
+ *  the analyzed instruction at pc assumes registers which include
+ *  regs[].  The facts of cfg hold for any run from such a state.
+ */
+bool is_covered_ycfg(const YCfg *cfg, Address pc, const Word regs[]);
+
+/** Return true iff pc follows a call analyzed in cfg. */
+bool is_return_site_ycfg(const YCfg *cfg, Address pc);
+
+/** Return true iff any of memory bytes [addr, addr + size) belongs
+ *  to an instruction analyzed in cfg.
+ */
+bool is_code_ycfg(const YCfg *cfg, Address addr, Size size);
+
+/** Return the number of bytes from the first byte of analyzed code in
+ *  cfg to just after the last, setting *addr to the first.
+ */
+Size get_code_ycfg(const YCfg *cfg, Address *addr);
+
+/** Return the CFG_ facts proved for the instruction at pc in cfg; 0 if
+ *  it was not analyzed.
+ */
+unsigned get_facts_ycfg(const YCfg *cfg, Address pc);
+
+#endif //ifndef _YCFG_H
@@ -0,0 +1,559 @@
+#include "ycores.h"
+
+#include "decode.h"
+#include "lazymem.h"
+#include "yops.h"
+#include "ysim.h"
+#include "yutil.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each core runs its own interpreter directly on the memory of the
+ * y86, since the y86 itself holds only one set of registers and is
+ * not thread-safe.  Its semantics are those of the checked path of
+ * step_ysim(), except that data words are loaded and stored with
+ * host atomics so that cores see each other's stores as the memory
+ * order requires.  Instructions are decoded once into a table shared
+ * by the cores and invalidated by stores over them: code must not be
+ * changed while another core may be running it.
+ *
+ * Stores made by the cores are not seen by the y86 until the run is
+ * over, when every changed word is written again through the y86 so
+ * that it shows up in dump_changes_y86().  To find them, the core which
+ * first stores to an aligned word during a run saves its value.
+ */
+
+enum {
+  WORD_SHIFT = 3,           /** log2 of bytes per word bitmap bit */
+};
+
+static const char *const ORDER_NAMES[] = { "sc", "relaxed" };
+
+/** An aligned word and its memory bytes before a run. */
+typedef struct {
+  Address addr;
+  Word bytes;
+} SavedWord;
+
+typedef struct {
+  YCores *ycores;
+  Word regs[N_REG + 1];     /** regs[REG_NONE] reads as 0 */
+  Address pc;
+  Byte cc;
+  Status status;
+  uint64_t nSteps;          /** # of instructions executed */
+  SavedWord *saved;         /** the nSaved words first stored by core */
+  Size nSaved;
+  Size maxSaved;
+} Core;
+
+struct YCoresStruct {
+  Y86 *y86;
+  Byte *mem;                /** memory of y86, shared by all cores */
+  Size memSize;
+  Decoded *decoded;         /** one entry per memory address */
+  uint64_t *isCodeWord;     /** bit set for each aligned word containing
+                             *  decoded bytes */
+  MemoryOrder order;
+  uint64_t *isStoredWord;   /** bit set for each aligned word stored
+                             *  during the current run */
+  int nCores;
+  Core *cores;
+  double seconds;           /** wall time of last run_ycores() */
+};
+
+/** Return # of bytes in a bitmap of the words of memory of memSize. */
+static inline Size
+word_bitmap_size(Size memSize)
+{
+  return ((memSize >> WORD_SHIFT) / 64 + 1) * sizeof(uint64_t);
+}
+
+YCores *
+new_ycores(Y86 *y86, int nCores, MemoryOrder order)
+{
+  YCores *ycores = mallocChk(sizeof(YCores));
+  ycores->y86 = y86;
+  ycores->mem = get_memory_pointer_y86(y86, 0);
+  ycores->memSize = get_memory_size_y86(y86);
+  ycores->decoded = new_lazy_mem(ycores->memSize * sizeof(Decoded));
+  ycores->isCodeWord = new_lazy_mem(word_bitmap_size(ycores->memSize));
+  ycores->order = order;
+  ycores->isStoredWord = new_lazy_mem(word_bitmap_size(ycores->memSize));
+  ycores->nCores = nCores;
+  ycores->cores = callocChk(nCores, sizeof(Core));
+  ycores->seconds = 0;
+  for (int k = 0; k < nCores; k++) {
+    Core *core = &ycores->cores[k];
+    core->ycores = ycores;
+    for (Register r = REG_RAX; r < N_REG; r++) {
+      core->regs[r] = read_register_y86(y86, r);
+    }
+    core->regs[REG_NONE] = 0;
+    core->regs[REG_RDX] = k;
+    core->regs[REG_RCX] = nCores;
+    core->pc = read_pc_y86(y86);
+    core->cc = read_cc_y86(y86);
+    core->status = read_status_y86(y86);
+  }
+  return ycores;
+}
+
+void
+free_ycores(YCores *ycores)
+{
+  for (int k = 0; k < ycores->nCores; k++) free(ycores->cores[k].saved);
+  free_lazy_mem(ycores->decoded, ycores->memSize * sizeof(Decoded));
+  free_lazy_mem(ycores->isCodeWord, word_bitmap_size(ycores->memSize));
+  free_lazy_mem(ycores->isStoredWord, word_bitmap_size(ycores->memSize));
+  free(ycores->cores);
+  free(ycores);
+}
+
+/*************************** Memory Access *****************************/
+
+/** Return w, a little-endian word loaded from y86 memory, in host
+ *  byte order, or vice versa.
+ */
+static inline Word
+swap_le(Word w)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return w;
+#else
+  return __builtin_bswap64(w);
+#endif
+}
+
+/** Return true iff a word access at addr lies within memSize bytes. */
+static inline bool
+is_word_in_bounds(Size memSize, Address addr)
+{
+  return memSize >= sizeof(Word) && addr <= memSize - sizeof(Word);
+}
+
+/** Set *value to the word at addr for core.  Return false, setting
+ *  its status, on an access error.  An unaligned word is loaded a
+ *  byte at a time and may be torn by a concurrent store.
+ */
+static bool
+load_word(Core *core, Address addr, Word *value)
+{
+  const YCores *ycores = core->ycores;
+  if (!is_word_in_bounds(ycores->memSize, addr)) {
+    core->status = STATUS_ADR;
+    return false;
+  }
+  Byte *p = &ycores->mem[addr];
+  bool isSC = ycores->order == ORDER_SC;
+  if (addr % sizeof(Word) == 0) {
+    Word w = isSC ? __atomic_load_n((Word *)p, __ATOMIC_SEQ_CST)
+                  : __atomic_load_n((Word *)p, __ATOMIC_RELAXED);
+    *value = swap_le(w);
+  }
+  else {
+    Byte bytes[sizeof(Word)];
+    for (Size i = 0; i < sizeof(Word); i++) {
+      bytes[i] = isSC ? __atomic_load_n(&p[i], __ATOMIC_SEQ_CST)
+                      : __atomic_load_n(&p[i], __ATOMIC_RELAXED);
+    }
+    *value = get_le_word(bytes);
+  }
+  return true;
+}
+
+/** Return true iff bit w of bitmap, one bit per aligned word, is set. */
+static inline bool
+is_word_set(const uint64_t bitmap[], Address w)
+{
+  return (__atomic_load_n(&bitmap[w / 64], __ATOMIC_RELAXED) >> (w % 64)) & 1;
+}
+
+/** Invalidate any decoded instructions of ycores overlapping the word
+ *  just stored at addr.
+ */
+static inline void
+invalidate_decoded(YCores *ycores, Address addr)
+{
+  Address first = addr >> WORD_SHIFT;
+  Address last = (addr + sizeof(Word) - 1) >> WORD_SHIFT;
+  if (!is_word_set(ycores->isCodeWord, first) &&
+      !is_word_set(ycores->isCodeWord, last)) {
+    return;
+  }
+  Address lo = (addr < MAX_INSTR_SIZE - 1) ? 0 : addr - (MAX_INSTR_SIZE - 1);
+  for (Address a = lo; a < addr + sizeof(Word); a++) {
+    __atomic_store_n(&ycores->decoded[a].isValid, false, __ATOMIC_RELAXED);
+  }
+}
+
+/** Save the bytes of the aligned word w << WORD_SHIFT for core unless
+ *  another core has already stored to it during this run.
+ */
+static void
+save_word(Core *core, Address w)
+{
+  YCores *ycores = core->ycores;
+  //read the word before claiming it: since every core claims a word
+  //before storing to it, a successful claim means it is unchanged
+  Address addr = w << WORD_SHIFT;
+  Size size = ycores->memSize - addr;
+  Byte bytes[sizeof(Word)] = { 0 };
+  for (Size i = 0; i < sizeof(Word) && i < size; i++) {
+    bytes[i] = __atomic_load_n(&ycores->mem[addr + i], __ATOMIC_RELAXED);
+  }
+  uint64_t bit = 1ULL << (w % 64);
+  if (__atomic_fetch_or(&ycores->isStoredWord[w / 64], bit, __ATOMIC_SEQ_CST)
+      & bit) {
+    return;
+  }
+  if (core->nSaved == core->maxSaved) {
+    core->maxSaved = core->maxSaved ? 2 * core->maxSaved : 64;
+    core->saved = reallocChk(core->saved, core->maxSaved * sizeof(SavedWord));
+  }
+  SavedWord *saved = &core->saved[core->nSaved++];
+  saved->addr = addr;
+  memcpy(&saved->bytes, bytes, sizeof(bytes));
+}
+
+/** Save each aligned word overlapping the word at addr as save_word(). */
+static inline void
+save_words(Core *core, Address addr)
+{
+  Address first = addr >> WORD_SHIFT;
+  Address last = (addr + sizeof(Word) - 1) >> WORD_SHIFT;
+  const uint64_t *isStoredWord = core->ycores->isStoredWord;
+  if (!is_word_set(isStoredWord, first)) save_word(core, first);
+  if (last != first && !is_word_set(isStoredWord, last)) {
+    save_word(core, last);
+  }
+}
+
+/** Store value at addr for core.  Return false, setting its status,
+ *  on an access error.
+ */
+static bool
+store_word(Core *core, Address addr, Word value)
+{
+  YCores *ycores = core->ycores;
+  if (!is_word_in_bounds(ycores->memSize, addr)) {
+    core->status = STATUS_ADR;
+    return false;
+  }
+  save_words(core, addr);
+  Byte *p = &ycores->mem[addr];
+  bool isSC = ycores->order == ORDER_SC;
+  if (addr % sizeof(Word) == 0) {
+    if (isSC) __atomic_store_n((Word *)p, swap_le(value), __ATOMIC_SEQ_CST);
+    else __atomic_store_n((Word *)p, swap_le(value), __ATOMIC_RELAXED);
+  }
+  else {
+    for (Size i = 0; i < sizeof(Word); i++) {
+      Byte b = value >> (i * BYTE_BITS);
+      if (isSC) __atomic_store_n(&p[i], b, __ATOMIC_SEQ_CST);
+      else __atomic_store_n(&p[i], b, __ATOMIC_RELAXED);
+    }
+  }
+  invalidate_decoded(ycores, addr);
+  return true;
+}
+
+/** Compare the aligned word at addr with *expected for core and
+ *  replace it with value if they are equal; otherwise set *expected
+ *  to the word.  Return false, setting its status, on an access error.
+ */
+static bool
+cas_word(Core *core, Address addr, Word *expected, Word value)
+{
+  YCores *ycores = core->ycores;
+  if (addr % sizeof(Word) != 0 ||
+      !is_word_in_bounds(ycores->memSize, addr)) {
+    core->status = STATUS_ADR;
+    return false;
+  }
+  save_words(core, addr);
+  Word old = swap_le(*expected);
+  __atomic_compare_exchange_n((Word *)&ycores->mem[addr], &old,
+                              swap_le(value), false,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  *expected = swap_le(old);
+  invalidate_decoded(ycores, addr);
+  return true;
+}
+
+/** Set the pc of core to addr.  Return false, setting its status, if
+ *  addr is invalid.
+ */
+static inline bool
+set_pc(Core *core, Address addr)
+{
+  if (addr >= core->ycores->memSize) {
+    core->status = STATUS_ADR;
+    return false;
+  }
+  core->pc = addr;
+  return true;
+}
+
+/**************************** Execution ********************************/
+
+/** Return the instruction at the pc of core, decoding it if necessary,
+ *  or NULL, setting the status of core, if it cannot be run.
+ */
+static const Decoded *
+get_decoded(Core *core)
+{
+  YCores *ycores = core->ycores;
+  Address pc = core->pc;
+  Decoded *d = &ycores->decoded[pc];
+  if (pc < ycores->memSize && __atomic_load_n(&d->isValid, __ATOMIC_ACQUIRE)) {
+    return d;
+  }
+  Decoded decoded;
+  Status status = decode_checked_instr(ycores->mem, ycores->memSize, pc,
+                                       &decoded);
+  //cores run neither the extensions nor traps
+  if (status == STATUS_AOK &&
+      (decoded.op == IOPQ_CODE || decoded.op == BLOCK_CODE ||
+       decoded.op == TRAP_CODE)) {
+    status = STATUS_INS;
+  }
+  if (status != STATUS_AOK) {
+    core->status = status;
+    return NULL;
+  }
+  Address last = decoded.nextPC - 1;
+  for (Address w = pc >> WORD_SHIFT; w <= last >> WORD_SHIFT; w++) {
+    if (!is_word_set(ycores->isCodeWord, w)) {
+      __atomic_fetch_or(&ycores->isCodeWord[w / 64], 1ULL << (w % 64),
+                        __ATOMIC_SEQ_CST);
+    }
+  }
+  //cores decoding the same instruction at once fill in the same entry
+  decoded.isValid = false;
+  *d = decoded;
+  __atomic_store_n(&d->isValid, true, __ATOMIC_RELEASE);
+  return d;
+}
+
+/** Execute the next instruction of core, with the semantics of the
+ *  checked path of step_ysim().
+ */
+static void
+step_core(Core *core)
+{
+  Word *regs = core->regs;
+  const Decoded *decoded = get_decoded(core);
+  if (decoded == NULL) return;
+  const Decoded d = *decoded;
+  Address nextPC = d.nextPC;
+  LazyCC cc = { .kind = CC_STORED };
+  switch (d.op) {
+  case HALT_CODE:
+    core->status = STATUS_HLT;
+    return;
+  case NOP_CODE:
+    if (d.fn == FENCE_FN) __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    break;
+  case CMOVxx_CODE:
+    if (is_cond(core->cc, d.fn)) regs[d.regB] = regs[d.regA];
+    break;
+  case IRMOVQ_CODE:
+    regs[d.regB] = d.imm;
+    break;
+  case RMMOVQ_CODE:
+    if (!store_word(core, regs[d.regB] + d.imm, regs[d.regA])) return;
+    break;
+  case MRMOVQ_CODE: {
+    Word value;
+    if (!load_word(core, regs[d.regB] + d.imm, &value)) return;
+    regs[d.regA] = value;
+    break;
+  }
+  case OP1_CODE:
+    //other functions do nothing, as in the base ISA
+    if (d.fn <= XORQ_FN) {
+      op_words(&cc, d.fn, regs[d.regA], regs[d.regB], &regs[d.regB]);
+    }
+    break;
+  case Jxx_CODE:
+    if (is_cond(core->cc, d.fn)) nextPC = d.imm;
+    break;
+  case CALL_CODE:
+    regs[REG_RSP] -= sizeof(Word);
+    if (!store_word(core, regs[REG_RSP], d.nextPC)) return;
+    nextPC = d.imm;
+    break;
+  case RET_CODE: {
+    Word retAddr;
+    if (!load_word(core, regs[REG_RSP], &retAddr)) return;
+    regs[REG_RSP] += sizeof(Word);
+    nextPC = retAddr;
+    break;
+  }
+  case PUSHQ_CODE: {
+    Word value = regs[d.regA];
+    regs[REG_RSP] -= sizeof(Word);
+    if (!store_word(core, regs[REG_RSP], value)) return;
+    break;
+  }
+  case POPQ_CODE: {
+    Word value;
+    if (!load_word(core, regs[REG_RSP], &value)) return;
+    regs[REG_RSP] += sizeof(Word);
+    regs[d.regA] = value;
+    break;
+  }
+  case CASQ_CODE: {
+    Word expected = regs[REG_RAX], old = expected;
+    if (!cas_word(core, regs[d.regB] + d.imm, &old, regs[d.regA])) return;
+    regs[REG_RAX] = old;
+    set_sub_arith_cc(&cc, old, expected, expected - old);
+    break;
+  }
+  default:
+    break;
+  }
+  if (cc.kind != CC_STORED) core->cc = eval_cc(&cc);
+  regs[REG_NONE] = 0;
+  set_pc(core, nextPC);
+}
+
+/** Thread function: run core until it stops. */
+static void *
+do_core(void *arg)
+{
+  Core *core = arg;
+  while (core->status == STATUS_AOK) {
+    step_core(core);
+    core->nSteps++;
+  }
+  return NULL;
+}
+
+/** Return <0, 0 or >0 as saved word a is below, at or above b. */
+static int
+compare_saved(const void *a, const void *b)
+{
+  Address addrA = ((const SavedWord *)a)->addr;
+  Address addrB = ((const SavedWord *)b)->addr;
+  return (addrA > addrB) - (addrA < addrB);
+}
+
+/** Write every word saved by the cores of ycores which has changed
+ *  through its y86 in order of address, restoring its saved value
+ *  first so that the write is recorded as a change.  Forget the saved
+ *  words.
+ */
+static void
+write_changes(YCores *ycores)
+{
+  Y86 *y86 = ycores->y86;
+  Byte *mem = ycores->mem;
+  Size memSize = ycores->memSize;
+  Size nSaved = 0;
+  for (int k = 0; k < ycores->nCores; k++) nSaved += ycores->cores[k].nSaved;
+  if (nSaved == 0) return;
+  SavedWord *saved = mallocChk(nSaved * sizeof(SavedWord));
+  nSaved = 0;
+  for (int k = 0; k < ycores->nCores; k++) {
+    Core *core = &ycores->cores[k];
+    if (core->nSaved == 0) continue;
+    memcpy(&saved[nSaved], core->saved, core->nSaved * sizeof(SavedWord));
+    nSaved += core->nSaved;
+    core->nSaved = 0;
+  }
+  qsort(saved, nSaved, sizeof(SavedWord), compare_saved);
+  for (Size i = 0; i < nSaved; i++) {
+    Address addr = saved[i].addr;
+    Address w = addr >> WORD_SHIFT;
+    ycores->isStoredWord[w / 64] &= ~(1ULL << (w % 64));
+    const Byte *initial = (const Byte *)&saved[i].bytes;
+    Size size = (memSize - addr < sizeof(Word)) ? memSize - addr
+                                                : sizeof(Word);
+    if (memcmp(&mem[addr], initial, size) == 0) continue;
+    if (size == sizeof(Word)) {
+      Word value = get_le_word(&mem[addr]);
+      memcpy(&mem[addr], initial, size);
+      write_memory_word_y86(y86, addr, value);
+    }
+    else {
+      for (Size j = 0; j < size; j++) {
+        Byte b = mem[addr + j];
+        mem[addr + j] = initial[j];
+        write_memory_byte_y86(y86, addr + j, b);
+      }
+    }
+    invalidate_ysim(y86, addr, size);
+  }
+  free(saved);
+}
+
+/** Make the state of core the state of its y86. */
+static void
+write_core(Core *core)
+{
+  Y86 *y86 = core->ycores->y86;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (read_register_y86(y86, r) != core->regs[r]) {
+      write_register_y86(y86, r, core->regs[r]);
+    }
+  }
+  if (read_cc_y86(y86) != core->cc) write_cc_y86(y86, core->cc);
+  if (read_pc_y86(y86) != core->pc) write_pc_y86(y86, core->pc);
+  if (read_status_y86(y86) != core->status) {
+    write_status_y86(y86, core->status);
+  }
+}
+
+uint64_t
+run_ycores(YCores *ycores)
+{
+  int nCores = ycores->nCores;
+  double t0 = now();
+  pthread_t threads[nCores];
+  for (int k = 1; k < nCores; k++) {
+    if (pthread_create(&threads[k], NULL, do_core, &ycores->cores[k])) {
+      fatal("cannot create thread:");
+    }
+  }
+  do_core(&ycores->cores[0]);     //main thread is core 0
+  for (int k = 1; k < nCores; k++) pthread_join(threads[k], NULL);
+  ycores->seconds = now() - t0;
+  write_changes(ycores);
+  write_core(&ycores->cores[0]);
+  uint64_t nSteps = 0;
+  for (int k = 0; k < nCores; k++) nSteps += ycores->cores[k].nSteps;
+  return nSteps;
+}
+
+void
+dump_ycores(const YCores *ycores, FILE *out)
+{
+  uint64_t nSteps = 0;
+  for (int k = 0; k < ycores->nCores; k++) nSteps += ycores->cores[k].nSteps;
+  double mips = (ycores->seconds > 0) ? nSteps / ycores->seconds / 1e6 : 0;
+  fprintf(out, "%d cores (%s): %lu instructions in %.3fs, %.1f MIPS\n",
+          ycores->nCores, ORDER_NAMES[ycores->order], (unsigned long)nSteps,
+          ycores->seconds, mips);
+  for (int k = 1; k < ycores->nCores; k++) {
+    const Core *core = &ycores->cores[k];
+    fprintf(out, "core %d: %lu instructions\n", k,
+            (unsigned long)core->nSteps);
+    for (Register r = REG_RAX; r < N_REG; r++) {
+      fprintf(out, "%s: %lx\n", REG_NAMES[r], core->regs[r]);
+    }
+    fprintf(out, "cc: %x\n", core->cc);
+    fprintf(out, "status: %x\n", core->status);
+  }
+  fprintf(out, "core 0: %lu instructions\n",
+          (unsigned long)ycores->cores[0].nSteps);
+}
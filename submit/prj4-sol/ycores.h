@@ -0,0 +1,61 @@
+#ifndef _YCORES_H
+#define _YCORES_H
+
+#include "y86.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** An opaque structure which runs the program in a y86 on several
+ *  cores sharing its memory, each core a host thread with its own
+ *  registers, pc, condition codes and status.
+ *
+ *  Besides the usual instructions, cores run
+ *
+ *    casq rA, D(rB)   (D0 rA:rB D): if the aligned word M at D(rB)
+ *                     equals %rax, atomically set M to rA; otherwise
+ *                     set %rax to M.  Sets cc as cmpq M, %rax.
+ *    fence            (11): complete all earlier memory accesses
+ *                     before any later one.
+ *
+ *  A fence is a nop elsewhere, and ysim runs casq only as one of the
+ *  extension instructions enabled by set_extensions_ysim().
+ */
+typedef struct YCoresStruct YCores;
+
+/** How the memory accesses of a core are ordered as seen by other
+ *  cores.  casq and fence are always sequentially consistent and
+ *  aligned words are never torn; under ORDER_RELAXED, other loads and
+ *  stores may be reordered with each other by the host.
+ */
+typedef enum { ORDER_SC, ORDER_RELAXED } MemoryOrder;
+
+enum { MAX_CORES = 1024 };
+
+/** Create nCores (at most MAX_CORES) cores which will run the
+ *  program in y86 from its current state, except that each core k
+ *  starts with %rdx = k and %rcx = nCores.  Cores share every other
+ *  register value, including %rsp, so a program must set up a stack
+ *  for each core before using it.
+ */
+YCores *new_ycores(Y86 *y86, int nCores, MemoryOrder order);
+
+/** Free all resources allocated by new_ycores(). */
+void free_ycores(YCores *ycores);
+
+/** Run each core of ycores on its own thread until every core has
+ *  stopped.  Then make the final state of core 0 and of memory the
+ *  state of its y86, recording them as changes for dump_changes_y86():
+ *  memory changes are recorded in order of address, one per changed
+ *  word, and stores which left a word unchanged are not recorded.
+ *  Return the total number of instructions executed.
+ */
+uint64_t run_ycores(YCores *ycores);
+
+/** Write to out the number of instructions each core of ycores
+ *  executed, the final state of the registers of each core but core 0,
+ *  whose state is that of its y86, and the wall time of the run.
+ */
+void dump_ycores(const YCores *ycores, FILE *out);
+
+#endif //ifndef _YCORES_H
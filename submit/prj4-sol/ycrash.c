@@ -0,0 +1,358 @@
+#include "ycrash.h"
+
+#include "decode.h"
+#include "ysim.h"
+#include "yutil.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Each thread makes its runs on a single Y86 which restore_y86()
+ * returns to the image before every run, copying only the pages the
+ * last run wrote, so a run costs little more than the instructions
+ * it executes.  As in AFL, a thread mutates the same parent input for
+ * a stretch of runs and compares the edge counts of each run against
+ * those it has seen itself, taking the lock on the shared state only
+ * when they look new.
+ */
+
+enum {
+  HAVOC_RUNS = 256,         /** # of runs mutating one parent input */
+  MAX_CRASHES = 1024,       /** max # of distinct crashes reported */
+};
+
+/** Words tried by mutations, along with the memory size and the words
+ *  around it.
+ */
+static const Word INTERESTING_WORDS[] = {
+  0, 1, 2, 7, 8, 16, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xffff,
+  0x7fffffff, 0x80000000, 0xffffffff, INT64_MAX, (Word)INT64_MIN,
+  (Word)-1, (Word)-8,
+};
+
+enum {
+  N_INTERESTING_WORDS =
+    sizeof(INTERESTING_WORDS) / sizeof(INTERESTING_WORDS[0]),
+};
+
+static const Byte INTERESTING_BYTES[] = { 0, 1, 0x7f, 0x80, 0xff };
+
+/** Where a run crashed, for reporting each crash once. */
+typedef struct {
+  Status status;
+  Address pc;
+} Crash;
+
+/** State shared by the threads of a fuzzing session. */
+typedef struct {
+  Snapshot *image;          /** state before each run */
+  Address addr;             /** input is size bytes at addr */
+  Size size;
+  Size memSize;
+  uint64_t maxSteps;
+  uint64_t nExecs;
+  uint64_t nextExec;        /** next run to be made by any thread */
+  pthread_mutex_t lock;     /** serializes the rest and output */
+  Byte *seen;               /** bucket bits of counts of any run */
+  Byte **corpus;            /** the nCorpus inputs kept */
+  Size nCorpus;
+  Crash crashes[MAX_CRASHES];
+  Size nCrashes;
+  uint64_t nHangs;
+  FILE *out;
+} Session;
+
+typedef struct {
+  Session *session;
+  uint64_t random;          /** xorshift64* state */
+  Y86 *y86;
+  Byte *parent;             /** input being mutated */
+  Byte *input;              /** input of current run */
+  Byte *trace;              /** edge counts of current run */
+  Byte *seen;               /** bucket bits of counts of this thread */
+  uint64_t nHangs;
+} Worker;
+
+/** Return the AFL bucket bit for an edge taken count times. */
+static inline Byte
+count_bucket(Byte count)
+{
+  if (count <= 2) return count;
+  if (count == 3) return 4;
+  if (count < 8) return 8;
+  if (count < 16) return 16;
+  if (count < 32) return 32;
+  if (count < 128) return 64;
+  return 128;
+}
+
+/** Apply a stack of 2 to 8 random mutations to input, which has the
+ *  size of the inputs of worker.
+ */
+static void
+mutate(Worker *worker, Byte input[])
+{
+  const Session *session = worker->session;
+  uint64_t *s = &worker->random;
+  Size size = session->size;
+  Size nWords = size / sizeof(Word);
+  int n = 1 << (1 + next_random(s) % 3);
+  for (int i = 0; i < n; i++) {
+    Byte *p = &input[next_random(s) % size];
+    int kind = next_random(s) % 6;
+    if (kind >= 3 && nWords == 0) kind = 1;
+    if (kind >= 3) p = &input[sizeof(Word) * (next_random(s) % nWords)];
+    Word w = (kind >= 3) ? get_le_word(p) : 0;
+    switch (kind) {
+    case 0:
+      *p ^= 1 << (next_random(s) % BYTE_BITS);
+      break;
+    case 1:
+      *p = next_random(s);
+      break;
+    case 2:
+      *p = INTERESTING_BYTES[next_random(s) % sizeof(INTERESTING_BYTES)];
+      break;
+    case 3: {
+      Size k = next_random(s) % (N_INTERESTING_WORDS + 3);
+      w = (k < N_INTERESTING_WORDS) ? INTERESTING_WORDS[k]
+        : session->memSize + sizeof(Word) * (k - N_INTERESTING_WORDS - 1);
+      break;
+    }
+    case 4: {
+      Word delta = 1 + next_random(s) % 35;
+      w = (next_random(s) % 2 == 0) ? w + delta : w - delta;
+      break;
+    }
+    default:
+      w = next_random(s);
+      break;
+    }
+    if (kind >= 3) put_le_word(p, w);
+  }
+}
+
+/** Set the parent of worker to a random input of the corpus. */
+static void
+choose_parent(Worker *worker)
+{
+  Session *session = worker->session;
+  pthread_mutex_lock(&session->lock);
+  Size i = next_random(&worker->random) % session->nCorpus;
+  memcpy(worker->parent, session->corpus[i], session->size);
+  pthread_mutex_unlock(&session->lock);
+}
+
+/** Write input to out as words if it is a whole number of words and
+ *  as bytes otherwise.
+ */
+static void
+write_input(const Byte input[], Size size, FILE *out)
+{
+  if (size % sizeof(Word) == 0) {
+    for (Size i = 0; i < size; i += sizeof(Word)) {
+      fprintf(out, " %ld", (long)get_le_word(&input[i]));
+    }
+  }
+  else {
+    for (Size i = 0; i < size; i++) fprintf(out, " %02x", input[i]);
+  }
+}
+
+/** Report the crash of run, which ended with status at pc after
+ *  nSteps instructions, unless it has been reported.
+ */
+static void
+note_crash(Worker *worker, uint64_t run, Status status, Address pc,
+           uint64_t nSteps)
+{
+  Session *session = worker->session;
+  pthread_mutex_lock(&session->lock);
+  bool isNew = session->nCrashes < MAX_CRASHES;
+  for (Size i = 0; i < session->nCrashes && isNew; i++) {
+    const Crash *c = &session->crashes[i];
+    isNew = c->status != status || c->pc != pc;
+  }
+  if (isNew) {
+    session->crashes[session->nCrashes++] = (Crash){ status, pc };
+    fprintf(session->out, "crash %lu: %s at pc %0*lx after %lu "
+            "instructions in run %lu; input",
+            (unsigned long)session->nCrashes, STATUS_NAMES[status],
+            (int)sizeof(Address)*2, pc, (unsigned long)nSteps,
+            (unsigned long)run);
+    write_input(worker->input, session->size, session->out);
+    fprintf(session->out, "\n");
+  }
+  pthread_mutex_unlock(&session->lock);
+}
+
+/** Return true iff the trace of worker has a bucket bit not in
+ *  seen[], adding its bits to seen[].
+ */
+static bool
+add_trace(const Worker *worker, Byte seen[])
+{
+  bool isNew = false;
+  const uint64_t *words = (const uint64_t *)worker->trace;
+  for (Size w = 0; w < COVERAGE_SIZE / sizeof(uint64_t); w++) {
+    if (words[w] == 0) continue;
+    for (Size i = w * sizeof(uint64_t); i < (w + 1) * sizeof(uint64_t); i++) {
+      Byte bit = count_bucket(worker->trace[i]);
+      if (bit & ~seen[i]) {
+        seen[i] |= bit;
+        isNew = true;
+      }
+    }
+  }
+  return isNew;
+}
+
+/** Add the input of worker to the corpus if its trace shows coverage
+ *  no earlier run of any thread had.
+ */
+static void
+note_coverage(Worker *worker)
+{
+  if (!add_trace(worker, worker->seen)) return;
+  Session *session = worker->session;
+  pthread_mutex_lock(&session->lock);
+  if (add_trace(worker, session->seen)) {
+    session->corpus = reallocChk(session->corpus,
+                                 (session->nCorpus + 1) * sizeof(Byte *));
+    Byte *input = mallocChk(session->size);
+    memcpy(input, worker->input, session->size);
+    session->corpus[session->nCorpus++] = input;
+  }
+  pthread_mutex_unlock(&session->lock);
+}
+
+/** Make run of worker with its input. */
+static void
+run_input(Worker *worker, uint64_t run)
+{
+  Session *session = worker->session;
+  Y86 *y86 = worker->y86;
+  restore_y86(y86, session->image);
+  memcpy(get_memory_pointer_y86(y86, session->addr), worker->input,
+         session->size);
+  invalidate_ysim(y86, session->addr, session->size);
+  memset(worker->trace, 0, COVERAGE_SIZE);
+  uint64_t nSteps = run_ysim(y86, session->maxSteps);
+  Status status = read_status_y86(y86);
+  if (status == STATUS_AOK) {
+    worker->nHangs++;
+  }
+  else if (status == STATUS_ADR || status == STATUS_INS) {
+    note_crash(worker, run, status, read_pc_y86(y86), nSteps);
+  }
+  else {
+    //as in AFL, only runs which finish feed the corpus
+    note_coverage(worker);
+  }
+}
+
+static void *
+do_worker(void *arg)
+{
+  Worker *worker = arg;
+  Session *session = worker->session;
+  //the simulator state of a Y86 belongs to the thread which made it
+  worker->y86 = fork_y86(session->image);
+  set_coverage_ysim(worker->y86, worker->trace);
+  for (;;) {
+    uint64_t first = __atomic_fetch_add(&session->nextExec, HAVOC_RUNS,
+                                        __ATOMIC_RELAXED);
+    if (first >= session->nExecs) break;
+    uint64_t end = (session->nExecs - first < HAVOC_RUNS)
+      ? session->nExecs : first + HAVOC_RUNS;
+    choose_parent(worker);
+    for (uint64_t run = first; run < end; run++) {
+      memcpy(worker->input, worker->parent, session->size);
+      if (run > 0) mutate(worker, worker->input);  //run 0 is the seed
+      run_input(worker, run);
+    }
+  }
+  free_ysim(worker->y86);
+  free_y86(worker->y86);
+  pthread_mutex_lock(&session->lock);
+  session->nHangs += worker->nHangs;
+  pthread_mutex_unlock(&session->lock);
+  return NULL;
+}
+
+void
+run_ycrash(Y86 *image, Address addr, Size size, uint64_t nExecs,
+           uint64_t maxSteps, int nThreads, FILE *out)
+{
+  Size memSize = get_memory_size_y86(image);
+  if (size == 0 || addr >= memSize || size > memSize - addr) {
+    fatal("fuzzed input %lx:%lu does not lie within memory",
+          (unsigned long)addr, (unsigned long)size);
+  }
+  if (nThreads <= 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads <= 0) nThreads = 1;
+  Session *session = callocChk(1, sizeof(Session));
+  session->image = snapshot_y86(image);
+  session->addr = addr;
+  session->size = size;
+  session->memSize = memSize;
+  session->maxSteps = maxSteps;
+  session->nExecs = nExecs;
+  pthread_mutex_init(&session->lock, NULL);
+  session->seen = callocChk(COVERAGE_SIZE, 1);
+  session->corpus = mallocChk(sizeof(Byte *));
+  session->corpus[0] = mallocChk(size);
+  memcpy(session->corpus[0], get_memory_pointer_y86(image, addr), size);
+  session->nCorpus = 1;
+  session->out = out;
+
+  double start = now();
+  Worker workers[nThreads];
+  pthread_t threads[nThreads];
+  for (int t = 0; t < nThreads; t++) {
+    workers[t] = (Worker) {
+      .session = session,
+      .random = 0x9E3779B97F4A7C15ULL * (t + 1),
+      .parent = mallocChk(size),
+      .input = mallocChk(size),
+      .trace = mallocChk(COVERAGE_SIZE),
+      .seen = callocChk(COVERAGE_SIZE, 1),
+    };
+    if (t > 0 && pthread_create(&threads[t], NULL, do_worker, &workers[t])) {
+      fatal("cannot create thread:");
+    }
+  }
+  do_worker(&workers[0]);     //main thread is worker 0
+  for (int t = 1; t < nThreads; t++) pthread_join(threads[t], NULL);
+  double seconds = now() - start;
+
+  Size nEdges = 0;
+  for (Size i = 0; i < COVERAGE_SIZE; i++) nEdges += session->seen[i] != 0;
+  fprintf(out, "fuzzed %lu runs in %.3fs (%.0f runs/s): %lu inputs kept, "
+          "%lu edges, %lu crashes, %lu runs stopped at %lu instructions\n",
+          (unsigned long)nExecs, seconds,
+          (seconds > 0) ? nExecs / seconds : 0.0,
+          (unsigned long)session->nCorpus, (unsigned long)nEdges,
+          (unsigned long)session->nCrashes, (unsigned long)session->nHangs,
+          (unsigned long)maxSteps);
+  for (int t = 0; t < nThreads; t++) {
+    free(workers[t].parent);
+    free(workers[t].input);
+    free(workers[t].trace);
+    free(workers[t].seen);
+  }
+  for (Size i = 0; i < session->nCorpus; i++) free(session->corpus[i]);
+  free(session->corpus);
+  free(session->seen);
+  free_snapshot(session->image);
+  pthread_mutex_destroy(&session->lock);
+  free(session);
+}
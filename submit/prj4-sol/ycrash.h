@@ -0,0 +1,28 @@
+#ifndef _YCRASH_H
+#define _YCRASH_H
+
+#include "y86.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Fuzz the program loaded in image for crashes, making nExecs runs
+ *  using nThreads threads (all online processors if nThreads is 0).
+ *  The size bytes of memory at addr are the program's input: each run
+ *  starts from the state of image with an input mutated from one in a
+ *  corpus, which starts with the input in image.  An input is added
+ *  to the corpus when its run halts after taking some edge (as counted
+ *  by set_coverage_ysim()) a number of times, bucketed as AFL does,
+ *  which no earlier run did.  Runs are limited to maxSteps instructions.
+ *  image itself is not changed.
+ *
+ *  Writes to out a line for each crash, a run which ends in
+ *  STATUS_ADR or STATUS_INS at a pc where no earlier crash with that
+ *  status ended, giving the input as words if size is a multiple of
+ *  sizeof(Word) and as bytes otherwise; then a summary of the runs.
+ *  With a single thread, the runs made are the same every time.
+ */
+void run_ycrash(Y86 *image, Address addr, Size size, uint64_t nExecs,
+                uint64_t maxSteps, int nThreads, FILE *out);
+
+#endif //ifndef _YCRASH_H
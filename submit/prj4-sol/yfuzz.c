@@ -0,0 +1,551 @@
+#include "decode.h"
+#include "y86.h"
+#include "yjit.h"
+#include "ysim.h"
+#include "yutil.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Differential fuzzer: run random y86 programs from random initial
+ *  states under the reference step_ysim() and under each accelerated
+ *  engine, comparing the complete machine state after every block of
+ *  instructions.  Each divergence is minimized and written out as a
+ *  .ys file which reproduces it.
+ */
+
+typedef enum { ENGINE_RUN, ENGINE_JIT, N_ENGINES } Engine;
+
+static const char *const ENGINE_NAMES[N_ENGINES] = { "run", "jit" };
+static const char *const ENGINE_FNS[N_ENGINES] = { "run_ysim()", "run_yjit()" };
+
+enum {
+  DEFAULT_N_CASES = 10000,
+  MIN_MEM_SIZE = 512,
+  MAX_MEM_SIZE = 4608,
+  MAX_STEPS = 20000,         /** max # of instructions run by a case */
+  MAX_BLOCK = 300,           /** max # of instructions between compares */
+  CODE_START = 0xc0,         /** random code follows the prologue */
+};
+
+/************************** Random Numbers *****************************/
+
+/** Return a well-mixed non-zero generator state for case i of seed. */
+static uint64_t
+case_state(uint64_t seed, uint64_t i)
+{
+  uint64_t z = seed * 0x9E3779B97F4A7C15ULL + i + 1;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return (z == 0) ? 1 : z;
+}
+
+/*************************** Fuzz Cases ********************************/
+
+/** Operations and operands which set each condition code value which
+ *  an OPq can produce.
+ */
+static const struct {
+  Byte fn;
+  Word a, b;
+} CC_SETUPS[] = {
+  { ADDQ_FN, 1, 1 },                                   //none
+  { XORQ_FN, 0, 0 },                                   //ZF
+  { ANDQ_FN, ~0ULL, ~0ULL },                           //SF
+  { ADDQ_FN, 1ULL << 63, 1ULL << 63 },                 //ZF OF
+  { ADDQ_FN, 1ULL << 62, 1ULL << 62 },                 //SF OF
+  { ADDQ_FN, 1ULL << 63, ~0ULL },                      //OF
+};
+
+enum { N_CC_SETUPS = sizeof(CC_SETUPS) / sizeof(CC_SETUPS[0]) };
+
+/** A program and initial state.  Memory starts with a prologue which
+ *  sets up the registers and condition codes and jumps to the random
+ *  code at CODE_START, so that the initial memory image alone
+ *  reproduces the case.
+ */
+typedef struct {
+  Size memSize;            /** a multiple of sizeof(Word) */
+  Byte *mem;               /** initial memory */
+  Word regs[N_REG];        /** registers set by prologue */
+  int ccSetup;             /** index in CC_SETUPS[] used by prologue */
+  uint64_t maxSteps;       /** # of instructions to run */
+  uint64_t blockSize;      /** # of instructions run per engine call */
+  bool isExtended;         /** run with set_extensions_ysim() */
+} FuzzCase;
+
+static Byte *
+emit_byte(Byte *p, Byte b)
+{
+  *p++ = b;
+  return p;
+}
+
+static Byte *
+emit_word(Byte *p, Word w)
+{
+  put_le_word(p, w);
+  return p + sizeof(Word);
+}
+
+static Byte *
+emit_irmovq(Byte *p, Word value, Register reg)
+{
+  p = emit_byte(p, IRMOVQ_CODE << 4);
+  p = emit_byte(p, REG_NONE << 4 | reg);
+  return emit_word(p, value);
+}
+
+/** Write the prologue of c to the start of its memory. */
+static void
+write_prologue(FuzzCase *c)
+{
+  Byte *p = c->mem;
+  p = emit_irmovq(p, CC_SETUPS[c->ccSetup].a, REG_RAX);
+  p = emit_irmovq(p, CC_SETUPS[c->ccSetup].b, REG_RBX);
+  p = emit_byte(p, OP1_CODE << 4 | CC_SETUPS[c->ccSetup].fn);
+  p = emit_byte(p, REG_RAX << 4 | REG_RBX);
+  for (Register r = REG_RAX; r < N_REG; r++) p = emit_irmovq(p, c->regs[r], r);
+  p = emit_byte(p, Jxx_CODE << 4 | ALWAYS_COND);
+  p = emit_word(p, CODE_START);
+  while (p < c->mem + CODE_START) p = emit_byte(p, NOP_CODE << 4);
+}
+
+/** Return # of bytes in the encoding of instructions with base op. */
+static int
+instr_size(BaseOpCode op)
+{
+  switch (op) {
+  case IRMOVQ_CODE: case RMMOVQ_CODE: case MRMOVQ_CODE: case CASQ_CODE:
+  case IOPQ_CODE:
+    return 2 + sizeof(Word);
+  case Jxx_CODE: case CALL_CODE:
+    return 1 + sizeof(Word);
+  case HALT_CODE: case NOP_CODE: case RET_CODE:
+    return 1;
+  default:
+    return 2;
+  }
+}
+
+/** Fill c with a random case using generator state *s.  Code is
+ *  mostly valid, with occasional bad bytes, registers and targets;
+ *  registers mostly point into the data in the upper half of memory.
+ *  Half the cases run with the extension instructions enabled and
+ *  use them.
+ */
+static void
+random_case(FuzzCase *c, uint64_t *s)
+{
+  Size n = (MIN_MEM_SIZE + next_random(s) % (MAX_MEM_SIZE - MIN_MEM_SIZE)) &
+           ~(sizeof(Word) - 1);
+  c->memSize = n;
+  c->mem = callocChk(n, 1);
+  c->isExtended = next_random(s) % 2 == 0;
+  BaseOpCode maxOp = c->isExtended ? BLOCK_CODE : POPQ_CODE;
+  Size codeEnd = n / 2;
+  Address starts[MAX_MEM_SIZE], jumps[MAX_MEM_SIZE];
+  int nStarts = 0, nJumps = 0;
+  Address pc = CODE_START;
+  while (pc + MAX_INSTR_SIZE <= codeEnd) {
+    starts[nStarts++] = pc;
+    if (next_random(s) % 50 == 0) {          //probably invalid
+      c->mem[pc++] = next_random(s);
+      continue;
+    }
+    BaseOpCode op = next_random(s) % (maxOp + 1);
+    if (op == HALT_CODE && next_random(s) % 8 != 0) op = OP1_CODE;
+    if (op == NOP_CODE && c->isExtended && next_random(s) % 2 == 0) {
+      op = CASQ_CODE;
+    }
+    Byte fn = 0;
+    if (op == NOP_CODE) fn = next_random(s) % (FENCE_FN + 1);
+    if (op == CMOVxx_CODE || op == Jxx_CODE) fn = next_random(s) % (GT_COND + 1);
+    if (op == OP1_CODE || op == IOPQ_CODE) {
+      fn = next_random(s) % (XORQ_FN + 1);
+    }
+    if (op == OP1_CODE && c->isExtended && next_random(s) % 4 == 0) {
+      fn = MULQ_FN + next_random(s) % (MODQ_FN - MULQ_FN + 1);
+    }
+    if (op == BLOCK_CODE) fn = next_random(s) % (FILLQ_FN + 1);
+    Byte *p = &c->mem[pc];
+    p = emit_byte(p, op << 4 | fn);
+    int size = instr_size(op);
+    if (size == 2 || size == 2 + (int)sizeof(Word)) {
+      Byte regA = next_random(s) % N_REG, regB = next_random(s) % N_REG;
+      if (op == IRMOVQ_CODE || op == IOPQ_CODE) regA = REG_NONE;
+      if (op == PUSHQ_CODE || op == POPQ_CODE) regB = REG_NONE;
+      if (next_random(s) % 60 == 0) regB = REG_NONE;
+      p = emit_byte(p, regA << 4 | regB);
+    }
+    if (op == IRMOVQ_CODE) {
+      p = emit_word(p, (next_random(s) % 4 != 0) ? next_random(s) % n
+                                                  : next_random(s));
+    }
+    else if (op == RMMOVQ_CODE || op == MRMOVQ_CODE || op == CASQ_CODE ||
+             op == IOPQ_CODE) {
+      p = emit_word(p, (next_random(s) % 10 != 0) ? next_random(s) % 64 - 32
+                                                   : next_random(s));
+    }
+    else if (op == Jxx_CODE || op == CALL_CODE) {
+      jumps[nJumps++] = pc;
+      p = emit_word(p, 0);                   //target patched below
+    }
+    pc += size;
+  }
+  //jump mostly to instruction boundaries, sometimes anywhere
+  for (int i = 0; i < nJumps; i++) {
+    Address target = (next_random(s) % 50 == 0)
+      ? next_random(s) % (n + 64) : starts[next_random(s) % nStarts];
+    emit_word(&c->mem[jumps[i] + 1], target);
+  }
+  for (Address a = codeEnd; a < n; a++) {
+    c->mem[a] = (next_random(s) % 4 == 0) ? next_random(s) : 0;
+  }
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    Word v;
+    switch (next_random(s) % 4) {
+    case 0: v = next_random(s) % 16; break;
+    case 1: v = next_random(s); break;
+    default: v = codeEnd + next_random(s) % (n - codeEnd - 64); break;
+    }
+    c->regs[r] = v;
+  }
+  c->regs[REG_RSP] = n - sizeof(Word) * (next_random(s) % 8);
+  c->ccSetup = next_random(s) % N_CC_SETUPS;
+  c->maxSteps = 1 + next_random(s) % MAX_STEPS;
+  c->blockSize = 1 + next_random(s) % MAX_BLOCK;
+  write_prologue(c);
+}
+
+/*********************** Differential Execution ************************/
+
+/** The first point at which an engine differed from step_ysim(). */
+typedef struct {
+  uint64_t step;           /** # of instructions run by step_ysim() */
+  char what[128];          /** description of difference */
+} Divergence;
+
+/** Return a new Y86 with the initial state of c. */
+static Y86 *
+new_case_y86(const FuzzCase *c)
+{
+  Y86 *y86 = new_y86(c->memSize);
+  memcpy(get_memory_pointer_y86(y86, 0), c->mem, c->memSize);
+  if (c->isExtended) set_extensions_ysim(y86, true);
+  return y86;
+}
+
+/** Return true if the state of y86 differs from that of ref, setting
+ *  div->what to the first difference found.
+ */
+static bool
+is_different(Y86 *ref, Y86 *y86, uint64_t nRef, uint64_t n, Size memSize,
+             Divergence *div)
+{
+  const char *names[] = { "steps", "status", "pc", "cc" };
+  Word a[] = { nRef, read_status_y86(ref), read_pc_y86(ref), read_cc_y86(ref) };
+  Word b[] = { n, read_status_y86(y86), read_pc_y86(y86), read_cc_y86(y86) };
+  for (int i = 0; i < (int)(sizeof(a) / sizeof(a[0])); i++) {
+    if (a[i] != b[i]) {
+      snprintf(div->what, sizeof(div->what), "%s %lx != %lx", names[i],
+               a[i], b[i]);
+      return true;
+    }
+  }
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    Word wa = read_register_y86(ref, r), wb = read_register_y86(y86, r);
+    if (wa != wb) {
+      snprintf(div->what, sizeof(div->what), "register %d %lx != %lx", r,
+               wa, wb);
+      return true;
+    }
+  }
+  const Byte *ma = get_memory_pointer_y86(ref, 0);
+  const Byte *mb = get_memory_pointer_y86(y86, 0);
+  if (memcmp(ma, mb, memSize) != 0) {
+    Address addr = 0;
+    while (ma[addr] == mb[addr]) addr++;
+    snprintf(div->what, sizeof(div->what), "memory byte %lx %02x != %02x",
+             addr, ma[addr], mb[addr]);
+    return true;
+  }
+  return false;
+}
+
+/** Run c under step_ysim() and engine, comparing their states after
+ *  every block.  Return true if they diverge, describing where in *div.
+ */
+static bool
+run_case(const FuzzCase *c, Engine engine, Divergence *div)
+{
+  Y86 *ref = new_case_y86(c);
+  Y86 *y86 = new_case_y86(c);
+  YJit *yjit = (engine == ENGINE_JIT) ? new_yjit(y86) : NULL;
+  uint64_t nRef = 0, n = 0;
+  bool isDiverged = false;
+  while (!isDiverged && nRef < c->maxSteps &&
+         read_status_y86(ref) == STATUS_AOK) {
+    uint64_t k = c->maxSteps - nRef;
+    if (k > c->blockSize) k = c->blockSize;
+    for (uint64_t i = 0; i < k && read_status_y86(ref) == STATUS_AOK; i++) {
+      step_ysim(ref);
+      nRef++;
+    }
+    n += (yjit != NULL) ? run_yjit(yjit, k) : run_ysim(y86, k);
+    isDiverged = is_different(ref, y86, nRef, n, c->memSize, div);
+    div->step = nRef;
+  }
+  if (yjit != NULL) free_yjit(yjit);
+  free_ysim(ref);
+  free_ysim(y86);
+  free_y86(ref);
+  free_y86(y86);
+  return isDiverged;
+}
+
+/** Shrink c while it still diverges under engine: shorten the run,
+ *  zero as much of memory as possible, then zero the registers and
+ *  condition codes, and shrink the blocks.  Set *div to the divergence
+ *  of the result.
+ */
+static void
+minimize_case(FuzzCase *c, Engine engine, Divergence *div)
+{
+  run_case(c, engine, div);
+  c->maxSteps = div->step;
+  for (int round = 0; round < 2; round++) {
+    uint64_t lo = 1, hi = c->maxSteps;
+    while (lo < hi) {
+      c->maxSteps = lo + (hi - lo) / 2;
+      if (run_case(c, engine, div)) hi = c->maxSteps; else lo = c->maxSteps + 1;
+    }
+    c->maxSteps = hi;
+    for (Size chunk = 64; chunk >= 1; chunk /= 8) {
+      for (Address a = CODE_START; a < c->memSize; a += chunk) {
+        Size n = (c->memSize - a < chunk) ? c->memSize - a : chunk;
+        Byte saved[64];
+        memcpy(saved, &c->mem[a], n);
+        Size i = 0;
+        while (i < n && saved[i] == 0) i++;
+        if (i == n) continue;
+        memset(&c->mem[a], 0, n);
+        if (!run_case(c, engine, div)) memcpy(&c->mem[a], saved, n);
+      }
+    }
+  }
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    Word saved = c->regs[r];
+    if (saved == 0) continue;
+    c->regs[r] = 0;
+    write_prologue(c);
+    if (!run_case(c, engine, div)) c->regs[r] = saved;
+  }
+  int savedCc = c->ccSetup;
+  c->ccSetup = 0;
+  write_prologue(c);
+  if (!run_case(c, engine, div)) c->ccSetup = savedCc;
+  write_prologue(c);
+  while (c->blockSize > 1) {
+    uint64_t saved = c->blockSize;
+    c->blockSize /= 2;
+    if (!run_case(c, engine, div)) {
+      c->blockSize = saved;
+      break;
+    }
+  }
+  if (!run_case(c, engine, div)) fatal("minimized case no longer diverges");
+}
+
+/** Write a .ys file to fileName which assembles to the memory of c. */
+static void
+write_reproducer(const char *fileName, const FuzzCase *c, Engine engine,
+                 const Divergence *div, uint64_t seed, uint64_t caseIndex)
+{
+  FILE *out = fopen(fileName, "w");
+  if (out == NULL) fatal("cannot write %s:", fileName);
+  fprintf(out,
+          "# step_ysim() and %s differ after %lu instructions: %s\n"
+          "# when %s runs blocks of %lu instructions.\n"
+          "# Reproduce using\n"
+          "#   yfuzz -s %lu -c %lu -e %s\n"
+          "# The code at 0 sets up the registers and condition codes%s.\n",
+          ENGINE_FNS[engine], (unsigned long)div->step, div->what,
+          ENGINE_FNS[engine], (unsigned long)c->blockSize,
+          (unsigned long)seed, (unsigned long)caseIndex, ENGINE_NAMES[engine],
+          c->isExtended ? "; extensions are enabled" : "");
+  bool isGap = true;
+  for (Address a = 0; a < c->memSize; a += sizeof(Word)) {
+    Word w = get_le_word(&c->mem[a]);
+    if (w == 0) {
+      isGap = true;
+      continue;
+    }
+    if (isGap) fprintf(out, "        .pos 0x%lx\n", a);
+    fprintf(out, "        .quad 0x%016lx\n", w);
+    isGap = false;
+  }
+  if (fclose(out) != 0) fatal("cannot write %s:", fileName);
+}
+
+/*************************** Fuzzing Cases *****************************/
+
+typedef struct {
+  uint64_t seed;
+  uint64_t nextCase;       /** next case to be run by any worker */
+  uint64_t nCases;
+  bool isEngine[N_ENGINES];
+  const char *outDir;
+  pthread_mutex_t lock;    /** serializes reports */
+  int nDivergences;
+} Fuzzer;
+
+/** Run case i of fuzzer under each engine, reporting any divergence. */
+static void
+fuzz_case(Fuzzer *fuzzer, uint64_t i)
+{
+  for (Engine engine = 0; engine < N_ENGINES; engine++) {
+    if (!fuzzer->isEngine[engine]) continue;
+    uint64_t s = case_state(fuzzer->seed, i);
+    FuzzCase c;
+    random_case(&c, &s);
+    Divergence div;
+    if (run_case(&c, engine, &div)) {
+      Divergence found = div;
+      minimize_case(&c, engine, &div);
+      char fileName[1024];
+      snprintf(fileName, sizeof(fileName), "%s/yfuzz-%lu-%lu-%s.ys",
+               fuzzer->outDir, (unsigned long)fuzzer->seed, (unsigned long)i,
+               ENGINE_NAMES[engine]);
+      write_reproducer(fileName, &c, engine, &div, fuzzer->seed, i);
+      pthread_mutex_lock(&fuzzer->lock);
+      printf("case %lu: %s differs after %lu instructions: %s; "
+             "minimized in %s\n", (unsigned long)i, ENGINE_FNS[engine],
+             (unsigned long)found.step, found.what, fileName);
+      fflush(stdout);
+      fuzzer->nDivergences++;
+      pthread_mutex_unlock(&fuzzer->lock);
+    }
+    free(c.mem);
+  }
+}
+
+static void *
+do_fuzzer(void *arg)
+{
+  Fuzzer *fuzzer = arg;
+  for (;;) {
+    uint64_t i = __atomic_fetch_add(&fuzzer->nextCase, 1, __ATOMIC_RELAXED);
+    if (i >= fuzzer->nCases) break;
+    fuzz_case(fuzzer, i);
+  }
+  return NULL;
+}
+
+/************************* Parse Command Line **************************/
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-c CASE] [-e ENGINES] [-j N_THREADS] [-n N_CASES] "
+          "[-o DIR] [-s SEED]\n", prog);
+  fprintf(stderr,
+          "          -c:  run only case CASE\n"
+          "          -e:  comma-separated engines from run, jit "
+          "(default: all)\n"
+          "          -j:  use N_THREADS threads (default: all processors)\n"
+          "          -n:  run N_CASES cases (default %d)\n"
+          "          -o:  write .ys reproducers to DIR (default .)\n"
+          "          -s:  generate cases from SEED (default 1)\n",
+          DEFAULT_N_CASES);
+  exit(1);
+}
+
+/** Return the value of option opt parsed from value; usage() if it is
+ *  not a number.
+ */
+static uint64_t
+parse_number(const char *prog, const char *opt, const char *value)
+{
+  char *p;
+  uint64_t n = strtoull(value, &p, 0);
+  if (p == value || *p != '\0' || value[0] == '-') {
+    fprintf(stderr, "bad value '%s' for %s\n", value, opt);
+    usage(prog);
+  }
+  return n;
+}
+
+int
+main(int argc, const char *argv[])
+{
+  Fuzzer fuzzer = {
+    .seed = 1,
+    .nCases = DEFAULT_N_CASES,
+    .isEngine = { true, true },
+    .outDir = ".",
+  };
+  int nThreads = 0;
+  bool isOneCase = false;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || i + 1 >= argc) usage(argv[0]);
+    const char *opt = argv[i], *value = argv[++i];
+    if (strcmp(opt, "-c") == 0) {
+      fuzzer.nextCase = parse_number(argv[0], opt, value);
+      isOneCase = true;
+    }
+    else if (strcmp(opt, "-e") == 0) {
+      if (!parse_engines(value, N_ENGINES, ENGINE_NAMES,
+                         fuzzer.isEngine)) {
+        fprintf(stderr, "bad engines '%s'\n", value);
+        usage(argv[0]);
+      }
+    }
+    else if (strcmp(opt, "-j") == 0) {
+      nThreads = parse_number(argv[0], opt, value);
+    }
+    else if (strcmp(opt, "-n") == 0) {
+      fuzzer.nCases = parse_number(argv[0], opt, value);
+    }
+    else if (strcmp(opt, "-o") == 0) {
+      fuzzer.outDir = value;
+    }
+    else if (strcmp(opt, "-s") == 0) {
+      fuzzer.seed = parse_number(argv[0], opt, value);
+    }
+    else {
+      fprintf(stderr, "unknown option '%s'\n", opt);
+      usage(argv[0]);
+    }
+  }
+  if (isOneCase) {
+    fuzzer.nCases = fuzzer.nextCase + 1;
+    nThreads = 1;
+  }
+  if (nThreads <= 0) nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nThreads <= 0) nThreads = 1;
+  pthread_mutex_init(&fuzzer.lock, NULL);
+  pthread_t threads[nThreads];
+  for (int t = 1; t < nThreads; t++) {
+    if (pthread_create(&threads[t], NULL, do_fuzzer, &fuzzer)) {
+      fatal("cannot create thread:");
+    }
+  }
+  do_fuzzer(&fuzzer);         //main thread is also a worker
+  for (int t = 1; t < nThreads; t++) pthread_join(threads[t], NULL);
+  pthread_mutex_destroy(&fuzzer.lock);
+  uint64_t nRun = fuzzer.nCases - (isOneCase ? fuzzer.nCases - 1 : 0);
+  printf("%lu case%s, %d divergence%s\n", (unsigned long)nRun,
+         (nRun == 1) ? "" : "s", fuzzer.nDivergences,
+         (fuzzer.nDivergences == 1) ? "" : "s");
+  return fuzzer.nDivergences > 0;
+}
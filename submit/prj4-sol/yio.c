@@ -0,0 +1,281 @@
+#include "yio.h"
+
+#include "decode.h"
+#include "ysim.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Input and output go through buffers large enough that a program
+ * streaming data costs a host read or write per IO_BUFFER_SIZE bytes.
+ * Writes of at least a buffer's worth bypass the output buffer and go
+ * directly from y86 memory to the file.
+ */
+
+enum {
+  IO_BUFFER_SIZE = 1 << 20,     /** # of bytes in each host buffer */
+};
+
+static const Word TRAP_ERROR = (Word)-1;
+
+struct YIOStruct {
+  Y86 *y86;
+  Byte *mem;                /** base of y86 memory */
+  Size memSize;
+  bool isInOpen;            /** false if fd 0 is closed */
+  FILE *in;                 /** NULL if there is no input beyond inBuf */
+  const char *inFileName;
+  bool isOutOpen;           /** false if fd 1 is closed */
+  FILE *out;                /** NULL if output is discarded */
+  const char *outFileName;
+  Byte *inBuf;              /** input not yet read: [inPos, inEnd) */
+  Size inPos, inEnd;
+  Byte *outBuf;             /** the nOut bytes of output not yet written */
+  Size nOut;
+  bool isKeeping;           /** keep input for take_input_yio() */
+  Byte *kept;               /** the nKept bytes of input kept */
+  Size nKept;
+  Size maxKept;
+};
+
+/** Return fileName opened in mode, with "-" for stdFile; NULL if
+ *  fileName is NULL.
+ */
+static FILE *
+open_file(const char *fileName, const char *mode, FILE *stdFile)
+{
+  if (fileName == NULL) return NULL;
+  if (strcmp(fileName, "-") == 0) return stdFile;
+  FILE *f = fopen(fileName, mode);
+  if (f == NULL) fatal("cannot open %s:", fileName);
+  return f;
+}
+
+/** Read up to size bytes of input into bytes[], returning # read. */
+static Size
+read_input(YIO *yio, Byte bytes[], Size size)
+{
+  Size n = fread(bytes, 1, size, yio->in);
+  if (ferror(yio->in)) fatal("cannot read %s:", yio->inFileName);
+  return n;
+}
+
+static void
+write_output(YIO *yio, const Byte bytes[], Size size)
+{
+  if (fwrite(bytes, 1, size, yio->out) != size) {
+    fatal("cannot write %s:", yio->outFileName);
+  }
+}
+
+static void
+flush_output(YIO *yio)
+{
+  if (yio->out != NULL) write_output(yio, yio->outBuf, yio->nOut);
+  yio->nOut = 0;
+}
+
+/** Add the size bytes at bytes[] to the input kept by yio. */
+static void
+keep_input(YIO *yio, const Byte bytes[], Size size)
+{
+  if (yio->nKept + size > yio->maxKept) {
+    while (yio->nKept + size > yio->maxKept) {
+      yio->maxKept = (yio->maxKept == 0) ? IO_BUFFER_SIZE : 2 * yio->maxKept;
+    }
+    yio->kept = reallocChk(yio->kept, yio->maxKept);
+  }
+  memcpy(&yio->kept[yio->nKept], bytes, size);
+  yio->nKept += size;
+}
+
+/** Write the size bytes at bytes[] to memory at addr through the y86
+ *  of yio.  Bytes which share an aligned word are written together as
+ *  that word, except in a partial word at the end of memory.
+ */
+static void
+write_memory(YIO *yio, Address addr, const Byte bytes[], Size size)
+{
+  Address end = addr + size;
+  for (Address w = addr - addr % sizeof(Word); w < end; w += sizeof(Word)) {
+    Address lo = (w < addr) ? addr : w;
+    Address hi = (end - w < sizeof(Word)) ? end : w + sizeof(Word);
+    if (yio->memSize - w < sizeof(Word)) {
+      for (Address a = lo; a < hi; a++) {
+        write_memory_byte_y86(yio->y86, a, bytes[a - addr]);
+      }
+    }
+    else {
+      Byte word[sizeof(Word)];
+      memcpy(word, &yio->mem[w], sizeof(Word));
+      memcpy(&word[lo - w], &bytes[lo - addr], hi - lo);
+      write_memory_word_y86(yio->y86, w, get_le_word(word));
+    }
+  }
+}
+
+/** Return true iff [addr, addr + size) lies within the memory of yio. */
+static bool
+is_in_memory(const YIO *yio, Address addr, Size size)
+{
+  return addr <= yio->memSize && size <= yio->memSize - addr;
+}
+
+/** Read count bytes of input into memory at addr, or fewer at the end
+ *  of input; return # of bytes read.
+ */
+static Word
+trap_read(YIO *yio, Address addr, Size count)
+{
+  Size n = 0;
+  while (n < count) {
+    if (yio->inPos == yio->inEnd) {
+      if (yio->in == NULL) break;
+      yio->inPos = 0;
+      yio->inEnd = read_input(yio, yio->inBuf, IO_BUFFER_SIZE);
+      if (yio->inEnd == 0) break;
+    }
+    Size size = yio->inEnd - yio->inPos;
+    if (size > count - n) size = count - n;
+    write_memory(yio, addr + n, &yio->inBuf[yio->inPos], size);
+    if (yio->isKeeping) keep_input(yio, &yio->inBuf[yio->inPos], size);
+    yio->inPos += size;
+    n += size;
+  }
+  invalidate_ysim(yio->y86, addr, n);
+  return n;
+}
+
+/** Write the count bytes at addr in memory to the output. */
+static Word
+trap_write(YIO *yio, Address addr, Size count)
+{
+  if (yio->out == NULL) return count;
+  if (yio->nOut + count > IO_BUFFER_SIZE) flush_output(yio);
+  if (count >= IO_BUFFER_SIZE) {
+    write_output(yio, &yio->mem[addr], count);
+  }
+  else {
+    memcpy(&yio->outBuf[yio->nOut], &yio->mem[addr], count);
+    yio->nOut += count;
+  }
+  return count;
+}
+
+/** The TrapFn for each y86 given to new_yio(). */
+static Status
+do_trap(void *ctx, Y86 *y86, Word *result)
+{
+  YIO *yio = ctx;
+  Word call = read_register_y86(y86, REG_RAX);
+  Word fd = read_register_y86(y86, REG_RDI);
+  Address buf = read_register_y86(y86, REG_RSI);
+  Size count = read_register_y86(y86, REG_RDX);
+  *result = TRAP_ERROR;
+  switch (call) {
+  case TRAP_READ:
+    if (fd != TRAP_IN_FD || !yio->isInOpen) break;
+    if (!is_in_memory(yio, buf, count)) return STATUS_ADR;
+    *result = trap_read(yio, buf, count);
+    break;
+  case TRAP_WRITE:
+    if (fd != TRAP_OUT_FD || !yio->isOutOpen) break;
+    if (!is_in_memory(yio, buf, count)) return STATUS_ADR;
+    *result = trap_write(yio, buf, count);
+    break;
+  case TRAP_EXIT:
+    *result = fd;           //%rdi holds the exit code
+    return STATUS_HLT;
+  default:
+    break;
+  }
+  return STATUS_AOK;
+}
+
+YIO *
+new_yio(Y86 *y86, const char *inFileName, const char *outFileName)
+{
+  YIO *yio = callocChk(1, sizeof(YIO));
+  yio->y86 = y86;
+  yio->mem = get_memory_pointer_y86(y86, 0);
+  yio->memSize = get_memory_size_y86(y86);
+  yio->isInOpen = inFileName != NULL;
+  yio->in = open_file(inFileName, "rb", stdin);
+  yio->inFileName = inFileName;
+  yio->isOutOpen = outFileName != NULL;
+  yio->out = open_file(outFileName, "wb", stdout);
+  yio->outFileName = outFileName;
+  yio->inBuf = mallocChk(IO_BUFFER_SIZE);
+  yio->outBuf = mallocChk(IO_BUFFER_SIZE);
+  set_trap_fn_ysim(y86, do_trap, yio);
+  return yio;
+}
+
+YIO *
+new_replay_yio(Y86 *y86, bool isInOpen, const Byte input[], Size nInput,
+               bool isOutOpen)
+{
+  YIO *yio = new_yio(y86, NULL, NULL);
+  yio->isInOpen = isInOpen;
+  yio->isOutOpen = isOutOpen;
+  if (nInput > IO_BUFFER_SIZE) yio->inBuf = reallocChk(yio->inBuf, nInput);
+  memcpy(yio->inBuf, input, nInput);
+  yio->inEnd = nInput;
+  return yio;
+}
+
+unsigned
+get_open_fds_yio(const YIO *yio)
+{
+  return (yio->isInOpen ? 1u << TRAP_IN_FD : 0) |
+         (yio->isOutOpen ? 1u << TRAP_OUT_FD : 0);
+}
+
+void
+set_output_yio(YIO *yio, const char *outFileName)
+{
+  flush_output(yio);
+  yio->out = open_file(outFileName, "wb", stdout);
+  yio->outFileName = outFileName;
+}
+
+void
+keep_input_yio(YIO *yio)
+{
+  yio->isKeeping = true;
+  yio->nKept = 0;
+}
+
+Size
+take_input_yio(YIO *yio, const Byte **input)
+{
+  *input = yio->kept;
+  Size n = yio->nKept;
+  yio->nKept = 0;
+  return n;
+}
+
+void
+free_yio(YIO *yio)
+{
+  set_trap_fn_ysim(yio->y86, NULL, NULL);
+  if (yio->out != NULL) {
+    flush_output(yio);
+    if (yio->out == stdout) {
+      if (fflush(stdout) != 0) fatal("cannot write standard output:");
+    }
+    else if (fclose(yio->out) != 0) {
+      fatal("cannot write %s:", yio->outFileName);
+    }
+  }
+  if (yio->in != NULL && yio->in != stdin) fclose(yio->in);
+  free(yio->inBuf);
+  free(yio->outBuf);
+  free(yio->kept);
+  free(yio);
+}
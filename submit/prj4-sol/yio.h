@@ -0,0 +1,76 @@
+#ifndef _YIO_H
+#define _YIO_H
+
+#include "y86.h"
+
+/** An opaque structure which carries out the trap instructions of a
+ *  y86 program as buffered reads of an input file and writes to an
+ *  output file.
+ */
+typedef struct YIOStruct YIO;
+
+/** Trap calls, selected by %rax.  Arguments are in %rdi, %rsi and
+ *  %rdx and the result is returned in %rax; a bad call number or file
+ *  descriptor returns -1.
+ *
+ *    read(fd, buf, count)   read up to count bytes from fd 0 into
+ *                           memory at buf; return # of bytes read,
+ *                           which is less than count only at the end
+ *                           of input
+ *    write(fd, buf, count)  write the count bytes at buf to fd 1;
+ *                           return count
+ *    exit(code)             halt with %rax = code
+ *
+ *  A buffer which does not lie within memory is STATUS_ADR.
+ */
+enum { TRAP_READ, TRAP_WRITE, TRAP_EXIT };
+
+enum { TRAP_IN_FD, TRAP_OUT_FD };
+
+/** Make the trap instructions of y86 read fd 0 from inFileName and
+ *  write fd 1 to outFileName, where "-" is standard input or output
+ *  and a NULL file name leaves its descriptor closed.  Since reads
+ *  only stop short at the end of input, a program run on the same
+ *  input always makes the same calls with the same results.  Memory
+ *  read into is written a word at a time through y86, so that it is
+ *  logged for dump_changes_y86() as the words get_changes_ysim()
+ *  reports.
+ */
+YIO *new_yio(Y86 *y86, const char *inFileName, const char *outFileName);
+
+/** Make the trap instructions of y86 behave as in a recorded run in
+ *  which fd 0 was open iff isInOpen and fd 1 iff isOutOpen.  Reads of
+ *  fd 0 return the nInput bytes of input[], which are copied, and
+ *  writes to fd 1 are discarded until set_output_yio() is called.
+ */
+YIO *new_replay_yio(Y86 *y86, bool isInOpen, const Byte input[],
+                    Size nInput, bool isOutOpen);
+
+/** Return a mask with bit fd set for each of TRAP_IN_FD and
+ *  TRAP_OUT_FD which is open in yio.
+ */
+unsigned get_open_fds_yio(const YIO *yio);
+
+/** Write the output to fd 1 of yio, which must have been made by
+ *  new_replay_yio() with isOutOpen, to outFileName ("-" for standard
+ *  output) from now on.
+ */
+void set_output_yio(YIO *yio, const char *outFileName);
+
+/** Keep the input read from fd 0 of yio from now on until it is taken
+ *  by take_input_yio().
+ */
+void keep_input_yio(YIO *yio);
+
+/** Set *input to the bytes read from fd 0 of yio since the last call
+ *  to this function or keep_input_yio() and return their number.  They
+ *  remain valid until yio next reads input.
+ */
+Size take_input_yio(YIO *yio, const Byte **input);
+
+/** Write out any buffered output of yio and free all resources
+ *  allocated by new_yio(), leaving traps in its y86 invalid.
+ */
+void free_yio(YIO *yio);
+
+#endif //ifndef _YIO_H
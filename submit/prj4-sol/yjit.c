@@ -0,0 +1,1074 @@
+#include "yjit.h"
+
+#include "decode.h"
+#include "lazymem.h"
+#include "ycfg.h"
+#include "ysim.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+/* Basic blocks of y86 code are translated into x86-64 code in an
+ * executable buffer the first time they are reached.  Y86 registers
+ * %rax - %r10 live in host registers while translated code runs and
+ * %r11 - %r14 live in a JitContext.  Condition codes are kept as one
+ * byte per flag in the JitContext and also used directly from the
+ * host flags when an ALU op is followed by cmovXX or jXX.
+ *
+ * Translated code only ever does what step_ysim() would do with
+ * certainty.  Anything else (halt, undecodable instructions, memory
+ * accesses which may be out of bounds, a shortage of step budget)
+ * leaves translated code at the start of the y86 instruction concerned
+ * so that it can be executed by step_ysim().  Accesses which a static
+ * analysis of the program proves to be in bounds, or stores which it
+ * proves cannot overwrite code, are translated without those checks;
+ * the analysis is discarded along with all translations as soon as
+ * the run leaves what it covers.
+ */
+
+enum {
+  CODE_BUFFER_SIZE = 16 * 1024 * 1024,
+  MAX_BLOCK_INSTRS = 64,      /** max # of y86 instructions per block */
+  MAX_BLOCK_CODE = 32 * 1024, /** upper bound on native code per block */
+  MAX_STUBS = 2 * MAX_BLOCK_INSTRS + 1,
+  MAX_CFG_BUILDS = 8,         /** max # of static analyses of a program */
+};
+
+/** Why translated code returned to run_yjit() */
+typedef enum {
+  EXIT_JUMP,       /** continue at pc; exitSite can be chained to it */
+  EXIT_INDIRECT,   /** continue at pc (return address) */
+  EXIT_STEP,       /** instruction at pc must be run by step_ysim() */
+  EXIT_BUDGET,     /** not enough budget to run block at pc */
+  EXIT_FLUSH,      /** translated code overwritten; continue at pc */
+} ExitReason;
+
+/** State shared between run_yjit() and translated code; accessed
+ *  from translated code relative to %rbx.
+ */
+typedef struct {
+  Word regs[N_REG];     /** y86 registers while outside translated code */
+  Byte of, sf, zf;      /** y86 condition code flags (0 or 1) */
+  uint32_t reason;      /** ExitReason */
+  Address pc;           /** y86 pc on exit */
+  int64_t budget;       /** remaining # of instructions */
+  Byte *mem;            /** base of y86 memory */
+  Address memSize;      /** # of bytes in y86 memory */
+  Address memLimit;     /** largest valid address for a word access */
+  Byte *exitSite;       /** patchable jump for EXIT_JUMP */
+  YJit *yjit;
+} JitContext;
+
+struct YJitStruct {
+  Y86 *y86;
+  Byte *mem;
+  Size memSize;
+  Byte *code;               /** executable buffer */
+  Size codeStart;           /** offset of first block in code */
+  Size codeUsed;            /** # of bytes of code in use */
+  Byte **blocks;            /** native entry for each y86 address */
+  uint64_t *isTranslated;   /** bitmap of y86 bytes in translations */
+  unsigned generation;      /** incremented on each flush */
+  YCfg *cfg;                /** analysis used by translations; NULL if none */
+  unsigned nCfgBuilds;      /** # of analyses made */
+  bool isStale;             /** translations or analysis read memory
+                             *  written since the last restore */
+  void (*enter)(JitContext *ctx, Byte *entry);
+  Byte *exitCode;           /** common exit from translated code */
+  JitContext ctx;
+};
+
+/***************************** x86-64 Encoding **************************/
+
+typedef enum {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15, NO_HOST = -1
+} HostReg;
+
+/** host register holding each y86 register, or NO_HOST */
+static const HostReg hostRegs[N_REG] = {
+  [REG_RAX] = RAX, [REG_RCX] = RCX, [REG_RDX] = RDX, [REG_RBX] = R12,
+  [REG_RSP] = R13, [REG_RBP] = R14, [REG_RSI] = RSI, [REG_RDI] = RDI,
+  [REG_R8] = R8, [REG_R9] = R9, [REG_R10] = R15, [REG_R11] = NO_HOST,
+  [REG_R12] = NO_HOST, [REG_R13] = NO_HOST, [REG_R14] = NO_HOST,
+};
+
+/** host registers holding y86 registers which a call may clobber */
+static const HostReg callerSaved[] = { RAX, RCX, RDX, RSI, RDI, R8, R9 };
+
+#define CTX RBX        /** JitContext pointer */
+#define MEM RBP        /** base of y86 memory */
+#define TMP0 R10       /** scratch */
+#define TMP1 R11       /** scratch */
+
+/** x86 condition codes */
+enum {
+  CC_O = 0x0, CC_Z = 0x4, CC_NZ = 0x5, CC_S = 0x8,
+  CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+/** x86 condition code for each y86 Condition other than ALWAYS_COND */
+static const Byte hostConds[] = {
+  [LE_COND] = CC_LE, [LT_COND] = CC_L, [EQ_COND] = CC_Z,
+  [NE_COND] = CC_NZ, [GE_COND] = CC_GE, [GT_COND] = CC_G,
+};
+
+/** x86 opcodes (r/m64, r64 form) for each OP1_CODE function */
+static const Byte aluOps[] = {
+  [ADDQ_FN] = 0x01, [SUBQ_FN] = 0x29, [ANDQ_FN] = 0x21, [XORQ_FN] = 0x31,
+};
+
+#define CTX_OFFSET(field) ((int32_t)offsetof(JitContext, field))
+#define REG_OFFSET(reg) (CTX_OFFSET(regs) + (int32_t)((reg) * sizeof(Word)))
+
+typedef struct {
+  Byte *p;             /** where next byte is emitted */
+} Asm;
+
+static void
+emit1(Asm *a, Byte b)
+{
+  *a->p++ = b;
+}
+
+static void
+emit4(Asm *a, uint32_t v)
+{
+  memcpy(a->p, &v, sizeof(v)); a->p += sizeof(v);
+}
+
+static void
+emit8(Asm *a, uint64_t v)
+{
+  memcpy(a->p, &v, sizeof(v)); a->p += sizeof(v);
+}
+
+/** emit REX prefix, omitting it when it would be a no-op */
+static void
+emit_rex(Asm *a, bool w, int r, int x, int b)
+{
+  Byte rex = 0x40 | (w << 3) | ((r >> 3) & 1) << 2 | ((x >> 3) & 1) << 1 |
+    ((b >> 3) & 1);
+  if (rex != 0x40) emit1(a, rex);
+}
+
+static void
+emit_modrm(Asm *a, int mod, int reg, int rm)
+{
+  emit1(a, (mod << 6) | (reg & 7) << 3 | (rm & 7));
+}
+
+/** emit ModRM (and SIB) for [base + disp] */
+static void
+emit_mem(Asm *a, int reg, HostReg base, int32_t disp)
+{
+  emit_modrm(a, 2, reg, base);
+  if ((base & 7) == RSP) emit1(a, 0x24);
+  emit4(a, disp);
+}
+
+/** emit ModRM and SIB for [base + index] */
+static void
+emit_mem_index(Asm *a, int reg, HostReg base, HostReg index)
+{
+  bool needsDisp = (base & 7) == RBP;
+  emit_modrm(a, needsDisp ? 1 : 0, reg, RSP);
+  emit1(a, (index & 7) << 3 | (base & 7));
+  if (needsDisp) emit1(a, 0);
+}
+
+/** mov dst, src */
+static void
+emit_mov_rr(Asm *a, HostReg dst, HostReg src)
+{
+  emit_rex(a, true, src, 0, dst); emit1(a, 0x89); emit_modrm(a, 3, src, dst);
+}
+
+/** mov dst, [base + disp] */
+static void
+emit_load(Asm *a, HostReg dst, HostReg base, int32_t disp)
+{
+  emit_rex(a, true, dst, 0, base); emit1(a, 0x8B); emit_mem(a, dst, base, disp);
+}
+
+/** mov [base + disp], src */
+static void
+emit_store(Asm *a, HostReg base, int32_t disp, HostReg src)
+{
+  emit_rex(a, true, src, 0, base); emit1(a, 0x89); emit_mem(a, src, base, disp);
+}
+
+/** mov dst, [base + index] */
+static void
+emit_load_index(Asm *a, HostReg dst, HostReg base, HostReg index)
+{
+  emit_rex(a, true, dst, index, base); emit1(a, 0x8B);
+  emit_mem_index(a, dst, base, index);
+}
+
+/** mov dst, imm64 in 10 bytes, so that it can be patched */
+static void
+emit_movabs(Asm *a, HostReg dst, uint64_t imm)
+{
+  emit_rex(a, true, 0, 0, dst); emit1(a, 0xB8 | (dst & 7)); emit8(a, imm);
+}
+
+/** mov dst, imm using the shortest encoding */
+static void
+emit_mov_ri(Asm *a, HostReg dst, uint64_t imm)
+{
+  if (imm <= UINT32_MAX) {
+    emit_rex(a, false, 0, 0, dst); emit1(a, 0xB8 | (dst & 7)); emit4(a, imm);
+  }
+  else if ((int64_t)imm == (int32_t)imm) {
+    emit_rex(a, true, 0, 0, dst); emit1(a, 0xC7); emit_modrm(a, 3, 0, dst);
+    emit4(a, imm);
+  }
+  else {
+    emit_movabs(a, dst, imm);
+  }
+}
+
+/** lea dst, [base + disp] */
+static void
+emit_lea(Asm *a, HostReg dst, HostReg base, int32_t disp)
+{
+  emit_rex(a, true, dst, 0, base); emit1(a, 0x8D); emit_mem(a, dst, base, disp);
+}
+
+/** lea dst, [base + index] */
+static void
+emit_lea_index(Asm *a, HostReg dst, HostReg base, HostReg index)
+{
+  emit_rex(a, true, dst, index, base); emit1(a, 0x8D);
+  emit_mem_index(a, dst, base, index);
+}
+
+/** op dst, src for op in aluOps[] */
+static void
+emit_alu_rr(Asm *a, Byte op, HostReg dst, HostReg src)
+{
+  emit_rex(a, true, src, 0, dst); emit1(a, op); emit_modrm(a, 3, src, dst);
+}
+
+/** op [base + disp], src for op in aluOps[] */
+static void
+emit_alu_mr(Asm *a, Byte op, HostReg base, int32_t disp, HostReg src)
+{
+  emit_rex(a, true, src, 0, base); emit1(a, op); emit_mem(a, src, base, disp);
+}
+
+/** setCC byte [base + disp] */
+static void
+emit_setcc(Asm *a, Byte cc, HostReg base, int32_t disp)
+{
+  emit_rex(a, false, 0, 0, base); emit1(a, 0x0F); emit1(a, 0x90 | cc);
+  emit_mem(a, 0, base, disp);
+}
+
+/** cmp reg, [base + disp] */
+static void
+emit_cmp_rm(Asm *a, HostReg reg, HostReg base, int32_t disp)
+{
+  emit_rex(a, true, reg, 0, base); emit1(a, 0x3B); emit_mem(a, reg, base, disp);
+}
+
+/** add (ext 0) or sub (ext 5) qword [base + disp], imm32 */
+static void
+emit_arith_mi(Asm *a, int ext, HostReg base, int32_t disp, int32_t imm)
+{
+  emit_rex(a, true, 0, 0, base); emit1(a, 0x81); emit_mem(a, ext, base, disp);
+  emit4(a, imm);
+}
+
+/** mov dword [base + disp], imm32 */
+static void
+emit_mov_mi32(Asm *a, HostReg base, int32_t disp, uint32_t imm)
+{
+  emit_rex(a, false, 0, 0, base); emit1(a, 0xC7); emit_mem(a, 0, base, disp);
+  emit4(a, imm);
+}
+
+/** movzx dst32, byte [base + disp] */
+static void
+emit_movzx_rm8(Asm *a, HostReg dst, HostReg base, int32_t disp)
+{
+  emit_rex(a, false, dst, 0, base); emit1(a, 0x0F); emit1(a, 0xB6);
+  emit_mem(a, dst, base, disp);
+}
+
+/** op dst8, byte [base + disp] for op xor (0x32) or or (0x0A) */
+static void
+emit_alu_rm8(Asm *a, Byte op, HostReg dst, HostReg base, int32_t disp)
+{
+  emit1(a, 0x40 | ((dst >> 3) & 1) << 2 | ((base >> 3) & 1));
+  emit1(a, op); emit_mem(a, dst, base, disp);
+}
+
+/** test reg32, reg32 */
+static void
+emit_test32(Asm *a, HostReg reg)
+{
+  emit_rex(a, false, reg, 0, reg); emit1(a, 0x85); emit_modrm(a, 3, reg, reg);
+}
+
+static void
+emit_push(Asm *a, HostReg reg)
+{
+  emit_rex(a, false, 0, 0, reg); emit1(a, 0x50 | (reg & 7));
+}
+
+static void
+emit_pop(Asm *a, HostReg reg)
+{
+  emit_rex(a, false, 0, 0, reg); emit1(a, 0x58 | (reg & 7));
+}
+
+/** add (ext 0) or sub (ext 5) rsp, imm8 */
+static void
+emit_adjust_rsp(Asm *a, int ext, int8_t imm)
+{
+  emit1(a, 0x48); emit1(a, 0x83); emit_modrm(a, 3, ext, RSP); emit1(a, imm);
+}
+
+/** jCC rel32; return location of rel32 for patch_rel32() */
+static Byte *
+emit_jcc(Asm *a, Byte cc)
+{
+  emit1(a, 0x0F); emit1(a, 0x80 | cc); emit4(a, 0);
+  return a->p - sizeof(int32_t);
+}
+
+/** jmp rel32; return location of rel32 for patch_rel32() */
+static Byte *
+emit_jmp(Asm *a)
+{
+  emit1(a, 0xE9); emit4(a, 0);
+  return a->p - sizeof(int32_t);
+}
+
+static void
+patch_rel32(Byte *rel32, const Byte *target)
+{
+  int32_t rel = target - (rel32 + sizeof(int32_t));
+  memcpy(rel32, &rel, sizeof(rel));
+}
+
+/************************ Trampolines and Helpers ***********************/
+
+/** Build the entry and exit trampolines at the start of the code
+ *  buffer.  Entry saves callee-saved registers, loads y86 registers
+ *  from the JitContext and jumps to the block; exit reverses this.
+ */
+static void
+emit_trampolines(YJit *yjit)
+{
+  static const HostReg saved[] = { RBX, RBP, R12, R13, R14, R15 };
+  enum { N_SAVED = sizeof(saved)/sizeof(saved[0]) };
+  Asm asm_ = { yjit->code }, *a = &asm_;
+
+  yjit->enter = (void (*)(JitContext *, Byte *))a->p;
+  for (int i = 0; i < N_SAVED; i++) emit_push(a, saved[i]);
+  emit_adjust_rsp(a, 5, 8);            //keep rsp 16-byte aligned
+  emit_mov_rr(a, CTX, RDI);
+  emit_mov_rr(a, TMP1, RSI);
+  emit_load(a, MEM, CTX, CTX_OFFSET(mem));
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (hostRegs[r] != NO_HOST) emit_load(a, hostRegs[r], CTX, REG_OFFSET(r));
+  }
+  emit1(a, 0x41); emit1(a, 0xFF); emit_modrm(a, 3, 4, TMP1);  //jmp r11
+
+  yjit->exitCode = a->p;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (hostRegs[r] != NO_HOST) emit_store(a, CTX, REG_OFFSET(r), hostRegs[r]);
+  }
+  emit_adjust_rsp(a, 0, 8);
+  for (int i = N_SAVED - 1; i >= 0; i--) emit_pop(a, saved[i]);
+  emit1(a, 0xC3);                     //ret
+
+  yjit->codeStart = yjit->codeUsed = a->p - yjit->code;
+}
+
+/** Return true iff any of y86 bytes [addr, addr + size) are covered
+ *  by translated code.
+ */
+static bool
+is_translated(const YJit *yjit, Address addr, Size size)
+{
+  for (Address a = addr; a < addr + size && a < yjit->memSize; a++) {
+    if (yjit->isTranslated[a / 64] & (1ULL << (a % 64))) return true;
+  }
+  return false;
+}
+
+static void
+mark_translated(YJit *yjit, Address addr, Size size)
+{
+  for (Address a = addr; a < addr + size; a++) {
+    yjit->isTranslated[a / 64] |= 1ULL << (a % 64);
+  }
+}
+
+/** Discard all translations. */
+static void
+flush_yjit(YJit *yjit)
+{
+  clear_lazy_mem(yjit->blocks, yjit->memSize * sizeof(yjit->blocks[0]));
+  clear_lazy_mem(yjit->isTranslated,
+                 (yjit->memSize / 64 + 1) * sizeof(yjit->isTranslated[0]));
+  yjit->codeUsed = yjit->codeStart;
+  yjit->generation++;
+}
+
+/** Discard the static analysis of yjit, along with the translations
+ *  which depend on it.
+ */
+static void
+drop_cfg(YJit *yjit)
+{
+  if (yjit->cfg == NULL) return;
+  free_ycfg(yjit->cfg);
+  yjit->cfg = NULL;
+  flush_yjit(yjit);
+}
+
+/** Make sure that any static analysis of yjit covers a run starting at
+ *  pc with the registers in yjit->ctx, analyzing the program afresh if
+ *  it does not.  Since translations are only made from analyzed code
+ *  while an analysis is in use, they are flushed when one is made.
+ */
+static void
+analyze_run(YJit *yjit, Address pc)
+{
+  if (yjit->cfg != NULL) {
+    if (is_covered_ycfg(yjit->cfg, pc, yjit->ctx.regs)) return;
+    drop_cfg(yjit);
+  }
+  if (yjit->nCfgBuilds >= MAX_CFG_BUILDS) return;
+  yjit->nCfgBuilds++;
+  yjit->cfg = new_ycfg(yjit->mem, yjit->memSize, pc, yjit->ctx.regs);
+  if (yjit->cfg != NULL) {
+    flush_yjit(yjit);
+    Address lo;
+    Size size = get_code_ycfg(yjit->cfg, &lo);
+    if (is_written_ysim(yjit->y86, lo, size)) yjit->isStale = true;
+  }
+}
+
+/** Called from translated code to store value at addr, which is
+ *  known to be valid.  Return non-zero iff translated or analyzed code
+ *  was overwritten.
+ */
+static int
+jit_store(JitContext *ctx, Address addr, Word value)
+{
+  YJit *yjit = ctx->yjit;
+  write_memory_word_y86(yjit->y86, addr, value);
+  invalidate_ysim(yjit->y86, addr, sizeof(Word));
+  return is_translated(yjit, addr, sizeof(Word)) ||
+    (yjit->cfg != NULL && is_code_ycfg(yjit->cfg, addr, sizeof(Word)));
+}
+
+/** Called from translated code to store value at addr, which is
+ *  proved to hold neither translated nor analyzed code.
+ */
+static void
+jit_store_data(JitContext *ctx, Address addr, Word value)
+{
+  YJit *yjit = ctx->yjit;
+  write_memory_word_y86(yjit->y86, addr, value);
+  invalidate_ysim(yjit->y86, addr, sizeof(Word));
+}
+
+/***************************** Translation ******************************/
+
+/** A side exit from a block, emitted after the block body */
+typedef struct {
+  Byte *rel32;         /** jump to be patched to stub */
+  Address pc;          /** y86 pc at which to continue */
+  int32_t refund;      /** # of unexecuted instructions to add to budget */
+  ExitReason reason;
+} Stub;
+
+typedef struct {
+  YJit *yjit;
+  Asm a;
+  bool isFlagsLive;    /** host flags hold y86 condition codes */
+  unsigned facts;      /** CFG_ facts for the instruction being translated */
+  int nInstrs;         /** # of y86 instructions in block */
+  int nStubs;
+  Stub stubs[MAX_STUBS];
+} Translation;
+
+/** Record jump rel32 to a side exit to be emitted after the block body */
+static void
+add_stub(Translation *t, Byte *rel32, Address pc, int32_t refund,
+         ExitReason reason)
+{
+  Stub *stub = &t->stubs[t->nStubs++];
+  stub->rel32 = rel32; stub->pc = pc; stub->refund = refund;
+  stub->reason = reason;
+}
+
+static void
+emit_stub(Translation *t, const Stub *stub)
+{
+  Asm *a = &t->a;
+  patch_rel32(stub->rel32, a->p);
+  if (stub->refund != 0) {
+    emit_arith_mi(a, 0, CTX, CTX_OFFSET(budget), stub->refund);
+  }
+  emit_mov_ri(a, TMP0, stub->pc);
+  emit_store(a, CTX, CTX_OFFSET(pc), TMP0);
+  emit_mov_mi32(a, CTX, CTX_OFFSET(reason), stub->reason);
+  patch_rel32(emit_jmp(a), t->yjit->exitCode);
+}
+
+/** Exit to pc target; the exit can later be patched into a direct jump
+ *  to the translation for target.
+ */
+static void
+emit_jump_exit(Translation *t, Address target)
+{
+  Asm *a = &t->a;
+  Byte *site = a->p;
+  emit_movabs(a, TMP0, target);       //at least 5 bytes to patch
+  emit_store(a, CTX, CTX_OFFSET(pc), TMP0);
+  emit_movabs(a, TMP1, (uint64_t)site);
+  emit_store(a, CTX, CTX_OFFSET(exitSite), TMP1);
+  emit_mov_mi32(a, CTX, CTX_OFFSET(reason), EXIT_JUMP);
+  patch_rel32(emit_jmp(a), t->yjit->exitCode);
+}
+
+/** Return host register containing y86 register reg, loading it into
+ *  tmp if necessary.
+ */
+static HostReg
+get_y86_reg(Translation *t, Register reg, HostReg tmp)
+{
+  if (hostRegs[reg] != NO_HOST) return hostRegs[reg];
+  emit_load(&t->a, tmp, CTX, REG_OFFSET(reg));
+  return tmp;
+}
+
+static void
+load_y86_reg(Translation *t, HostReg dst, Register reg)
+{
+  HostReg src = get_y86_reg(t, reg, dst);
+  if (src != dst) emit_mov_rr(&t->a, dst, src);
+}
+
+static void
+set_y86_reg(Translation *t, Register reg, HostReg src)
+{
+  if (hostRegs[reg] == NO_HOST) {
+    emit_store(&t->a, CTX, REG_OFFSET(reg), src);
+  }
+  else if (hostRegs[reg] != src) {
+    emit_mov_rr(&t->a, hostRegs[reg], src);
+  }
+}
+
+/** Leave block for step_ysim() at instruction i unless TMP0 is a valid
+ *  address for a word access or is proved to be one.
+ */
+static void
+emit_bounds_check(Translation *t, int i, Address pc)
+{
+  if (t->facts & CFG_IN_BOUNDS) return;
+  emit_cmp_rm(&t->a, TMP0, CTX, CTX_OFFSET(memLimit));
+  add_stub(t, emit_jcc(&t->a, 0x7 /*a*/), pc, t->nInstrs - i, EXIT_STEP);
+  t->isFlagsLive = false;
+}
+
+/** Store TMP1 at address TMP0 via jit_store() for instruction i,
+ *  leaving the block for pc next if code was overwritten; or via
+ *  jit_store_data() if the store is proved not to overwrite code.
+ */
+static void
+emit_store_call(Translation *t, int i, Address next)
+{
+  enum { N_CALLER_SAVED = sizeof(callerSaved)/sizeof(callerSaved[0]) };
+  Asm *a = &t->a;
+  bool isData = t->facts & CFG_NOT_CODE;
+  for (int j = 0; j < N_CALLER_SAVED; j++) emit_push(a, callerSaved[j]);
+  emit_adjust_rsp(a, 5, 8);
+  emit_mov_rr(a, RDI, CTX);
+  emit_mov_rr(a, RSI, TMP0);
+  emit_mov_rr(a, RDX, TMP1);
+  emit_movabs(a, RAX, isData ? (uint64_t)jit_store_data : (uint64_t)jit_store);
+  emit1(a, 0xFF); emit_modrm(a, 3, 2, RAX);                  //call rax
+  if (!isData) {
+    emit1(a, 0x41); emit1(a, 0x89); emit_modrm(a, 3, RAX, TMP1); //mov r11d, eax
+  }
+  emit_adjust_rsp(a, 0, 8);
+  for (int j = N_CALLER_SAVED - 1; j >= 0; j--) emit_pop(a, callerSaved[j]);
+  if (!isData) {
+    emit_test32(a, TMP1);
+    add_stub(t, emit_jcc(a, CC_NZ), next, t->nInstrs - i - 1, EXIT_FLUSH);
+  }
+  t->isFlagsLive = false;
+}
+
+/** Emit a jump taken iff y86 condition cond is jumpIfTrue; return
+ *  its rel32 for patching.
+ */
+static Byte *
+emit_cond_jump(Translation *t, Condition cond, bool jumpIfTrue)
+{
+  Asm *a = &t->a;
+  Byte cc;
+  if (t->isFlagsLive) {
+    cc = hostConds[cond];
+  }
+  else {
+    //compute condition from flag bytes: non-zero TMP0 iff true
+    switch (cond) {
+    case EQ_COND: case NE_COND:
+      emit_movzx_rm8(a, TMP0, CTX, CTX_OFFSET(zf));
+      break;
+    case LT_COND: case GE_COND:
+      emit_movzx_rm8(a, TMP0, CTX, CTX_OFFSET(sf));
+      emit_alu_rm8(a, 0x32, TMP0, CTX, CTX_OFFSET(of));
+      break;
+    default:
+      emit_movzx_rm8(a, TMP0, CTX, CTX_OFFSET(sf));
+      emit_alu_rm8(a, 0x32, TMP0, CTX, CTX_OFFSET(of));
+      emit_alu_rm8(a, 0x0A, TMP0, CTX, CTX_OFFSET(zf));
+      break;
+    }
+    emit_test32(a, TMP0);
+    bool isTrueNonZero = cond == EQ_COND || cond == LT_COND || cond == LE_COND;
+    cc = isTrueNonZero ? CC_NZ : CC_Z;
+  }
+  return emit_jcc(a, jumpIfTrue ? cc : cc ^ 1);
+}
+
+/** Leave TMP0 containing y86 register base + disp. */
+static void
+emit_address(Translation *t, Register base, Word disp)
+{
+  HostReg b = get_y86_reg(t, base, TMP0);
+  if ((int64_t)disp == (int32_t)disp) {
+    emit_lea(&t->a, TMP0, b, disp);
+  }
+  else {
+    load_y86_reg(t, TMP1, base);
+    emit_mov_ri(&t->a, TMP0, disp);
+    emit_lea_index(&t->a, TMP0, TMP0, TMP1);
+  }
+}
+
+/** Translate instruction d at pc, the i'th instruction of its block. */
+static void
+translate_instr(Translation *t, int i, Address pc, const Decoded *d)
+{
+  Asm *a = &t->a;
+  switch (d->op) {
+  case NOP_CODE:
+    break;
+  case IRMOVQ_CODE:
+    if (hostRegs[d->regB] != NO_HOST) {
+      emit_mov_ri(a, hostRegs[d->regB], d->imm);
+    }
+    else {
+      emit_mov_ri(a, TMP0, d->imm);
+      set_y86_reg(t, d->regB, TMP0);
+    }
+    break;
+  case CMOVxx_CODE: {
+    Byte *skip = NULL;
+    if (d->fn != ALWAYS_COND) skip = emit_cond_jump(t, d->fn, false);
+    set_y86_reg(t, d->regB, get_y86_reg(t, d->regA, TMP1));
+    if (skip != NULL) patch_rel32(skip, a->p);
+    break;
+  }
+  case OP1_CODE: case IOPQ_CODE: {
+    HostReg src = TMP0;
+    if (d->op == IOPQ_CODE) {
+      emit_mov_ri(a, TMP0, d->imm);
+    }
+    else {
+      src = get_y86_reg(t, d->regA, TMP0);
+    }
+    if (hostRegs[d->regB] != NO_HOST) {
+      emit_alu_rr(a, aluOps[d->fn], hostRegs[d->regB], src);
+    }
+    else {
+      emit_alu_mr(a, aluOps[d->fn], CTX, REG_OFFSET(d->regB), src);
+    }
+    emit_setcc(a, CC_O, CTX, CTX_OFFSET(of));
+    emit_setcc(a, CC_S, CTX, CTX_OFFSET(sf));
+    emit_setcc(a, CC_Z, CTX, CTX_OFFSET(zf));
+    t->isFlagsLive = true;
+    break;
+  }
+  case MRMOVQ_CODE:
+    emit_address(t, d->regB, d->imm);
+    emit_bounds_check(t, i, pc);
+    emit_load_index(a, TMP1, MEM, TMP0);
+    set_y86_reg(t, d->regA, TMP1);
+    break;
+  case RMMOVQ_CODE:
+    emit_address(t, d->regB, d->imm);
+    emit_bounds_check(t, i, pc);
+    load_y86_reg(t, TMP1, d->regA);
+    emit_store_call(t, i, d->nextPC);
+    break;
+  case PUSHQ_CODE:
+    emit_lea(a, TMP0, get_y86_reg(t, REG_RSP, TMP0), -(int32_t)sizeof(Word));
+    emit_bounds_check(t, i, pc);
+    load_y86_reg(t, TMP1, d->regA);
+    set_y86_reg(t, REG_RSP, TMP0);
+    emit_store_call(t, i, d->nextPC);
+    break;
+  case POPQ_CODE:
+    load_y86_reg(t, TMP0, REG_RSP);
+    emit_bounds_check(t, i, pc);
+    emit_load_index(a, TMP1, MEM, TMP0);
+    emit_lea(a, TMP0, TMP0, sizeof(Word));
+    set_y86_reg(t, REG_RSP, TMP0);
+    set_y86_reg(t, d->regA, TMP1);
+    break;
+  case CALL_CODE:
+    emit_lea(a, TMP0, get_y86_reg(t, REG_RSP, TMP0), -(int32_t)sizeof(Word));
+    emit_bounds_check(t, i, pc);
+    emit_mov_ri(a, TMP1, d->nextPC);
+    set_y86_reg(t, REG_RSP, TMP0);
+    emit_store_call(t, i, d->imm);
+    emit_jump_exit(t, d->imm);
+    break;
+  case RET_CODE:
+    load_y86_reg(t, TMP0, REG_RSP);
+    emit_bounds_check(t, i, pc);
+    emit_load_index(a, TMP1, MEM, TMP0);
+    emit_cmp_rm(a, TMP1, CTX, CTX_OFFSET(memSize));
+    add_stub(t, emit_jcc(a, 0x3 /*ae*/), pc, t->nInstrs - i, EXIT_STEP);
+    emit_lea(a, TMP0, TMP0, sizeof(Word));
+    set_y86_reg(t, REG_RSP, TMP0);
+    emit_store(a, CTX, CTX_OFFSET(pc), TMP1);
+    emit_mov_mi32(a, CTX, CTX_OFFSET(reason), EXIT_INDIRECT);
+    patch_rel32(emit_jmp(a), t->yjit->exitCode);
+    break;
+  case Jxx_CODE:
+    if (d->fn == ALWAYS_COND) {
+      emit_jump_exit(t, d->imm);
+    }
+    else {
+      Byte *taken = emit_cond_jump(t, d->fn, true);
+      emit_jump_exit(t, d->nextPC);
+      patch_rel32(taken, a->p);
+      emit_jump_exit(t, d->imm);
+    }
+    break;
+  default:
+    fatal("yjit: unexpected opcode %d\n", d->op);
+  }
+}
+
+/** Translate the basic block starting at pc into native code.  Return
+ *  its entry point, or NULL if the first instruction must be run by
+ *  step_ysim().
+ */
+static Byte *
+translate_block(YJit *yjit, Address pc)
+{
+  Decoded instrs[MAX_BLOCK_INSTRS];
+  Address pcs[MAX_BLOCK_INSTRS];
+  int n = 0;
+  bool isExtended = get_extensions_ysim(yjit->y86);
+  bool isEnded = false;
+  for (Address p = pc; n < MAX_BLOCK_INSTRS && !isEnded; n++) {
+    Decoded *d = &instrs[n];
+    //casq, traps and extensions other than the OPq's with immediates
+    //are left to step_ysim()
+    if (!decode_instr(yjit->mem, yjit->memSize, p, d) ||
+        d->op == HALT_CODE || d->op == CASQ_CODE || d->op == TRAP_CODE ||
+        (is_extension(d) && (d->op != IOPQ_CODE || !isExtended))) {
+      break;
+    }
+    bool hasTarget = d->op == Jxx_CODE || d->op == CALL_CODE;
+    if (hasTarget && d->imm >= yjit->memSize) break;  //bad pc: step_ysim()
+    pcs[n] = p;
+    isEnded = d->op == Jxx_CODE || d->op == CALL_CODE || d->op == RET_CODE;
+    p = d->nextPC;
+  }
+  if (n == 0) return NULL;
+  if (CODE_BUFFER_SIZE - yjit->codeUsed < MAX_BLOCK_CODE) flush_yjit(yjit);
+
+  Translation t;
+  t.yjit = yjit;
+  t.a.p = yjit->code + yjit->codeUsed;
+  t.isFlagsLive = false;
+  t.nInstrs = n;
+  t.nStubs = 0;
+  Byte *entry = t.a.p;
+  emit_arith_mi(&t.a, 5, CTX, CTX_OFFSET(budget), n);
+  add_stub(&t, emit_jcc(&t.a, CC_L), pc, n, EXIT_BUDGET);
+  for (int i = 0; i < n; i++) {
+    t.facts = (yjit->cfg == NULL) ? 0 : get_facts_ycfg(yjit->cfg, pcs[i]);
+    translate_instr(&t, i, pcs[i], &instrs[i]);
+    mark_translated(yjit, pcs[i], instrs[i].size);
+  }
+  if (!isEnded) emit_jump_exit(&t, instrs[n - 1].nextPC);
+  for (int i = 0; i < t.nStubs; i++) emit_stub(&t, &t.stubs[i]);
+  yjit->codeUsed = t.a.p - yjit->code;
+  yjit->blocks[pc] = entry;
+  Size size = pcs[n - 1] + instrs[n - 1].size - pc;
+  if (is_written_ysim(yjit->y86, pc, size)) yjit->isStale = true;
+  return entry;
+}
+
+/*************************** Running Translations ***********************/
+
+YJit *
+new_yjit(Y86 *y86)
+{
+  YJit *yjit = callocChk(1, sizeof(YJit));
+  yjit->y86 = y86;
+  yjit->mem = get_memory_pointer_y86(y86, 0);
+  yjit->memSize = get_memory_size_y86(y86);
+  yjit->code = mmap(NULL, CODE_BUFFER_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (yjit->code == MAP_FAILED) fatal("cannot map code buffer:");
+  yjit->blocks = new_lazy_mem(yjit->memSize * sizeof(yjit->blocks[0]));
+  yjit->isTranslated =
+    new_lazy_mem((yjit->memSize / 64 + 1) * sizeof(yjit->isTranslated[0]));
+  yjit->ctx.mem = yjit->mem;
+  yjit->ctx.memSize = yjit->memSize;
+  yjit->ctx.memLimit = yjit->memSize - sizeof(Word);
+  yjit->ctx.yjit = yjit;
+  emit_trampolines(yjit);
+  return yjit;
+}
+
+void
+free_yjit(YJit *yjit)
+{
+  if (yjit->cfg != NULL) free_ycfg(yjit->cfg);
+  munmap(yjit->code, CODE_BUFFER_SIZE);
+  free_lazy_mem(yjit->blocks, yjit->memSize * sizeof(yjit->blocks[0]));
+  free_lazy_mem(yjit->isTranslated,
+                (yjit->memSize / 64 + 1) * sizeof(yjit->isTranslated[0]));
+  free(yjit);
+}
+
+void
+reset_yjit(YJit *yjit)
+{
+  //code read only from unwritten memory is unchanged by the restore
+  if (!yjit->isStale) return;
+  if (yjit->cfg != NULL) drop_cfg(yjit); else flush_yjit(yjit);
+  yjit->isStale = false;
+}
+
+/** Copy y86 registers and condition codes into yjit->ctx. */
+static void
+load_context(YJit *yjit)
+{
+  JitContext *ctx = &yjit->ctx;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    ctx->regs[r] = read_register_y86(yjit->y86, r);
+  }
+  Byte cc = read_cc_y86(yjit->y86);
+  ctx->of = (cc >> OF_CC) & 1;
+  ctx->sf = (cc >> SF_CC) & 1;
+  ctx->zf = (cc >> ZF_CC) & 1;
+}
+
+/** Copy yjit->ctx registers and condition codes and pc into y86,
+ *  writing only values which changed.
+ */
+static void
+store_context(YJit *yjit, Address pc)
+{
+  Y86 *y86 = yjit->y86;
+  JitContext *ctx = &yjit->ctx;
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (read_register_y86(y86, r) != ctx->regs[r]) {
+      write_register_y86(y86, r, ctx->regs[r]);
+    }
+  }
+  Byte cc = ctx->of << OF_CC | ctx->sf << SF_CC | ctx->zf << ZF_CC;
+  if (read_cc_y86(y86) != cc) write_cc_y86(y86, cc);
+  if (read_pc_y86(y86) != pc) write_pc_y86(y86, pc);
+}
+
+/** Return true with [*addr, *addr + *size) set to the memory which
+ *  the instruction at pc would write, if any.
+ */
+static bool
+get_write_range(YJit *yjit, Address pc, Address *addr, Size *size)
+{
+  if (pc >= yjit->memSize) return false;
+  BaseOpCode op = get_nybble(yjit->mem[pc], 1);
+  Y86 *y86 = yjit->y86;
+  *size = sizeof(Word);
+  switch (op) {
+  case RMMOVQ_CODE: case CASQ_CODE:
+    if (yjit->memSize - pc < MAX_INSTR_SIZE) return false;
+    Word disp = 0;
+    for (int i = sizeof(Word) - 1; i >= 0; i--) {
+      disp = (disp << BYTE_BITS) | yjit->mem[pc + 2 + i];
+    }
+    *addr = read_register_y86(y86, get_nybble(yjit->mem[pc + 1], 0)) + disp;
+    return true;
+  case PUSHQ_CODE: case CALL_CODE:
+    *addr = read_register_y86(y86, REG_RSP) - sizeof(Word);
+    return true;
+  case BLOCK_CODE: {
+    //the first word outside memory faults
+    if (yjit->memSize - pc < 2) return false;
+    *addr = read_register_y86(y86, get_nybble(yjit->mem[pc + 1], 0));
+    if (*addr >= yjit->memSize) return false;
+    Word n = read_register_y86(y86, REG_RCX);
+    Size limit = yjit->memSize - *addr;
+    *size = (n > limit / sizeof(Word)) ? limit : n * sizeof(Word);
+    return true;
+  }
+  case TRAP_CODE: {
+    //a trap may write only its buffer
+    *addr = read_register_y86(y86, REG_RSI);
+    if (*addr >= yjit->memSize) return false;
+    Word n = read_register_y86(y86, REG_RDX);
+    *size = (n > yjit->memSize - *addr) ? yjit->memSize - *addr : n;
+    return *size > 0;
+  }
+  default:
+    return false;
+  }
+}
+
+/** Run the instruction at pc using step_ysim(), keeping translations
+ *  and the static analysis consistent with any memory it writes and
+ *  the state it leads to.
+ */
+static void
+step_instr(YJit *yjit, Address pc)
+{
+  store_context(yjit, pc);
+  Address addr = 0;
+  Size size = 0;
+  bool isWrite = get_write_range(yjit, pc, &addr, &size);
+  step_ysim(yjit->y86);
+  YCfg *cfg = yjit->cfg;
+  if (isWrite && cfg != NULL && is_code_ycfg(cfg, addr, size)) {
+    drop_cfg(yjit);
+  }
+  else if (isWrite && is_translated(yjit, addr, size)) {
+    flush_yjit(yjit);
+  }
+  load_context(yjit);
+  if (yjit->cfg != NULL &&
+      !is_covered_ycfg(yjit->cfg, read_pc_y86(yjit->y86), yjit->ctx.regs)) {
+    drop_cfg(yjit);
+  }
+}
+
+uint64_t
+run_yjit(YJit *yjit, uint64_t maxSteps)
+{
+  Y86 *y86 = yjit->y86;
+  JitContext *ctx = &yjit->ctx;
+  uint64_t nSteps = 0;
+  if (read_status_y86(y86) != STATUS_AOK || yjit->memSize < MAX_INSTR_SIZE) {
+    return run_ysim(y86, maxSteps);
+  }
+  load_context(yjit);
+  Address pc = read_pc_y86(y86);
+  analyze_run(yjit, pc);
+  while (nSteps < maxSteps) {
+    if (pc >= yjit->memSize) {
+      store_context(yjit, pc);    //let write_pc_y86() report bad pc
+      return nSteps;
+    }
+    Byte *entry = yjit->blocks[pc];
+    if (entry == NULL) entry = translate_block(yjit, pc);
+    if (entry == NULL) {
+      step_instr(yjit, pc);
+      nSteps++;
+      if (read_status_y86(y86) != STATUS_AOK) return nSteps;
+      pc = read_pc_y86(y86);
+      continue;
+    }
+    uint64_t budget = maxSteps - nSteps;
+    ctx->budget = (budget > INT64_MAX) ? INT64_MAX : budget;
+    int64_t budget0 = ctx->budget;
+    yjit->enter(ctx, entry);
+    nSteps += budget0 - ctx->budget;
+    pc = ctx->pc;
+    switch (ctx->reason) {
+    case EXIT_JUMP: {
+      if (pc >= yjit->memSize) break;
+      unsigned generation = yjit->generation;
+      Byte *target = yjit->blocks[pc];
+      if (target == NULL) target = translate_block(yjit, pc);
+      if (target != NULL && generation == yjit->generation) {
+        Byte *site = ctx->exitSite;
+        site[0] = 0xE9;               //jmp rel32
+        patch_rel32(site + 1, target);
+      }
+      break;
+    }
+    case EXIT_INDIRECT:
+      //the analysis assumes that ret only returns after analyzed calls
+      if (yjit->cfg != NULL && !is_return_site_ycfg(yjit->cfg, pc)) {
+        drop_cfg(yjit);
+      }
+      break;
+    case EXIT_FLUSH:
+      if (yjit->cfg != NULL) drop_cfg(yjit); else flush_yjit(yjit);
+      break;
+    case EXIT_STEP: case EXIT_BUDGET:
+      if (nSteps == maxSteps) break;
+      step_instr(yjit, pc);
+      nSteps++;
+      if (read_status_y86(y86) != STATUS_AOK) return nSteps;
+      pc = read_pc_y86(y86);
+      break;
+    }
+  }
+  store_context(yjit, pc);
+  return nSteps;
+}
+
+#else //!defined(__x86_64__)
+
+struct YJitStruct {
+  Y86 *y86;
+};
+
+YJit *
+new_yjit(Y86 *y86)
+{
+  YJit *yjit = mallocChk(sizeof(YJit));
+  yjit->y86 = y86;
+  return yjit;
+}
+
+void
+free_yjit(YJit *yjit)
+{
+  free(yjit);
+}
+
+void
+reset_yjit(YJit *yjit)
+{
+}
+
+uint64_t
+run_yjit(YJit *yjit, uint64_t maxSteps)
+{
+  return run_ysim(yjit->y86, maxSteps);
+}
+
+#endif //if defined(__x86_64__)
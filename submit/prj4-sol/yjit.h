@@ -0,0 +1,37 @@
+#ifndef _YJIT_H
+#define _YJIT_H
+
+#include "y86.h"
+
+/** An opaque structure holding native translations of y86 code. */
+typedef struct YJitStruct YJit;
+
+/** Create a new translator which runs y86 as native x86-64 code.  On
+ *  other hosts, run_yjit() simply uses run_ysim().
+ */
+YJit *new_yjit(Y86 *y86);
+
+/** Free all resources allocated by new_yjit() in yjit. */
+void free_yjit(YJit *yjit);
+
+/** Prepare yjit to run its y86 again after restore_y86() has returned
+ *  it to the snapshot of its previous restore or of the fork_y86()
+ *  which made it.  Only translations and analysis made from memory
+ *  written since then are discarded, so code translated in one run is
+ *  reused by the next.
+ */
+void reset_yjit(YJit *yjit);
+
+/** Run the y86 for yjit until it halts, faults or has executed
+ *  maxSteps instructions.  Return the number of instructions
+ *  executed.  The resulting state is identical to that produced by
+ *  the same number of step_ysim() calls.
+ *
+ *  Translations are invalidated by memory writes made while running;
+ *  if memory or the set_extensions_ysim() setting is changed in any
+ *  other way after the first call, yjit must be freed and a new one
+ *  created, or reset using reset_yjit() after a restore_y86().
+ */
+uint64_t run_yjit(YJit *yjit, uint64_t maxSteps);
+
+#endif //ifndef _YJIT_H
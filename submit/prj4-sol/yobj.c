@@ -0,0 +1,533 @@
+#include "yobj.h"
+
+#include "yas.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* An object image consists of an ObjHeader, followed by nSegments
+ * ObjSegment's, followed by nSymbols symbols (each an ObjSymbol
+ * followed by the bytes of its name), followed by the contents of the
+ * segments, each starting at a multiple of OBJ_ALIGN.  Everything is
+ * in host byte order.
+ *
+ * Segments are the runs of OBJ_ALIGN-byte pages of memory which are
+ * not all zero, so memory which the program leaves zero is neither
+ * stored nor touched when loading.
+ */
+
+enum {
+  OBJ_VERSION = 1,
+  OBJ_ALIGN = 4096,         /** alignment of segments in memory and file */
+};
+
+static const char OBJ_MAGIC[4] = { 'Y', '8', '6', 'O' };
+
+typedef struct {
+  char magic[4];            /** OBJ_MAGIC */
+  uint32_t version;         /** OBJ_VERSION */
+  uint64_t memSize;         /** size of memory program was loaded into */
+  uint64_t sourceHash;      /** hash of contents of .ys files */
+  uint64_t entry;           /** pc after loading */
+  uint32_t nSegments;
+  uint32_t nSymbols;
+} ObjHeader;
+
+typedef struct {
+  uint64_t addr;            /** y86 address of first byte */
+  uint64_t size;            /** # of bytes */
+  uint64_t offset;          /** offset of contents in file */
+} ObjSegment;
+
+typedef struct {
+  uint64_t addr;            /** y86 address of label */
+  uint32_t nameLen;         /** # of bytes in following name */
+  uint32_t pad;
+} ObjSymbol;
+
+/** A label defined by a program. */
+typedef struct {
+  Address addr;
+  char *name;
+} Symbol;
+
+struct YSymbolsStruct {
+  int n;
+  Symbol *symbols;
+};
+
+/** Return FNV-1a hash of the n bytes at p, continuing from hash. */
+static uint64_t
+hash_bytes(uint64_t hash, const void *p, size_t n)
+{
+  const Byte *bytes = p;
+  for (size_t i = 0; i < n; i++) hash = (hash ^ bytes[i]) * 0x100000001b3UL;
+  return hash;
+}
+
+/** Set *hash to a hash of the contents of the numFiles yasFiles[].
+ *  Return false if any of them cannot be read.
+ */
+static bool
+hash_sources(int numFiles, const char *yasFiles[], uint64_t *hash)
+{
+  uint64_t h = hash_bytes(0xcbf29ce484222325UL, &numFiles, sizeof(numFiles));
+  for (int i = 0; i < numFiles; i++) {
+    FILE *in = fopen(yasFiles[i], "rb");
+    if (in == NULL) return false;
+    Byte buf[BUFSIZ];
+    uint64_t size = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+      h = hash_bytes(h, buf, n);
+      size += n;
+    }
+    bool isOk = !ferror(in);
+    fclose(in);
+    if (!isOk) return false;
+    h = hash_bytes(h, &size, sizeof(size));  //separate consecutive files
+  }
+  *hash = h;
+  return true;
+}
+
+/************************** Writing an Image ***************************/
+
+/** Return # of bytes in page p of memory of size memSize. */
+static inline Size
+obj_page_size(Size memSize, Address p)
+{
+  Address addr = p * OBJ_ALIGN;
+  return (memSize - addr < OBJ_ALIGN) ? memSize - addr : OBJ_ALIGN;
+}
+
+/** Return the segments of the memSize bytes at mem, setting *nSegments
+ *  to their number.  The caller must free the result.
+ */
+static ObjSegment *
+find_segments(const Byte mem[], Size memSize, uint32_t *nSegments)
+{
+  ObjSegment *segments = NULL;
+  uint32_t n = 0;
+  Size nPages = (memSize + OBJ_ALIGN - 1) / OBJ_ALIGN;
+  bool isInSegment = false;
+  for (Address p = 0; p < nPages; p++) {
+    Size size = obj_page_size(memSize, p);
+    const Byte *page = &mem[p * OBJ_ALIGN];
+    Size i = 0;
+    while (i < size && page[i] == 0) i++;
+    if (i == size) {
+      isInSegment = false;
+    }
+    else if (isInSegment) {
+      segments[n - 1].size += size;
+    }
+    else {
+      segments = reallocChk(segments, (n + 1) * sizeof(ObjSegment));
+      segments[n++] = (ObjSegment) { .addr = p * OBJ_ALIGN, .size = size };
+      isInSegment = true;
+    }
+  }
+  *nSegments = n;
+  return segments;
+}
+
+/** Add the label of nameLen bytes at name for addr to symbols. */
+static void
+add_symbol(YSymbols *symbols, Address addr, const char *name, size_t nameLen)
+{
+  int i = symbols->n++;
+  symbols->symbols =
+    reallocChk(symbols->symbols, symbols->n * sizeof(Symbol));
+  symbols->symbols[i].addr = addr;
+  symbols->symbols[i].name = strndup(name, nameLen);
+  if (symbols->symbols[i].name == NULL) fatal("cannot allocate symbol:");
+}
+
+/** If line of a listing defines a label, add it to symbols.  A label
+ *  follows the '|' which separates the source from the address and
+ *  code.
+ */
+static void
+add_listing_symbol(YSymbols *symbols, const char *line)
+{
+  const char *p = line;
+  while (isspace(*p)) p++;
+  char *end;
+  Address addr = strtoul(p, &end, 16);
+  if (end == p || *end != ':') return;
+  const char *source = strchr(end, '|');
+  if (source == NULL) return;
+  source++;
+  while (isspace(*source)) source++;
+  const char *q = source;
+  if (!isalpha(*q) && *q != '_' && *q != '.') return;
+  while (isalnum(*q) || *q == '_' || *q == '.') q++;
+  if (*q != ':') return;
+  add_symbol(symbols, addr, source, q - source);
+}
+
+/** Return the labels in the listing of the numFiles yasFiles[]. */
+static YSymbols
+get_symbols(int numFiles, const char *yasFiles[])
+{
+  YSymbols symbols = { .n = 0, .symbols = NULL };
+  char *listing = NULL;
+  size_t listingSize = 0;
+  FILE *out = open_memstream(&listing, &listingSize);
+  if (out == NULL) fatal("cannot create listing stream:");
+  yas_to_listing(out, numFiles, yasFiles);
+  if (fclose(out) != 0) fatal("cannot write listing stream:");
+  for (char *line = strtok(listing, "\n"); line != NULL;
+       line = strtok(NULL, "\n")) {
+    add_listing_symbol(&symbols, line);
+  }
+  free(listing);
+  return symbols;
+}
+
+static void
+free_symbols(YSymbols *symbols)
+{
+  for (int i = 0; i < symbols->n; i++) free(symbols->symbols[i].name);
+  free(symbols->symbols);
+}
+
+/** Write to out the image of memory mem described by header, with
+ *  its segments[] and symbols.  Return false on a write error.
+ */
+static bool
+write_obj_image(FILE *out, const ObjHeader *header,
+                const ObjSegment segments[], const YSymbols *symbols,
+                const Byte mem[])
+{
+  //stdio errors are sticky: a failed write is caught by ferror() below
+  fwrite(header, sizeof(*header), 1, out);
+  fwrite(segments, sizeof(ObjSegment), header->nSegments, out);
+  for (int i = 0; i < symbols->n; i++) {
+    ObjSymbol symbol = {
+      .addr = symbols->symbols[i].addr,
+      .nameLen = strlen(symbols->symbols[i].name),
+    };
+    fwrite(&symbol, sizeof(symbol), 1, out);
+    fwrite(symbols->symbols[i].name, 1, symbol.nameLen, out);
+  }
+  for (uint32_t i = 0; i < header->nSegments; i++) {
+    if (fseeko(out, segments[i].offset, SEEK_SET) != 0) return false;
+    fwrite(&mem[segments[i].addr], 1, segments[i].size, out);
+  }
+  return !ferror(out);
+}
+
+/** Write the object image of the program in y86, whose sources hash to
+ *  sourceHash, to objFileName.  Return false if it cannot be written,
+ *  after reporting why with error().
+ */
+static bool
+write_obj(const char *objFileName, Y86 *y86, uint64_t sourceHash,
+          int numFiles, const char *yasFiles[])
+{
+  const Byte *mem = get_memory_pointer_y86(y86, 0);
+  ObjHeader header = {
+    .version = OBJ_VERSION,
+    .memSize = get_memory_size_y86(y86),
+    .sourceHash = sourceHash,
+    .entry = read_pc_y86(y86),
+  };
+  memcpy(header.magic, OBJ_MAGIC, sizeof(header.magic));
+  ObjSegment *segments = find_segments(mem, header.memSize, &header.nSegments);
+  YSymbols symbols = get_symbols(numFiles, yasFiles);
+  header.nSymbols = symbols.n;
+
+  uint64_t offset = sizeof(header) + header.nSegments * sizeof(ObjSegment);
+  for (int i = 0; i < symbols.n; i++) {
+    offset += sizeof(ObjSymbol) + strlen(symbols.symbols[i].name);
+  }
+  for (uint32_t i = 0; i < header.nSegments; i++) {
+    offset = (offset + OBJ_ALIGN - 1) / OBJ_ALIGN * OBJ_ALIGN;
+    segments[i].offset = offset;
+    offset += segments[i].size;
+  }
+
+  FILE *out = fopen(objFileName, "wb");
+  bool isOk = false;
+  if (out == NULL) {
+    error("cannot create object file %s:", objFileName);
+  }
+  else {
+    isOk = write_obj_image(out, &header, segments, &symbols, mem);
+    if (fclose(out) != 0) isOk = false;
+    if (!isOk) error("cannot write object file %s:", objFileName);
+  }
+  free_symbols(&symbols);
+  free(segments);
+  return isOk;
+}
+
+void
+write_yobj(const char *objFileName, Y86 *y86,
+           int numFiles, const char *yasFiles[])
+{
+  uint64_t sourceHash = 0;
+  if (!hash_sources(numFiles, yasFiles, &sourceHash)) {
+    fatal("cannot read sources for object file %s:", objFileName);
+  }
+  if (!write_obj(objFileName, y86, sourceHash, numFiles, yasFiles)) exit(1);
+}
+
+/************************** Reading an Image ***************************/
+
+/** Read the header of objFileName into *header.  Return false if it
+ *  cannot be read or is not an object image for this host.
+ */
+static bool
+read_obj_header(const char *objFileName, ObjHeader *header)
+{
+  FILE *in = fopen(objFileName, "rb");
+  if (in == NULL) return false;
+  bool isOk = fread(header, sizeof(*header), 1, in) == 1 &&
+    memcmp(header->magic, OBJ_MAGIC, sizeof(header->magic)) == 0 &&
+    header->version == OBJ_VERSION;
+  fclose(in);
+  return isOk;
+}
+
+bool
+is_yobj(const char *fileName)
+{
+  ObjHeader header;
+  return read_obj_header(fileName, &header);
+}
+
+/** A mapped object image. */
+typedef struct {
+  const Byte *image;
+  Size fileSize;
+  ObjHeader header;
+  const ObjSegment *segments;
+  Size symbolsOffset;       /** offset of symbol table in image */
+} ObjImage;
+
+/** Map the object image in objFileName into *obj, checking that its
+ *  segment and symbol tables lie within it.  It is a fatal error if it
+ *  cannot be read or is invalid.
+ */
+static void
+map_obj(const char *objFileName, ObjImage *obj)
+{
+  int fd = open(objFileName, O_RDONLY);
+  if (fd < 0) fatal("cannot open object file %s:", objFileName);
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    fatal("cannot stat object file %s:", objFileName);
+  }
+  Size fileSize = fileStat.st_size;
+  if (fileSize < sizeof(ObjHeader)) fatal("%s: bad object file", objFileName);
+  const Byte *image = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED) fatal("cannot map object file %s:", objFileName);
+  close(fd);
+
+  ObjHeader header;
+  memcpy(&header, image, sizeof(header));
+  if (memcmp(header.magic, OBJ_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != OBJ_VERSION ||
+      (fileSize - sizeof(header)) / sizeof(ObjSegment) < header.nSegments) {
+    fatal("%s: bad object file", objFileName);
+  }
+  Size offset = sizeof(header) + header.nSegments * sizeof(ObjSegment);
+  obj->symbolsOffset = offset;
+  for (uint32_t i = 0; i < header.nSymbols; i++) {
+    ObjSymbol symbol;
+    if (fileSize - offset < sizeof(symbol)) {
+      fatal("%s: bad object file", objFileName);
+    }
+    memcpy(&symbol, &image[offset], sizeof(symbol));
+    offset += sizeof(symbol);
+    if (fileSize - offset < symbol.nameLen) {
+      fatal("%s: bad object file", objFileName);
+    }
+    offset += symbol.nameLen;
+  }
+  obj->image = image;
+  obj->fileSize = fileSize;
+  obj->header = header;
+  obj->segments = (const ObjSegment *)(image + sizeof(header));
+}
+
+static void
+unmap_obj(ObjImage *obj)
+{
+  munmap((void *)obj->image, obj->fileSize);
+}
+
+void
+read_yobj(Y86 *y86, const char *objFileName)
+{
+  ObjImage obj;
+  map_obj(objFileName, &obj);
+  Byte *mem = get_memory_pointer_y86(y86, 0);
+  Size memSize = get_memory_size_y86(y86);
+  for (uint32_t i = 0; i < obj.header.nSegments; i++) {
+    ObjSegment seg;
+    memcpy(&seg, &obj.segments[i], sizeof(seg));
+    if (seg.offset > obj.fileSize || seg.size > obj.fileSize - seg.offset) {
+      fatal("%s: bad object file", objFileName);
+    }
+    if (seg.addr > memSize || seg.size > memSize - seg.addr) {
+      fatal("%s: segment at %lx does not fit in memory of %lu bytes",
+            objFileName, (unsigned long)seg.addr, (unsigned long)memSize);
+    }
+    memcpy(&mem[seg.addr], &obj.image[seg.offset], seg.size);
+  }
+  if (read_pc_y86(y86) != obj.header.entry) {
+    write_pc_y86(y86, obj.header.entry);
+  }
+  unmap_obj(&obj);
+}
+
+/** Return the symbol table of the object image in objFileName. */
+static YSymbols
+read_symbols(const char *objFileName)
+{
+  YSymbols symbols = { .n = 0, .symbols = NULL };
+  ObjImage obj;
+  map_obj(objFileName, &obj);
+  Size offset = obj.symbolsOffset;
+  for (uint32_t i = 0; i < obj.header.nSymbols; i++) {
+    ObjSymbol symbol;
+    memcpy(&symbol, &obj.image[offset], sizeof(symbol));
+    offset += sizeof(symbol);
+    add_symbol(&symbols, symbol.addr, (const char *)&obj.image[offset],
+               symbol.nameLen);
+    offset += symbol.nameLen;
+  }
+  unmap_obj(&obj);
+  return symbols;
+}
+
+/*************************** Symbol Lookup *****************************/
+
+static int
+compare_symbols(const void *p1, const void *p2)
+{
+  const Symbol *s1 = p1, *s2 = p2;
+  if (s1->addr != s2->addr) return (s1->addr > s2->addr) ? 1 : -1;
+  return strcmp(s1->name, s2->name);
+}
+
+YSymbols *
+new_ysymbols(int numFiles, const char *fileNames[])
+{
+  YSymbols *symbols = mallocChk(sizeof(YSymbols));
+  *symbols = (numFiles == 1 && is_yobj(fileNames[0]))
+    ? read_symbols(fileNames[0])
+    : get_symbols(numFiles, fileNames);
+  qsort(symbols->symbols, symbols->n, sizeof(Symbol), compare_symbols);
+  return symbols;
+}
+
+void
+free_ysymbols(YSymbols *symbols)
+{
+  free_symbols(symbols);
+  free(symbols);
+}
+
+const char *
+find_ysymbols(const YSymbols *symbols, Address addr, Address *offset)
+{
+  //binary search for the last symbol at or before addr
+  int lo = 0, hi = symbols->n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (symbols->symbols[mid].addr <= addr) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) return NULL;
+  //the first of several labels at the same address
+  Address symAddr = symbols->symbols[lo - 1].addr;
+  while (lo > 1 && symbols->symbols[lo - 2].addr == symAddr) lo--;
+  *offset = addr - symAddr;
+  return symbols->symbols[lo - 1].name;
+}
+
+/**************************** Object Cache *****************************/
+
+/** Return the name of the file in cacheDir for sources with hash.  The
+ *  caller must free the result.
+ */
+static char *
+cache_file_name(const char *cacheDir, uint64_t hash)
+{
+  const char *fmt = "%s/%016lx.yobj";
+  size_t size = snprintf(NULL, 0, fmt, cacheDir, (unsigned long)hash) + 1;
+  char *name = mallocChk(size);
+  snprintf(name, size, fmt, cacheDir, (unsigned long)hash);
+  return name;
+}
+
+/** Add the program in y86 to cacheDir as objFileName.  The image is
+ *  renamed into place so that concurrent runs never see a partial
+ *  image.  Failures are reported but are not fatal: the program is
+ *  simply not cached.
+ */
+static void
+add_to_cache(const char *cacheDir, const char *objFileName, Y86 *y86,
+             uint64_t hash, int numFiles, const char *yasFiles[])
+{
+  if (mkdir(cacheDir, 0777) != 0 && errno != EEXIST) {
+    error("cannot create cache directory %s:", cacheDir);
+    return;
+  }
+  const char *fmt = "%s.%ld.tmp";
+  size_t size = snprintf(NULL, 0, fmt, objFileName, (long)getpid()) + 1;
+  char tmpName[size];
+  snprintf(tmpName, size, fmt, objFileName, (long)getpid());
+  if (!write_obj(tmpName, y86, hash, numFiles, yasFiles)) {
+    unlink(tmpName);
+  }
+  else if (rename(tmpName, objFileName) != 0) {
+    error("cannot rename %s to %s:", tmpName, objFileName);
+    unlink(tmpName);
+  }
+}
+
+bool
+load_yobj(Y86 *y86, int numFiles, const char *fileNames[],
+          const char *cacheDir)
+{
+  if (numFiles == 1 && is_yobj(fileNames[0])) {
+    read_yobj(y86, fileNames[0]);
+    return true;
+  }
+  uint64_t hash;
+  if (cacheDir == NULL || !hash_sources(numFiles, fileNames, &hash)) {
+    return yas_to_y86(y86, numFiles, fileNames);
+  }
+  char *objFileName = cache_file_name(cacheDir, hash);
+  ObjHeader header;
+  bool isOk = true;
+  if (read_obj_header(objFileName, &header) && header.sourceHash == hash) {
+    read_yobj(y86, objFileName);
+  }
+  else if ((isOk = yas_to_y86(y86, numFiles, fileNames))) {
+    add_to_cache(cacheDir, objFileName, y86, hash, numFiles, fileNames);
+  }
+  free(objFileName);
+  return isOk;
+}
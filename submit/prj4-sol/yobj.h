@@ -0,0 +1,53 @@
+#ifndef _YOBJ_H
+#define _YOBJ_H
+
+#include "y86.h"
+
+/** Write an object image of the program loaded in y86 to objFileName.
+ *  The program must have just been assembled from the numFiles .ys
+ *  files yasFiles[]; their contents are hashed into the image and
+ *  their labels recorded in its symbol table.
+ */
+void write_yobj(const char *objFileName, Y86 *y86,
+                int numFiles, const char *yasFiles[]);
+
+/** Return true iff fileName names a y86 object image. */
+bool is_yobj(const char *fileName);
+
+/** Load the object image in objFileName into y86 by mapping it and
+ *  copying its segments into y86 memory.  Loaded memory is not
+ *  reported as changed by dump_changes_y86().  It is a fatal error if
+ *  the image is invalid or does not fit in y86 memory.
+ */
+void read_yobj(Y86 *y86, const char *objFileName);
+
+/** Load the program in the numFiles fileNames[] into y86, returning
+ *  true iff there were no errors.  A single object image is loaded
+ *  directly; otherwise fileNames[] are .ys files.  If cacheDir is not
+ *  NULL, it holds object images named by a hash of the contents of
+ *  the .ys files: an image in the cache is loaded instead of
+ *  assembling, and a newly assembled program is added to the cache.
+ */
+bool load_yobj(Y86 *y86, int numFiles, const char *fileNames[],
+               const char *cacheDir);
+
+/** An opaque structure holding the labels defined by a program. */
+typedef struct YSymbolsStruct YSymbols;
+
+/** Return the labels of the program in the numFiles fileNames[], which
+ *  are as for load_yobj(): those in the symbol table of a single object
+ *  image, otherwise those defined in the .ys files.
+ */
+YSymbols *new_ysymbols(int numFiles, const char *fileNames[]);
+
+/** Free all resources allocated by new_ysymbols(). */
+void free_ysymbols(YSymbols *symbols);
+
+/** Return the label in symbols closest at or before addr, setting
+ *  *offset to the distance of addr beyond it.  Return NULL if there is
+ *  no such label.
+ */
+const char *find_ysymbols(const YSymbols *symbols, Address addr,
+                          Address *offset);
+
+#endif //ifndef _YOBJ_H
@@ -0,0 +1,175 @@
+#ifndef _YOPS_H
+#define _YOPS_H
+
+#include "decode.h"
+#include "y86.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Condition codes and operations shared by ysim and the cores of
+ * ycores, which must give instructions the same semantics.
+ */
+
+/** accessing condition code flags */
+static inline bool get_zf(Byte cc) { return (cc & (1<<ZF_CC)) > 0; }
+static inline bool get_sf(Byte cc) { return (cc & (1<<SF_CC)) > 0; }
+static inline bool get_of(Byte cc) { return (cc & (1<<OF_CC)) > 0; }
+
+/** Kinds of operations which set condition codes. */
+typedef enum {
+  CC_STORED,           /** condition codes are those already stored */
+  CC_ADD,
+  CC_SUB,
+  CC_MUL,
+  CC_LOGIC,
+} CcKind;
+
+/** Condition codes are not computed when an operation sets them;
+ *  instead the operation is recorded here and the flags are worked
+ *  out only when they are actually needed.
+ */
+typedef struct {
+  CcKind kind;         /** kind of last operation which set cc */
+  Word opA, opB;       /** operands of that operation */
+  Word result;         /** its result */
+} LazyCC;
+
+/** return true iff word has its sign bit set */
+static inline bool
+isLt0(Word word) {
+  return (word & (1UL << (sizeof(Word)*CHAR_BIT - 1))) != 0;
+}
+
+/** Return the condition codes recorded in cc, which must not be
+ *  CC_STORED.
+ */
+static inline Byte
+eval_cc(const LazyCC *cc)
+{
+  bool isOverflow = false;
+  switch (cc->kind) {
+  case CC_ADD:
+    // Set overflow if sign changed
+    isOverflow = (isLt0(cc->opA) == isLt0(cc->opB)) &&
+                 (isLt0(cc->result) != isLt0(cc->opA));
+    break;
+  case CC_SUB:
+    // Set overflow if sign changed
+    isOverflow = (isLt0(cc->opA) != isLt0(cc->opB)) &&
+                 (isLt0(cc->result) != isLt0(cc->opB));
+    break;
+  case CC_MUL: {
+    // Set overflow if the signed product does not fit in a word
+    int64_t product;
+    isOverflow = __builtin_mul_overflow((int64_t)cc->opA, (int64_t)cc->opB,
+                                        &product);
+    break;
+  }
+  default:
+    break;
+  }
+  return (cc->result == 0) << ZF_CC | isLt0(cc->result) << SF_CC |
+         isOverflow << OF_CC;
+}
+
+/** Return true iff condition cond holds for condition codes cc.
+ *  Encoding of Figure 3.15 of Bryant's CompSys3e.
+ */
+static inline bool
+is_cond(Byte cc, Condition cond)
+{
+  switch (cond) {
+  case ALWAYS_COND: return true;
+  case LE_COND: return (get_sf(cc) ^ get_of(cc)) | get_zf(cc);
+  case LT_COND: return get_sf(cc) ^ get_of(cc);
+  case EQ_COND: return get_zf(cc);
+  case NE_COND: return !get_zf(cc);
+  case GE_COND: return !(get_sf(cc) ^ get_of(cc));
+  case GT_COND: return !(get_sf(cc) ^ get_of(cc)) & !get_zf(cc);
+  default: return false;
+  }
+}
+
+/** Set condition codes for addition operation with operands opA, opB
+ *  and result with result == opA + opB.
+ */
+static inline void
+set_add_arith_cc(LazyCC *cc, Word opA, Word opB, Word result)
+{
+  cc->kind = CC_ADD;
+  cc->opA = opA; cc->opB = opB; cc->result = result;
+}
+
+/** Set condition codes for subtraction operation with operands opA, opB
+ *  and result with result == opB - opA.
+ */
+static inline void
+set_sub_arith_cc(LazyCC *cc, Word opA, Word opB, Word result)
+{
+  cc->kind = CC_SUB;
+  cc->opA = opA; cc->opB = opB; cc->result = result;
+}
+
+/** Set condition codes for multiplication operation with operands
+ *  opA, opB and result with result == opA * opB.
+ */
+static inline void
+set_mul_arith_cc(LazyCC *cc, Word opA, Word opB, Word result)
+{
+  cc->kind = CC_MUL;
+  cc->opA = opA; cc->opB = opB; cc->result = result;
+}
+
+static inline void
+set_logic_op_cc(LazyCC *cc, Word result)
+{
+  cc->kind = CC_LOGIC;
+  cc->result = result;
+}
+
+/** Set *result to b OP a for OPq function fn, which may be any
+ *  function including the extensions, recording its condition codes
+ *  in cc.  Return false without changing anything if fn is a division
+ *  by zero or a division whose quotient overflows.
+ */
+static inline bool
+op_words(LazyCC *cc, Byte fn, Word a, Word b, Word *result)
+{
+  int64_t sa = a, sb = b;
+  switch (fn) {
+  case ADDQ_FN:
+    *result = a + b;
+    set_add_arith_cc(cc, a, b, *result);
+    return true;
+  case SUBQ_FN:
+    *result = b - a;
+    set_sub_arith_cc(cc, a, b, *result);
+    return true;
+  case ANDQ_FN:
+    *result = a & b;
+    break;
+  case XORQ_FN:
+    *result = a ^ b;
+    break;
+  case MULQ_FN:
+    *result = a * b;
+    set_mul_arith_cc(cc, a, b, *result);
+    return true;
+  case DIVQ_FN:
+    if (sa == 0 || (sa == -1 && sb == INT64_MIN)) return false;
+    *result = sb / sa;
+    break;
+  case MODQ_FN:
+    if (sa == 0) return false;
+    *result = (sa == -1) ? 0 : sb % sa;
+    break;
+  default:
+    return false;
+  }
+  set_logic_op_cc(cc, *result);
+  return true;
+}
+
+#endif //ifndef _YOPS_H
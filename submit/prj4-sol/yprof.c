@@ -0,0 +1,261 @@
+#include "yprof.h"
+
+#include "decode.h"
+#include "lazymem.h"
+#include "yobj.h"
+#include "ysim.h"
+#include "yas.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The simulator counts instructions in tables indexed by address so
+ * that counting one costs an increment.  The tables are allocated
+ * lazily, so only the pages covering executed code are ever committed;
+ * the report scans just the pages the simulator marked as counted.
+ */
+
+enum {
+  N_HOT_SPOTS = 10,                  /** # of entries in each report */
+};
+
+struct YProfStruct {
+  Y86 *y86;
+  const Byte *mem;          /** base of y86 memory */
+  Size memSize;
+  Size nPages;              /** # of PROFILE_PAGE_SIZE pages in memory */
+  ProfileCounts counts;     /** counted by the simulator */
+};
+
+/** An address and its count, for sorting. */
+typedef struct {
+  Address addr;
+  uint64_t count;
+} AddrCount;
+
+YProf *
+new_yprof(Y86 *y86)
+{
+  YProf *yprof = mallocChk(sizeof(YProf));
+  yprof->y86 = y86;
+  yprof->mem = get_memory_pointer_y86(y86, 0);
+  yprof->memSize = get_memory_size_y86(y86);
+  yprof->nPages =
+    (yprof->memSize + PROFILE_PAGE_SIZE - 1) >> PROFILE_PAGE_SHIFT;
+  Size tableSize = yprof->memSize * sizeof(uint64_t);
+  yprof->counts.counts = new_lazy_mem(tableSize);
+  yprof->counts.takenCounts = new_lazy_mem(tableSize);
+  yprof->counts.callCounts = new_lazy_mem(tableSize);
+  yprof->counts.isCountedPage = new_lazy_mem(yprof->nPages * sizeof(Byte));
+  return yprof;
+}
+
+void
+free_yprof(YProf *yprof)
+{
+  Size tableSize = yprof->memSize * sizeof(uint64_t);
+  free_lazy_mem(yprof->counts.counts, tableSize);
+  free_lazy_mem(yprof->counts.takenCounts, tableSize);
+  free_lazy_mem(yprof->counts.callCounts, tableSize);
+  free_lazy_mem(yprof->counts.isCountedPage, yprof->nPages * sizeof(Byte));
+  free(yprof);
+}
+
+void
+run_yprof(YProf *yprof)
+{
+  Y86 *y86 = yprof->y86;
+  set_profile_ysim(y86, &yprof->counts);
+  while (read_status_y86(y86) == STATUS_AOK) run_ysim(y86, UINT64_MAX);
+  set_profile_ysim(y86, NULL);
+}
+
+/*************************** Profile Report ****************************/
+
+static int
+compare_addr_counts(const void *p1, const void *p2)
+{
+  const AddrCount *a1 = p1, *a2 = p2;
+  if (a1->count != a2->count) return (a1->count < a2->count) ? 1 : -1;
+  return (a1->addr > a2->addr) - (a1->addr < a2->addr);
+}
+
+/** Return the addresses with non-zero counts[] in yprof paired with
+ *  their counts and sorted by decreasing count, setting *n to their
+ *  number.  The caller must free the result.
+ */
+static AddrCount *
+sort_by_count(const YProf *yprof, const uint64_t counts[], Size *n)
+{
+  const Byte *isCountedPage = yprof->counts.isCountedPage;
+  Size nSorted = 0, maxSorted = 16;
+  AddrCount *sorted = mallocChk(maxSorted * sizeof(AddrCount));
+  for (Size p = 0; p < yprof->nPages; p++) {
+    if (!isCountedPage[p]) continue;
+    Address lo = p << PROFILE_PAGE_SHIFT;
+    Address end = (yprof->memSize - lo < PROFILE_PAGE_SIZE)
+      ? yprof->memSize : lo + PROFILE_PAGE_SIZE;
+    for (Address a = lo; a < end; a++) {
+      if (counts[a] == 0) continue;
+      if (nSorted == maxSorted) {
+        maxSorted *= 2;
+        sorted = reallocChk(sorted, maxSorted * sizeof(AddrCount));
+      }
+      sorted[nSorted++] = (AddrCount) { .addr = a, .count = counts[a] };
+    }
+  }
+  qsort(sorted, nSorted, sizeof(AddrCount), compare_addr_counts);
+  *n = nSorted;
+  return sorted;
+}
+
+static inline bool
+is_jump(const YProf *yprof, Address addr)
+{
+  return get_nybble(yprof->mem[addr], 1) == Jxx_CODE;
+}
+
+/** End a line of the report for addr with the label in symbols at or
+ *  before it.
+ */
+static void
+dump_label(const YSymbols *symbols, Address addr, FILE *out)
+{
+  Address offset;
+  const char *label = find_ysymbols(symbols, addr, &offset);
+  if (label != NULL && offset == 0) {
+    fprintf(out, "  %s", label);
+  }
+  else if (label != NULL) {
+    fprintf(out, "  %s+0x%lx", label, (unsigned long)offset);
+  }
+  fprintf(out, "\n");
+}
+
+static void
+dump_hot_spots(const YProf *yprof, const YSymbols *symbols, FILE *out)
+{
+  int addrWidth = (int)sizeof(Address)*2;
+  Size nPcs;
+  AddrCount *pcs = sort_by_count(yprof, yprof->counts.counts, &nPcs);
+  uint64_t nInstrs = 0;
+  for (Size i = 0; i < nPcs; i++) nInstrs += pcs[i].count;
+  fprintf(out, "profile: %lu instructions executed\n",
+          (unsigned long)nInstrs);
+  fprintf(out, "hot spots:%*s %12s %7s\n", addrWidth - 8, "", "count", "%");
+  for (Size i = 0; i < nPcs && i < N_HOT_SPOTS; i++) {
+    fprintf(out, "  %0*lx %12lu %6.2f%%", addrWidth, pcs[i].addr,
+            (unsigned long)pcs[i].count, 100.0 * pcs[i].count / nInstrs);
+    dump_label(symbols, pcs[i].addr, out);
+  }
+  fprintf(out, "branches:%*s %12s %12s\n", addrWidth - 7, "", "taken",
+          "not taken");
+  for (Size i = 0, n = 0; i < nPcs && n < N_HOT_SPOTS; i++) {
+    if (!is_jump(yprof, pcs[i].addr)) continue;
+    uint64_t taken = yprof->counts.takenCounts[pcs[i].addr];
+    fprintf(out, "  %0*lx %12lu %12lu", addrWidth, pcs[i].addr,
+            (unsigned long)taken, (unsigned long)(pcs[i].count - taken));
+    dump_label(symbols, pcs[i].addr, out);
+    n++;
+  }
+  free(pcs);
+  Size nTargets;
+  AddrCount *targets =
+    sort_by_count(yprof, yprof->counts.callCounts, &nTargets);
+  fprintf(out, "calls:%*s %12s\n", addrWidth - 4, "", "calls");
+  for (Size i = 0; i < nTargets && i < N_HOT_SPOTS; i++) {
+    fprintf(out, "  %0*lx %12lu", addrWidth, targets[i].addr,
+            (unsigned long)targets[i].count);
+    dump_label(symbols, targets[i].addr, out);
+  }
+  free(targets);
+}
+
+/** Return true if line of a listing starts with an address followed by
+ *  the code stored at that address, setting *addr to the address.
+ *  Lines for labels, comments and directives without code are
+ *  rejected since their address is followed by something else.
+ */
+static bool
+get_listing_addr(const YProf *yprof, const char *line, Address *addr)
+{
+  const char *p = line;
+  while (isspace(*p)) p++;
+  if (!isxdigit(*p)) return false;
+  char *end;
+  Address a = strtoul(p, &end, 16);
+  if (a >= yprof->memSize) return false;
+  if (*end == ':') end++;
+  while (*end == ' ' || *end == '\t') end++;
+  char code[3];
+  snprintf(code, sizeof(code), "%02x", yprof->mem[a]);
+  if (tolower(end[0]) != code[0] || tolower(end[1]) != code[1]) return false;
+  *addr = a;
+  return true;
+}
+
+/** Write line of listing to out preceded by the execution count of its
+ *  instruction and followed by its branch or call counts.
+ */
+static void
+dump_listing_line(const YProf *yprof, const char *line, FILE *out)
+{
+  enum { COUNT_WIDTH = 12 };
+  const ProfileCounts *counts = &yprof->counts;
+  Address addr;
+  size_t len = strlen(line);
+  if (len > 0 && line[len - 1] == '\n') len--;
+  if (!get_listing_addr(yprof, line, &addr) ||
+      (counts->counts[addr] == 0 && counts->callCounts[addr] == 0)) {
+    fprintf(out, "%*s  %.*s\n", COUNT_WIDTH, "", (int)len, line);
+    return;
+  }
+  fprintf(out, "%*lu  %.*s", COUNT_WIDTH, (unsigned long)counts->counts[addr],
+          (int)len, line);
+  if (counts->counts[addr] > 0 && is_jump(yprof, addr)) {
+    uint64_t taken = counts->takenCounts[addr];
+    fprintf(out, "  # taken %lu, not taken %lu", (unsigned long)taken,
+            (unsigned long)(counts->counts[addr] - taken));
+  }
+  if (counts->callCounts[addr] > 0) {
+    fprintf(out, "  # called %lu", (unsigned long)counts->callCounts[addr]);
+  }
+  fprintf(out, "\n");
+}
+
+void
+dump_yprof(const YProf *yprof, int numFiles, const char *yasFiles[],
+           FILE *out)
+{
+  YSymbols *symbols = new_ysymbols(numFiles, yasFiles);
+  dump_hot_spots(yprof, symbols, out);
+  free_ysymbols(symbols);
+  if (numFiles == 1 && is_yobj(yasFiles[0])) {
+    fprintf(out, "annotated listing: not available for object image %s\n",
+            yasFiles[0]);
+    return;
+  }
+  char *listing = NULL;
+  size_t listingSize = 0;
+  FILE *listingOut = open_memstream(&listing, &listingSize);
+  if (listingOut == NULL) fatal("cannot create listing stream:");
+  yas_to_listing(listingOut, numFiles, yasFiles);
+  if (fclose(listingOut) != 0) fatal("cannot write listing stream:");
+  fprintf(out, "annotated listing:\n");
+  for (char *line = listing; *line != '\0'; ) {
+    char *end = strchr(line, '\n');
+    end = (end == NULL) ? line + strlen(line) : end + 1;
+    char c = *end;
+    *end = '\0';
+    dump_listing_line(yprof, line, out);
+    *end = c;
+    line = end;
+  }
+  free(listing);
+}
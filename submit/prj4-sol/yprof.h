@@ -0,0 +1,35 @@
+#ifndef _YPROF_H
+#define _YPROF_H
+
+#include "y86.h"
+
+#include <stdio.h>
+
+/** An opaque structure which counts the instructions executed by a y86
+ *  program.
+ */
+typedef struct YProfStruct YProf;
+
+/** Create a profile of the program in y86. */
+YProf *new_yprof(Y86 *y86);
+
+/** Free all resources allocated by new_yprof(). */
+void free_yprof(YProf *yprof);
+
+/** Run the y86 for yprof using run_ysim() until it halts or faults,
+ *  counting each instruction at its pc.  Jumps also count whether
+ *  they were taken, and calls count how often their target was called.
+ */
+void run_yprof(YProf *yprof);
+
+/** Write to out a report of the instructions, branches and call
+ *  targets executed most often in yprof, each labelled by the closest
+ *  label at or before its address, followed by the listing of
+ *  the numFiles .ys files yasFiles[] from which its program was
+ *  assembled, annotated with the counts for each instruction.  No
+ *  listing is available for a program loaded from an object image.
+ */
+void dump_yprof(const YProf *yprof, int numFiles, const char *yasFiles[],
+                FILE *out);
+
+#endif //ifndef _YPROF_H
@@ -0,0 +1,300 @@
+#include "yrecord.h"
+
+#include "params.h"
+#include "ysim.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A record file consists of a RecordHeader, followed by the program
+ * parameters, followed by nPages ImagePage's (each followed by its
+ * bytes) giving the non-zero pages of memory before the parameters
+ * were set up, followed by a Checkpoint after every CHECKPOINT_STEPS
+ * instructions and at the end of the run.  Each checkpoint is
+ * followed by the nWords WordChange's written since the previous one
+ * and then by the nInput bytes of input read by traps since then.
+ * Everything is in host byte order.
+ *
+ * The simulator is deterministic given the input read by traps, so
+ * the checkpoints only serve to avoid re-executing the instructions
+ * before them.
+ */
+
+enum {
+  CHECKPOINT_STEPS = 1 << 24,   /** # of instructions between checkpoints */
+  IMAGE_PAGE_SIZE = 4096,       /** size of pages of recorded image */
+};
+
+static const char RECORD_MAGIC[4] = { 'Y', '8', '6', 'R' };
+
+typedef struct {
+  char magic[4];            /** RECORD_MAGIC */
+  uint32_t numParams;
+  uint64_t memSize;         /** size of y86 memory */
+  uint64_t nPages;          /** # of ImagePage's */
+  uint64_t openFds;         /** get_open_fds_yio(); 0 if no YIO */
+} RecordHeader;
+
+typedef struct {
+  uint64_t addr;            /** address of page */
+  uint64_t size;            /** # of bytes following */
+} ImagePage;
+
+typedef struct {
+  uint64_t step;            /** # of instructions executed */
+  uint64_t nWords;          /** # of WordChange's following */
+  uint64_t nInput;          /** # of bytes of input following them */
+  Address pc;
+  Word regs[N_REG];
+  Byte cc;
+  Byte status;
+} Checkpoint;
+
+typedef struct {
+  Address addr;             /** address of aligned word */
+  Byte bytes[sizeof(Word)]; /** contents of word */
+} WordChange;
+
+/** Return # of bytes of the word at addr in memory of memSize. */
+static inline Size
+word_size(Size memSize, Address addr)
+{
+  return (memSize - addr < sizeof(Word)) ? memSize - addr : sizeof(Word);
+}
+
+/************************** Recording a Run ****************************/
+
+static void
+write_record(FILE *out, const char *fileName, const void *p, size_t size)
+{
+  if (fwrite(p, 1, size, out) != size) {
+    fatal("cannot write record file %s:", fileName);
+  }
+}
+
+/** Return true if the size bytes at mem are all zero. */
+static bool
+is_zero(const Byte mem[], Size size)
+{
+  Size i = 0;
+  while (i < size && mem[i] == 0) i++;
+  return i == size;
+}
+
+/** Write the non-zero pages of the memory of y86 to out. */
+static void
+write_image(FILE *out, const char *fileName, Y86 *y86, uint64_t nPages)
+{
+  const Byte *mem = get_memory_pointer_y86(y86, 0);
+  Size memSize = get_memory_size_y86(y86);
+  for (Address addr = 0; addr < memSize && nPages > 0; addr += IMAGE_PAGE_SIZE) {
+    Size size = (memSize - addr < IMAGE_PAGE_SIZE) ? memSize - addr : IMAGE_PAGE_SIZE;
+    if (is_zero(&mem[addr], size)) continue;
+    ImagePage page = { .addr = addr, .size = size };
+    write_record(out, fileName, &page, sizeof(page));
+    write_record(out, fileName, &mem[addr], size);
+    nPages--;
+  }
+}
+
+/** Write a checkpoint of y86 after step instructions to out, along with
+ *  the memory words written and the input read from yio, if not NULL,
+ *  since the last checkpoint.
+ */
+static void
+write_checkpoint(FILE *out, const char *fileName, Y86 *y86, YIO *yio,
+                 uint64_t step)
+{
+  YChanges changes;
+  get_changes_ysim(y86, &changes);
+  const Byte *input = NULL;
+  Size nInput = (yio == NULL) ? 0 : take_input_yio(yio, &input);
+  Checkpoint checkpoint = {
+    .step = step,
+    .nWords = changes.nWords,
+    .nInput = nInput,
+    .pc = read_pc_y86(y86),
+    .cc = read_cc_y86(y86),
+    .status = read_status_y86(y86),
+  };
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    checkpoint.regs[r] = read_register_y86(y86, r);
+  }
+  write_record(out, fileName, &checkpoint, sizeof(checkpoint));
+  const Byte *mem = get_memory_pointer_y86(y86, 0);
+  Size memSize = get_memory_size_y86(y86);
+  for (Size i = 0; i < changes.nWords; i++) {
+    WordChange change = { .addr = changes.words[i] };
+    memcpy(change.bytes, &mem[change.addr], word_size(memSize, change.addr));
+    write_record(out, fileName, &change, sizeof(change));
+  }
+  write_record(out, fileName, input, nInput);
+  clear_changes_ysim(y86);
+}
+
+void
+record_y86(const char *recordFileName, Y86 *y86, YIO *yio,
+           int numParams, const Word params[], FILE *out)
+{
+  FILE *record = fopen(recordFileName, "wb");
+  if (record == NULL) fatal("cannot create record file %s:", recordFileName);
+  const Byte *mem = get_memory_pointer_y86(y86, 0);
+  RecordHeader header = {
+    .numParams = numParams,
+    .memSize = get_memory_size_y86(y86),
+    .nPages = 0,
+    .openFds = (yio == NULL) ? 0 : get_open_fds_yio(yio),
+  };
+  memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+  for (Address addr = 0; addr < header.memSize; addr += IMAGE_PAGE_SIZE) {
+    Size size = header.memSize - addr;
+    if (!is_zero(&mem[addr], size < IMAGE_PAGE_SIZE ? size : IMAGE_PAGE_SIZE)) {
+      header.nPages++;
+    }
+  }
+  write_record(record, recordFileName, &header, sizeof(header));
+  write_record(record, recordFileName, params, numParams * sizeof(Word));
+  write_image(record, recordFileName, y86, header.nPages);
+
+  setup_params(y86, numParams, params, out);
+  clear_changes_ysim(y86);   //parameters are set up again on replay
+  if (yio != NULL) keep_input_yio(yio);
+  uint64_t step = 0;
+  write_checkpoint(record, recordFileName, y86, yio, step);
+  while (read_status_y86(y86) == STATUS_AOK) {
+    step += run_ysim(y86, CHECKPOINT_STEPS);
+    write_checkpoint(record, recordFileName, y86, yio, step);
+  }
+  if (fclose(record) != 0) fatal("cannot write record file %s:", recordFileName);
+}
+
+/************************** Replaying a Run ****************************/
+
+static void
+read_record(FILE *in, const char *fileName, void *p, size_t size)
+{
+  if (fread(p, 1, size, in) != size) {
+    fatal("%s: truncated or unreadable record file", fileName);
+  }
+}
+
+/** Skip the next size bytes of in. */
+static void
+skip_record(FILE *in, const char *fileName, uint64_t size)
+{
+  if (size > LONG_MAX || fseek(in, size, SEEK_CUR) != 0) {
+    fatal("%s: truncated or unreadable record file", fileName);
+  }
+}
+
+/** Set the registers, pc, cc and status of y86 from checkpoint. */
+static void
+restore_checkpoint(Y86 *y86, const Checkpoint *checkpoint)
+{
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (read_register_y86(y86, r) != checkpoint->regs[r]) {
+      write_register_y86(y86, r, checkpoint->regs[r]);
+    }
+  }
+  if (read_cc_y86(y86) != checkpoint->cc) write_cc_y86(y86, checkpoint->cc);
+  if (read_pc_y86(y86) != checkpoint->pc) write_pc_y86(y86, checkpoint->pc);
+  if (read_status_y86(y86) != checkpoint->status) {
+    write_status_y86(y86, checkpoint->status);
+  }
+}
+
+Y86 *
+replay_y86(const char *recordFileName, uint64_t step, YIO **yio,
+           uint64_t *reached, FILE *out)
+{
+  FILE *in = fopen(recordFileName, "rb");
+  if (in == NULL) fatal("cannot read record file %s:", recordFileName);
+  RecordHeader header;
+  read_record(in, recordFileName, &header, sizeof(header));
+  if (memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0) {
+    fatal("%s: not a record file", recordFileName);
+  }
+  Word *params = mallocChk((header.numParams + 1) * sizeof(Word));
+  read_record(in, recordFileName, params, header.numParams * sizeof(Word));
+
+  Y86 *y86 = new_y86(header.memSize);
+  Byte *mem = get_memory_pointer_y86(y86, 0);
+  for (uint64_t i = 0; i < header.nPages; i++) {
+    ImagePage page;
+    read_record(in, recordFileName, &page, sizeof(page));
+    if (page.addr > header.memSize || page.size > header.memSize - page.addr) {
+      fatal("%s: bad record file", recordFileName);
+    }
+    read_record(in, recordFileName, &mem[page.addr], page.size);
+  }
+  setup_params(y86, header.numParams, params, out);
+  free(params);
+
+  //apply the memory changes of each checkpoint up to step
+  Checkpoint checkpoint = { .step = 0 };
+  bool isRestored = false;
+  Checkpoint next;
+  bool isNext = false;      //next is the first checkpoint after step
+  while (fread(&next, sizeof(next), 1, in) == 1) {
+    if (next.step > step) {
+      isNext = true;
+      break;
+    }
+    for (uint64_t i = 0; i < next.nWords; i++) {
+      WordChange change;
+      read_record(in, recordFileName, &change, sizeof(change));
+      if (change.addr >= header.memSize) {
+        fatal("%s: bad record file", recordFileName);
+      }
+      //write full words through y86 so that they are dumped as changed
+      Size size = word_size(header.memSize, change.addr);
+      if (size == sizeof(Word)) {
+        Word value;
+        memcpy(&value, change.bytes, sizeof(Word));
+        write_memory_word_y86(y86, change.addr, value);
+      }
+      else {
+        memcpy(&mem[change.addr], change.bytes, size);
+      }
+      invalidate_ysim(y86, change.addr, size);
+    }
+    skip_record(in, recordFileName, next.nInput);
+    checkpoint = next;
+    isRestored = true;
+    if (checkpoint.status != STATUS_AOK) break;
+  }
+  //the input read after the checkpoint is read again
+  Byte *input = NULL;
+  Size nInput = 0;
+  while (isNext && header.openFds != 0) {
+    skip_record(in, recordFileName, next.nWords * sizeof(WordChange));
+    input = reallocChk(input, nInput + next.nInput);
+    read_record(in, recordFileName, &input[nInput], next.nInput);
+    nInput += next.nInput;
+    isNext = fread(&next, sizeof(next), 1, in) == 1;
+  }
+  if (ferror(in)) fatal("cannot read record file %s:", recordFileName);
+  fclose(in);
+  if (!isRestored) fatal("%s: record file has no checkpoints", recordFileName);
+  restore_checkpoint(y86, &checkpoint);
+  *yio = NULL;
+  if (header.openFds != 0) {
+    *yio = new_replay_yio(y86, (header.openFds & (1u << TRAP_IN_FD)) != 0,
+                          input, nInput,
+                          (header.openFds & (1u << TRAP_OUT_FD)) != 0);
+  }
+  free(input);
+
+  *reached = checkpoint.step;
+  while (*reached < step && read_status_y86(y86) == STATUS_AOK) {
+    *reached += run_ysim(y86, step - *reached);
+  }
+  clear_changes_ysim(y86);
+  return y86;
+}
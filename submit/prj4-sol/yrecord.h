@@ -0,0 +1,35 @@
+#ifndef _YRECORD_H
+#define _YRECORD_H
+
+#include "y86.h"
+#include "yio.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Run the program loaded in y86 to completion, recording it in
+ *  recordFileName so that it can later be replayed by replay_y86().
+ *  The initial memory image and the numParams params[] are recorded,
+ *  the params are set up as by setup_params() (writing the argv lines
+ *  to out), and a checkpoint is written periodically while running.
+ *  If yio is not NULL, it carries out the traps of y86 and the
+ *  descriptors it has open and the input read by the program are
+ *  recorded too.
+ */
+void record_y86(const char *recordFileName, Y86 *y86, YIO *yio,
+                int numParams, const Word params[], FILE *out);
+
+/** Return a new Y86 in the state reached after executing step
+ *  instructions of the run recorded in recordFileName, or its final
+ *  state if it stopped sooner.  The state is restored from the last
+ *  checkpoint at or before step and only the remaining instructions
+ *  are executed.  The argv lines of the recorded run are written to
+ *  out and *reached is set to the number of instructions executed.
+ *  If the run was recorded with a YIO, *yio is set to one made by
+ *  new_replay_yio() which reads the rest of the recorded input;
+ *  otherwise it is set to NULL.
+ */
+Y86 *replay_y86(const char *recordFileName, uint64_t step, YIO **yio,
+                uint64_t *reached, FILE *out);
+
+#endif //ifndef _YRECORD_H
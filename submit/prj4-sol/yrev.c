@@ -0,0 +1,502 @@
+#include "yrev.h"
+
+#include "decode.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Any earlier state is reached by restoring the last checkpoint
+ * before it and running forward with run_ysim(), which is
+ * deterministic.  A checkpoint is taken at each multiple of the
+ * checkpoint interval reached; when the checkpoints outgrow their
+ * share of the budget, every other one is dropped and the interval
+ * doubled, so that however long the run, its checkpoints stay spread
+ * over all of it.
+ *
+ * Instructions executed one at a time are also logged with the
+ * register and memory values they overwrote, in a ring which drops
+ * the oldest instructions when full.  A short step back then just
+ * undoes the last instructions.  After restoring a checkpoint, the
+ * last LOG_REPLAY_STEPS instructions up to the target are executed
+ * with logging, so that further steps back are undone too.
+ */
+
+enum {
+  CHECKPOINT_STEPS = 1 << 16,   /** initial # of instructions between
+                                 *  checkpoints */
+  LOG_REPLAY_STEPS = 1 << 12,   /** # of instructions logged when
+                                 *  replaying to a target */
+  LOG_SHARE = 4,                /** 1/LOG_SHARE of the budget is log */
+  UNDO_COST = 4,                /** cost of logging or undoing an
+                                 *  instruction, in instructions run by
+                                 *  run_ysim() */
+};
+
+typedef enum { UNDO_INSTR, UNDO_REG, UNDO_WORD } UndoKind;
+
+/** A value overwritten by an instruction.  An instruction is logged as
+ *  its UNDO_WORD's, then its UNDO_REG's, then an UNDO_INSTR.
+ */
+typedef struct {
+  Word value;               /** old value; the pc for UNDO_INSTR */
+  Address addr;             /** address of word; register for UNDO_REG;
+                             *  old cc for UNDO_INSTR */
+  UndoKind kind;
+} UndoEntry;
+
+typedef struct {
+  uint64_t step;            /** # of instructions executed before it */
+  Snapshot *snapshot;
+  Size size;                /** # of bytes not shared with the previous
+                             *  checkpoint */
+} Checkpoint;
+
+struct YRevStruct {
+  Y86 *y86;
+  Size memSize;
+  uint64_t step;            /** # of instructions executed */
+  Word regs[N_REG];         /** registers of y86 */
+  Checkpoint *checkpoints;  /** the nCheckpoints in order of step, the
+                             *  first at step 0 */
+  Size nCheckpoints;
+  uint64_t interval;        /** checkpoints are at its multiples */
+  Size checkpointBytes;     /** # of bytes held by the checkpoints */
+  Size checkpointBudget;
+  UndoEntry *log;           /** ring of maxLog entries holding nLog from
+                             *  index first */
+  Size maxLog, first, nLog;
+  uint64_t nLogSteps;       /** # of instructions logged, which are
+                             *  those leading to the current state */
+};
+
+/** Reload the registers of yrev after its y86 was changed other than
+ *  by a logged instruction.
+ */
+static void
+load_registers(YRev *yrev)
+{
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    yrev->regs[r] = read_register_y86(yrev->y86, r);
+  }
+}
+
+/************************** Checkpoints ****************************/
+
+/** Return the # of bytes held by checkpoint i of yrev which are not
+ *  shared with checkpoint i - 1.
+ */
+static Size
+checkpoint_size(const YRev *yrev, Size i)
+{
+  const Snapshot *base = (i == 0) ? NULL : yrev->checkpoints[i - 1].snapshot;
+  return sizeof(Checkpoint) +
+    get_snapshot_size(yrev->checkpoints[i].snapshot, base);
+}
+
+/** Double the checkpoint interval of yrev, dropping the checkpoints
+ *  which are no longer at a multiple of it.
+ */
+static void
+thin_checkpoints(YRev *yrev)
+{
+  yrev->interval *= 2;
+  Size n = 1;
+  yrev->checkpointBytes = yrev->checkpoints[0].size;
+  for (Size i = 1; i < yrev->nCheckpoints; i++) {
+    Checkpoint *c = &yrev->checkpoints[i];
+    if (c->step % yrev->interval != 0) {
+      free_snapshot(c->snapshot);
+      continue;
+    }
+    yrev->checkpoints[n] = *c;
+    c = &yrev->checkpoints[n];
+    c->size = checkpoint_size(yrev, n++);
+    yrev->checkpointBytes += c->size;
+  }
+  yrev->nCheckpoints = n;
+}
+
+/** Take a checkpoint of yrev at the current step, thinning the
+ *  checkpoints to keep them within their budget.
+ */
+static void
+add_checkpoint(YRev *yrev)
+{
+  yrev->checkpoints = reallocChk(yrev->checkpoints,
+                                 (yrev->nCheckpoints + 1) * sizeof(Checkpoint));
+  Size i = yrev->nCheckpoints++;
+  Checkpoint *c = &yrev->checkpoints[i];
+  c->step = yrev->step;
+  c->snapshot = snapshot_y86(yrev->y86);
+  c->size = checkpoint_size(yrev, i);
+  yrev->checkpointBytes += c->size;
+  while (yrev->checkpointBytes > yrev->checkpointBudget &&
+         yrev->nCheckpoints > 1) {
+    thin_checkpoints(yrev);
+  }
+}
+
+/** Take a checkpoint if the current step of yrev is a multiple of the
+ *  checkpoint interval past the last checkpoint.
+ */
+static void
+note_step(YRev *yrev)
+{
+  const Checkpoint *last = &yrev->checkpoints[yrev->nCheckpoints - 1];
+  if (yrev->step % yrev->interval == 0 && yrev->step > last->step) {
+    add_checkpoint(yrev);
+  }
+}
+
+/** Return the index of the last checkpoint of yrev at or before step. */
+static Size
+find_checkpoint(const YRev *yrev, uint64_t step)
+{
+  Size lo = 0, hi = yrev->nCheckpoints;
+  while (hi - lo > 1) {
+    Size mid = (lo + hi) / 2;
+    if (yrev->checkpoints[mid].step <= step) lo = mid; else hi = mid;
+  }
+  return lo;
+}
+
+/*************************** Undo Log ******************************/
+
+/** Return entry i of the log of yrev, counting from the oldest. */
+static inline UndoEntry *
+log_entry(const YRev *yrev, Size i)
+{
+  return &yrev->log[(yrev->first + i) % yrev->maxLog];
+}
+
+static void
+clear_log(YRev *yrev)
+{
+  yrev->first = yrev->nLog = 0;
+  yrev->nLogSteps = 0;
+}
+
+/** Drop the oldest instruction from the log of yrev. */
+static void
+drop_oldest(YRev *yrev)
+{
+  UndoKind kind;
+  do {
+    kind = log_entry(yrev, 0)->kind;
+    yrev->first = (yrev->first + 1) % yrev->maxLog;
+    yrev->nLog--;
+  } while (kind != UNDO_INSTR);
+  yrev->nLogSteps--;
+}
+
+static inline void
+push_entry(YRev *yrev, UndoKind kind, Address addr, Word value)
+{
+  *log_entry(yrev, yrev->nLog++) = (UndoEntry){ value, addr, kind };
+}
+
+/** Set *addr to the address of the first of the consecutive words
+ *  which the instruction at the pc of yrev may store, returning their
+ *  number.
+ */
+static Word
+get_stores(const YRev *yrev, Address *addr)
+{
+  Y86 *y86 = yrev->y86;
+  Decoded d;
+  if (!decode_instr(get_memory_pointer_y86(y86, 0), yrev->memSize,
+                    read_pc_y86(y86), &d)) {
+    return 0;
+  }
+  switch (d.op) {
+  case RMMOVQ_CODE: case CASQ_CODE:
+    *addr = yrev->regs[d.regB] + d.imm;
+    return 1;
+  case PUSHQ_CODE: case CALL_CODE:
+    *addr = yrev->regs[REG_RSP] - sizeof(Word);
+    return 1;
+  case BLOCK_CODE:
+    *addr = yrev->regs[d.regB];
+    return yrev->regs[REG_RCX];
+  default:
+    return 0;
+  }
+}
+
+/** Return true iff the aligned word at word overlaps one of the
+ *  nWords words from addr.
+ */
+static bool
+is_logged_word(Address word, Address addr, Size nWords)
+{
+  for (Size i = 0; i < nWords; i++) {
+    Address a = addr + i * sizeof(Word);
+    if (word <= a + sizeof(Word) - 1 && a <= word + sizeof(Word) - 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Execute the next instruction of the y86 of yrev, logging it if the
+ *  log can hold it and clearing the log otherwise.
+ */
+static void
+step_logged(YRev *yrev)
+{
+  Y86 *y86 = yrev->y86;
+  Address pc = read_pc_y86(y86);
+  Byte cc = read_cc_y86(y86);
+
+  //a store stops at the first word which is not in memory
+  Address addr = 0;
+  Word nWords = get_stores(yrev, &addr);
+  if (addr > yrev->memSize - sizeof(Word)) {
+    nWords = 0;
+  }
+  else if (nWords > (yrev->memSize - sizeof(Word) - addr) / sizeof(Word)) {
+    nWords = (yrev->memSize - sizeof(Word) - addr) / sizeof(Word) + 1;
+  }
+  bool isLogged = nWords + N_REG + 1 <= yrev->maxLog;
+  if (isLogged) {
+    while (yrev->maxLog - yrev->nLog < nWords + N_REG + 1) drop_oldest(yrev);
+    const Byte *mem = get_memory_pointer_y86(y86, 0);
+    for (Size i = 0; i < nWords; i++) {
+      Address a = addr + i * sizeof(Word);
+      push_entry(yrev, UNDO_WORD, a, get_le_word(&mem[a]));
+    }
+  }
+  else {
+    clear_log(yrev);
+  }
+
+  clear_changes_ysim(y86);
+  step_ysim(y86);
+  YChanges changes;
+  get_changes_ysim(y86, &changes);
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if ((changes.regs & (1u << r)) == 0) continue;
+    if (isLogged) push_entry(yrev, UNDO_REG, r, yrev->regs[r]);
+    yrev->regs[r] = read_register_y86(y86, r);
+  }
+  for (Size i = 0; i < changes.nWords; i++) {
+    assert(!isLogged || is_logged_word(changes.words[i], addr, nWords));
+  }
+  if (isLogged) {
+    push_entry(yrev, UNDO_INSTR, cc, pc);
+    yrev->nLogSteps++;
+  }
+  yrev->step++;
+  note_step(yrev);
+}
+
+/** Undo the last instruction in the log of yrev. */
+static void
+undo_logged(YRev *yrev)
+{
+  Y86 *y86 = yrev->y86;
+  UndoEntry *e = log_entry(yrev, --yrev->nLog);
+  assert(e->kind == UNDO_INSTR);
+  write_pc_y86(y86, e->value);
+  write_cc_y86(y86, e->addr);
+  write_status_y86(y86, STATUS_AOK);
+  while (yrev->nLog > 0) {
+    e = log_entry(yrev, yrev->nLog - 1);
+    if (e->kind == UNDO_INSTR) break;
+    if (e->kind == UNDO_REG) {
+      write_register_y86(y86, e->addr, e->value);
+      yrev->regs[e->addr] = e->value;
+    }
+    else {
+      write_memory_word_y86(y86, e->addr, e->value);
+      invalidate_ysim(y86, e->addr, sizeof(Word));
+    }
+    yrev->nLog--;
+  }
+  yrev->nLogSteps--;
+  yrev->step--;
+}
+
+/************************** Moving Around **************************/
+
+/** Run y86 of yrev forward from the current step to step, which the
+ *  run must reach, using run_ysim().
+ */
+static void
+run_to(YRev *yrev, uint64_t step)
+{
+  while (yrev->step < step) {
+    yrev->step += run_ysim(yrev->y86, step - yrev->step);
+    assert(read_status_y86(yrev->y86) == STATUS_AOK || yrev->step == step);
+  }
+}
+
+/** Restore checkpoint i of yrev, so that a run_ysim() from a
+ *  breakpoint stops there.
+ */
+static void
+restore_checkpoint(YRev *yrev, Size i)
+{
+  restore_y86(yrev->y86, yrev->checkpoints[i].snapshot);
+  yrev->step = yrev->checkpoints[i].step;
+  run_ysim(yrev->y86, 0);     //forget any earlier stop
+  clear_log(yrev);
+}
+
+/** Move yrev back to step by restoring the last checkpoint before it,
+ *  logging the last instructions executed to reach it.
+ */
+static void
+replay_to(YRev *yrev, uint64_t step)
+{
+  restore_checkpoint(yrev, find_checkpoint(yrev, step));
+  uint64_t nLogged = step - yrev->step;
+  if (nLogged > LOG_REPLAY_STEPS) nLogged = LOG_REPLAY_STEPS;
+  run_to(yrev, step - nLogged);
+  load_registers(yrev);
+  while (yrev->step < step) step_logged(yrev);
+}
+
+YRev *
+new_yrev(Y86 *y86, Size budget)
+{
+  YRev *yrev = callocChk(1, sizeof(YRev));
+  yrev->y86 = y86;
+  yrev->memSize = get_memory_size_y86(y86);
+  load_registers(yrev);
+  yrev->interval = CHECKPOINT_STEPS;
+  yrev->checkpointBudget = budget - budget / LOG_SHARE;
+  yrev->maxLog = budget / LOG_SHARE / sizeof(UndoEntry);
+  yrev->log = mallocChk((yrev->maxLog + 1) * sizeof(UndoEntry));
+  add_checkpoint(yrev);
+  if (yrev->checkpointBytes > yrev->checkpointBudget) {
+    fatal("reverse execution needs a budget of at least %lu bytes to "
+          "checkpoint the initial state",
+          (unsigned long)(yrev->checkpointBytes * LOG_SHARE /
+                          (LOG_SHARE - 1) + 1));
+  }
+  return yrev;
+}
+
+void
+free_yrev(YRev *yrev)
+{
+  for (Size i = 0; i < yrev->nCheckpoints; i++) {
+    free_snapshot(yrev->checkpoints[i].snapshot);
+  }
+  free(yrev->checkpoints);
+  free(yrev->log);
+  free(yrev);
+}
+
+uint64_t
+get_step_yrev(const YRev *yrev)
+{
+  return yrev->step;
+}
+
+uint64_t
+step_yrev(YRev *yrev, uint64_t n)
+{
+  uint64_t start = yrev->step;
+  while (yrev->step - start < n && read_status_y86(yrev->y86) == STATUS_AOK) {
+    step_logged(yrev);
+  }
+  return yrev->step - start;
+}
+
+StopKind
+continue_yrev(YRev *yrev, Address *addr)
+{
+  Y86 *y86 = yrev->y86;
+  if (read_status_y86(y86) != STATUS_AOK) return STOP_NONE;
+  step_logged(yrev);
+  if (read_status_y86(y86) != STATUS_AOK) return STOP_NONE;
+  run_ysim(y86, 0);     //stop at a breakpoint even if stopped here before
+  StopKind stop = STOP_NONE;
+  while (read_status_y86(y86) == STATUS_AOK && stop == STOP_NONE) {
+    uint64_t next = (yrev->step / yrev->interval + 1) * yrev->interval;
+    uint64_t n = run_ysim(y86, next - yrev->step);
+    if (n > 0) clear_log(yrev);
+    yrev->step += n;
+    note_step(yrev);
+    stop = get_stop_ysim(y86, addr);
+  }
+  load_registers(yrev);
+  return stop;
+}
+
+uint64_t
+reverse_step_yrev(YRev *yrev, uint64_t n)
+{
+  if (n > yrev->step) n = yrev->step;
+  uint64_t target = yrev->step - n;
+  uint64_t fromCheckpoint =
+    target - yrev->checkpoints[find_checkpoint(yrev, target)].step;
+  uint64_t nLogged = (fromCheckpoint < LOG_REPLAY_STEPS)
+    ? fromCheckpoint : LOG_REPLAY_STEPS;
+  uint64_t replayCost = fromCheckpoint + nLogged * (UNDO_COST - 1);
+  if (n <= yrev->nLogSteps && n <= replayCost / UNDO_COST) {
+    for (uint64_t i = 0; i < n; i++) undo_logged(yrev);
+  }
+  else {
+    replay_to(yrev, target);
+  }
+  return n;
+}
+
+StopKind
+reverse_continue_yrev(YRev *yrev, Address *addr)
+{
+  Y86 *y86 = yrev->y86;
+  uint64_t end = yrev->step;
+  if (end == 0) return STOP_NONE;
+  //search back a checkpoint at a time for the last stop before end
+  for (Size i = find_checkpoint(yrev, end - 1) + 1; i-- > 0; ) {
+    uint64_t segmentEnd =
+      (i + 1 < yrev->nCheckpoints && yrev->checkpoints[i + 1].step < end)
+      ? yrev->checkpoints[i + 1].step : end;
+    restore_checkpoint(yrev, i);
+    bool isFound = false;
+    uint64_t stopStep = 0;
+    StopKind stop = STOP_NONE;
+    Address stopAddr = 0;
+    for (;;) {
+      yrev->step += run_ysim(y86, segmentEnd - yrev->step);
+      Address a;
+      StopKind kind = get_stop_ysim(y86, &a);
+      if (kind == STOP_NONE) break;
+      if (yrev->step < end) {
+        isFound = true;
+        stopStep = yrev->step;
+        stop = kind;
+        stopAddr = a;
+      }
+    }
+    if (isFound) {
+      replay_to(yrev, stopStep);
+      *addr = stopAddr;
+      return stop;
+    }
+  }
+  replay_to(yrev, 0);
+  return STOP_NONE;
+}
+
+void
+dump_yrev(const YRev *yrev, FILE *out)
+{
+  fprintf(out, "%lu checkpoints every %lu instructions in %lu bytes; "
+          "%lu instructions logged in %lu bytes\n",
+          (unsigned long)yrev->nCheckpoints, (unsigned long)yrev->interval,
+          (unsigned long)yrev->checkpointBytes,
+          (unsigned long)yrev->nLogSteps,
+          (unsigned long)(yrev->nLog * sizeof(UndoEntry)));
+}
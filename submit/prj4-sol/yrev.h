@@ -0,0 +1,61 @@
+#ifndef _YREV_H
+#define _YREV_H
+
+#include "y86.h"
+#include "ysim.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** An opaque structure which executes a y86 program so that it can be
+ *  run backwards as well as forwards, within a memory budget.
+ */
+typedef struct YRevStruct YRev;
+
+/** Start executing the program in y86 reversibly, holding at most
+ *  budget bytes of checkpoints and undo log.  Step 0 is the current
+ *  state of y86, which is the earliest state that can be returned to.
+ *  The program must not execute traps which read input since it is
+ *  replayed from checkpoints.
+ */
+YRev *new_yrev(Y86 *y86, Size budget);
+
+/** Free all resources allocated by new_yrev(). */
+void free_yrev(YRev *yrev);
+
+/** Return the # of instructions executed to reach the current state. */
+uint64_t get_step_yrev(const YRev *yrev);
+
+/** Execute up to n instructions using step_ysim(), logging each so
+ *  that it can be undone.  Stop early if the program halts or faults.
+ *  Return the # of instructions executed.
+ */
+uint64_t step_yrev(YRev *yrev, uint64_t n);
+
+/** Execute the current instruction, then run using run_ysim() until
+ *  the program halts, faults or stops at a breakpoint or watchpoint.
+ *  Return why it stopped, setting *addr as get_stop_ysim() does.
+ */
+StopKind continue_yrev(YRev *yrev, Address *addr);
+
+/** Return to the state n instructions before the current one, or to
+ *  step 0 if there are fewer.  The instructions are undone from the
+ *  log if it holds them and that is cheaper than restoring the last
+ *  checkpoint before the target and executing forward to it.  Return
+ *  the # of instructions undone.
+ */
+uint64_t reverse_step_yrev(YRev *yrev, uint64_t n);
+
+/** Return to the last state before the current one at which
+ *  continue_yrev() would have stopped for a breakpoint or watchpoint,
+ *  or to step 0 if there is none.  Return why it would have stopped
+ *  there (STOP_NONE at step 0), setting *addr as get_stop_ysim() does.
+ */
+StopKind reverse_continue_yrev(YRev *yrev, Address *addr);
+
+/** Write to out a line giving the checkpoints and undo log held by
+ *  yrev and the memory they use.
+ */
+void dump_yrev(const YRev *yrev, FILE *out);
+
+#endif //ifndef _YREV_H
@@ -1,141 +1,54 @@
 #include "ysim.h"
 
-#include "errors.h"
-#include <stdio.h>
+#include "decode.h"
+#include "lazymem.h"
+#include "ycfg.h"
+#include "yops.h"
 
-/************************** Utility Routines ****************************/
+#include "errors.h"
+#include "memalloc.h"
 
-/** Return nybble from op (pos 0: least-significant; pos 1:
- *  most-significant)
- */
-static Byte
-get_nybble(Byte op, int pos) {
-  return (op >> (pos * 4)) & 0xF;
-}
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 /************************** Condition Codes ****************************/
 
-/** Conditions used in instructions */
-typedef enum {
-  ALWAYS_COND, LE_COND, LT_COND, EQ_COND, NE_COND, GE_COND, GT_COND
-} Condition;
-
-/** accessing condition code flags */
-static inline bool read_cc_flag(Byte cc, unsigned flagBitIndex) {
-  return !!(cc & (1 << flagBitIndex));
-}
-/*static inline bool get_zf(Byte cc) { return read_cc_flag(cc, (1<<ZF_CC)); }
-static inline bool get_sf(Byte cc) { return read_cc_flag(cc, (1<<SF_CC)); }
-static inline bool get_of(Byte cc) { return read_cc_flag(cc, (1<<OF_CC)); }
-*/
-static inline bool get_zf(Byte cc) { return (cc & (1<<ZF_CC)) > 0; }
-static inline bool get_sf(Byte cc) { return (cc & (1<<SF_CC)) > 0; }
-static inline bool get_of(Byte cc) { return (cc & (1<<OF_CC)) > 0; }
-
-/** Return true iff the condition specified in the least-significant
- *  nybble of op holds in y86.  Encoding of Figure 3.15 of Bryant's
- *  CompSys3e.
- */
-bool
-check_cc(const Y86 *y86, Byte op)
+/** Return the current condition codes of y86 given pending cc. */
+static inline Byte
+read_lazy_cc(const Y86 *y86, const LazyCC *cc)
 {
-  bool ret = false;
-  Condition condition = get_nybble(op, 0);
-  Byte cc = read_cc_y86(y86);
-  switch (condition) {
-  case ALWAYS_COND:
-    ret = true;
-    break;
-  case LE_COND:
-    ret = (get_sf(cc) ^ get_of(cc)) | get_zf(cc);
-    break;
-	case LT_COND:
-		ret = get_sf(cc) ^ get_of(cc);	
-		break;
-	case EQ_COND:
-		ret = get_zf(cc);
-		break;
-	case NE_COND:
-		ret = !get_zf(cc);
-		break;
-  case GE_COND:
-		ret = !(get_sf(cc)^get_of(cc));
-		break;
-	case GT_COND:
-		ret = !(get_sf(cc)^get_of(cc)) & !get_zf(cc);
-		break;	
-  default: {
-    Address pc = read_pc_y86(y86);
-    fatal("%08lx: bad condition code %d\n", pc, condition);
-    break;
-    }
-  }
-  return ret;
-}
-
-/** return true iff word has its sign bit set */
-static inline bool
-isLt0(Word word) {
-  return (word & (1UL << (sizeof(Word)*CHAR_BIT - 1))) != 0;
+  return (cc->kind == CC_STORED) ? read_cc_y86(y86) : eval_cc(cc);
 }
 
-/** Set condition codes for addition operation with operands opA, opB
- *  and result with result == opA + opB.
- */
-static void
-set_add_arith_cc(Y86 *y86, Word opA, Word opB, Word result)
+/** Write any condition codes pending in cc into y86. */
+static inline void
+store_cc(Y86 *y86, LazyCC *cc)
 {
-	if(result == 0) write_cc_y86(y86, read_cc_y86(y86) | (1<<ZF_CC));
-	else write_cc_y86(y86, read_cc_y86(y86) & ~(1<<ZF_CC));
-
-	if(isLt0(result)) write_cc_y86(y86, read_cc_y86(y86) | (1<<SF_CC));
-	else write_cc_y86(y86, read_cc_y86(y86) & ~(1<<SF_CC));
-	
-	// Set overflow if sign changed
-	if((isLt0(opA) == isLt0(opB)) && (isLt0(result) != isLt0(opA)))
-		write_cc_y86(y86, read_cc_y86(y86) | (1<<OF_CC));
-  else
-		write_cc_y86(y86, read_cc_y86(y86) & ~(1<<OF_CC));
+  if (cc->kind != CC_STORED) {
+    write_cc_y86(y86, eval_cc(cc));
+    cc->kind = CC_STORED;
+  }
 }
 
-/** Set condition codes for subtraction operation with operands opA, opB
- *  and result with result == opA - opB.
+/** Return true iff the condition specified in the least-significant
+ *  nybble of op holds in y86 with pending condition codes lazy.  The
+ *  caller must already have rejected a condition beyond GT_COND as an
+ *  invalid instruction.
  */
-static void
-set_sub_arith_cc(Y86 *y86, Word opA, Word opB, Word result)
-{
-	if(result == 0) write_cc_y86(y86, read_cc_y86(y86) | (1<<ZF_CC));
-	else write_cc_y86(y86, read_cc_y86(y86) & ~(1<<ZF_CC));
-	
-	if(isLt0(result)) write_cc_y86(y86, read_cc_y86(y86) | (1<<SF_CC));
-	else write_cc_y86(y86, read_cc_y86(y86) & ~(1<<SF_CC));
-	
-	// Set overflow if sign changed
-	if((isLt0(opA) != isLt0(opB)) && (isLt0(result) != isLt0(opB)))
-		write_cc_y86(y86, read_cc_y86(y86) | (1<<OF_CC));
-  else
-		write_cc_y86(y86, read_cc_y86(y86) & ~(1<<OF_CC));
-}
-
-static void
-set_logic_op_cc(Y86 *y86, Word result)
+static bool
+check_cc(const Y86 *y86, const LazyCC *lazy, Byte op)
 {
-	// Set zero flag
-	if(result == 0) write_cc_y86(y86, read_cc_y86(y86) | (1<<ZF_CC)); 
-	else write_cc_y86(y86, read_cc_y86(y86) & ~((1<<ZF_CC)));
-
-	// Set sign flag
-	if(isLt0(result)) write_cc_y86(y86, read_cc_y86(y86) | (1<<SF_CC));
-	else write_cc_y86(y86, read_cc_y86(y86) & ~((1<<SF_CC)));
-
-	// Clear overflow flag
-	write_cc_y86(y86, read_cc_y86(y86) & ~((1<<OF_CC)));
+  Condition condition = get_nybble(op, 0);
+  assert(condition <= GT_COND);
+  return is_cond(read_lazy_cc(y86, lazy), condition);
 }
 
 /**************************** Operations *******************************/
 
 static void
-op1(Y86 *y86, Byte op, Register regA, Register regB)
+op1(Y86 *y86, LazyCC *cc, Byte op, Register regA, Register regB)
 {
   enum {ADDL_FN, SUBL_FN, ANDL_FN, XORL_FN };
 	switch(op) {
@@ -148,7 +61,7 @@ op1(Y86 *y86, Byte op, Register regA, Register regB)
 			Word result = reg_a_val + reg_b_val;
 			write_register_y86(y86, regB, result);
 
-			set_add_arith_cc(y86, reg_a_val, reg_b_val, result);
+			set_add_arith_cc(cc, reg_a_val, reg_b_val, result);
 		} break;
 	
 		case SUBL_FN:
@@ -160,7 +73,7 @@ op1(Y86 *y86, Byte op, Register regA, Register regB)
 			Word result = reg_b_val - reg_a_val;
 			write_register_y86(y86, regB, result);
 
-			set_sub_arith_cc(y86, reg_a_val, reg_b_val, result);
+			set_sub_arith_cc(cc, reg_a_val, reg_b_val, result);
 		} break;
 	
 		case ANDL_FN:
@@ -172,7 +85,7 @@ op1(Y86 *y86, Byte op, Register regA, Register regB)
 			Word result = reg_a_val & reg_b_val;
 			write_register_y86(y86, regB, result);
 
-			set_logic_op_cc(y86, result);
+			set_logic_op_cc(cc, result);
 		} break;
 
 		case XORL_FN:
@@ -183,29 +96,660 @@ op1(Y86 *y86, Byte op, Register regA, Register regB)
 			
 			Word result = reg_a_val ^ reg_b_val;
 
-			set_logic_op_cc(y86, result);
+			set_logic_op_cc(cc, result);
 			write_register_y86(y86, regB, result);
 		} break;
 
 	}
 }
 
+/** Perform OPq function fn on registers regA and regB of regs[],
+ *  recording its condition codes in cc.
+ */
+static inline void
+op_regs(LazyCC *cc, Word regs[], Byte fn, Register regA, Register regB)
+{
+  Word a = regs[regA], b = regs[regB];
+  switch (fn) {
+  case ADDQ_FN:
+    regs[regB] = a + b;
+    set_add_arith_cc(cc, a, b, a + b);
+    break;
+  case SUBQ_FN:
+    regs[regB] = b - a;
+    set_sub_arith_cc(cc, a, b, b - a);
+    break;
+  case ANDQ_FN:
+    regs[regB] = a & b;
+    set_logic_op_cc(cc, a & b);
+    break;
+  case XORQ_FN:
+    regs[regB] = a ^ b;
+    set_logic_op_cc(cc, a ^ b);
+    break;
+  }
+}
+
+/** Return true iff condition cond holds for the codes set by
+ *  computing b - a, without evaluating the codes: the signed
+ *  comparison of b with a gives the same result.
+ */
+static inline bool
+is_sub_cond(Byte cond, Word a, Word b)
+{
+  int64_t sa = a, sb = b;
+  switch (cond) {
+  case LE_COND: return sb <= sa;
+  case LT_COND: return sb < sa;
+  case EQ_COND: return b == a;
+  case NE_COND: return b != a;
+  case GE_COND: return sb >= sa;
+  case GT_COND: return sb > sa;
+  default: return true;
+  }
+}
+
+/** Return true iff condition cond holds for the codes set by a logical
+ *  operation with result, whose overflow flag is always clear.
+ */
+static inline bool
+is_logic_cond(Byte cond, Word result)
+{
+  int64_t r = result;
+  switch (cond) {
+  case LE_COND: return r <= 0;
+  case LT_COND: return r < 0;
+  case EQ_COND: return r == 0;
+  case NE_COND: return r != 0;
+  case GE_COND: return r >= 0;
+  case GT_COND: return r > 0;
+  default: return true;
+  }
+}
+
 /*********************** Single Instruction Step ***********************/
 
-typedef enum {
-  HALT_CODE, NOP_CODE, CMOVxx_CODE, IRMOVQ_CODE, RMMOVQ_CODE, MRMOVQ_CODE,
-  OP1_CODE, Jxx_CODE, CALL_CODE, RET_CODE,
-  PUSHQ_CODE, POPQ_CODE } BaseOpCode;
+/********************** Decoded Instruction Cache **********************/
 
-/** Execute the next instruction of y86. Must change status of
- *  y86 to STATUS_HLT on halt, STATUS_ADR or STATUS_INS on
- *  bad address or instruction.
+enum {
+  PAGE_SHIFT = 8,        /** log2 of bytes per code or snapshot page */
+  PAGE_SIZE = 1 << PAGE_SHIFT,
+  WORD_SHIFT = 3,        /** log2 of bytes per changed-word bit */
+  MAX_CFG_BUILDS = 8,    /** max # of static analyses of a program */
+};
+
+/** Indices of run_ysim() handlers other than those for single
+ *  instructions, which are indexed by instruction byte.  A fused
+ *  handler runs an instruction and the one following it with a single
+ *  dispatch.
  */
-void
-step_ysim(Y86 *y86)
+enum {
+  N_OPQ_FNS = XORQ_FN + 1,
+  N_CONDS = GT_COND + 1,
+  HANDLER_FUSE = 0x100,          /** fusion not yet decided */
+  HANDLER_IRMOVQ_OPQ,            /** + OPq function code */
+  HANDLER_MRMOVQ_OPQ = HANDLER_IRMOVQ_OPQ + N_OPQ_FNS,
+  HANDLER_SUBQ_JXX = HANDLER_MRMOVQ_OPQ + N_OPQ_FNS,  /** + jxx condition */
+  HANDLER_ANDQ_JXX = HANDLER_SUBQ_JXX + N_CONDS,
+  HANDLER_BREAK = HANDLER_ANDQ_JXX + N_CONDS,  /** instruction at breakpoint */
+  //accesses proved by static analysis to be in bounds and, for stores,
+  //not to overwrite analyzed code
+  HANDLER_MRMOVQ_PROVEN,
+  HANDLER_RMMOVQ_PROVEN,
+  HANDLER_CALL_PROVEN,
+  HANDLER_RET_PROVEN,
+  HANDLER_PUSHQ_PROVEN,
+  HANDLER_POPQ_PROVEN,
+  HANDLER_RET_ANALYZED,          /** ret which must reach a return site */
+  HANDLER_CHECKED,               /** left to step_checked() */
+  N_HANDLERS,
+};
+
+/** Stop before the instruction at pc if register reg holds value (or
+ *  always if reg is REG_NONE).
+ */
+typedef struct {
+  Address pc;
+  Register reg;
+  Word value;
+} Breakpoint;
+
+/** Stop after a store to any of memory bytes [addr, addr + size). */
+typedef struct {
+  Address addr;
+  Size size;
+} Watchpoint;
+
+/** Simulator state associated with a Y86 instance. */
+typedef struct YSimStruct {
+  Y86 *y86;
+  const Byte *mem;         /** base of y86 memory */
+  Size memSize;
+  Decoded *decoded;        /** one entry per memory address */
+  Size nPages;             /** # of pages in memory */
+  Byte *isCodePage;        /** true for pages containing decoded bytes */
+  Byte *isDirtyPage;       /** true for pages written since base */
+  Address *dirtyPages;     /** the nDirty pages written since base */
+  Size nDirty;
+  Snapshot *base;          /** if non-NULL, snapshot which memory matches
+                            *  except for dirty pages */
+  unsigned changedRegs;    /** bit r set for each register r written
+                            *  since changes were cleared; also
+                            *  CHANGED_CC and CHANGED_STATUS */
+  uint64_t *isChangedWord; /** bit set for each aligned word written
+                            *  since changes were cleared */
+  Address *changedWords;   /** the nChanged words written since cleared */
+  Size nChanged;
+  LazyCC cc;               /** condition codes not yet stored in y86 */
+  StoreFn *storeFn;        /** if non-NULL, called after each store */
+  void *storeCtx;          /** context for storeFn */
+  TrapFn *trapFn;          /** if non-NULL, carries out traps */
+  void *trapCtx;           /** context for trapFn */
+  Byte *coverage;          /** if non-NULL, counts of control transfers
+                            *  in COVERAGE_SIZE entries */
+  ProfileCounts *profile;  /** if non-NULL, execution counts */
+  Breakpoint *breaks;      /** the nBreaks breakpoints */
+  Size nBreaks;
+  Byte *isBreakPage;       /** if non-NULL, true for pages containing
+                            *  breakpoints */
+  Watchpoint *watches;     /** the nWatches watchpoints */
+  Size nWatches;
+  Byte *isWatchPage;       /** if non-NULL, true for pages containing
+                            *  watched bytes */
+  StopKind stop;           /** why the last run stopped */
+  Address stopAddr;        /** breakpoint pc or watched word address */
+  YCfg *cfg;               /** if non-NULL, static analysis covering the
+                            *  current run */
+  Address cfgLo, cfgEnd;   /** extent of code analyzed in cfg */
+  unsigned nCfgBuilds;     /** # of times cfg has been built */
+  bool isExtended;         /** extension instructions are enabled */
+  struct YSimStruct *succ;
+} YSim;
+
+/** All YSim's created so far by the current thread; the most recently
+ *  used is kept first.
+ */
+static _Thread_local YSim *ysims;
+
+/** Return # of bytes in the changed-word bitmap for memory of memSize. */
+static inline Size
+changed_bitmap_size(Size memSize)
+{
+  return ((memSize >> WORD_SHIFT) / 64 + 1) * sizeof(uint64_t);
+}
+
+/** Return # of bytes in the changed-word list for memory of memSize. */
+static inline Size
+changed_list_size(Size memSize)
+{
+  return ((memSize >> WORD_SHIFT) + 2) * sizeof(Address);
+}
+
+static YSim *
+new_ysim(Y86 *y86)
+{
+  YSim *ysim = mallocChk(sizeof(YSim));
+  ysim->y86 = y86;
+  ysim->mem = get_memory_pointer_y86(y86, 0);
+  ysim->memSize = get_memory_size_y86(y86);
+  //tables indexed by address are committed only where memory is used
+  ysim->decoded = new_lazy_mem(ysim->memSize * sizeof(Decoded));
+  ysim->nPages = (ysim->memSize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  ysim->isCodePage = new_lazy_mem((ysim->nPages + 1) * sizeof(Byte));
+  ysim->isDirtyPage = new_lazy_mem((ysim->nPages + 1) * sizeof(Byte));
+  ysim->dirtyPages = new_lazy_mem((ysim->nPages + 1) * sizeof(Address));
+  ysim->nDirty = 0;
+  ysim->base = NULL;
+  ysim->changedRegs = 0;
+  ysim->isChangedWord = new_lazy_mem(changed_bitmap_size(ysim->memSize));
+  ysim->changedWords = new_lazy_mem(changed_list_size(ysim->memSize));
+  ysim->nChanged = 0;
+  ysim->cc.kind = CC_STORED;
+  ysim->storeFn = NULL;
+  ysim->storeCtx = NULL;
+  ysim->trapFn = NULL;
+  ysim->trapCtx = NULL;
+  ysim->coverage = NULL;
+  ysim->profile = NULL;
+  ysim->breaks = NULL;
+  ysim->nBreaks = 0;
+  ysim->isBreakPage = NULL;
+  ysim->watches = NULL;
+  ysim->nWatches = 0;
+  ysim->isWatchPage = NULL;
+  ysim->stop = STOP_NONE;
+  ysim->stopAddr = 0;
+  ysim->cfg = NULL;
+  ysim->cfgLo = ysim->cfgEnd = 0;
+  ysim->nCfgBuilds = 0;
+  ysim->isExtended = false;
+  ysim->succ = ysims;
+  ysims = ysim;
+  return ysim;
+}
+
+/** Return simulator state for y86, creating it on first use. */
+static YSim *
+get_ysim(Y86 *y86)
+{
+  if (ysims != NULL && ysims->y86 == y86) return ysims;
+  for (YSim **p = &ysims; *p != NULL; p = &(*p)->succ) {
+    if ((*p)->y86 == y86) {
+      YSim *ysim = *p;
+      *p = ysim->succ;
+      ysim->succ = ysims;
+      ysims = ysim;
+      return ysim;
+    }
+  }
+  return new_ysim(y86);
+}
+
+/** Return true iff ysim has a breakpoint at pc. */
+static bool
+is_breakpoint(const YSim *ysim, Address pc)
+{
+  for (Size i = 0; i < ysim->nBreaks; i++) {
+    if (ysim->breaks[i].pc == pc) return true;
+  }
+  return false;
+}
+
+/** Return decoded instruction at pc in ysim, decoding and caching it
+ *  if necessary.  Return NULL if it must be left to step_checked().
+ */
+static const Decoded *
+get_decoded(YSim *ysim, Address pc)
+{
+  if (pc >= ysim->memSize) return NULL;
+  Decoded *d = &ysim->decoded[pc];
+  if (d->isValid) return d;
+  if (!decode_instr(ysim->mem, ysim->memSize, pc, d)) return NULL;
+  for (Address a = pc; a < d->nextPC; a += PAGE_SIZE) {
+    ysim->isCodePage[a >> PAGE_SHIFT] = true;
+  }
+  ysim->isCodePage[(d->nextPC - 1) >> PAGE_SHIFT] = true;
+  //only instructions on pages with breakpoints need to be looked up
+  bool isBreak = ysim->isBreakPage != NULL &&
+                 ysim->isBreakPage[pc >> PAGE_SHIFT] && is_breakpoint(ysim, pc);
+  d->handler = isBreak ? HANDLER_BREAK : HANDLER_FUSE;
+  d->isValid = true;
+  return d;
+}
+
+/** Return the run_ysim() handler for decoded instruction d at pc on
+ *  its own, using whatever the static analysis of ysim proved about it.
+ */
+static uint16_t
+single_handler(const YSim *ysim, Address pc, const Decoded *d)
+{
+  uint16_t handler = d->op << 4 | d->fn;
+  if (is_extension(d) && !ysim->isExtended) return HANDLER_CHECKED;
+  if (ysim->cfg == NULL) return handler;
+  unsigned facts = get_facts_ycfg(ysim->cfg, pc);
+  bool isLoad = (facts & CFG_IN_BOUNDS) != 0;
+  bool isStore = isLoad && (facts & CFG_NOT_CODE) != 0;
+  switch (d->op) {
+  case MRMOVQ_CODE: return isLoad ? HANDLER_MRMOVQ_PROVEN : handler;
+  case RMMOVQ_CODE: return isStore ? HANDLER_RMMOVQ_PROVEN : handler;
+  case CALL_CODE:   return isStore ? HANDLER_CALL_PROVEN : handler;
+  case RET_CODE:    return isLoad ? HANDLER_RET_PROVEN : HANDLER_RET_ANALYZED;
+  case PUSHQ_CODE:  return isStore ? HANDLER_PUSHQ_PROVEN : handler;
+  case POPQ_CODE:   return isLoad ? HANDLER_POPQ_PROVEN : handler;
+  default:          return handler;
+  }
+}
+
+/** Set the run_ysim() handler of the decoded instruction at pc,
+ *  fusing it with the instruction which follows it if they form one
+ *  of the common pairs:
+ *
+ *    irmovq $k, %r; OPq %r, %x
+ *    mrmovq D(%b), %a; OPq
+ *    subq or andq; jxx
+ *
+ *  An instruction at a breakpoint is never the second of a pair.
+ */
+static void
+fuse_decoded(YSim *ysim, Address pc)
+{
+  Decoded *d = &ysim->decoded[pc];
+  d->handler = single_handler(ysim, pc, d);
+  const Decoded *d2 = get_decoded(ysim, d->nextPC);
+  if (d2 == NULL || d2->handler == HANDLER_BREAK) return;
+  if (d2->op == OP1_CODE && d2->fn > XORQ_FN) return;
+  if (d->op == IRMOVQ_CODE && d2->op == OP1_CODE && d2->regA == d->regB) {
+    d->handler = HANDLER_IRMOVQ_OPQ + d2->fn;
+  }
+  else if (d->op == MRMOVQ_CODE && d2->op == OP1_CODE) {
+    d->handler = HANDLER_MRMOVQ_OPQ + d2->fn;
+  }
+  else if (d->op == OP1_CODE && d->fn == SUBQ_FN && d2->op == Jxx_CODE) {
+    d->handler = HANDLER_SUBQ_JXX + d2->fn;
+  }
+  else if (d->op == OP1_CODE && d->fn == ANDQ_FN && d2->op == Jxx_CODE) {
+    d->handler = HANDLER_ANDQ_JXX + d2->fn;
+  }
+}
+
+/** Invalidate all decoded instructions in ysim which overlap memory
+ *  bytes [addr, addr + size), along with any instructions fused with
+ *  them.
+ */
+static void
+invalidate_decoded(YSim *ysim, Address addr, Size size)
+{
+  if (addr >= ysim->memSize || size == 0) return;
+  Address last = (ysim->memSize - addr < size) ? ysim->memSize - 1 : addr + size - 1;
+  bool hasCode = false;
+  for (Address p = addr >> PAGE_SHIFT; p <= last >> PAGE_SHIFT; p++) {
+    hasCode |= ysim->isCodePage[p];
+  }
+  if (!hasCode) return;
+  //a fused pair is entered at the first of its two instructions
+  const Size reach = 2*MAX_INSTR_SIZE - 1;
+  Address lo = (addr < reach) ? 0 : addr - reach;
+  for (Address a = lo; a <= last; a++) {
+    ysim->decoded[a].isValid = false;
+  }
+}
+
+/** Discard the static analysis of ysim, along with the decoded
+ *  instructions which depend on it.
+ */
+static void
+drop_cfg(YSim *ysim)
+{
+  free_ycfg(ysim->cfg);
+  ysim->cfg = NULL;
+  invalidate_decoded(ysim, ysim->cfgLo, ysim->cfgEnd - ysim->cfgLo);
+  ysim->cfgLo = ysim->cfgEnd = 0;
+}
+
+/** Make sure that any static analysis of ysim covers a run starting at
+ *  pc with registers regs[], analyzing the program afresh if it does
+ *  not.  A program which keeps invalidating its analysis is eventually
+ *  left unanalyzed.
+ */
+static void
+analyze_run(YSim *ysim, Address pc, const Word regs[])
+{
+  if (ysim->cfg != NULL) {
+    if (is_covered_ycfg(ysim->cfg, pc, regs)) return;
+    drop_cfg(ysim);
+  }
+  if (ysim->nCfgBuilds >= MAX_CFG_BUILDS) return;
+  ysim->nCfgBuilds++;
+  ysim->cfg = new_ycfg(ysim->mem, ysim->memSize, pc, regs);
+  if (ysim->cfg == NULL) return;
+  Address lo;
+  Size size = get_code_ycfg(ysim->cfg, &lo);
+  ysim->cfgLo = lo;
+  ysim->cfgEnd = lo + size;
+  //redecode analyzed instructions to use what was proved about them
+  invalidate_decoded(ysim, lo, size);
+}
+
+/** Discard the static analysis of ysim if memory bytes
+ *  [addr, addr + size), which have changed, contain analyzed code.
+ */
+static inline void
+invalidate_cfg(YSim *ysim, Address addr, Size size)
+{
+  if (addr < ysim->cfgEnd && addr + size > ysim->cfgLo &&
+      is_code_ycfg(ysim->cfg, addr, size)) {
+    drop_cfg(ysim);
+  }
+}
+
+/** Invalidate decoded instructions overlapping memory bytes
+ *  [addr, addr + size), which have changed, discarding the static
+ *  analysis of ysim if they contain analyzed code.
+ */
+static inline void
+invalidate_code(YSim *ysim, Address addr, Size size)
 {
-  //@TODO 
+  invalidate_cfg(ysim, addr, size);
+  invalidate_decoded(ysim, addr, size);
+}
+
+/** Record that memory bytes [addr, addr + size) of ysim have been
+ *  written since its base snapshot was taken.
+ */
+static inline void
+mark_dirty(YSim *ysim, Address addr, Size size)
+{
+  if (addr >= ysim->memSize || size == 0) return;
+  Address last = (ysim->memSize - addr < size) ? ysim->memSize - 1 : addr + size - 1;
+  for (Address p = addr >> PAGE_SHIFT; p <= last >> PAGE_SHIFT; p++) {
+    if (!ysim->isDirtyPage[p]) {
+      ysim->isDirtyPage[p] = true;
+      ysim->dirtyPages[ysim->nDirty++] = p;
+    }
+  }
+}
+
+/** Record that memory bytes [addr, addr + size) of ysim have been
+ *  written since its changes were last cleared.
+ */
+static inline void
+mark_changed(YSim *ysim, Address addr, Size size)
+{
+  if (addr >= ysim->memSize || size == 0) return;
+  Address last = (ysim->memSize - addr < size) ? ysim->memSize - 1 : addr + size - 1;
+  for (Address w = addr >> WORD_SHIFT; w <= last >> WORD_SHIFT; w++) {
+    uint64_t bit = 1ULL << (w % 64);
+    if (!(ysim->isChangedWord[w / 64] & bit)) {
+      ysim->isChangedWord[w / 64] |= bit;
+      ysim->changedWords[ysim->nChanged++] = w << WORD_SHIFT;
+    }
+  }
+}
+
+/** Write value to register reg of ysim's y86, recording the change. */
+static inline void
+set_register(YSim *ysim, Register reg, Word value)
+{
+  write_register_y86(ysim->y86, reg, value);
+  ysim->changedRegs |= 1u << reg;
+}
+
+/** Write any condition codes pending in ysim into its y86, recording
+ *  the change.
+ */
+static inline void
+flush_cc(YSim *ysim)
+{
+  if (ysim->cc.kind != CC_STORED) ysim->changedRegs |= CHANGED_CC;
+  store_cc(ysim->y86, &ysim->cc);
+}
+
+/** Record a change of status if ysim's y86, which was running before
+ *  the last step or run, has stopped.
+ */
+static inline void
+note_status(YSim *ysim)
+{
+  if (read_status_y86(ysim->y86) != STATUS_AOK) {
+    ysim->changedRegs |= CHANGED_STATUS;
+  }
+}
+
+/** Record a STOP_WATCH in ysim if the store of the word at addr
+ *  overlaps a watchpoint.
+ */
+static void
+check_watchpoints(YSim *ysim, Address addr)
+{
+  Address last = addr + sizeof(Word) - 1;
+  if (!ysim->isWatchPage[addr >> PAGE_SHIFT] &&
+      !ysim->isWatchPage[last >> PAGE_SHIFT]) {
+    return;
+  }
+  for (Size i = 0; i < ysim->nWatches; i++) {
+    const Watchpoint *w = &ysim->watches[i];
+    if (addr <= w->addr + (w->size - 1) && w->addr <= last) {
+      ysim->stop = STOP_WATCH;
+      ysim->stopAddr = addr;
+      return;
+    }
+  }
+}
+
+/** Update ysim after a successful store of the word at addr, which
+ *  is known not to overlap any analyzed instruction.  It may still
+ *  overwrite instructions decoded outside the analysis.
+ */
+static inline void
+note_data_store(YSim *ysim, Address addr)
+{
+  invalidate_decoded(ysim, addr, sizeof(Word));
+  mark_dirty(ysim, addr, sizeof(Word));
+  mark_changed(ysim, addr, sizeof(Word));
+  if (ysim->isWatchPage != NULL) check_watchpoints(ysim, addr);
+  if (ysim->storeFn != NULL) ysim->storeFn(ysim->storeCtx, addr);
+}
+
+/** Update ysim after a successful store of the word at addr. */
+static inline void
+note_store(YSim *ysim, Address addr)
+{
+  invalidate_cfg(ysim, addr, sizeof(Word));
+  note_data_store(ysim, addr);
+}
+
+/** Write word value to addr in y86, invalidating any decoded
+ *  instructions which it overwrites.
+ */
+static void
+write_code_word(YSim *ysim, Address addr, Word value)
+{
+  write_memory_word_y86(ysim->y86, addr, value);
+  if (read_status_y86(ysim->y86) == STATUS_AOK) note_store(ysim, addr);
+}
+
+/** Count the control transfer from pc to target in coverage[],
+ *  indexed as AFL does by a hash of both ends so that the edge from
+ *  target back to pc counts separately.
+ */
+static inline void
+note_edge(Byte coverage[], Address pc, Address target)
+{
+  uint64_t from = pc * 0x9E3779B97F4A7C15ULL;
+  uint64_t to = target * 0x9E3779B97F4A7C15ULL;
+  coverage[((from >> 1) ^ to) >> (64 - COVERAGE_BITS)]++;
+}
+
+/** Count the edge taken by the instruction just run at pc by ysim if
+ *  it was a jump, call or return.
+ */
+static void
+note_transfer(YSim *ysim, Address pc)
+{
+  if (pc >= ysim->memSize || read_status_y86(ysim->y86) != STATUS_AOK) return;
+  BaseOpCode op = get_nybble(ysim->mem[pc], 1);
+  if (op == Jxx_CODE || op == CALL_CODE || op == RET_CODE) {
+    note_edge(ysim->coverage, pc, read_pc_y86(ysim->y86));
+  }
+}
+
+/** Count the instruction at pc in profile unless it lies beyond
+ *  memory of memSize bytes.
+ */
+static inline void
+count_instr(ProfileCounts *profile, Address pc, Size memSize)
+{
+  if (pc >= memSize) return;
+  profile->counts[pc]++;
+  profile->isCountedPage[pc >> PROFILE_PAGE_SHIFT] = true;
+}
+
+/** Count a call to target in profile unless it lies beyond memory of
+ *  memSize bytes.
+ */
+static inline void
+count_call(ProfileCounts *profile, Address target, Size memSize)
+{
+  if (target >= memSize) return;
+  profile->callCounts[target]++;
+  profile->isCountedPage[target >> PROFILE_PAGE_SHIFT] = true;
+}
+
+/** Count in the profile of ysim whether the instruction about to be run
+ *  at pc is a jump which will be taken.  Return true iff it is a call,
+ *  whose target is to be counted once it has run.
+ */
+static bool
+count_checked_jump(YSim *ysim, Address pc)
+{
+  if (pc >= ysim->memSize) return false;
+  Byte instr = ysim->mem[pc];
+  BaseOpCode op = get_nybble(instr, 1);
+  if (op == Jxx_CODE && get_nybble(instr, 0) <= GT_COND) {
+    ysim->profile->takenCounts[pc] += check_cc(ysim->y86, &ysim->cc, instr);
+  }
+  return op == CALL_CODE;
+}
+
+/** Return true iff a word access at addr lies entirely within the
+ *  memory of ysim.
+ */
+static inline bool
+is_word_in_bounds(const YSim *ysim, Address addr)
+{
+  return ysim->memSize >= sizeof(Word) && addr <= ysim->memSize - sizeof(Word);
+}
+
+/** Set *value to the word at addr in ysim's y86, reading in-bounds
+ *  words directly from memory.  Return false on an access error.
+ */
+static inline bool
+load_word(YSim *ysim, Address addr, Word *value)
+{
+  if (is_word_in_bounds(ysim, addr)) {
+    *value = get_le_word(&ysim->mem[addr]);
+    return true;
+  }
+  *value = read_memory_word_y86(ysim->y86, addr);
+  return read_status_y86(ysim->y86) == STATUS_AOK;
+}
 
+/** Store word value at addr in ysim's y86 as write_code_word(), but
+ *  without checking status for in-bounds words.  Return false on an
+ *  access error.
+ */
+static inline bool
+store_word(YSim *ysim, Address addr, Word value)
+{
+  if (is_word_in_bounds(ysim, addr)) {
+    write_memory_word_y86(ysim->y86, addr, value);
+    note_store(ysim, addr);
+    return true;
+  }
+  write_code_word(ysim, addr, value);
+  return read_status_y86(ysim->y86) == STATUS_AOK;
+}
+
+/** Store word value at addr in ysim's y86, where static analysis has
+ *  proved that the word lies within memory and outside any analyzed
+ *  instruction.
+ */
+static inline void
+store_data_word(YSim *ysim, Address addr, Word value)
+{
+  write_memory_word_y86(ysim->y86, addr, value);
+  note_data_store(ysim, addr);
+}
+
+/** Execute the next instruction of y86 by fetching and decoding it
+ *  directly from memory, checking status after every access.  This
+ *  is the reference path used for anything the decoded-instruction
+ *  cache declines to handle.
+ */
+static void
+step_checked(YSim *ysim)
+{
+  Y86 *y86 = ysim->y86;
   if(read_status_y86(y86) != STATUS_AOK) return;
 
   //Fetch instruction
@@ -216,6 +760,12 @@ step_ysim(Y86 *y86)
   if(read_status_y86(y86) != STATUS_AOK) return;
 
   BaseOpCode op = get_nybble(instr, 1);
+
+  //an undefined condition makes the instruction invalid
+  if ((op == CMOVxx_CODE || op == Jxx_CODE) && get_nybble(instr, 0) > GT_COND) {
+    write_status_y86(y86, STATUS_INS);
+    return;
+  }
   
   switch(op) {
     
@@ -239,7 +789,7 @@ step_ysim(Y86 *y86)
 			Word imm = read_memory_word_y86(y86, pc + 2*sizeof(Byte));
   		if(read_status_y86(y86) != STATUS_AOK) return;
 	
-			write_register_y86(y86, reg, imm);
+			set_register(ysim, reg, imm);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
 			write_pc_y86(y86, pc + 2*sizeof(Byte) + sizeof(Word));
@@ -257,10 +807,10 @@ step_ysim(Y86 *y86)
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
 			stack_addr -= sizeof(Address);
-			write_register_y86(y86, REG_RSP, stack_addr);
+			set_register(ysim, REG_RSP, stack_addr);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
-			write_memory_word_y86(y86, stack_addr, pc+sizeof(Byte)+sizeof(Word));
+			write_code_word(ysim, stack_addr, pc+sizeof(Byte)+sizeof(Word));
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
 
@@ -279,7 +829,7 @@ step_ysim(Y86 *y86)
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
 			stack_addr += sizeof(Address);
-			write_register_y86(y86, REG_RSP, stack_addr);
+			set_register(ysim, REG_RSP, stack_addr);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 	
 			// Move PC to there
@@ -301,7 +851,7 @@ step_ysim(Y86 *y86)
 			Word data = read_memory_word_y86(y86, reg_b_value+offset);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
-			write_register_y86(y86, reg_a, data);
+			set_register(ysim, reg_a, data);
 
 			write_pc_y86(y86, pc+2*sizeof(Byte)+sizeof(Word));
 
@@ -321,7 +871,7 @@ step_ysim(Y86 *y86)
 			Word reg_b_value = read_register_y86(y86, reg_b);	
 			Word data = read_register_y86(y86, reg_a); 
 
-			write_memory_word_y86(y86, reg_b_value+offset, data);
+			write_code_word(ysim, reg_b_value+offset, data);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
 			write_pc_y86(y86, pc+2*sizeof(Byte)+sizeof(Word));
@@ -335,7 +885,7 @@ step_ysim(Y86 *y86)
 			write_pc_y86(y86, pc+2*sizeof(Byte));
 
 			// If the compare fails, skip to next instruction	
-			if(!check_cc(y86, func)) break;		
+			if(!check_cc(y86, &ysim->cc, func)) break;		
 
 			// Mov value from one register to another
 			Byte reg_byte = read_memory_byte_y86(y86, pc+sizeof(Byte));
@@ -345,7 +895,7 @@ step_ysim(Y86 *y86)
 			Register reg_b = get_nybble(reg_byte, 0);
 
 			Word reg_a_value = read_register_y86(y86, reg_a);
-			write_register_y86(y86, reg_b, reg_a_value);
+			set_register(ysim, reg_b, reg_a_value);
 
 		} break;
 
@@ -357,9 +907,86 @@ step_ysim(Y86 *y86)
 			
 			Register reg_a = get_nybble(reg_byte, 1);
 			Register reg_b = get_nybble(reg_byte, 0);
-				
-			op1(y86, get_nybble(instr, 0), reg_a, reg_b);			
-			
+			Byte func = get_nybble(instr, 0);
+
+			// Other functions after xorq do nothing, as in the base ISA
+			if (ysim->isExtended && func > XORQ_FN && func <= MODQ_FN) {
+				Word result;
+				if (!op_words(&ysim->cc, func, read_register_y86(y86, reg_a),
+				              read_register_y86(y86, reg_b), &result)) {
+					write_status_y86(y86, STATUS_INS);
+					return;
+				}
+				set_register(ysim, reg_b, result);
+			}
+			else {
+				op1(y86, &ysim->cc, func, reg_a, reg_b);
+				ysim->changedRegs |= 1u << reg_b;
+			}
+
+			write_pc_y86(y86, pc + 2*sizeof(Byte));
+		} break;
+
+		case IOPQ_CODE:
+		{
+			Byte func = get_nybble(instr, 0);
+			if (!ysim->isExtended || func > XORQ_FN) {
+				write_status_y86(y86, STATUS_INS);
+				return;
+			}
+			Byte reg_byte = read_memory_byte_y86(y86, pc + sizeof(Byte));
+  		if(read_status_y86(y86) != STATUS_AOK) return;
+
+			Register reg_b = get_nybble(reg_byte, 0);
+
+			Word imm = read_memory_word_y86(y86, pc + 2*sizeof(Byte));
+  		if(read_status_y86(y86) != STATUS_AOK) return;
+
+			Word result;
+			op_words(&ysim->cc, func, imm, read_register_y86(y86, reg_b), &result);
+			set_register(ysim, reg_b, result);
+
+			write_pc_y86(y86, pc + 2*sizeof(Byte) + sizeof(Word));
+		} break;
+
+		case BLOCK_CODE:
+		{
+			Byte func = get_nybble(instr, 0);
+			if (!ysim->isExtended || func > FILLQ_FN) {
+				write_status_y86(y86, STATUS_INS);
+				return;
+			}
+			Byte reg_byte = read_memory_byte_y86(y86, pc + sizeof(Byte));
+  		if(read_status_y86(y86) != STATUS_AOK) return;
+
+			Register reg_a = get_nybble(reg_byte, 1);
+			Register reg_b = get_nybble(reg_byte, 0);
+			if (reg_a == REG_NONE || reg_b == REG_NONE || reg_a == reg_b ||
+			    reg_a == REG_RCX || reg_b == REG_RCX) {
+				write_status_y86(y86, STATUS_INS);
+				return;
+			}
+
+			// Move a word at a time, so that after a fault the registers
+			// describe the words not yet moved
+			while (read_register_y86(y86, REG_RCX) != 0) {
+				Address src = read_register_y86(y86, reg_a);
+				Address dst = read_register_y86(y86, reg_b);
+				Word value = src;
+				if (func == COPYQ_FN) {
+					value = read_memory_word_y86(y86, src);
+  				if(read_status_y86(y86) != STATUS_AOK) return;
+				}
+				write_code_word(ysim, dst, value);
+  			if(read_status_y86(y86) != STATUS_AOK) return;
+
+				if (func == COPYQ_FN) {
+					set_register(ysim, reg_a, src + sizeof(Word));
+				}
+				set_register(ysim, reg_b, dst + sizeof(Word));
+				set_register(ysim, REG_RCX, read_register_y86(y86, REG_RCX) - 1);
+			}
+
 			write_pc_y86(y86, pc + 2*sizeof(Byte));
 		} break;
 
@@ -378,9 +1005,9 @@ step_ysim(Y86 *y86)
 			Word reg_value = read_register_y86(y86, reg);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
-			write_register_y86(y86, REG_RSP, stack_addr);
+			set_register(ysim, REG_RSP, stack_addr);
 
-			write_memory_word_y86(y86, stack_addr, reg_value);
+			write_code_word(ysim, stack_addr, reg_value);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 
 
@@ -401,20 +1028,80 @@ step_ysim(Y86 *y86)
 			Word stack_value = read_memory_word_y86(y86, stack_addr);
   		if(read_status_y86(y86) != STATUS_AOK) return;
 			stack_addr += sizeof(Address);
-			write_register_y86(y86, REG_RSP, stack_addr);
+			set_register(ysim, REG_RSP, stack_addr);
 
-			write_register_y86(y86, reg, stack_value);
+			set_register(ysim, reg, stack_value);
 
 
 			write_pc_y86(y86, pc + 2*sizeof(Byte));
 
 		} break;
 
+		case CASQ_CODE:
+		{
+			if (!ysim->isExtended || get_nybble(instr, 0) != 0) {
+				write_status_y86(y86, STATUS_INS);
+				return;
+			}
+			Byte reg_byte = read_memory_byte_y86(y86, pc + sizeof(Byte));
+  		if(read_status_y86(y86) != STATUS_AOK) return;
+
+			Register reg_a = get_nybble(reg_byte, 1);
+			Register reg_b = get_nybble(reg_byte, 0);
+			if (reg_a == REG_NONE || reg_b == REG_NONE) {
+				write_status_y86(y86, STATUS_INS);
+				return;
+			}
+
+			Word offset = read_memory_word_y86(y86, pc+2*sizeof(Byte));
+  		if(read_status_y86(y86) != STATUS_AOK) return;
+
+			// Only aligned words can be swapped atomically
+			Address addr = read_register_y86(y86, reg_b) + offset;
+			if (addr % sizeof(Word) != 0) {
+				write_status_y86(y86, STATUS_ADR);
+				return;
+			}
+			Word old = read_memory_word_y86(y86, addr);
+  		if(read_status_y86(y86) != STATUS_AOK) return;
+
+			Word expected = read_register_y86(y86, REG_RAX);
+			if (old == expected) {
+				write_code_word(ysim, addr, read_register_y86(y86, reg_a));
+  			if(read_status_y86(y86) != STATUS_AOK) return;
+			}
+			else {
+				set_register(ysim, REG_RAX, old);
+			}
+			set_sub_arith_cc(&ysim->cc, old, expected, expected - old);
+
+			write_pc_y86(y86, pc+2*sizeof(Byte)+sizeof(Word));
+		} break;
+
+		case TRAP_CODE:
+		{
+			if (get_nybble(instr, 0) != 0 || ysim->trapFn == NULL) {
+				write_status_y86(y86, STATUS_INS);
+				return;
+			}
+			Word result;
+			Status status = ysim->trapFn(ysim->trapCtx, y86, &result);
+			if (status == STATUS_AOK || status == STATUS_HLT) {
+				set_register(ysim, REG_RAX, result);
+			}
+			if (status != STATUS_AOK) {
+				write_status_y86(y86, status);
+				return;
+			}
+
+			write_pc_y86(y86, pc + sizeof(Byte));
+		} break;
+
 		case Jxx_CODE:
 		{
 
 			Word dest = read_memory_word_y86(y86, pc+sizeof(Byte));	
-			if(check_cc(y86, instr)) {
+			if(check_cc(y86, &ysim->cc, instr)) {
 				write_pc_y86(y86, dest);		
 			}
 			else {
@@ -432,3 +1119,1095 @@ step_ysim(Y86 *y86)
 
 }
 
+/** Execute the decoded instruction d in ysim.  Accesses which
+ *  are known to be valid from decoding are not re-checked.
+ */
+static void
+step_decoded(YSim *ysim, const Decoded *d)
+{
+  Y86 *y86 = ysim->y86;
+  //extensions are left to the reference path unless run by run_ysim()
+  if (is_extension(d)) {
+    step_checked(ysim);
+    return;
+  }
+  switch (d->op) {
+  case HALT_CODE:
+    write_status_y86(y86, STATUS_HLT);
+    break;
+  case NOP_CODE:
+    write_pc_y86(y86, d->nextPC);
+    break;
+  case CMOVxx_CODE:
+    write_pc_y86(y86, d->nextPC);
+    if (check_cc(y86, &ysim->cc, d->fn)) {
+      set_register(ysim, d->regB, read_register_y86(y86, d->regA));
+    }
+    break;
+  case IRMOVQ_CODE:
+    set_register(ysim, d->regB, d->imm);
+    write_pc_y86(y86, d->nextPC);
+    break;
+  case RMMOVQ_CODE: {
+    Address addr = read_register_y86(y86, d->regB) + d->imm;
+    if (!store_word(ysim, addr, read_register_y86(y86, d->regA))) return;
+    write_pc_y86(y86, d->nextPC);
+    break;
+  }
+  case MRMOVQ_CODE: {
+    Address addr = read_register_y86(y86, d->regB) + d->imm;
+    Word data;
+    if (!load_word(ysim, addr, &data)) return;
+    set_register(ysim, d->regA, data);
+    write_pc_y86(y86, d->nextPC);
+    break;
+  }
+  case OP1_CODE:
+    op1(y86, &ysim->cc, d->fn, d->regA, d->regB);
+    ysim->changedRegs |= 1u << d->regB;
+    write_pc_y86(y86, d->nextPC);
+    break;
+  case Jxx_CODE:
+    write_pc_y86(y86, check_cc(y86, &ysim->cc, d->fn) ? d->imm : d->nextPC);
+    break;
+  case CALL_CODE: {
+    Address stackAddr = read_register_y86(y86, REG_RSP) - sizeof(Address);
+    set_register(ysim, REG_RSP, stackAddr);
+    if (!store_word(ysim, stackAddr, d->nextPC)) return;
+    write_pc_y86(y86, d->imm);
+    break;
+  }
+  case RET_CODE: {
+    Address stackAddr = read_register_y86(y86, REG_RSP);
+    Address retAddr;
+    if (!load_word(ysim, stackAddr, &retAddr)) return;
+    set_register(ysim, REG_RSP, stackAddr + sizeof(Address));
+    write_pc_y86(y86, retAddr);
+    break;
+  }
+  case PUSHQ_CODE: {
+    Address stackAddr = read_register_y86(y86, REG_RSP) - sizeof(Address);
+    Word value = read_register_y86(y86, d->regA);
+    set_register(ysim, REG_RSP, stackAddr);
+    if (!store_word(ysim, stackAddr, value)) return;
+    write_pc_y86(y86, d->nextPC);
+    break;
+  }
+  case POPQ_CODE: {
+    Address stackAddr = read_register_y86(y86, REG_RSP);
+    Word value;
+    if (!load_word(ysim, stackAddr, &value)) return;
+    set_register(ysim, REG_RSP, stackAddr + sizeof(Address));
+    set_register(ysim, d->regA, value);
+    write_pc_y86(y86, d->nextPC);
+    break;
+  }
+  default:
+    step_checked(ysim);
+    break;
+  }
+}
+
+/** Execute the next instruction of y86. Must change status of
+ *  y86 to STATUS_HLT on halt, STATUS_ADR or STATUS_INS on
+ *  bad address or instruction.
+ */
+void
+step_ysim(Y86 *y86)
+{
+  if (read_status_y86(y86) != STATUS_AOK) return;
+  YSim *ysim = get_ysim(y86);
+  Address pc = read_pc_y86(y86);
+  ProfileCounts *profile = ysim->profile;
+  bool isCall = false;
+  if (profile != NULL) {
+    count_instr(profile, pc, ysim->memSize);
+    isCall = count_checked_jump(ysim, pc);
+  }
+  const Decoded *d = get_decoded(ysim, pc);
+  if (d == NULL) {
+    step_checked(ysim);
+  }
+  else {
+    step_decoded(ysim, d);
+  }
+  flush_cc(ysim);
+  note_status(ysim);
+  if (ysim->coverage != NULL) note_transfer(ysim, pc);
+  if (isCall && read_status_y86(y86) == STATUS_AOK) {
+    count_call(profile, read_pc_y86(y86), ysim->memSize);
+  }
+}
+
+/** Invalidate any decoded instructions cached for y86 which overlap
+ *  memory bytes [addr, addr + size).
+ */
+void
+invalidate_ysim(Y86 *y86, Address addr, Size size)
+{
+  YSim *ysim = get_ysim(y86);
+  mark_dirty(ysim, addr, size);
+  mark_changed(ysim, addr, size);
+  invalidate_code(ysim, addr, size);
+}
+
+/** Arrange for fn(ctx, addr) to be called after every word which the
+ *  simulator successfully stores at addr in y86.
+ */
+void
+set_store_fn_ysim(Y86 *y86, StoreFn *fn, void *ctx)
+{
+  YSim *ysim = get_ysim(y86);
+  ysim->storeFn = fn;
+  ysim->storeCtx = ctx;
+}
+
+/** Arrange for fn(ctx, y86, &result) to carry out each trap
+ *  instruction run in y86.
+ */
+void
+set_trap_fn_ysim(Y86 *y86, TrapFn *fn, void *ctx)
+{
+  YSim *ysim = get_ysim(y86);
+  ysim->trapFn = fn;
+  ysim->trapCtx = ctx;
+}
+
+/** Make step_ysim() and run_ysim() count the edges taken in y86 in
+ *  coverage[COVERAGE_SIZE].
+ */
+void
+set_coverage_ysim(Y86 *y86, Byte coverage[])
+{
+  get_ysim(y86)->coverage = coverage;
+}
+
+/** Make step_ysim() and run_ysim() count the instructions run in y86
+ *  in profile.
+ */
+void
+set_profile_ysim(Y86 *y86, ProfileCounts *profile)
+{
+  get_ysim(y86)->profile = profile;
+}
+
+/** Enable the extension instructions in y86 iff isEnabled. */
+void
+set_extensions_ysim(Y86 *y86, bool isEnabled)
+{
+  YSim *ysim = get_ysim(y86);
+  if (ysim->isExtended == isEnabled) return;
+  ysim->isExtended = isEnabled;
+  //handlers of decoded extensions depend on whether they are enabled
+  clear_lazy_mem(ysim->decoded, ysim->memSize * sizeof(Decoded));
+}
+
+/** Return true iff the extension instructions are enabled in y86. */
+bool
+get_extensions_ysim(Y86 *y86)
+{
+  return get_ysim(y86)->isExtended;
+}
+
+/** Make run_ysim() stop before the instruction at pc when register reg
+ *  holds value, or always if reg is REG_NONE.
+ */
+void
+add_breakpoint_ysim(Y86 *y86, Address pc, Register reg, Word value)
+{
+  YSim *ysim = get_ysim(y86);
+  if (pc >= ysim->memSize) return;
+  if (ysim->isBreakPage == NULL) {
+    ysim->isBreakPage = new_lazy_mem((ysim->nPages + 1) * sizeof(Byte));
+  }
+  ysim->breaks =
+    reallocChk(ysim->breaks, (ysim->nBreaks + 1) * sizeof(Breakpoint));
+  ysim->breaks[ysim->nBreaks++] = (Breakpoint){ pc, reg, value };
+  ysim->isBreakPage[pc >> PAGE_SHIFT] = true;
+  //redecode the instruction along with any pair it was fused into
+  invalidate_decoded(ysim, pc, 1);
+}
+
+/** Make run_ysim() stop after any store to memory bytes
+ *  [addr, addr + size).
+ */
+void
+add_watchpoint_ysim(Y86 *y86, Address addr, Size size)
+{
+  YSim *ysim = get_ysim(y86);
+  if (addr >= ysim->memSize || size == 0) return;
+  if (ysim->memSize - addr < size) size = ysim->memSize - addr;
+  if (ysim->isWatchPage == NULL) {
+    //+ 1 since a stored word may extend past the end of memory
+    ysim->isWatchPage = new_lazy_mem((ysim->nPages + 1) * sizeof(Byte));
+  }
+  ysim->watches =
+    reallocChk(ysim->watches, (ysim->nWatches + 1) * sizeof(Watchpoint));
+  ysim->watches[ysim->nWatches++] = (Watchpoint){ addr, size };
+  Address last = addr + size - 1;
+  for (Address p = addr >> PAGE_SHIFT; p <= last >> PAGE_SHIFT; p++) {
+    ysim->isWatchPage[p] = true;
+  }
+}
+
+/** Return why the last run_ysim() of y86 stopped. */
+StopKind
+get_stop_ysim(Y86 *y86, Address *addr)
+{
+  YSim *ysim = get_ysim(y86);
+  *addr = ysim->stopAddr;
+  return ysim->stop;
+}
+
+/** Set *changes to the state of y86 written since changes were last
+ *  cleared.
+ */
+void
+get_changes_ysim(Y86 *y86, YChanges *changes)
+{
+  YSim *ysim = get_ysim(y86);
+  changes->regs = ysim->changedRegs;
+  changes->nWords = ysim->nChanged;
+  changes->words = ysim->changedWords;
+}
+
+/** Forget the changes recorded for y86. */
+void
+clear_changes_ysim(Y86 *y86)
+{
+  YSim *ysim = get_ysim(y86);
+  for (Size i = 0; i < ysim->nChanged; i++) {
+    Address w = ysim->changedWords[i] >> WORD_SHIFT;
+    ysim->isChangedWord[w / 64] &= ~(1ULL << (w % 64));
+  }
+  ysim->nChanged = 0;
+  ysim->changedRegs = 0;
+}
+
+/** Free all simulator resources associated with y86. */
+void
+free_ysim(Y86 *y86)
+{
+  for (YSim **p = &ysims; *p != NULL; p = &(*p)->succ) {
+    if ((*p)->y86 == y86) {
+      YSim *ysim = *p;
+      *p = ysim->succ;
+      free_lazy_mem(ysim->decoded, ysim->memSize * sizeof(Decoded));
+      free_lazy_mem(ysim->isCodePage, (ysim->nPages + 1) * sizeof(Byte));
+      free_lazy_mem(ysim->isDirtyPage, (ysim->nPages + 1) * sizeof(Byte));
+      free_lazy_mem(ysim->dirtyPages, (ysim->nPages + 1) * sizeof(Address));
+      free_lazy_mem(ysim->isChangedWord, changed_bitmap_size(ysim->memSize));
+      free_lazy_mem(ysim->changedWords, changed_list_size(ysim->memSize));
+      if (ysim->isBreakPage != NULL) {
+        free_lazy_mem(ysim->isBreakPage, (ysim->nPages + 1) * sizeof(Byte));
+      }
+      if (ysim->isWatchPage != NULL) {
+        free_lazy_mem(ysim->isWatchPage, (ysim->nPages + 1) * sizeof(Byte));
+      }
+      free(ysim->breaks);
+      free(ysim->watches);
+      if (ysim->cfg != NULL) free_ycfg(ysim->cfg);
+      if (ysim->base != NULL) free_snapshot(ysim->base);
+      free(ysim);
+      return;
+    }
+  }
+}
+
+/****************************** Snapshots ******************************/
+
+/** A page of snapshot memory.  Pages are immutable once created and
+ *  are shared by all snapshots in which they are unchanged.
+ */
+typedef struct {
+  int refCount;
+  Byte bytes[];
+} SnapPage;
+
+struct SnapshotStruct {
+  int refCount;            /** # of references, including YSim bases */
+  Size memSize;
+  Size nPages;
+  SnapPage **pages;        /** NULL for pages which are all zero */
+  Word regs[N_REG];
+  Address pc;
+  Byte cc;
+  Status status;
+  bool isExtended;         /** extension instructions are enabled */
+};
+
+/** Return # of bytes in page p of memory of size memSize. */
+static inline Size
+page_size(Size memSize, Address p)
+{
+  Address addr = p << PAGE_SHIFT;
+  return (memSize - addr < PAGE_SIZE) ? memSize - addr : PAGE_SIZE;
+}
+
+/** Return true if the size bytes at mem are all zero. */
+static inline bool
+is_zero(const Byte mem[], Size size)
+{
+  Size i = 0;
+  while (i < size && mem[i] == 0) i++;
+  return i == size;
+}
+
+/** Return a new page containing the size bytes at mem; NULL if they
+ *  are all zero.
+ */
+static SnapPage *
+new_snap_page(const Byte mem[], Size size)
+{
+  if (is_zero(mem, size)) return NULL;
+  SnapPage *page = mallocChk(sizeof(SnapPage) + size);
+  page->refCount = 1;
+  memcpy(page->bytes, mem, size);
+  return page;
+}
+
+static inline SnapPage *
+ref_snap_page(SnapPage *page)
+{
+  if (page != NULL) __atomic_add_fetch(&page->refCount, 1, __ATOMIC_RELAXED);
+  return page;
+}
+
+static inline void
+unref_snap_page(SnapPage *page)
+{
+  if (page != NULL && __atomic_sub_fetch(&page->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(page);
+  }
+}
+
+/** Make snapshot the base of ysim, whose memory must match it. */
+static void
+set_base(YSim *ysim, Snapshot *snapshot)
+{
+  __atomic_add_fetch(&snapshot->refCount, 1, __ATOMIC_RELAXED);
+  if (ysim->base != NULL) free_snapshot(ysim->base);
+  ysim->base = snapshot;
+  for (Size i = 0; i < ysim->nDirty; i++) {
+    ysim->isDirtyPage[ysim->dirtyPages[i]] = false;
+  }
+  ysim->nDirty = 0;
+}
+
+/** Return a snapshot of the current state of y86.  Memory pages which
+ *  are unchanged since the last snapshot of y86 (or the snapshot it
+ *  was last restored from) are shared with that snapshot, so taking a
+ *  snapshot copies only the pages written since then.
+ */
+Snapshot *
+snapshot_y86(Y86 *y86)
+{
+  YSim *ysim = get_ysim(y86);
+  Snapshot *snapshot = mallocChk(sizeof(Snapshot));
+  snapshot->refCount = 1;
+  snapshot->memSize = ysim->memSize;
+  snapshot->nPages = ysim->nPages;
+  snapshot->pages = mallocChk(ysim->nPages * sizeof(SnapPage *));
+  const Snapshot *base = ysim->base;
+  if (base != NULL) {
+    for (Size p = 0; p < ysim->nPages; p++) {
+      snapshot->pages[p] = ref_snap_page(base->pages[p]);
+    }
+    for (Size i = 0; i < ysim->nDirty; i++) {
+      Address p = ysim->dirtyPages[i];
+      unref_snap_page(snapshot->pages[p]);
+      snapshot->pages[p] = new_snap_page(&ysim->mem[p << PAGE_SHIFT],
+                                         page_size(ysim->memSize, p));
+    }
+  }
+  else {
+    for (Size p = 0; p < ysim->nPages; p++) {
+      snapshot->pages[p] = new_snap_page(&ysim->mem[p << PAGE_SHIFT],
+                                         page_size(ysim->memSize, p));
+    }
+  }
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    snapshot->regs[r] = read_register_y86(y86, r);
+  }
+  snapshot->pc = read_pc_y86(y86);
+  snapshot->cc = read_cc_y86(y86);
+  snapshot->status = read_status_y86(y86);
+  snapshot->isExtended = ysim->isExtended;
+  set_base(ysim, snapshot);
+  return snapshot;
+}
+
+/** Copy page p of snapshot into the memory mem of ysim.  A page which
+ *  is to be zeroed is not written if it is already zero, so that
+ *  untouched memory is never committed.
+ */
+static void
+restore_page(YSim *ysim, Byte *mem, const Snapshot *snapshot, Address p)
+{
+  Address addr = p << PAGE_SHIFT;
+  Size size = page_size(ysim->memSize, p);
+  const SnapPage *page = snapshot->pages[p];
+  if (page == NULL) {
+    if (is_zero(&mem[addr], size)) return;
+    memset(&mem[addr], 0, size);
+  }
+  else {
+    memcpy(&mem[addr], page->bytes, size);
+  }
+  invalidate_code(ysim, addr, size);
+}
+
+/** Set the registers, pc, cc, status and enabled extensions of ysim's
+ *  y86 from snapshot.
+ */
+static void
+restore_cpu(YSim *ysim, const Snapshot *snapshot)
+{
+  Y86 *y86 = ysim->y86;
+  set_extensions_ysim(y86, snapshot->isExtended);
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (read_register_y86(y86, r) != snapshot->regs[r]) {
+      set_register(ysim, r, snapshot->regs[r]);
+    }
+  }
+  if (read_cc_y86(y86) != snapshot->cc) {
+    write_cc_y86(y86, snapshot->cc);
+    ysim->changedRegs |= CHANGED_CC;
+  }
+  if (read_pc_y86(y86) != snapshot->pc) write_pc_y86(y86, snapshot->pc);
+  if (read_status_y86(y86) != snapshot->status) {
+    write_status_y86(y86, snapshot->status);
+    ysim->changedRegs |= CHANGED_STATUS;
+  }
+}
+
+/** Restore y86 to the state recorded in snapshot, which must have
+ *  been taken from a Y86 with the same memory size.  Only pages
+ *  written since y86's last snapshot or restore, and pages in which
+ *  that snapshot differs from this one, are copied.
+ */
+void
+restore_y86(Y86 *y86, Snapshot *snapshot)
+{
+  YSim *ysim = get_ysim(y86);
+  if (ysim->memSize != snapshot->memSize) {
+    fatal("cannot restore snapshot of %lu bytes into memory of %lu bytes",
+          (unsigned long)snapshot->memSize, (unsigned long)ysim->memSize);
+  }
+  Byte *mem = get_memory_pointer_y86(y86, 0);
+  for (Size i = 0; i < ysim->nDirty; i++) {
+    restore_page(ysim, mem, snapshot, ysim->dirtyPages[i]);
+  }
+  const Snapshot *base = ysim->base;
+  if (base != snapshot) {
+    for (Size p = 0; p < ysim->nPages; p++) {
+      if (!ysim->isDirtyPage[p] &&
+          (base == NULL || base->pages[p] != snapshot->pages[p])) {
+        restore_page(ysim, mem, snapshot, p);
+      }
+    }
+  }
+  ysim->cc.kind = CC_STORED;
+  restore_cpu(ysim, snapshot);
+  set_base(ysim, snapshot);
+}
+
+/** Return a new Y86 with the state recorded in snapshot. */
+Y86 *
+fork_y86(Snapshot *snapshot)
+{
+  Y86 *y86 = new_y86(snapshot->memSize);
+  YSim *ysim = get_ysim(y86);
+  Byte *mem = get_memory_pointer_y86(y86, 0);
+  for (Size p = 0; p < snapshot->nPages; p++) {
+    //new memory is zero, so only non-zero pages need to be copied
+    if (snapshot->pages[p] != NULL) restore_page(ysim, mem, snapshot, p);
+  }
+  restore_cpu(ysim, snapshot);
+  set_base(ysim, snapshot);
+  return y86;
+}
+
+bool
+is_written_ysim(Y86 *y86, Address addr, Size size)
+{
+  YSim *ysim = get_ysim(y86);
+  if (addr >= ysim->memSize || size == 0) return false;
+  Address last =
+    (ysim->memSize - addr < size) ? ysim->memSize - 1 : addr + size - 1;
+  for (Address p = addr >> PAGE_SHIFT; p <= last >> PAGE_SHIFT; p++) {
+    if (ysim->isDirtyPage[p]) return true;
+  }
+  return false;
+}
+
+/** Free a snapshot returned by snapshot_y86(). */
+void
+free_snapshot(Snapshot *snapshot)
+{
+  if (__atomic_sub_fetch(&snapshot->refCount, 1, __ATOMIC_ACQ_REL) > 0) return;
+  for (Size p = 0; p < snapshot->nPages; p++) {
+    unref_snap_page(snapshot->pages[p]);
+  }
+  free(snapshot->pages);
+  free(snapshot);
+}
+
+/** Return the # of bytes held by snapshot which it does not share with
+ *  base: its own structure and the memory pages it does not have in
+ *  common with base, which may be NULL.
+ */
+Size
+get_snapshot_size(const Snapshot *snapshot, const Snapshot *base)
+{
+  Size size = sizeof(Snapshot) + snapshot->nPages * sizeof(SnapPage *);
+  for (Size p = 0; p < snapshot->nPages; p++) {
+    const SnapPage *page = snapshot->pages[p];
+    if (page != NULL && (base == NULL || base->pages[p] != page)) {
+      size += sizeof(SnapPage) + page_size(snapshot->memSize, p);
+    }
+  }
+  return size;
+}
+
+/************************* Multiple Instructions ************************/
+
+/** Copy registers regs[] into ysim's y86, writing only those which
+ *  differ.
+ */
+static void
+store_registers(YSim *ysim, const Word regs[])
+{
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    if (read_register_y86(ysim->y86, r) != regs[r]) set_register(ysim, r, regs[r]);
+  }
+}
+
+static void
+load_registers(const Y86 *y86, Word regs[])
+{
+  for (Register r = REG_RAX; r < N_REG; r++) regs[r] = read_register_y86(y86, r);
+}
+
+/** Return true iff the condition of some breakpoint of ysim at pc holds
+ *  for registers regs[].
+ */
+static bool
+is_break_hit(const YSim *ysim, Address pc, const Word regs[])
+{
+  for (Size i = 0; i < ysim->nBreaks; i++) {
+    const Breakpoint *b = &ysim->breaks[i];
+    if (b->pc == pc && (b->reg >= N_REG || regs[b->reg] == b->value)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Run y86 until it halts, faults or has executed maxSteps
+ *  instructions, returning the number of instructions executed.  The
+ *  final state is the same as that produced by the same number of
+ *  calls to step_ysim().
+ *
+ *  Registers and pc are kept in locals while running and each handler
+ *  dispatches directly to the handler for the following instruction
+ *  (using GCC computed gotos) rather than returning to a central loop.
+ */
+static uint64_t
+run_decoded(Y86 *y86, uint64_t maxSteps)
+{
+  //function codes are ignored by instructions which do not use them
+  static void *const handlers[N_HANDLERS] = {
+    [0x00 ... 0xff] = &&do_undecoded,
+    [HALT_CODE << 4 ... (HALT_CODE << 4 | 0xf)] = &&do_halt,
+    [NOP_CODE << 4 ... (NOP_CODE << 4 | 0xf)] = &&do_nop,
+    [CMOVxx_CODE << 4 ... (CMOVxx_CODE << 4 | GT_COND)] = &&do_cmovxx,
+    [IRMOVQ_CODE << 4 ... (IRMOVQ_CODE << 4 | 0xf)] = &&do_irmovq,
+    [RMMOVQ_CODE << 4 ... (RMMOVQ_CODE << 4 | 0xf)] = &&do_rmmovq,
+    [MRMOVQ_CODE << 4 ... (MRMOVQ_CODE << 4 | 0xf)] = &&do_mrmovq,
+    [OP1_CODE << 4 | ADDQ_FN] = &&do_addq,
+    [OP1_CODE << 4 | SUBQ_FN] = &&do_subq,
+    [OP1_CODE << 4 | ANDQ_FN] = &&do_andq,
+    [OP1_CODE << 4 | XORQ_FN] = &&do_xorq,
+    [OP1_CODE << 4 | MULQ_FN] = &&do_mulq,
+    [OP1_CODE << 4 | DIVQ_FN] = &&do_divq,
+    [OP1_CODE << 4 | MODQ_FN] = &&do_divq,
+    [IOPQ_CODE << 4 | ADDQ_FN] = &&do_iaddq,
+    [(IOPQ_CODE << 4 | SUBQ_FN) ... (IOPQ_CODE << 4 | XORQ_FN)] = &&do_iopq,
+    [BLOCK_CODE << 4 | COPYQ_FN] = &&do_copyq,
+    [BLOCK_CODE << 4 | FILLQ_FN] = &&do_fillq,
+    [Jxx_CODE << 4] = &&do_jmp,
+    [(Jxx_CODE << 4 | LE_COND) ... (Jxx_CODE << 4 | GT_COND)] = &&do_jxx,
+    [CALL_CODE << 4 ... (CALL_CODE << 4 | 0xf)] = &&do_call,
+    [RET_CODE << 4 ... (RET_CODE << 4 | 0xf)] = &&do_ret,
+    [PUSHQ_CODE << 4 ... (PUSHQ_CODE << 4 | 0xf)] = &&do_pushq,
+    [POPQ_CODE << 4 ... (POPQ_CODE << 4 | 0xf)] = &&do_popq,
+    [HANDLER_FUSE] = &&do_fuse,
+    [HANDLER_IRMOVQ_OPQ + ADDQ_FN] = &&do_irmovq_addq,
+    [HANDLER_IRMOVQ_OPQ + SUBQ_FN] = &&do_irmovq_subq,
+    [HANDLER_IRMOVQ_OPQ + ANDQ_FN] = &&do_irmovq_andq,
+    [HANDLER_IRMOVQ_OPQ + XORQ_FN] = &&do_irmovq_xorq,
+    [HANDLER_MRMOVQ_OPQ + ADDQ_FN] = &&do_mrmovq_addq,
+    [HANDLER_MRMOVQ_OPQ + SUBQ_FN] = &&do_mrmovq_subq,
+    [HANDLER_MRMOVQ_OPQ + ANDQ_FN] = &&do_mrmovq_andq,
+    [HANDLER_MRMOVQ_OPQ + XORQ_FN] = &&do_mrmovq_xorq,
+    [HANDLER_SUBQ_JXX + ALWAYS_COND] = &&do_subq_jmp,
+    [HANDLER_SUBQ_JXX + LE_COND] = &&do_subq_jle,
+    [HANDLER_SUBQ_JXX + LT_COND] = &&do_subq_jl,
+    [HANDLER_SUBQ_JXX + EQ_COND] = &&do_subq_je,
+    [HANDLER_SUBQ_JXX + NE_COND] = &&do_subq_jne,
+    [HANDLER_SUBQ_JXX + GE_COND] = &&do_subq_jge,
+    [HANDLER_SUBQ_JXX + GT_COND] = &&do_subq_jg,
+    [HANDLER_ANDQ_JXX + ALWAYS_COND] = &&do_andq_jmp,
+    [HANDLER_ANDQ_JXX + LE_COND] = &&do_andq_jle,
+    [HANDLER_ANDQ_JXX + LT_COND] = &&do_andq_jl,
+    [HANDLER_ANDQ_JXX + EQ_COND] = &&do_andq_je,
+    [HANDLER_ANDQ_JXX + NE_COND] = &&do_andq_jne,
+    [HANDLER_ANDQ_JXX + GE_COND] = &&do_andq_jge,
+    [HANDLER_ANDQ_JXX + GT_COND] = &&do_andq_jg,
+    [HANDLER_BREAK] = &&do_break,
+    [HANDLER_MRMOVQ_PROVEN] = &&do_mrmovq_proven,
+    [HANDLER_RMMOVQ_PROVEN] = &&do_rmmovq_proven,
+    [HANDLER_CALL_PROVEN] = &&do_call_proven,
+    [HANDLER_RET_PROVEN] = &&do_ret_proven,
+    [HANDLER_PUSHQ_PROVEN] = &&do_pushq_proven,
+    [HANDLER_POPQ_PROVEN] = &&do_popq_proven,
+    [HANDLER_RET_ANALYZED] = &&do_ret_analyzed,
+    [HANDLER_CHECKED] = &&do_undecoded,
+  };
+  uint64_t nSteps = 0;
+  if (read_status_y86(y86) != STATUS_AOK) return nSteps;
+  YSim *ysim = get_ysim(y86);
+  const Size memSize = ysim->memSize;
+  const Byte *const mem = ysim->mem;
+  Byte *const coverage = ysim->coverage;
+  ProfileCounts *const profile = ysim->profile;
+  Word regs[N_REG];
+  load_registers(y86, regs);
+  Address pc = read_pc_y86(y86);
+  analyze_run(ysim, pc, regs);
+  const Decoded *d, *d2;
+  //a run resumed from a breakpoint does not stop at it again
+  const bool isResume = (ysim->stop == STOP_BREAK && ysim->stopAddr == pc);
+  ysim->stop = STOP_NONE;
+
+/** dispatch to the handler for the instruction at pc */
+#define DISPATCH()                                      \
+  do {                                                  \
+    if (nSteps >= maxSteps) goto done;                  \
+    if (profile != NULL) count_instr(profile, pc, memSize); \
+    d = get_decoded(ysim, pc);                          \
+    if (d == NULL) goto do_checked;                     \
+    nSteps++;                                           \
+    goto *handlers[d->handler];                         \
+  } while (0)
+
+/** start a fused handler by counting the second instruction d2, or
+ *  run the first instruction alone at label single if there is no
+ *  step left for the second.
+ */
+#define FUSED(single)                                   \
+  do {                                                  \
+    if (nSteps >= maxSteps) goto single;                \
+    nSteps++;                                           \
+    if (profile != NULL) count_instr(profile, d->nextPC, memSize); \
+    d2 = &ysim->decoded[d->nextPC];                     \
+  } while (0)
+
+/** irmovq followed by OPq function fn on the register it set */
+#define IRMOVQ_OPQ(fn)                                  \
+  do {                                                  \
+    FUSED(do_irmovq);                                   \
+    regs[d->regB] = d->imm;                             \
+    op_regs(&ysim->cc, regs, fn, d2->regA, d2->regB);   \
+    pc = d2->nextPC;                                    \
+    DISPATCH();                                         \
+  } while (0)
+
+/** mrmovq followed by OPq function fn */
+#define MRMOVQ_OPQ(fn)                                  \
+  do {                                                  \
+    FUSED(do_mrmovq);                                   \
+    Word data;                                          \
+    if (!load_word(ysim, regs[d->regB] + d->imm, &data)) { \
+      nSteps--;     /* OPq not executed */              \
+      if (profile != NULL) profile->counts[d->nextPC]--; \
+      goto done;                                        \
+    }                                                   \
+    regs[d->regA] = data;                               \
+    op_regs(&ysim->cc, regs, fn, d2->regA, d2->regB);   \
+    pc = d2->nextPC;                                    \
+    DISPATCH();                                         \
+  } while (0)
+
+/** subq followed by jxx with condition cond */
+#define SUBQ_JXX(cond)                                  \
+  do {                                                  \
+    FUSED(do_subq);                                     \
+    Word a = regs[d->regA], b = regs[d->regB];          \
+    regs[d->regB] = b - a;                              \
+    set_sub_arith_cc(&ysim->cc, a, b, b - a);           \
+    pc = d->nextPC;                                     \
+    TAKE_IF(is_sub_cond(cond, a, b), d2);               \
+  } while (0)
+
+/** andq followed by jxx with condition cond */
+#define ANDQ_JXX(cond)                                  \
+  do {                                                  \
+    FUSED(do_andq);                                     \
+    Word result = regs[d->regA] & regs[d->regB];        \
+    regs[d->regB] = result;                             \
+    set_logic_op_cc(&ysim->cc, result);                 \
+    pc = d->nextPC;                                     \
+    TAKE_IF(is_logic_cond(cond, result), d2);           \
+  } while (0)
+
+/** jump to the target of jxx d at pc iff isTaken, counting it */
+#define TAKE_IF(isTaken, d)                             \
+  do {                                                  \
+    bool isTaken_ = (isTaken);                          \
+    if (profile != NULL) profile->takenCounts[pc] += isTaken_; \
+    JUMP(isTaken_ ? (d)->imm : (d)->nextPC);            \
+  } while (0)
+
+/** continue at next unless the last store hit a watchpoint */
+#define NEXT_UNLESS_WATCHED(next)                       \
+  do {                                                  \
+    pc = (next);                                        \
+    if (ysim->stop != STOP_NONE) goto done;             \
+    DISPATCH();                                         \
+  } while (0)
+
+/** return to target, which the static analysis assumes follows one
+ *  of its calls; it is discarded if not.
+ */
+#define RETURN(target)                                  \
+  do {                                                  \
+    Address return_ = (target);                         \
+    if (ysim->cfg != NULL && !is_return_site_ycfg(ysim->cfg, return_)) { \
+      drop_cfg(ysim);                                   \
+    }                                                   \
+    JUMP(return_);                                      \
+  } while (0)
+
+/** transfer control to target; an invalid target is left to
+ *  write_pc_y86() to report.
+ */
+#define JUMP(target)                                    \
+  do {                                                  \
+    Address target_ = (target);                         \
+    if (target_ >= memSize) {                           \
+      store_registers(ysim, regs);                      \
+      flush_cc(ysim);                                   \
+      if (read_pc_y86(y86) != pc) write_pc_y86(y86, pc); \
+      write_pc_y86(y86, target_);                       \
+      return nSteps;                                    \
+    }                                                   \
+    if (coverage != NULL) note_edge(coverage, pc, target_); \
+    pc = target_;                                       \
+    DISPATCH();                                         \
+  } while (0)
+
+  DISPATCH();
+
+ do_fuse:
+  fuse_decoded(ysim, pc);
+  goto *handlers[d->handler];
+
+ do_break:
+  if ((nSteps > 1 || !isResume) && is_break_hit(ysim, pc, regs)) {
+    nSteps--;       //not executed
+    if (profile != NULL) profile->counts[pc]--;
+    ysim->stop = STOP_BREAK;
+    ysim->stopAddr = pc;
+    goto done;
+  }
+  goto *handlers[single_handler(ysim, pc, d)];
+
+ do_undecoded:
+  nSteps--;         //not executed yet: counted again below
+ do_checked: {
+    store_registers(ysim, regs);
+    if (read_pc_y86(y86) != pc) write_pc_y86(y86, pc);
+    //already counted in the profile by DISPATCH()
+    bool isCall = (profile != NULL) && count_checked_jump(ysim, pc);
+    step_checked(ysim);
+    nSteps++;
+    if (read_status_y86(y86) != STATUS_AOK) {
+      flush_cc(ysim);
+      return nSteps;
+    }
+    if (isCall) count_call(profile, read_pc_y86(y86), memSize);
+  }
+  if (coverage != NULL) note_transfer(ysim, pc);
+  load_registers(y86, regs);
+  pc = read_pc_y86(y86);
+  //the checked path may do what the static analysis did not allow for
+  if (ysim->cfg != NULL && !is_covered_ycfg(ysim->cfg, pc, regs)) {
+    drop_cfg(ysim);
+  }
+  if (ysim->stop != STOP_NONE) goto done;
+  DISPATCH();
+
+ do_halt:
+  write_status_y86(y86, STATUS_HLT);
+  goto done;
+
+ do_nop:
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_cmovxx:
+  if (check_cc(y86, &ysim->cc, d->fn)) regs[d->regB] = regs[d->regA];
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_irmovq:
+  regs[d->regB] = d->imm;
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_rmmovq:
+  if (!store_word(ysim, regs[d->regB] + d->imm, regs[d->regA])) goto done;
+  NEXT_UNLESS_WATCHED(d->nextPC);
+
+ do_mrmovq: {
+    Word data;
+    if (!load_word(ysim, regs[d->regB] + d->imm, &data)) goto done;
+    regs[d->regA] = data;
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_addq: {
+    Word a = regs[d->regA], b = regs[d->regB];
+    regs[d->regB] = a + b;
+    set_add_arith_cc(&ysim->cc, a, b, a + b);
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_subq: {
+    Word a = regs[d->regA], b = regs[d->regB];
+    regs[d->regB] = b - a;
+    set_sub_arith_cc(&ysim->cc, a, b, b - a);
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_andq:
+  regs[d->regB] &= regs[d->regA];
+  set_logic_op_cc(&ysim->cc, regs[d->regB]);
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_xorq:
+  regs[d->regB] ^= regs[d->regA];
+  set_logic_op_cc(&ysim->cc, regs[d->regB]);
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_mulq: {
+    Word a = regs[d->regA], b = regs[d->regB];
+    regs[d->regB] = a * b;
+    set_mul_arith_cc(&ysim->cc, a, b, a * b);
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_divq:
+  if (!op_words(&ysim->cc, d->fn, regs[d->regA], regs[d->regB],
+                &regs[d->regB])) {
+    write_status_y86(y86, STATUS_INS);
+    goto done;
+  }
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_iaddq: {
+    Word a = d->imm, b = regs[d->regB];
+    regs[d->regB] = a + b;
+    set_add_arith_cc(&ysim->cc, a, b, a + b);
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_iopq:
+  op_words(&ysim->cc, d->fn, d->imm, regs[d->regB], &regs[d->regB]);
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_copyq: {
+    Register src = d->regA, dst = d->regB;
+    while (regs[REG_RCX] != 0) {
+      Word value;
+      if (!load_word(ysim, regs[src], &value) ||
+          !store_word(ysim, regs[dst], value)) {
+        goto done;
+      }
+      regs[src] += sizeof(Word);
+      regs[dst] += sizeof(Word);
+      regs[REG_RCX]--;
+    }
+    NEXT_UNLESS_WATCHED(d->nextPC);
+  }
+
+ do_fillq: {
+    Word value = regs[d->regA];
+    Register dst = d->regB;
+    while (regs[REG_RCX] != 0) {
+      if (!store_word(ysim, regs[dst], value)) goto done;
+      regs[dst] += sizeof(Word);
+      regs[REG_RCX]--;
+    }
+    NEXT_UNLESS_WATCHED(d->nextPC);
+  }
+
+ do_jmp:
+  if (profile != NULL) profile->takenCounts[pc]++;
+  JUMP(d->imm);
+
+ do_jxx:
+  TAKE_IF(check_cc(y86, &ysim->cc, d->fn), d);
+
+ do_call: {
+    Address stackAddr = regs[REG_RSP] - sizeof(Address);
+    regs[REG_RSP] = stackAddr;
+    if (!store_word(ysim, stackAddr, d->nextPC)) goto done;
+    if (profile != NULL) count_call(profile, d->imm, memSize);
+    if (ysim->stop != STOP_NONE && d->imm < memSize) {
+      pc = d->imm;
+      goto done;
+    }
+    JUMP(d->imm);
+  }
+
+ do_ret: {
+    Address stackAddr = regs[REG_RSP];
+    Address retAddr;
+    if (!load_word(ysim, stackAddr, &retAddr)) goto done;
+    regs[REG_RSP] = stackAddr + sizeof(Address);
+    JUMP(retAddr);
+  }
+
+ do_pushq: {
+    Address stackAddr = regs[REG_RSP] - sizeof(Address);
+    Word value = regs[d->regA];
+    regs[REG_RSP] = stackAddr;
+    if (!store_word(ysim, stackAddr, value)) goto done;
+    NEXT_UNLESS_WATCHED(d->nextPC);
+  }
+
+ do_popq: {
+    Address stackAddr = regs[REG_RSP];
+    Word value;
+    if (!load_word(ysim, stackAddr, &value)) goto done;
+    regs[REG_RSP] = stackAddr + sizeof(Address);
+    regs[d->regA] = value;
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_mrmovq_proven:
+  regs[d->regA] = get_le_word(&mem[regs[d->regB] + d->imm]);
+  pc = d->nextPC;
+  DISPATCH();
+
+ do_rmmovq_proven:
+  store_data_word(ysim, regs[d->regB] + d->imm, regs[d->regA]);
+  NEXT_UNLESS_WATCHED(d->nextPC);
+
+ do_call_proven: {
+    Address stackAddr = regs[REG_RSP] - sizeof(Address);
+    regs[REG_RSP] = stackAddr;
+    store_data_word(ysim, stackAddr, d->nextPC);
+    if (profile != NULL) count_call(profile, d->imm, memSize);
+    if (ysim->stop != STOP_NONE && d->imm < memSize) {
+      pc = d->imm;
+      goto done;
+    }
+    JUMP(d->imm);
+  }
+
+ do_ret_proven: {
+    Address stackAddr = regs[REG_RSP];
+    regs[REG_RSP] = stackAddr + sizeof(Address);
+    RETURN(get_le_word(&mem[stackAddr]));
+  }
+
+ do_ret_analyzed: {
+    Address stackAddr = regs[REG_RSP];
+    Address retAddr;
+    if (!load_word(ysim, stackAddr, &retAddr)) goto done;
+    regs[REG_RSP] = stackAddr + sizeof(Address);
+    RETURN(retAddr);
+  }
+
+ do_pushq_proven: {
+    Address stackAddr = regs[REG_RSP] - sizeof(Address);
+    Word value = regs[d->regA];
+    regs[REG_RSP] = stackAddr;
+    store_data_word(ysim, stackAddr, value);
+    NEXT_UNLESS_WATCHED(d->nextPC);
+  }
+
+ do_popq_proven: {
+    Address stackAddr = regs[REG_RSP];
+    regs[REG_RSP] = stackAddr + sizeof(Address);
+    regs[d->regA] = get_le_word(&mem[stackAddr]);
+    pc = d->nextPC;
+    DISPATCH();
+  }
+
+ do_irmovq_addq: IRMOVQ_OPQ(ADDQ_FN);
+ do_irmovq_subq: IRMOVQ_OPQ(SUBQ_FN);
+ do_irmovq_andq: IRMOVQ_OPQ(ANDQ_FN);
+ do_irmovq_xorq: IRMOVQ_OPQ(XORQ_FN);
+
+ do_mrmovq_addq: MRMOVQ_OPQ(ADDQ_FN);
+ do_mrmovq_subq: MRMOVQ_OPQ(SUBQ_FN);
+ do_mrmovq_andq: MRMOVQ_OPQ(ANDQ_FN);
+ do_mrmovq_xorq: MRMOVQ_OPQ(XORQ_FN);
+
+ do_subq_jmp: SUBQ_JXX(ALWAYS_COND);
+ do_subq_jle: SUBQ_JXX(LE_COND);
+ do_subq_jl:  SUBQ_JXX(LT_COND);
+ do_subq_je:  SUBQ_JXX(EQ_COND);
+ do_subq_jne: SUBQ_JXX(NE_COND);
+ do_subq_jge: SUBQ_JXX(GE_COND);
+ do_subq_jg:  SUBQ_JXX(GT_COND);
+
+ do_andq_jmp: ANDQ_JXX(ALWAYS_COND);
+ do_andq_jle: ANDQ_JXX(LE_COND);
+ do_andq_jl:  ANDQ_JXX(LT_COND);
+ do_andq_je:  ANDQ_JXX(EQ_COND);
+ do_andq_jne: ANDQ_JXX(NE_COND);
+ do_andq_jge: ANDQ_JXX(GE_COND);
+ do_andq_jg:  ANDQ_JXX(GT_COND);
+
+ done:
+  store_registers(ysim, regs);
+  flush_cc(ysim);
+  if (read_pc_y86(y86) != pc) write_pc_y86(y86, pc);
+  return nSteps;
+
+#undef DISPATCH
+#undef FUSED
+#undef IRMOVQ_OPQ
+#undef MRMOVQ_OPQ
+#undef SUBQ_JXX
+#undef ANDQ_JXX
+#undef TAKE_IF
+#undef NEXT_UNLESS_WATCHED
+#undef RETURN
+#undef JUMP
+}
+
+uint64_t
+run_ysim(Y86 *y86, uint64_t maxSteps)
+{
+  if (read_status_y86(y86) != STATUS_AOK) return 0;
+  uint64_t nSteps = run_decoded(y86, maxSteps);
+  note_status(get_ysim(y86));
+  return nSteps;
+}
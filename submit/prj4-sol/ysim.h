@@ -9,4 +9,238 @@
  */
 void step_ysim(Y86 *y86);
 
+/** Run y86 until it halts, faults or has executed maxSteps
+ *  instructions.  Return the number of instructions executed.  The
+ *  resulting state is identical to that produced by the same number
+ *  of step_ysim() calls.
+ */
+uint64_t run_ysim(Y86 *y86, uint64_t maxSteps);
+
+/** Decoded instructions are cached by step_ysim().  Memory writes
+ *  made by the simulator invalidate the affected entries; any other
+ *  code which changes memory bytes [addr, addr + size) after y86 has
+ *  started running must call this function.
+ */
+void invalidate_ysim(Y86 *y86, Address addr, Size size);
+
+/** Enable the extension instructions in y86 iff isEnabled; they are
+ *  invalid instructions (STATUS_INS) when disabled, except that an
+ *  OPq with an unused function code does nothing as in the base ISA.
+ *
+ *    iaddq V, rB    (C0 F:rB V)  rB += V, setting cc as addq; likewise
+ *                                isubq (C1), iandq (C2) and ixorq (C3)
+ *    mulq rA, rB    (64 rA:rB)   rB *= rA, setting ZF and SF from the
+ *                                result and OF iff the signed product
+ *                                overflows
+ *    divq rA, rB    (65 rA:rB)   rB /= rA, signed and truncating
+ *    modq rA, rB    (66 rA:rB)   rB %= rA, with the sign of rB
+ *    copyq rA, rB   (E0 rA:rB)   copy %rcx words from rA to rB
+ *    fillq rA, rB   (E1 rA:rB)   store rA into %rcx words from rB
+ *    casq rA, D(rB) (D0 rA:rB D) compare and swap, as run by ycores
+ *
+ *  divq and modq set ZF and SF from the result and clear OF; dividing
+ *  by 0, or a quotient which overflows, is STATUS_INS.  copyq and
+ *  fillq leave cc unchanged and move one word at a time in increasing
+ *  address order, after each one adding 8 to each pointer and
+ *  subtracting 1 from %rcx, so a fault leaves the registers describing
+ *  the words not yet moved.  Their operands must be distinct registers
+ *  other than %rcx, or they are STATUS_INS.  Each extension counts as
+ *  a single instruction.
+ *
+ *  Whether extensions are enabled is part of a snapshot of y86.
+ */
+void set_extensions_ysim(Y86 *y86, bool isEnabled);
+
+/** Return true iff the extension instructions are enabled in y86. */
+bool get_extensions_ysim(Y86 *y86);
+
+/** Type of function called with the address of each word stored by
+ *  the simulator.
+ */
+typedef void StoreFn(void *ctx, Address addr);
+
+/** Arrange for fn(ctx, addr) to be called after every word which the
+ *  simulator successfully stores at addr in y86.  A NULL fn removes
+ *  any previously set function.
+ */
+void set_store_fn_ysim(Y86 *y86, StoreFn *fn, void *ctx);
+
+/** Type of function which carries out a trap instruction
+ *
+ *    trap           (F0)  call %rax with arguments %rdi, %rsi, %rdx
+ *
+ *  run by y86.  It may write only memory bytes [%rsi, %rsi + %rdx),
+ *  reporting them using invalidate_ysim(), and returns the status of
+ *  y86 after the trap: STATUS_AOK to continue with the next
+ *  instruction or STATUS_HLT to halt, in both cases with %rax set to
+ *  *result, or STATUS_ADR or STATUS_INS to fault with registers
+ *  unchanged.
+ */
+typedef Status TrapFn(void *ctx, Y86 *y86, Word *result);
+
+/** Arrange for fn(ctx, y86, &result) to carry out each trap
+ *  instruction run in y86; without a function, a trap is an invalid
+ *  instruction.  A NULL fn removes any previously set function.  The
+ *  function is not part of a snapshot of y86.
+ */
+void set_trap_fn_ysim(Y86 *y86, TrapFn *fn, void *ctx);
+
+/* A coverage map is smaller than AFL's 64K entries: y86 programs have
+ * few branches, and a fuzzer clears and scans the map after every run,
+ * which for short runs costs more than the run unless it stays in the
+ * L1 cache.
+ */
+enum {
+  COVERAGE_BITS = 12,
+  COVERAGE_SIZE = 1 << COVERAGE_BITS,  /** # of entries in a coverage map */
+};
+
+/** Make step_ysim() and run_ysim() count each jump, call and return
+ *  taken in y86 in the entry of coverage[COVERAGE_SIZE] for its edge,
+ *  a hash of its address and target as in AFL.  Counts wrap around.
+ *  A NULL coverage stops counting.  Code run by run_yjit() is not
+ *  counted.
+ */
+void set_coverage_ysim(Y86 *y86, Byte coverage[]);
+
+enum {
+  PROFILE_PAGE_SHIFT = 12,
+  PROFILE_PAGE_SIZE = 1 << PROFILE_PAGE_SHIFT,  /** addresses per page */
+};
+
+/** Execution counts of a y86 program.  The tables are indexed by
+ *  address and have an entry for each byte of y86 memory.
+ */
+typedef struct {
+  uint64_t *counts;         /** # of executions of instruction at addr */
+  uint64_t *takenCounts;    /** # of times jump at addr was taken */
+  uint64_t *callCounts;     /** # of calls to addr */
+  Byte *isCountedPage;      /** true for each page of PROFILE_PAGE_SIZE
+                             *  addresses with non-zero counts or
+                             *  callCounts */
+} ProfileCounts;
+
+/** Make step_ysim() and run_ysim() count in profile each instruction
+ *  run in y86, including one which faults, at its address.  A jump is
+ *  also counted as taken when its condition holds on the condition
+ *  codes it is run with, and a call which succeeds counts its target.
+ *  A NULL profile stops counting.  Code run by run_yjit() is not
+ *  counted.
+ */
+void set_profile_ysim(Y86 *y86, ProfileCounts *profile);
+
+/** Reasons for run_ysim() to stop before y86 halts, faults or
+ *  executes maxSteps instructions.
+ */
+typedef enum {
+  STOP_NONE,
+  STOP_BREAK,              /** before instruction at a breakpoint */
+  STOP_WATCH,              /** after a store to watched memory */
+} StopKind;
+
+/** Make run_ysim() stop before executing the instruction at pc whenever
+ *  register reg holds value, or always if reg is REG_NONE.  The check
+ *  is made only when an instruction at a breakpoint is reached; other
+ *  instructions run at full speed.  A run started at a breakpoint
+ *  executes its instruction before checking breakpoints.  step_ysim()
+ *  ignores breakpoints.
+ */
+void add_breakpoint_ysim(Y86 *y86, Address pc, Register reg, Word value);
+
+/** Make run_ysim() stop after any instruction which stores to memory
+ *  bytes [addr, addr + size).  Only stores to pages containing watched
+ *  bytes are checked.
+ */
+void add_watchpoint_ysim(Y86 *y86, Address addr, Size size);
+
+/** Return why the last run_ysim() of y86 stopped, setting *addr to the
+ *  pc of the breakpoint or the address of the watched word stored.
+ */
+StopKind get_stop_ysim(Y86 *y86, Address *addr);
+
+/** Bits in YChanges.regs for changes other than to registers. */
+enum {
+  CHANGED_CC = 1 << (REG_NONE + 1),
+  CHANGED_STATUS = 1 << (REG_NONE + 2),
+};
+
+/** State of a Y86 written since its changes were last cleared. */
+typedef struct {
+  unsigned regs;           /** bit r set if register r was written;
+                            *  also CHANGED_CC and CHANGED_STATUS */
+  Size nWords;             /** # of memory words written */
+  const Address *words;    /** addresses of the aligned 8-byte words
+                            *  written, in order of first write */
+} YChanges;
+
+/** Set *changes to the state of y86 written by the simulator, or
+ *  reported to invalidate_ysim(), since the last call to
+ *  clear_changes_ysim().  A value written may equal the value it
+ *  replaced.  changes->words remains valid until y86 is next
+ *  simulated.  Registers written by translated code are not recorded.
+ */
+void get_changes_ysim(Y86 *y86, YChanges *changes);
+
+/** Forget the changes recorded for y86, in time proportional to their
+ *  number.
+ */
+void clear_changes_ysim(Y86 *y86);
+
+/** Free all simulator resources associated with y86.  Must be called
+ *  before free_y86(y86).
+ *
+ *  Simulator resources are private to the thread which creates them:
+ *  different threads may simulate different Y86's concurrently, but a
+ *  Y86 must be simulated and freed by a single thread.
+ */
+void free_ysim(Y86 *y86);
+
+/** An opaque snapshot of the complete state of a Y86.  Memory is
+ *  shared copy-on-write, page by page, between snapshots.
+ */
+typedef struct SnapshotStruct Snapshot;
+
+/** Return a snapshot of the current state of y86.  Only memory pages
+ *  written since the last snapshot or restore of y86 are copied.  The
+ *  state of the simulator must be reached using step_ysim(),
+ *  run_ysim(), run_yjit() or with any other memory changes reported
+ *  using invalidate_ysim().
+ */
+Snapshot *snapshot_y86(Y86 *y86);
+
+/** Restore y86 to the state recorded in snapshot, which must have the
+ *  same memory size.  Only pages written since the last snapshot or
+ *  restore of y86, and pages which differ between that snapshot and
+ *  this one, are copied.  Restored memory is not logged for
+ *  dump_changes_y86() and any YJit for y86 must be recreated, or
+ *  reset using reset_yjit() if snapshot is the one restored before.
+ */
+void restore_y86(Y86 *y86, Snapshot *snapshot);
+
+/** Return a new Y86 with the state recorded in snapshot.  It must be
+ *  freed using free_ysim() followed by free_y86().  Since its memory
+ *  is newly allocated, this copies all non-zero pages; continuing from
+ *  a snapshot many times is cheapest by using restore_y86() on the
+ *  same Y86.
+ */
+Y86 *fork_y86(Snapshot *snapshot);
+
+/** Return true iff any of memory bytes [addr, addr + size) of y86 may
+ *  have been written since its last snapshot, restore or fork.
+ */
+bool is_written_ysim(Y86 *y86, Address addr, Size size);
+
+/** Free a snapshot returned by snapshot_y86().  Snapshots may be
+ *  shared between threads.
+ */
+void free_snapshot(Snapshot *snapshot);
+
+/** Return the # of bytes of memory held by snapshot and not shared
+ *  with base, which may be NULL to count all of it.  Successive
+ *  snapshots of a Y86 share the pages which did not change between
+ *  them, so the sum of the sizes of each relative to the one before
+ *  is the memory held by all of them.
+ */
+Size get_snapshot_size(const Snapshot *snapshot, const Snapshot *base);
+
 #endif //ifndef _YSIM_H
@@ -0,0 +1,46 @@
+#include "ytrace.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Rebuild the text output of y86-sim -v or -V from a trace file
+ *  produced by y86-sim -t.
+ */
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-v] [-V] TRACE_FILE\n", prog);
+  fprintf(stderr,
+          "          -v:  verbose: dump changes after each instruction "
+          "(default)\n"
+          "          -V:  very verbose: dump all registers after each "
+          "instruction\n");
+  exit(1);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  bool isVeryVerbose = false;
+  const char *traceFileName = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      continue;
+    }
+    else if (strcmp(argv[i], "-V") == 0) {
+      isVeryVerbose = true;
+    }
+    else if (argv[i][0] == '-' || traceFileName != NULL) {
+      usage(argv[0]);
+    }
+    else {
+      traceFileName = argv[i];
+    }
+  }
+  if (traceFileName == NULL) usage(argv[0]);
+  dump_ytrace(traceFileName, isVeryVerbose, stdout);
+  return 0;
+}
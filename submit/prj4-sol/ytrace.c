@@ -0,0 +1,355 @@
+#include "ytrace.h"
+
+#include "params.h"
+#include "yobj.h"
+#include "ysim.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A trace file consists of a TraceHeader, followed by the names of the
+ * traced .ys files (each preceded by its uint32_t length), followed by
+ * the program parameters, followed by one TraceRecord per executed
+ * instruction.  Everything is in host byte order.
+ *
+ * Register, condition code and status changes are recorded by value.
+ * Stores are recorded as they happen, so a store which leaves memory
+ * unchanged is still replayed.  The words written by a trap are
+ * recorded in extra records which precede the record of the trap.
+ */
+
+enum {
+  TRACE_BLOCK_RECORDS = 16 * 1024,  /** # of records written at a time */
+  MAX_CHANGED_REGS = 2,             /** most registers changed by 1 instr */
+};
+
+static const char TRACE_MAGIC[4] = { 'Y', '8', '6', 'T' };
+
+typedef struct {
+  char magic[4];            /** TRACE_MAGIC */
+  uint32_t recordSize;      /** sizeof(TraceRecord) */
+  uint64_t memSize;         /** size of y86 memory */
+  uint64_t memHash;         /** hash of memory when tracing started */
+  uint32_t numFileNames;
+  uint32_t numParams;
+} TraceHeader;
+
+/** Effects of executing a single instruction. */
+typedef struct {
+  Address pc;               /** address of instruction */
+  Address nextPC;           /** pc after executing instruction */
+  Address storeAddr;        /** address of word stored, if isStore */
+  Word storeValue;          /** value of word stored, if isStore */
+  Word regValues[MAX_CHANGED_REGS];
+  Byte regs[MAX_CHANGED_REGS]; /** changed registers; REG_NONE if unused */
+  Byte instr;               /** first byte of instruction */
+  Byte cc;                  /** condition codes after instruction */
+  Byte status;              /** status after instruction */
+  Byte isStore;             /** true if instruction stored a word */
+  Byte isExtra;             /** true if only a word written by a trap */
+} TraceRecord;
+
+struct YTraceStruct {
+  Y86 *y86;
+  FILE *out;
+  const char *fileName;
+  const Byte *mem;          /** base of y86 memory */
+  Size memSize;
+  Word regs[N_REG];         /** register values after last record */
+  TraceRecord *current;     /** record being filled in */
+  int nRecords;             /** # of records in records[] */
+  TraceRecord records[TRACE_BLOCK_RECORDS];
+};
+
+/** Return FNV-1a hash of the memSize bytes at mem. */
+static uint64_t
+hash_memory(const Byte mem[], Size memSize)
+{
+  uint64_t hash = 0xcbf29ce484222325UL;
+  for (Size i = 0; i < memSize; i++) {
+    hash = (hash ^ mem[i]) * 0x100000001b3UL;
+  }
+  return hash;
+}
+
+/************************** Writing a Trace ****************************/
+
+static void
+write_trace(YTrace *ytrace, const void *p, size_t size, size_t n)
+{
+  if (fwrite(p, size, n, ytrace->out) != n) {
+    fatal("cannot write trace file %s:", ytrace->fileName);
+  }
+}
+
+static void
+flush_records(YTrace *ytrace)
+{
+  write_trace(ytrace, ytrace->records, sizeof(TraceRecord), ytrace->nRecords);
+  ytrace->nRecords = 0;
+}
+
+static void
+add_record(YTrace *ytrace, const TraceRecord *r)
+{
+  ytrace->records[ytrace->nRecords] = *r;
+  if (++ytrace->nRecords == TRACE_BLOCK_RECORDS) flush_records(ytrace);
+}
+
+/** Add an extra record for each word written by the trap executed
+ *  at pc.  A word which extends past the end of memory is recorded
+ *  with only the bytes within memory.
+ */
+static void
+add_trap_records(YTrace *ytrace, Address pc, const YChanges *changes)
+{
+  for (Size i = 0; i < changes->nWords; i++) {
+    Address addr = changes->words[i];
+    Size n = ytrace->memSize - addr;
+    TraceRecord extra = {
+      .pc = pc, .nextPC = pc, .storeAddr = addr,
+      .regs = { REG_NONE, REG_NONE }, .isStore = true, .isExtra = true,
+    };
+    memcpy(&extra.storeValue, &ytrace->mem[addr],
+           n < sizeof(Word) ? n : sizeof(Word));
+    add_record(ytrace, &extra);
+  }
+}
+
+/** Note a store at addr in the instruction being traced. */
+static void
+note_store(void *ctx, Address addr)
+{
+  YTrace *ytrace = ctx;
+  ytrace->current->isStore = true;
+  ytrace->current->storeAddr = addr;
+}
+
+YTrace *
+new_ytrace(const char *traceFileName, Y86 *y86,
+           int numFileNames, const char *fileNames[],
+           int numParams, const Word params[])
+{
+  YTrace *ytrace = mallocChk(sizeof(YTrace));
+  ytrace->y86 = y86;
+  ytrace->fileName = traceFileName;
+  if ((ytrace->out = fopen(traceFileName, "wb")) == NULL) {
+    fatal("cannot create trace file %s:", traceFileName);
+  }
+  ytrace->mem = get_memory_pointer_y86(y86, 0);
+  ytrace->memSize = get_memory_size_y86(y86);
+  for (Register r = REG_RAX; r < N_REG; r++) {
+    ytrace->regs[r] = read_register_y86(y86, r);
+  }
+  ytrace->current = NULL;
+  ytrace->nRecords = 0;
+  TraceHeader header = {
+    .recordSize = sizeof(TraceRecord),
+    .memSize = ytrace->memSize,
+    .memHash = hash_memory(ytrace->mem, ytrace->memSize),
+    .numFileNames = numFileNames,
+    .numParams = numParams,
+  };
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  write_trace(ytrace, &header, sizeof(header), 1);
+  for (int i = 0; i < numFileNames; i++) {
+    uint32_t len = strlen(fileNames[i]);
+    write_trace(ytrace, &len, sizeof(len), 1);
+    write_trace(ytrace, fileNames[i], 1, len);
+  }
+  write_trace(ytrace, params, sizeof(Word), numParams);
+  set_store_fn_ysim(y86, note_store, ytrace);
+  return ytrace;
+}
+
+void
+free_ytrace(YTrace *ytrace)
+{
+  set_store_fn_ysim(ytrace->y86, NULL, NULL);
+  flush_records(ytrace);
+  if (fclose(ytrace->out) != 0) {
+    fatal("cannot write trace file %s:", ytrace->fileName);
+  }
+  free(ytrace);
+}
+
+/** Add reg to r if its value has changed since the last record. */
+static void
+note_register(YTrace *ytrace, TraceRecord *r, int *nRegs, Register reg)
+{
+  Word value = read_register_y86(ytrace->y86, reg);
+  if (value != ytrace->regs[reg]) {
+    if (*nRegs >= MAX_CHANGED_REGS) {
+      fatal("%08lx: too many registers changed", r->pc);
+    }
+    ytrace->regs[reg] = value;
+    r->regs[*nRegs] = reg;
+    r->regValues[*nRegs] = value;
+    (*nRegs)++;
+  }
+}
+
+void
+step_ytrace(YTrace *ytrace)
+{
+  Y86 *y86 = ytrace->y86;
+  Address pc = read_pc_y86(y86);
+  TraceRecord r = {
+    .pc = pc,
+    .instr = (pc < ytrace->memSize) ? ytrace->mem[pc] : 0,
+    .regs = { REG_NONE, REG_NONE },
+  };
+  ytrace->current = &r;
+  clear_changes_ysim(y86);
+  step_ysim(y86);
+  ytrace->current = NULL;
+  if (r.isStore) {
+    r.storeValue = read_memory_word_y86(y86, r.storeAddr);
+  }
+
+  //only registers written by the simulator can change
+  YChanges changes;
+  get_changes_ysim(y86, &changes);
+  int nRegs = 0;
+  for (Register reg = REG_RAX; reg < N_REG; reg++) {
+    if (changes.regs & (1u << reg)) note_register(ytrace, &r, &nRegs, reg);
+  }
+  //memory written without a store can only have been written by a trap
+  if (!r.isStore) add_trap_records(ytrace, pc, &changes);
+  r.cc = read_cc_y86(y86);
+  r.status = read_status_y86(y86);
+  r.nextPC = read_pc_y86(y86);
+  add_record(ytrace, &r);
+}
+
+/************************** Decoding a Trace ***************************/
+
+static void
+read_trace(FILE *in, const char *fileName, void *p, size_t size, size_t n)
+{
+  if (fread(p, size, n, in) != n) {
+    fatal("%s: truncated or unreadable trace file", fileName);
+  }
+}
+
+/** Write the word recorded by the extra record r to y86, writing
+ *  only the bytes within memory at the end of memory.
+ */
+static void
+replay_extra(Y86 *y86, const TraceRecord *r)
+{
+  Size n = get_memory_size_y86(y86) - r->storeAddr;
+  if (n >= sizeof(Word)) {
+    write_memory_word_y86(y86, r->storeAddr, r->storeValue);
+  }
+  else {
+    Byte bytes[sizeof(Word)];
+    memcpy(bytes, &r->storeValue, sizeof(bytes));
+    for (Size i = 0; i < n; i++) {
+      write_memory_byte_y86(y86, r->storeAddr + i, bytes[i]);
+    }
+  }
+}
+
+/** Apply the effects recorded in r to y86 using the same public
+ *  functions used by the simulator.  Return true if anything was
+ *  written.
+ */
+static bool
+replay_record(Y86 *y86, const TraceRecord *r)
+{
+  if (r->isExtra) {
+    replay_extra(y86, r);
+    return true;
+  }
+  bool isChanged = r->isStore || r->regs[0] != REG_NONE;
+  for (int i = 0; i < MAX_CHANGED_REGS && r->regs[i] != REG_NONE; i++) {
+    write_register_y86(y86, r->regs[i], r->regValues[i]);
+  }
+  if (r->isStore) write_memory_word_y86(y86, r->storeAddr, r->storeValue);
+  if (read_cc_y86(y86) != r->cc) {
+    write_cc_y86(y86, r->cc);
+    isChanged = true;
+  }
+  if (read_pc_y86(y86) != r->nextPC) write_pc_y86(y86, r->nextPC);
+  if (read_status_y86(y86) != r->status) {
+    write_status_y86(y86, r->status);
+    isChanged = true;
+  }
+  return isChanged;
+}
+
+void
+dump_ytrace(const char *traceFileName, bool isVeryVerbose, FILE *out)
+{
+  FILE *in = fopen(traceFileName, "rb");
+  if (in == NULL) fatal("cannot read trace file %s:", traceFileName);
+  TraceHeader header;
+  read_trace(in, traceFileName, &header, sizeof(header), 1);
+  if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.recordSize != sizeof(TraceRecord)) {
+    fatal("%s: not a trace file for this host", traceFileName);
+  }
+  const char *fileNames[header.numFileNames];
+  for (uint32_t i = 0; i < header.numFileNames; i++) {
+    uint32_t len;
+    read_trace(in, traceFileName, &len, sizeof(len), 1);
+    char *name = mallocChk(len + 1);
+    read_trace(in, traceFileName, name, 1, len);
+    name[len] = '\0';
+    fileNames[i] = name;
+  }
+  Word params[header.numParams];
+  read_trace(in, traceFileName, params, sizeof(Word), header.numParams);
+
+  Y86 *y86 = new_y86(header.memSize);
+  if (!load_yobj(y86, header.numFileNames, fileNames, NULL)) {
+    fatal("%s: cannot assemble traced program", traceFileName);
+  }
+  setup_params(y86, header.numParams, params, out);
+  if (hash_memory(get_memory_pointer_y86(y86, 0), header.memSize) !=
+      header.memHash) {
+    fatal("%s: traced program has changed", traceFileName);
+  }
+
+  TraceRecord *records = mallocChk(TRACE_BLOCK_RECORDS * sizeof(TraceRecord));
+  bool isFirstRecord = true;   //setup_params() changes are not recorded
+  bool isTrapWritten = false;  //extra records precede the trap's record
+  size_t n;
+  while ((n = fread(records, sizeof(TraceRecord), TRACE_BLOCK_RECORDS, in))
+         > 0) {
+    for (size_t i = 0; i < n; i++) {
+      const TraceRecord *r = &records[i];
+      bool isChanged = replay_record(y86, r);
+      if (r->isExtra) {
+        isTrapWritten = true;
+        continue;
+      }
+      isChanged |= isTrapWritten;
+      isTrapWritten = false;
+      if (r->status == STATUS_AOK) {
+        fprintf(out, "pc: %0*lx\n", (int)sizeof(Address)*2, r->pc);
+        //without -V there is nothing to dump if nothing was written
+        if (isVeryVerbose || isFirstRecord || isChanged) {
+          dump_changes_y86(y86, isVeryVerbose, out);
+        }
+        fprintf(out, "\n");
+      }
+      isFirstRecord = false;
+    }
+  }
+  if (ferror(in)) fatal("cannot read trace file %s:", traceFileName);
+  dump_changes_y86(y86, true, out);
+
+  free(records);
+  for (uint32_t i = 0; i < header.numFileNames; i++) {
+    free((char *)fileNames[i]);
+  }
+  free_y86(y86);
+  fclose(in);
+}
@@ -0,0 +1,38 @@
+#ifndef _YTRACE_H
+#define _YTRACE_H
+
+#include "y86.h"
+
+#include <stdio.h>
+
+/** An opaque structure which records a binary execution trace. */
+typedef struct YTraceStruct YTrace;
+
+/** Create a trace of the program in y86 which will be written to
+ *  traceFileName.  The program must have been loaded from the
+ *  numFileNames .ys files fileNames[] and set up with the numParams
+ *  parameters params[]; these are recorded so that the trace can
+ *  later be decoded.
+ */
+YTrace *new_ytrace(const char *traceFileName, Y86 *y86,
+                   int numFileNames, const char *fileNames[],
+                   int numParams, const Word params[]);
+
+/** Flush any buffered records in ytrace to its file and free all
+ *  resources allocated by new_ytrace().
+ */
+void free_ytrace(YTrace *ytrace);
+
+/** Execute the next instruction of the y86 for ytrace using
+ *  step_ysim(), adding a record of its effects to ytrace.
+ */
+void step_ytrace(YTrace *ytrace);
+
+/** Decode the trace file traceFileName, writing to out the same text
+ *  which the simulator would have produced when run with -v (-V if
+ *  isVeryVerbose) on the traced program.  The traced .ys files are
+ *  re-assembled; it is a fatal error if they have changed.
+ */
+void dump_ytrace(const char *traceFileName, bool isVeryVerbose, FILE *out);
+
+#endif //ifndef _YTRACE_H
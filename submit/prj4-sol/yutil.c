@@ -0,0 +1,47 @@
+#include "yutil.h"
+
+#include <string.h>
+#include <time.h>
+
+const char *const STATUS_NAMES[] = {
+  [STATUS_AOK] = "AOK", [STATUS_HLT] = "HLT",
+  [STATUS_ADR] = "ADR", [STATUS_INS] = "INS",
+};
+
+void
+put_le_word(Byte bytes[], Word word)
+{
+  for (int i = 0; i < (int)sizeof(Word); i++) {
+    bytes[i] = word >> (BYTE_BITS * i);
+  }
+}
+
+double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+bool
+parse_engines(const char *value, int nEngines,
+              const char *const names[], bool isEngine[])
+{
+  memset(isEngine, 0, nEngines * sizeof(bool));
+  const char *p = value;
+  while (*p != '\0') {
+    size_t len = strcspn(p, ",");
+    int engine = 0;
+    while (engine < nEngines &&
+           (strlen(names[engine]) != len ||
+            strncmp(p, names[engine], len) != 0)) {
+      engine++;
+    }
+    if (engine == nEngines) return false;
+    isEngine[engine] = true;
+    p += len;
+    if (*p == ',') p++;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef _YUTIL_H
+#define _YUTIL_H
+
+#include "y86.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Names of the machine statuses, indexed by Status. */
+extern const char *const STATUS_NAMES[];
+
+/** Return the next value of the xorshift64* generator with state *s,
+ *  which must be non-zero.
+ */
+static inline uint64_t
+next_random(uint64_t *s)
+{
+  *s ^= *s >> 12; *s ^= *s << 25; *s ^= *s >> 27;
+  return *s * 0x2545F4914F6CDD1DULL;
+}
+
+/** Store word into bytes[0, sizeof(Word)) in little-endian order. */
+void put_le_word(Byte bytes[], Word word);
+
+/** Return the current time in seconds. */
+double now(void);
+
+/** Set isEngine[e] iff names[e] is one of the comma-separated engine
+ *  names in value, for each of the nEngines engines.  Return false if
+ *  a name is unknown.
+ */
+bool parse_engines(const char *value, int nEngines,
+                   const char *const names[], bool isEngine[]);
+
+#endif //ifndef _YUTIL_H
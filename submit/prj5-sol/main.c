@@ -5,6 +5,7 @@
 
 #include "ysim.h"
 #include "stall-sim.h"
+#include "yobj.h"
 
 #include "errors.h"
 
@@ -23,6 +24,7 @@ typedef struct {
   int verbosity;
   bool isStep;
   bool isList;
+  const char *cacheDir;
 } Args;
 
 enum { SILENT_VERBOSE, VERBOSE, VERY_VERBOSE };
@@ -298,8 +300,11 @@ static void
 usage(const char *prog)
 {
   fprintf(stderr,
-          "usage: %s [-s] [-v] [-V] YAS_FILE_NAMES... INT_INPUTS...\n", prog);
+          "usage: %s [-c CACHE_DIR] [-s] [-v] [-V] YAS_FILE_NAMES... "
+          "INT_INPUTS...\n", prog);
   fprintf(stderr,
+          "          -c:  reuse object images of unchanged programs cached "
+          "in CACHE_DIR\n"
           "          -l:  produce assembler listing only\n"
          "          -s:  single-step program\n"
           "          -v:  verbose: dump state at completion\n"
@@ -325,6 +330,13 @@ first_pass_args(int argc, const char *argv[], Args *args)
     else if (strcmp(argv[i], "-l") == 0) {
       args->isList = true;
     }
+    else if (strcmp(argv[i], "-c") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "missing value for option '%s'\n", argv[i]);
+        usage(argv[0]);
+      }
+      args->cacheDir = argv[++i];
+    }
     else if (argv[i][0] == '-' && !isdigit(argv[i][1])) {
       fprintf(stderr, "unknown option '%s'\n", argv[i]);
       usage(argv[0]);
@@ -349,7 +361,10 @@ second_pass_args(int argc, const char *argv[], Args *args)
   args->numFileNames = args->numParams = 0;
   for (int i = 1; i < argc; i++) {
     const char *arg = argv[i];
-    if (arg[0] == '-' && !isdigit(arg[1])) {
+    if (strcmp(arg, "-c") == 0) {
+      i++;  //skip option value
+    }
+    else if (arg[0] == '-' && !isdigit(arg[1])) {
       continue;
     }
     else if (isdigit(arg[0]) || (arg[0] == '-' && isdigit(arg[1]))) {
@@ -384,7 +399,7 @@ main(int argc, const char *argv[])
   }
   else {
     Y86 *y86 = new_y86_default();
-    if (yas_to_y86(y86, args.numFileNames, args.fileNames)) {
+    if (load_yobj(y86, args.numFileNames, args.fileNames, args.cacheDir)) {
       simulate(&args, y86, stdout);
     }
     free_y86(y86);